@@ -26,13 +26,29 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 #include "fwu.h"
+#include "fwu_profile.h"
+
+#ifdef FWU_PROFILE
+#define FWU_PROBE_BEGIN() uint32_t probeStartCycles = FWU_PROFILE_CYCLES()
+#define FWU_PROBE_END(probe) fwuProfileRecord(probe, FWU_PROFILE_CYCLES() - probeStartCycles)
+static TFwuProbe sProbes[FWU_NOF_PROBES];
+static inline void fwuProfileRecord(EFwuProbe probe, uint32_t cycles);
+#else
+#define FWU_PROBE_BEGIN()
+#define FWU_PROBE_END(probe)
+#endif
 
 // TODO too big, split in separate files!
 
 typedef enum {
     FWU_PS_IDLE = 0,
+    FWU_PS_BANNER = 5,
     FWU_PS_PING = 10,
+    FWU_PS_PROTOCOL_VERSION = 12,
+    FWU_PS_HW_VERSION = 14,
+    FWU_PS_FW_VERSION = 16,
     FWU_PS_RCPT_NOTIF = 20,
     FWU_PS_MTU = 30,
     FWU_PS_OBJ1_SELECT = 40,
@@ -45,6 +61,8 @@ typedef enum {
     FWU_PS_OBJ2_WRITE = 110,
     FWU_PS_OBJ2_CRC_GET = 120,
     FWU_PS_OBJ2_EXECUTE = 130,
+    FWU_PS_OBJ2_RESUME = 140,
+    FWU_PS_ABORT = 250,
     FWU_PS_FAIL = 254,
     FWU_PS_DONE = 255,
 } EFwuProcessState;
@@ -72,8 +90,6 @@ typedef enum {
     FWU_CR_SEND = 1,
     FWU_CR_SENDONLY = 2,
     FWU_CR_EOM_RECEIVED = 3,
-    FWU_CR_RX_OVERFLOW = 4,
-    FWU_CR_INVALID_ESCAPE_SEQ,
 } EFwuCommandRequest;
 
 
@@ -81,42 +97,74 @@ typedef enum {
 #define FWU_RESPONSE_START 0x60
 #define FWU_RESPONSE_SUCCESS 0x01
 
+// The bootloader keeps the UART for 10 ms after printing its banner.
+#define FWU_BANNER_SETTLE_MILLISEC 20
+static const char sBannerBootloader[] = "@@BOOTLOADER";
+static const char sBannerDfuRequested[] = "@@DFUR >";
+
+
+// The request templates are read-only and shared by all sessions; requests with
+// parameters are assembled in the session's own request buffer.
 
 // PING 09 01 C0 -> 60 09 01 01 C0
-static uint8_t sPingRequest[] = { 0x09, 0x01 };
-static uint8_t sPingRequestLen = 2;
+static const uint8_t sPingRequest[] = { 0x09, 0x01 };
+static const uint8_t sPingRequestLen = 2;
 
 // SET RECEIPT 02 00 00 C0 -> 60 02 01 C0
-static uint8_t sSetReceiptRequest[] = { 0x02, 0x00, 0x00 };
-static uint8_t sSetReceiptRequestLen = 3;
+static const uint8_t sSetReceiptRequest[] = { 0x02, 0x00, 0x00 };
+static const uint8_t sSetReceiptRequestLen = 3;
 
 // Get the preferred MTU size on the request.
 // GET MTU 07 -> 60 07 01 83 00 C0
-static uint8_t sGetMtuRequest[] = { 0x07 };
-static uint8_t sGetMtuRequestLen = 1;
+static const uint8_t sGetMtuRequest[] = { 0x07 };
+static const uint8_t sGetMtuRequestLen = 1;
 
 // Triggers the last transferred object of the specified type to be selected
 //  and queries information (max size, cur offset, cur CRC) about the object.
 //  If there's no object of the specified type, the object type is still selected,
 //  CRC and offset are 0 in this case.
 // SELECT OBJECT 06 01 C0 -> 60 06 01 00 01 00 00 00 00 00 00 00 00 00 00 C0
-static uint8_t sSelectObjectRequest[] = { 0x06, 0x01 };
-static uint8_t sSelectObjectRequestLen = 2;
+#define FWU_OP_SELECT_OBJECT 0x06
 
 // Creating a command or data object; the target reserves the space, resets the
 //  progress since the last Execute command and selects the new object.)
 // CREATE OBJECT 01 01 87 00 00 00 C0 -> 60 01 01 C0
-static uint8_t sCreateObjectRequest[] = { 0x01, 0x01, 0x87, 0x00, 0x00, 0x00 };
-static uint8_t sCreateObjectRequestLen = 6;
+#define FWU_OP_CREATE_OBJECT 0x01
 
 // CRC GET 03 C0 -> 60 03 01 87 00 00 00 38 f4 97 72 C0
-static uint8_t sGetCrcRequest[] = { 0x03 };
-static uint8_t sGetCrcRequestLen = 1;
+static const uint8_t sGetCrcRequest[] = { 0x03 };
+static const uint8_t sGetCrcRequestLen = 1;
 
 // Execute an object after it has been fully transmitted.
 // EXECUTE OBJECT 04 C0 -> 60 04 01 C0
-static uint8_t sExecuteObjectRequest[] = { 0x04 };
-static uint8_t sExecuteObjectRequestLen = 1;
+static const uint8_t sExecuteObjectRequest[] = { 0x04 };
+static const uint8_t sExecuteObjectRequestLen = 1;
+
+// Version of the DFU protocol implemented by the target.
+// PROTOCOL VERSION 00 C0 -> 60 00 01 01 C0
+static const uint8_t sProtocolVersionRequest[] = { 0x00 };
+static const uint8_t sProtocolVersionRequestLen = 1;
+
+// Hardware version: part, variant, ROM size, RAM size, ROM page size.
+// HW VERSION 0A C0 -> 60 0A 01 32 28 05 00 30 42 41 41 00 00 08 00 00 00 01 00 00 10 00 00 C0
+static const uint8_t sHwVersionRequest[] = { 0x0A };
+static const uint8_t sHwVersionRequestLen = 1;
+
+// Firmware version of image <n>: type, version, start address, length.
+// Image 0 is the bootloader, then the SoftDevice (if present) and the application.
+// FW VERSION 0B 02 C0 -> 60 0B 01 01 01 00 00 00 00 60 02 00 F0 4C 00 00 C0
+#define FWU_OP_FW_VERSION 0x0B
+
+// Abort the DFU; the bootloader resets and starts the existing application (if valid)
+// instead of waiting for the inactivity timeout. The target may reset before it can
+// respond, so the request is sent without waiting for a response.
+// ABORT 0C C0
+#define FWU_OP_ABORT 0x0C
+#define FWU_FW_TYPE_APPLICATION 0x01
+#define FWU_MAX_IMAGE_NUMBER 3
+
+#define FWU_OBJ_TYPE_COMMAND 0x01
+#define FWU_OBJ_TYPE_DATA 0x02
 
 
 static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec);
@@ -126,13 +174,32 @@ static EFwuResponseStatus fwuTestReceivedPacketValid(TFwu *fwu);
 
 // Don't send more than FWU_REQUEST_BUF_SIZE bytes.
 // Don't include the EOM.
-static void fwuPrepareSendBuffer(TFwu *fwu, uint8_t *data, uint8_t len);
+static void fwuPrepareSendBuffer(TFwu *fwu, const uint8_t *data, uint8_t len);
+static void fwuPrepareSelectObject(TFwu *fwu, uint8_t objectType);
+static void fwuPrepareCreateObject(TFwu *fwu, uint8_t objectType, uint32_t size);
+static void fwuPrepareFwVersion(TFwu *fwu, uint8_t imageNumber);
+static void fwuStartPing(TFwu *fwu);
+static void fwuStartTransfer(TFwu *fwu);
+static void fwuStartAbort(TFwu *fwu, EFwuProcessStatus finalStatus);
+static uint8_t fwuRetry(TFwu *fwu);
+static void fwuPrependEom(TFwu *fwu);
+static uint8_t fwuRequestOpcode(TFwu *fwu);
+static void fwuDropResponseFrame(TFwu *fwu);
+static void fwuScanBanner(TFwu *fwu, uint8_t c);
+static uint8_t fwuBannerLineIs(TFwu *fwu, const char *banner);
+static void fwuPrepareNextDataObject(TFwu *fwu);
+static uint32_t fwuDataObjectEndCrc(TFwu *fwu);
+static EFwuErrorClass fwuClassifyStatus(EFwuResponseStatus status);
+static uint8_t fwuPhaseOf(uint8_t processState);
+static void fwuStatsRecordResponse(TFwu *fwu);
 
 static void fwuPrepareLargeObjectSendBuffer(TFwu *fwu, uint8_t requestCode);
 
 static void fwuDebugPrintStatus(TFwu *fwu, char *msg);
 
-static void updateCrc(TFwu *fwu, uint8_t b);
+static uint8_t fwuEncodeWriteFrame(uint8_t *dst, const uint8_t *src, uint16_t len);
+static uint8_t fwuFrameCacheCoversObject(TFwu *fwu);
+static uint8_t fwuCrcTableCoversObject(TFwu *fwu);
 static void fwuSignalFailure(TFwu *fwu, EFwuResponseStatus reason);
 static inline uint16_t fwuLittleEndianToHost16(uint8_t *bytes);
 static inline uint32_t fwuLittleEndianToHost32(uint8_t *bytes);
@@ -145,15 +212,49 @@ void fwuInit(TFwu *fwu)
     fwu->privateProcessState = FWU_PS_IDLE;
     fwu->privateProcessRequest = FWU_PR_NONE;
     fwu->privateCommandState = FWU_CS_IDLE;
+    fwu->privateCommandRequest = FWU_CR_NONE;
+    fwu->privateDataObjectOffset = 0;
+    fwu->privateRequestPtr = fwu->privateRequestBuf;
+    fwu->privateRequestLen = 0;
+    fwu->privateRequestIx = 0;
+    fwu->privateRequestPayload = 0;
+    fwu->privateObjectFromCache = 0;
+    fwu->privateObjectCrcFromTable = 0;
+    fwu->privateResponseLen = 0;
+    fwu->privateResponseEscapeCharacter = 0;
+    fwu->privateSendBufSpace = 0;
+    fwu->privateCommandAcceptError = 0;
+    fwu->privateAbortRequested = 0;
+    fwu->privateObjectRetries = 0;
+    fwu->privateResponseResync = 0;
+    fwu->privateBannerLineLen = 0;
+    fwu->privateClockMillisec = 0;
+    fwu->privateChunkSize = (fwu->dataChunkSize == 0 || fwu->dataChunkSize > FWU_DATA_CHUNK_SIZE)
+        ? FWU_DATA_CHUNK_SIZE : fwu->dataChunkSize;
     
     fwu->processStatus = FWU_STATUS_UNDEFINED;
     fwu->responseStatus = FWU_RSP_OK;
+    fwu->updateSkipped = 0;
+    fwu->resultCode = FWU_RES_INVALID;
+    fwu->extendedError = FWU_EXT_NO_ERROR;
+    fwu->errorClass = FWU_ERR_CLASS_NONE;
+    fwu->retryCount = 0;
+    fwu->bannerSeen = 0;
+    fwu->bannerMillisec = 0;
+    fwu->pingMillisec = 0;
+    fwu->targetProtocolVersion = 0;
+    fwu->targetHwPart = 0;
+    fwu->targetHwVariant = 0;
+    fwu->targetAppValid = 0;
+    fwu->targetAppVersion = 0;
+    memset(&fwu->stats, 0, sizeof(fwu->stats));
 }
 
 // Execute the firmware update.
 void fwuExec(TFwu *fwu)
 {
     // Start with sending a PING command to the target to see if it's there...
+    fwu->privateClockMillisec = 0;
     fwu->privateProcessRequest = FWU_PR_START;
 }
 
@@ -168,26 +269,95 @@ EFwuProcessStatus fwuYield(TFwu *fwu, uint32_t elapsedMillisec)
     }
     
     // Processing is ongoing, yield to FSMs.
+    FWU_PROBE_BEGIN();
+    fwu->privateClockMillisec += elapsedMillisec;
+    // The elapsed time was spent in the state the session is still in.
+    uint8_t phase = fwuPhaseOf(fwu->privateProcessState);
+    if (phase < FWU_NOF_PHASES) {
+        fwu->stats.phaseMillisec[phase] += elapsedMillisec;
+    }
     fwuYieldCommandFsm(fwu, elapsedMillisec);
     fwuYieldProcessFsm(fwu, elapsedMillisec);
+    FWU_PROBE_END(FWU_PROBE_YIELD);
     
     return fwu->processStatus;
 }
 
+// Abort the firmware update; the ABORT request is sent once the current request has
+// been transmitted and the session then ends with FWU_RSP_ABORTED.
+void fwuAbort(TFwu *fwu)
+{
+    fwu->privateAbortRequested = 1;
+}
+
 // Call after data from the target has been received.
 void fwuDidReceiveData(TFwu *fwu, uint8_t *bytes, uint8_t len)
 {
+    FWU_PROBE_BEGIN();
+    fwu->stats.rxBytes += len;
+    if (fwu->traceFunction) {
+        fwu->traceFunction(fwu, FWU_TRACE_RX, fwu->privateClockMillisec, bytes, len);
+    }
     while (len > 0) {
+        uint8_t c = *bytes++;
+        len--;
+
+        // Nothing else is expected until the received response has been processed.
+        if (fwu->privateCommandRequest == FWU_CR_EOM_RECEIVED) {
+            if (c != FWU_EOM) {
+                fwu->privateResponseResync = 1;
+            }
+            continue;
+        }
+
+        // No response expected: bootloader text, or a late response to a repeated request.
+        if (!(fwu->privateCommandState == FWU_CS_RECEIVE
+              || (fwu->privateCommandState == FWU_CS_SEND && !fwu->privateCommandSendOnly))) {
+            fwu->privateResponseLen = 0;
+            fwu->privateResponseEscapeCharacter = 0;
+            fwuScanBanner(fwu, c);
+            continue;
+        }
+
+        // Skip the rest of a broken frame; the next EOM starts over.
+        if (fwu->privateResponseResync) {
+            if (c == FWU_EOM) {
+                fwu->privateResponseResync = 0;
+            }
+            continue;
+        }
+
+        // Between frames, anything but a response start is text or line noise.
+        if (fwu->privateResponseLen == 0 && !fwu->privateResponseEscapeCharacter) {
+            if (c == FWU_EOM) {
+                continue;
+            }
+            if (c != FWU_RESPONSE_START) {
+                fwuScanBanner(fwu, c);
+                continue;
+            }
+        }
+
         if (fwu->privateResponseLen == FWU_RESPONSE_BUF_SIZE) {
-            fwu->privateCommandRequest = FWU_CR_RX_OVERFLOW;
-            return;
+            // Too long for a response.
+            fwuDropResponseFrame(fwu);
+            if (c == FWU_EOM) {
+                fwu->privateResponseResync = 0;
+            }
+            continue;
         }
-        uint8_t c = *bytes++;
+
         if (c == FWU_EOM) {
+            fwu->privateResponseEscapeCharacter = 0;
+            // A late response to an earlier request is dropped here, so that the
+            // response to the current request in the same chunk is not lost.
+            if (fwu->privateResponseLen >= 2 && fwu->privateResponseBuf[1] != fwuRequestOpcode(fwu)) {
+                fwu->privateResponseLen = 0;
+                continue;
+            }
+            fwu->privateResponseBuf[fwu->privateResponseLen++] = c;
             fwu->privateCommandRequest = FWU_CR_EOM_RECEIVED;
-        }
-        
-        if (c == 0xDB) {
+        } else if (c == 0xDB) {
             fwu->privateResponseEscapeCharacter = 1;
         } else {
             if (fwu->privateResponseEscapeCharacter) {
@@ -197,14 +367,14 @@ void fwuDidReceiveData(TFwu *fwu, uint8_t *bytes, uint8_t len)
                 } else if (c == 0xDD) {
                     c = 0xDB;
                 } else {
-                    fwu->privateCommandRequest = FWU_CR_INVALID_ESCAPE_SEQ;
-                    return;
+                    fwuDropResponseFrame(fwu);
+                    continue;
                 }
             }
             fwu->privateResponseBuf[fwu->privateResponseLen++] = c;
         }
-        len--;
     }
+    FWU_PROBE_END(FWU_PROBE_DID_RECEIVE_DATA);
 }
 
 // Inform the FWU module that it may send maxLen bytes of data to the target.
@@ -213,6 +383,107 @@ void fwuCanSendData(TFwu *fwu, uint8_t maxLen)
     fwu->privateSendBufSpace = maxLen;
 }
 
+// What the session is waiting for (EFwuWork flags); FWU_WORK_NONE if there is nothing to do.
+uint8_t fwuPendingWork(TFwu *fwu)
+{
+    if (fwu->processStatus != FWU_STATUS_UNDEFINED
+        || fwu->privateProcessState == FWU_PS_DONE
+        || fwu->privateProcessState == FWU_PS_FAIL) {
+        return FWU_WORK_NONE;
+    }
+    if (fwu->privateProcessRequest != FWU_PR_NONE) {
+        return FWU_WORK_INTERNAL;
+    }
+    if (fwu->privateProcessState == FWU_PS_BANNER) {
+        return FWU_WORK_RX;
+    }
+    switch (fwu->privateCommandState) {
+        case FWU_CS_IDLE:
+            return (fwu->privateCommandRequest == FWU_CR_SEND
+                    || fwu->privateCommandRequest == FWU_CR_SENDONLY) ? FWU_WORK_INTERNAL : FWU_WORK_NONE;
+        case FWU_CS_SEND:
+            return (fwu->privateRequestIx < fwu->privateRequestLen) ? FWU_WORK_TX : FWU_WORK_INTERNAL;
+        case FWU_CS_RECEIVE:
+            return (fwu->privateCommandRequest == FWU_CR_EOM_RECEIVED) ? FWU_WORK_INTERNAL : FWU_WORK_RX;
+        default:
+            return FWU_WORK_INTERNAL;
+    }
+}
+
+// Milliseconds until the current command times out; 0xffffffff if no command is active.
+uint32_t fwuDeadlineMillisec(TFwu *fwu)
+{
+    if (fwu->privateProcessState == FWU_PS_BANNER) {
+        return fwu->bannerSeen ? fwu->privateBannerSettleMillisec : fwu->privateBannerWaitMillisec;
+    }
+    if (fwu->privateCommandState == FWU_CS_SEND || fwu->privateCommandState == FWU_CS_RECEIVE) {
+        return fwu->privateCommandTimeoutRemainingMillisec;
+    }
+    return 0xffffffff;
+}
+
+uint32_t fwuStatsProgressBytes(TFwu *fwu)
+{
+    switch (fwu->privateProcessState) {
+        case FWU_PS_DONE:
+            return fwu->processStatus == FWU_STATUS_COMPLETION ? fwu->dataObjectLen : fwu->privateDataObjectOffset;
+        case FWU_PS_OBJ2_WRITE:
+        case FWU_PS_OBJ2_CRC_GET:
+        case FWU_PS_OBJ2_EXECUTE:
+            // Only now does privateObjectIx refer to the current data object.
+            return fwu->privateDataObjectOffset + fwu->privateObjectIx;
+        default:
+            return fwu->privateDataObjectOffset;
+    }
+}
+
+uint32_t fwuStatsThroughput(TFwu *fwu)
+{
+    uint32_t millisec = 0;
+    uint8_t phase;
+
+    for (phase = FWU_PHASE_OBJ2_SELECT; phase <= FWU_PHASE_OBJ2_RESUME; phase++) {
+        millisec += fwu->stats.phaseMillisec[phase];
+    }
+    if (millisec == 0) {
+        return 0;
+    }
+    return (uint32_t)((uint64_t)fwuStatsProgressBytes(fwu) * 1000 / millisec);
+}
+
+uint32_t fwuStatsEtaMillisec(TFwu *fwu)
+{
+    uint32_t progress = fwuStatsProgressBytes(fwu);
+    uint32_t throughput = fwuStatsThroughput(fwu);
+
+    if (progress >= fwu->dataObjectLen) {
+        return 0;
+    }
+    if (throughput == 0) {
+        return 0xffffffff;
+    }
+    return (uint32_t)((uint64_t)(fwu->dataObjectLen - progress) * 1000 / throughput);
+}
+
+uint32_t fwuStatsRttAvgMillisec(TFwu *fwu, uint8_t opcode)
+{
+    if (opcode >= FWU_NOF_OPCODES || fwu->stats.rtt[opcode].count == 0) {
+        return 0;
+    }
+    return fwu->stats.rtt[opcode].totalMillisec / fwu->stats.rtt[opcode].count;
+}
+
+const char *fwuPhaseName(EFwuPhase phase)
+{
+    static const char *names[FWU_NOF_PHASES] = {
+        "BANNER", "PING", "VERSION", "RCPT_NOTIF", "MTU",
+        "OBJ1_SELECT", "OBJ1_CREATE", "OBJ1_WRITE", "OBJ1_CRC_GET", "OBJ1_EXECUTE",
+        "OBJ2_SELECT", "OBJ2_CREATE", "OBJ2_WRITE", "OBJ2_CRC_GET", "OBJ2_EXECUTE",
+        "OBJ2_RESUME", "ABORT",
+    };
+    return phase < FWU_NOF_PHASES ? names[phase] : "?";
+}
+
 static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
 {
     uint8_t tmpPrivateProcessRequest = fwu->privateProcessRequest;
@@ -224,10 +495,22 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
         return;
     }
 
-    // Failure handling
+    // Failure handling; repeat what can be repeated, otherwise reset the target with
+    // an ABORT so it doesn't wait in DFU mode.
     if (tmpPrivateProcessRequest == FWU_PR_REQUEST_FAILED) {
-        fwu->privateProcessState = FWU_PS_FAIL;
-        fwu->processStatus = FWU_STATUS_FAILURE;
+        if (!fwuRetry(fwu)) {
+            fwuStartAbort(fwu, FWU_STATUS_FAILURE);
+        }
+        return;
+    }
+
+    // Abort requested by the application, as soon as no request is half-way sent.
+    if (fwu->privateAbortRequested && fwu->privateProcessState != FWU_PS_ABORT) {
+        if (fwu->privateCommandState == FWU_CS_SEND && fwu->privateRequestIx < fwu->privateRequestLen) {
+            return;
+        }
+        fwu->responseStatus = FWU_RSP_ABORTED;
+        fwuStartAbort(fwu, FWU_STATUS_FAILURE);
         return;
     }
     
@@ -236,9 +519,30 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
             
         case FWU_PS_IDLE:
             if (tmpPrivateProcessRequest == FWU_PR_START) {
-                // Send a PING and switch to the PING state to wait for the response.
-                fwuPrepareSendBuffer(fwu, sPingRequest, sPingRequestLen);
-                fwu->privateProcessState = FWU_PS_PING;
+                if (fwu->bannerTimeoutMillisec) {
+                    fwu->privateBannerWaitMillisec = fwu->bannerTimeoutMillisec;
+                    fwu->privateProcessState = FWU_PS_BANNER;
+                } else {
+                    fwuStartPing(fwu);
+                }
+            }
+            break;
+
+            // BANNER: Wait until the bootloader has printed its banner and released the UART
+        case FWU_PS_BANNER:
+            if (fwu->bannerSeen) {
+                if (fwu->privateBannerSettleMillisec > elapsedMillisec) {
+                    fwu->privateBannerSettleMillisec -= elapsedMillisec;
+                } else {
+                    fwuStartPing(fwu);
+                }
+            } else {
+                // No banner; the target may already be waiting in DFU mode.
+                if (fwu->privateBannerWaitMillisec > elapsedMillisec) {
+                    fwu->privateBannerWaitMillisec -= elapsedMillisec;
+                } else {
+                    fwuStartPing(fwu);
+                }
             }
             break;
         
@@ -246,16 +550,71 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
         case FWU_PS_PING:
             // Wait for the PING response, then verify it.
             if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
+                fwu->pingMillisec = fwu->privateClockMillisec;
                 // ID match?
-                if (fwu->privateRequestBuf[1] == fwu->privateResponseBuf[3]) {
-                    // Send a SET_RECEIPT and switch to the corresponding state to wait for the response.
-                    fwuPrepareSendBuffer(fwu, sSetReceiptRequest, sSetReceiptRequestLen);
-                    fwu->privateProcessState = FWU_PS_RCPT_NOTIF;
+                if (sPingRequest[1] == fwu->privateResponseBuf[3]) {
+                    if (fwu->versionCheck) {
+                        // Older targets may not know the version requests; don't fail on errors.
+                        fwu->privateCommandAcceptError = 1;
+                        fwuPrepareSendBuffer(fwu, sProtocolVersionRequest, sProtocolVersionRequestLen);
+                        fwu->privateProcessState = FWU_PS_PROTOCOL_VERSION;
+                    } else {
+                        fwuStartTransfer(fwu);
+                    }
                 } else {
                     fwuSignalFailure(fwu, FWU_RSP_PING_ID_MISMATCH);
                 }
             }
             break;
+
+            // PROTOCOL_VERSION: Query the DFU protocol version
+        case FWU_PS_PROTOCOL_VERSION:
+            if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
+                if (fwu->privateResponseBuf[2] == FWU_RESPONSE_SUCCESS) {
+                    fwu->targetProtocolVersion = fwu->privateResponseBuf[3];
+                }
+                fwuPrepareSendBuffer(fwu, sHwVersionRequest, sHwVersionRequestLen);
+                fwu->privateProcessState = FWU_PS_HW_VERSION;
+            }
+            break;
+
+            // HW_VERSION: Query the hardware the bootloader runs on
+        case FWU_PS_HW_VERSION:
+            if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
+                if (fwu->privateResponseBuf[2] == FWU_RESPONSE_SUCCESS) {
+                    fwu->targetHwPart = fwuLittleEndianToHost32(&fwu->privateResponseBuf[3]);
+                    fwu->targetHwVariant = fwuLittleEndianToHost32(&fwu->privateResponseBuf[7]);
+                }
+                fwu->privateImageNumber = 0;
+                fwuPrepareFwVersion(fwu, fwu->privateImageNumber);
+                fwu->privateProcessState = FWU_PS_FW_VERSION;
+            }
+            break;
+
+            // FW_VERSION: Walk the images on the target until the application is found
+        case FWU_PS_FW_VERSION:
+            if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
+                // An error response means there are no more images.
+                if (fwu->privateResponseBuf[2] == FWU_RESPONSE_SUCCESS
+                    && fwu->privateResponseBuf[3] == FWU_FW_TYPE_APPLICATION) {
+                    fwu->targetAppValid = 1;
+                    fwu->targetAppVersion = fwuLittleEndianToHost32(&fwu->privateResponseBuf[4]);
+                } else if (fwu->privateResponseBuf[2] == FWU_RESPONSE_SUCCESS
+                           && fwu->privateImageNumber < FWU_MAX_IMAGE_NUMBER) {
+                    fwuPrepareFwVersion(fwu, ++fwu->privateImageNumber);
+                    break;
+                }
+                fwu->privateCommandAcceptError = 0;
+                if (fwu->targetAppValid && fwu->targetAppVersion == fwu->imageFwVersion) {
+                    // The target already runs this version; nothing to transfer.
+                    // Leave DFU mode right away so the application starts.
+                    fwu->updateSkipped = 1;
+                    fwuStartAbort(fwu, FWU_STATUS_COMPLETION);
+                } else {
+                    fwuStartTransfer(fwu);
+                }
+            }
+            break;
         
             // RCPT_NOTIF: Define Receipt settings
         case FWU_PS_RCPT_NOTIF:
@@ -270,10 +629,10 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
             // FWU_PS_MTU: Get maximum transmission unit size
         case FWU_PS_MTU:
             if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
+                fwu->privateObjectRetries = 0;
                 fwu->privateMtuSize = fwuLittleEndianToHost16(&fwu->privateResponseBuf[3]);
                 // Send a SET_RECEIPT and switch to the corresponding state to wait for the response.
-                sSelectObjectRequest[1] = 0x01; // select object 1 (command object)
-                fwuPrepareSendBuffer(fwu, sSelectObjectRequest, sSelectObjectRequestLen);
+                fwuPrepareSelectObject(fwu, FWU_OBJ_TYPE_COMMAND);
                 fwu->privateProcessState = FWU_PS_OBJ1_SELECT;
             }
             break;
@@ -285,9 +644,7 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
                 if (maxSize < fwu->commandObjectLen) {
                     fwuSignalFailure(fwu, FWU_RSP_INIT_COMMAND_TOO_LARGE);
                 } else {
-                    sCreateObjectRequest[1] = 0x01; // create type 1 object (COMMAND)
-                    fwuHostToLittleEndian32(fwu->commandObjectLen, &sCreateObjectRequest[2]);
-                    fwuPrepareSendBuffer(fwu, sCreateObjectRequest, sCreateObjectRequestLen);
+                    fwuPrepareCreateObject(fwu, FWU_OBJ_TYPE_COMMAND, fwu->commandObjectLen);
                     fwu->privateProcessState = FWU_PS_OBJ1_CREATE;
                 }
             }
@@ -301,6 +658,8 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
                 fwu->privateObjectLen = fwu->commandObjectLen;
                 fwu->privateObjectIx = 0;
                 fwu->privateObjectCrc = 0xffffffff;
+                fwu->privateObjectFromCache = 0;
+                fwu->privateObjectCrcFromTable = 0;
                 fwuPrepareLargeObjectSendBuffer(fwu, 0x08);
             }
             break;
@@ -336,9 +695,9 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
         
         case FWU_PS_OBJ1_EXECUTE:
             if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
-                sSelectObjectRequest[1] = 0x02; // select object 2 (DATA object)
+                fwu->privateObjectRetries = 0;
                 fwu->privateDataObjectOffset = 0; // from the beginning
-                fwuPrepareSendBuffer(fwu, sSelectObjectRequest, sSelectObjectRequestLen);
+                fwuPrepareSelectObject(fwu, FWU_OBJ_TYPE_DATA);
                 fwu->privateProcessState = FWU_PS_OBJ2_SELECT;
             }
             break;
@@ -348,15 +707,8 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
             if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
                 fwu->privateDataObjectMaxSize = fwuLittleEndianToHost32(&fwu->privateResponseBuf[3]);
                 fwu->privateObjectCrc = 0xffffffff; // do it here because it's global for the entire blob
-                // We'll create and execute multiple data objects, so it's ok if the actual size is greater than max size.
-                fwu->privateDataObjectSize = (fwu->dataObjectLen - fwu->privateDataObjectOffset); // nof bytes remaining
-                if (fwu->privateDataObjectSize > fwu->privateDataObjectMaxSize) {
-                    fwu->privateDataObjectSize = fwu->privateDataObjectMaxSize;
-                }
-                sCreateObjectRequest[1] = 0x02; // create type 2 object (COMMAND)
-                fwuHostToLittleEndian32(fwu->privateDataObjectSize, &sCreateObjectRequest[2]);
-                fwuPrepareSendBuffer(fwu, sCreateObjectRequest, sCreateObjectRequestLen);
-                fwu->privateProcessState = FWU_PS_OBJ2_CREATE;
+                fwu->privateDataObjectStartCrc = fwu->privateObjectCrc;
+                fwuPrepareNextDataObject(fwu);
             }
             break;
             
@@ -367,6 +719,12 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
                 fwu->privateObjectProviderFunction = fwu->dataObjectProviderFunction;
                 fwu->privateObjectLen = fwu->privateDataObjectSize;
                 fwu->privateObjectIx = 0;
+                fwu->privateObjectFromCache = fwuFrameCacheCoversObject(fwu);
+                fwu->privateObjectCrcFromTable = fwuCrcTableCoversObject(fwu);
+                if (!fwu->privateObjectFromCache && !fwu->dataObjectProviderFunction) {
+                    fwuSignalFailure(fwu, FWU_RSP_FRAME_CACHE_MISMATCH);
+                    break;
+                }
                 fwuPrepareLargeObjectSendBuffer(fwu, 0x08);
             }
             break;
@@ -403,25 +761,62 @@ static void fwuYieldProcessFsm(TFwu *fwu, uint32_t elapsedMillisec)
 
         case FWU_PS_OBJ2_EXECUTE:
             if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
+                if (fwu->privateCommandAcceptError) {
+                    // Repeated EXECUTE after a resume: "not permitted" means the target had
+                    // already executed the object before the response got lost.
+                    fwu->privateCommandAcceptError = 0;
+                    if (fwu->resultCode != FWU_RES_SUCCESS && fwu->resultCode != FWU_RES_OPERATION_NOT_PERMITTED) {
+                        fwuSignalFailure(fwu, FWU_RSP_ERROR_RESPONSE);
+                        break;
+                    }
+                }
+                fwu->privateObjectRetries = 0;
                 fwu->privateDataObjectOffset += fwu->privateDataObjectSize;
+                fwu->privateDataObjectStartCrc = fwu->privateObjectCrc;
                 if (fwu->privateDataObjectOffset == fwu->dataObjectLen) {
                     fwu->privateProcessState = FWU_PS_DONE;
                     fwu->processStatus = FWU_STATUS_COMPLETION;
 
                 } else {
-                    // We'll create and execute multiple data objects, so it's ok if the actual size is greater than max size.
-                    fwu->privateDataObjectSize = (fwu->dataObjectLen - fwu->privateDataObjectOffset); // nof bytes remaining
-                    if (fwu->privateDataObjectSize > fwu->privateDataObjectMaxSize) {
-                        fwu->privateDataObjectSize = fwu->privateDataObjectMaxSize;
-                    }
-                    sCreateObjectRequest[1] = 0x02; // create type 2 object (COMMAND)
-                    fwuHostToLittleEndian32(fwu->privateDataObjectSize, &sCreateObjectRequest[2]);
-                    fwuPrepareSendBuffer(fwu, sCreateObjectRequest, sCreateObjectRequestLen);
-                    fwu->privateProcessState = FWU_PS_OBJ2_CREATE;
+                    fwuPrepareNextDataObject(fwu);
+                }
+            }
+            break;
+
+            // FWU_PS_OBJ2_RESUME: Continue with the current DATA object after a failure
+        case FWU_PS_OBJ2_RESUME:
+            if (tmpPrivateProcessRequest == FWU_PR_RECEIVED_RESPONSE) {
+                // 60 06 01 <max size> <offset> <crc> C0
+                uint32_t offset = fwuLittleEndianToHost32(&fwu->privateResponseBuf[7]);
+                uint32_t actualCks = fwuLittleEndianToHost32(&fwu->privateResponseBuf[11]);
+                if (!fwuFrameCacheCoversObject(fwu) && !fwu->dataObjectProviderFunction) {
+                    fwuSignalFailure(fwu, FWU_RSP_FRAME_CACHE_MISMATCH);
+                    break;
+                }
+                uint32_t objectEndCrc = fwuDataObjectEndCrc(fwu);
+                if (offset == fwu->privateDataObjectOffset + fwu->privateDataObjectSize
+                    && actualCks == ~objectEndCrc) {
+                    // The whole object arrived and may even have been executed already.
+                    fwu->privateObjectCrc = objectEndCrc;
+                    fwu->privateCommandAcceptError = 1;
+                    fwuPrepareSendBuffer(fwu, sExecuteObjectRequest, sExecuteObjectRequestLen);
+                    fwu->privateProcessState = FWU_PS_OBJ2_EXECUTE;
+                } else {
+                    // Start the object over; CREATE discards everything since the last EXECUTE.
+                    fwu->privateObjectCrc = fwu->privateDataObjectStartCrc;
+                    fwuPrepareNextDataObject(fwu);
                 }
             }
             break;
 
+            // FWU_PS_ABORT: Wait until the ABORT request has been sent
+        case FWU_PS_ABORT:
+            if (tmpPrivateProcessRequest == FWU_PR_REQUEST_SENT) {
+                fwu->privateProcessState = (fwu->privateFinalStatus == FWU_STATUS_COMPLETION) ? FWU_PS_DONE : FWU_PS_FAIL;
+                fwu->processStatus = fwu->privateFinalStatus;
+            }
+            break;
+
         default:
             fwu->privateProcessState = FWU_PS_FAIL;
             break;
@@ -446,21 +841,12 @@ static void fwuYieldCommandFsm(TFwu *fwu, uint32_t elapsedMillisec)
             fwu->privateCommandTimeoutRemainingMillisec -= elapsedMillisec;
         }
         if (fwu->privateCommandTimeoutRemainingMillisec == 0) {
+            fwu->stats.timeouts++;
             fwuSignalFailure(fwu, FWU_RSP_TIMEOUT);
             return;
         }
     }
     
-    // Catch errors
-    if (fwu->privateCommandRequest == FWU_CR_RX_OVERFLOW) {
-        fwuSignalFailure(fwu, FWU_RSP_RX_OVERFLOW);
-        return;
-    }
-    if (fwu->privateCommandRequest == FWU_CR_INVALID_ESCAPE_SEQ) {
-        fwuSignalFailure(fwu, FWU_RSP_RX_INVALID_ESCAPE_SEQ);
-        return;
-    }
-
     switch (fwu->privateCommandState) {
         case FWU_CS_IDLE:
             // Ready and waiting for a transmission request.
@@ -488,8 +874,33 @@ static void fwuYieldCommandFsm(TFwu *fwu, uint32_t elapsedMillisec)
                 if (n > toSend) {
                     n = toSend;
                 }
-                fwu->txFunction(fwu, &fwu->privateRequestBuf[fwu->privateRequestIx], n);
+                const uint8_t *p = &fwu->privateRequestPtr[fwu->privateRequestIx];
+                fwu->txFunction(fwu, (uint8_t *)p, n);
                 fwu->privateRequestIx += n;
+                // Every 0xDB on the wire starts an escape sequence; a literal 0xDB is sent as DB DD.
+                // Frames from the cache are not scanned, their escapes are known in advance.
+                fwu->stats.wireBytes += n;
+                if (fwu->privateRequestPtr == fwu->privateRequestBuf) {
+                    while (n--) {
+                        if (*p++ == 0xDB) {
+                            fwu->stats.escapeBytes++;
+                        }
+                    }
+                }
+                if (fwu->privateRequestIx == fwu->privateRequestLen) {
+                    if (fwu->privateRequestPtr != fwu->privateRequestBuf) {
+                        fwu->stats.escapeBytes += fwu->privateRequestEscapes;
+                    }
+                    // A frame cut short by a retry never counts as payload.
+                    fwu->stats.payloadBytes += fwu->privateRequestPayload;
+                    fwu->privateRequestPayload = 0;
+                    fwu->stats.framesSent++;
+                    fwu->privateRequestSentMillisec = fwu->privateClockMillisec;
+                    if (fwu->traceFunction) {
+                        fwu->traceFunction(fwu, FWU_TRACE_TX, fwu->privateClockMillisec,
+                                           fwu->privateRequestPtr, fwu->privateRequestLen);
+                    }
+                }
             }
             break;
         case FWU_CS_RECEIVE:
@@ -497,13 +908,18 @@ static void fwuYieldCommandFsm(TFwu *fwu, uint32_t elapsedMillisec)
             if (fwu->privateCommandRequest == FWU_CR_EOM_RECEIVED) {
                 fwu->privateCommandRequest = FWU_CR_NONE;
                 EFwuResponseStatus responseStatus = fwuTestReceivedPacketValid(fwu);
+                if (responseStatus == FWU_RSP_OK || responseStatus == FWU_RSP_ERROR_RESPONSE) {
+                    fwuStatsRecordResponse(fwu);
+                }
                 if (responseStatus == FWU_RSP_OK) {
                     // Inform the process state machine that command reception has completed.
                     fwu->privateProcessRequest = FWU_PR_RECEIVED_RESPONSE;
                     fwu->privateCommandState = FWU_CS_DONE;
+                } else if (responseStatus != FWU_RSP_ERROR_RESPONSE) {
+                    // Not a response to this request; keep waiting for one until the timeout.
+                    fwu->privateResponseLen = 0;
                 } else {
-                    fwu->responseStatus = responseStatus;
-                    fwu->privateCommandState = FWU_CS_FAIL;
+                    fwuSignalFailure(fwu, responseStatus);
                 }
             }
             break;
@@ -522,67 +938,170 @@ static EFwuResponseStatus fwuTestReceivedPacketValid(TFwu *fwu)
     if (fwu->privateResponseBuf[0] != FWU_RESPONSE_START) {
         return FWU_RSP_START_MARKER_MISSING;
     }
-    if (fwu->privateResponseBuf[1] != fwu->privateRequestBuf[0]) {
+    if (fwu->privateResponseBuf[1] != fwuRequestOpcode(fwu)) {
         return FWU_RSP_REQUEST_REFERENCE_INVALID;
     }
-    if (fwu->privateResponseBuf[2] != FWU_RESPONSE_SUCCESS) {
-        return FWU_RSP_ERROR_RESPONSE;
-    }
     if (fwu->privateResponseBuf[fwu->privateResponseLen - 1] != FWU_EOM) {
         return FWU_RSP_END_MARKER_MISSING;
     }
+    // 60 <cmd> 0B <ext> C0
+    fwu->resultCode = fwu->privateResponseBuf[2];
+    fwu->extendedError = (fwu->resultCode == FWU_RES_EXT_ERROR && fwu->privateResponseLen >= 5)
+        ? fwu->privateResponseBuf[3] : FWU_EXT_NO_ERROR;
+    if (fwu->privateResponseBuf[2] != FWU_RESPONSE_SUCCESS && !fwu->privateCommandAcceptError) {
+        return FWU_RSP_ERROR_RESPONSE;
+    }
     return FWU_RSP_OK;
 }
 
 static void fwuPrepareLargeObjectSendBuffer(TFwu *fwu, uint8_t requestCode)
 {
+    FWU_PROBE_BEGIN();
+    uint32_t pos = fwu->privateDataObjectOffset + fwu->privateObjectIx;
     uint16_t bytesTodo = fwu->privateObjectLen - fwu->privateObjectIx;
-    uint16_t bufSpace = FWU_REQUEST_BUF_SIZE - 2;
-    
-    uint16_t i;
-    uint8_t *p = &fwu->privateRequestBuf[0];
 
-    *p++ = requestCode;
-    fwu->privateRequestLen = 2; // including requestCode and FWU_EOM
+    if (bytesTodo > fwu->privateChunkSize) {
+        bytesTodo = fwu->privateChunkSize;
+    }
+    fwu->privateRequestPayload = bytesTodo;
     fwu->privateRequestIx = 0;
 
-    if (bytesTodo > 32) {
-        bytesTodo = 32;
+    if (fwu->privateObjectFromCache) {
+        // Zero-copy: send the pre-encoded frame straight from the shared cache.
+        const TFwuFrameCache *cache = fwu->frameCache;
+        uint32_t frame = pos / cache->chunkSize;
+        fwu->privateRequestPtr = &cache->frames[cache->frameOffsets[frame]];
+        fwu->privateRequestLen = cache->frameOffsets[frame + 1] - cache->frameOffsets[frame];
+        // opcode + payload + escapes + EOM
+        fwu->privateRequestEscapes = fwu->privateRequestLen - 2 - bytesTodo;
+        fwu->privateObjectIx += bytesTodo;
+        if (fwu->privateObjectIx == fwu->privateObjectLen) {
+            // Object complete; take over the running CRC at its end from the cache.
+            pos += bytesTodo;
+            fwu->privateObjectCrc = cache->crcs[(pos - 1) / cache->crcStride];
+        }
+    } else {
+        const uint8_t *srcPtr = fwu->privateObjectProviderFunction(fwu, pos, bytesTodo);
+        fwu->privateRequestBuf[0] = requestCode;
+        fwu->privateRequestPtr = fwu->privateRequestBuf;
+        fwu->privateRequestLen = fwuEncodeWriteFrame(&fwu->privateRequestBuf[1], srcPtr, bytesTodo) + 1;
+        fwu->privateObjectIx += bytesTodo;
+        if (!fwu->privateObjectCrcFromTable) {
+            fwu->privateObjectCrc = fwuCrc32Update(fwu->privateObjectCrc, srcPtr, bytesTodo);
+        } else if (fwu->privateObjectIx == fwu->privateObjectLen) {
+            pos += bytesTodo;
+            fwu->privateObjectCrc = fwu->dataObjectCrcs[(pos - 1) / fwu->dataObjectCrcStride];
+        }
     }
-    
-    uint8_t *srcPtr = fwu->privateObjectProviderFunction(fwu, fwu->privateDataObjectOffset + fwu->privateObjectIx, bytesTodo);
-    
-    for (i = 0; i < bytesTodo && bufSpace >= 2; i++) {
-        uint8_t b = srcPtr[i];
+
+    fwu->privateCommandRequest = FWU_CR_SENDONLY;
+    FWU_PROBE_END(FWU_PROBE_PREPARE_LARGE_OBJECT);
+}
+
+// SLIP-encode len payload bytes followed by the EOM; returns the number of bytes written.
+static uint8_t fwuEncodeWriteFrame(uint8_t *dst, const uint8_t *src, uint16_t len)
+{
+    uint8_t *p = dst;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        uint8_t b = src[i];
         // SLIP escape characters: C0->DBDC, DB->DBDD
         if (b == 0xC0 || b == 0xDB) {
             *p++ = 0xDB;
             *p++ = (b == 0xC0) ? 0xDC : 0xDD;
-            fwu->privateRequestLen += 2;
-            bufSpace -= 2;
         } else {
             *p++ = b;
-            fwu->privateRequestLen++;
-            bufSpace--;
         }
-        updateCrc(fwu, b);
-        fwu->privateObjectIx++;
     }
-    
-    *p = FWU_EOM;
-    fwu->privateCommandRequest = FWU_CR_SENDONLY;
+    *p++ = FWU_EOM;
+    return (uint8_t)(p - dst);
+}
+
+// The cache can only serve a data object that starts on a frame boundary and ends
+// on a CRC checkpoint (or at the end of the image).
+static uint8_t fwuFrameCacheCoversObject(TFwu *fwu)
+{
+    const TFwuFrameCache *cache = fwu->frameCache;
+    uint32_t end = fwu->privateDataObjectOffset + fwu->privateDataObjectSize;
+
+    if (!cache || cache->dataLen != fwu->dataObjectLen || cache->chunkSize != fwu->privateChunkSize
+        || cache->crcStride == 0 || fwu->privateDataObjectSize == 0) {
+        return 0;
+    }
+    if (fwu->privateDataObjectOffset % cache->chunkSize != 0) {
+        return 0;
+    }
+    return (end == cache->dataLen || end % cache->crcStride == 0) ? 1 : 0;
+}
+
+// The CRC table can replace the computation for a data object that ends on one of its entries.
+static uint8_t fwuCrcTableCoversObject(TFwu *fwu)
+{
+    uint32_t end = fwu->privateDataObjectOffset + fwu->privateDataObjectSize;
+
+    if (!fwu->dataObjectCrcs || fwu->dataObjectCrcStride == 0 || fwu->privateDataObjectSize == 0) {
+        return 0;
+    }
+    return (end == fwu->dataObjectLen || end % fwu->dataObjectCrcStride == 0) ? 1 : 0;
+}
+
+uint32_t fwuFrameCacheNofFrames(uint32_t len)
+{
+    return (len + FWU_DATA_CHUNK_SIZE - 1) / FWU_DATA_CHUNK_SIZE;
+}
+
+uint32_t fwuFrameCacheMaxFramesSize(uint32_t len)
+{
+    return fwuFrameCacheNofFrames(len) * 2 + 2 * len;
+}
+
+void fwuFrameCacheBuild(TFwuFrameCache *cache, const uint8_t *data, uint32_t len, uint32_t crcStride,
+                        uint8_t *frames, uint32_t *frameOffsets, uint32_t *crcs)
+{
+    uint32_t pos = 0;
+    uint32_t frame = 0;
+    uint32_t offset = 0;
+    uint32_t crc = 0xffffffff;
+
+    cache->dataLen = len;
+    cache->chunkSize = FWU_DATA_CHUNK_SIZE;
+    cache->nofFrames = fwuFrameCacheNofFrames(len);
+    cache->frames = frames;
+    cache->frameOffsets = frameOffsets;
+    cache->crcStride = crcStride;
+    cache->crcs = crcs;
+
+    while (pos < len) {
+        uint32_t n = len - pos;
+        if (n > FWU_DATA_CHUNK_SIZE) {
+            n = FWU_DATA_CHUNK_SIZE;
+        }
+        frameOffsets[frame++] = offset;
+        frames[offset] = 0x08; // WRITE OBJECT
+        offset += 1 + fwuEncodeWriteFrame(&frames[offset + 1], &data[pos], n);
+        crc = fwuCrc32Update(crc, &data[pos], n);
+        pos += n;
+        if (pos % crcStride == 0 || pos == len) {
+            crcs[(pos - 1) / crcStride] = crc;
+        }
+    }
+    frameOffsets[frame] = offset;
 }
 
-static void fwuPrepareSendBuffer(TFwu *fwu, uint8_t *data, uint8_t len)
+static void fwuPrepareSendBuffer(TFwu *fwu, const uint8_t *data, uint8_t len)
 {
     // TODO assert privateCommandState == FWU_CS_IDLE | _DONE | _FAIL
     // TODO assert len <= FWU_REQUEST_BUF_SIZE
     
+    FWU_PROBE_BEGIN();
     uint8_t i;
     uint8_t *p = &fwu->privateRequestBuf[0];
 
+    fwu->privateRequestPtr = fwu->privateRequestBuf;
     fwu->privateRequestIx = 0;
     fwu->privateRequestLen = len + 1;
+    fwu->privateRequestPayload = 0;
     fwu->privateResponseLen = 0;
 
     // Copy the data into our internal buffer.
@@ -603,22 +1122,351 @@ static void fwuPrepareSendBuffer(TFwu *fwu, uint8_t *data, uint8_t len)
     
     // Ready to send!
     fwu->privateCommandRequest = FWU_CR_SEND;
+    FWU_PROBE_END(FWU_PROBE_PREPARE_SEND_BUFFER);
+}
+
+// SELECT OBJECT 06 <type>
+static void fwuPrepareSelectObject(TFwu *fwu, uint8_t objectType)
+{
+    uint8_t request[2];
+    request[0] = FWU_OP_SELECT_OBJECT;
+    request[1] = objectType;
+    fwuPrepareSendBuffer(fwu, request, sizeof(request));
+}
+
+// CREATE OBJECT 01 <type> <size, 4 bytes little endian>
+static void fwuPrepareCreateObject(TFwu *fwu, uint8_t objectType, uint32_t size)
+{
+    uint8_t request[6];
+    request[0] = FWU_OP_CREATE_OBJECT;
+    request[1] = objectType;
+    fwuHostToLittleEndian32(size, &request[2]);
+    fwuPrepareSendBuffer(fwu, request, sizeof(request));
+}
+
+// FW VERSION 0B <image number>
+static void fwuPrepareFwVersion(TFwu *fwu, uint8_t imageNumber)
+{
+    uint8_t request[2];
+    request[0] = FWU_OP_FW_VERSION;
+    request[1] = imageNumber;
+    fwuPrepareSendBuffer(fwu, request, sizeof(request));
+}
+
+static void fwuStartPing(TFwu *fwu)
+{
+    // Send a PING and switch to the PING state to wait for the response.
+    fwuPrepareSendBuffer(fwu, sPingRequest, sPingRequestLen);
+    fwu->privateProcessState = FWU_PS_PING;
+}
+
+// Continue with the transfer after PING (and the optional version checks).
+static void fwuStartTransfer(TFwu *fwu)
+{
+    // Send a SET_RECEIPT and switch to the corresponding state to wait for the response.
+    fwuPrepareSendBuffer(fwu, sSetReceiptRequest, sSetReceiptRequestLen);
+    fwu->privateProcessState = FWU_PS_RCPT_NOTIF;
+}
+
+static void fwuPrepareNextDataObject(TFwu *fwu)
+{
+    // We'll create and execute multiple data objects, so it's ok if the actual size is greater than max size.
+    fwu->privateDataObjectSize = (fwu->dataObjectLen - fwu->privateDataObjectOffset); // nof bytes remaining
+    if (fwu->privateDataObjectSize > fwu->privateDataObjectMaxSize) {
+        fwu->privateDataObjectSize = fwu->privateDataObjectMaxSize;
+    }
+    fwuPrepareCreateObject(fwu, FWU_OBJ_TYPE_DATA, fwu->privateDataObjectSize);
+    fwu->privateProcessState = FWU_PS_OBJ2_CREATE;
+}
+
+// Running CRC at the end of the current data object, computed from its start.
+static uint32_t fwuDataObjectEndCrc(TFwu *fwu)
+{
+    uint32_t pos = fwu->privateDataObjectOffset;
+    uint32_t end = pos + fwu->privateDataObjectSize;
+    uint32_t crc = fwu->privateDataObjectStartCrc;
+
+    if (fwuFrameCacheCoversObject(fwu)) {
+        return fwu->frameCache->crcs[(end - 1) / fwu->frameCache->crcStride];
+    }
+    if (fwuCrcTableCoversObject(fwu)) {
+        return fwu->dataObjectCrcs[(end - 1) / fwu->dataObjectCrcStride];
+    }
+    while (pos < end) {
+        uint32_t n = end - pos;
+        if (n > FWU_DATA_CHUNK_SIZE) {
+            n = FWU_DATA_CHUNK_SIZE;
+        }
+        crc = fwuCrc32Update(crc, fwu->dataObjectProviderFunction(fwu, pos, n), n);
+        pos += n;
+    }
+    return crc;
+}
+
+// Terminate a frame that was only partly sent by putting an EOM in front of the prepared request.
+// A request repeated as is may already start with one; a single EOM is enough.
+static void fwuPrependEom(TFwu *fwu)
+{
+    uint8_t i;
+    if (fwu->privateRequestBuf[0] == FWU_EOM) {
+        return;
+    }
+    for (i = fwu->privateRequestLen; i > 0; i--) {
+        fwu->privateRequestBuf[i] = fwu->privateRequestBuf[i - 1];
+    }
+    fwu->privateRequestBuf[0] = FWU_EOM;
+    fwu->privateRequestLen++;
+}
+
+// Op code of the current request; a retried frame starts with the EOM from fwuPrependEom.
+static uint8_t fwuRequestOpcode(TFwu *fwu)
+{
+    uint8_t i = 0;
+    while (i + 1 < fwu->privateRequestLen && fwu->privateRequestPtr[i] == FWU_EOM) {
+        i++;
+    }
+    return fwu->privateRequestPtr[i];
+}
+
+// Discard the response frame received so far and skip the rest of it.
+static void fwuDropResponseFrame(TFwu *fwu)
+{
+    fwu->privateResponseLen = 0;
+    fwu->privateResponseEscapeCharacter = 0;
+    fwu->privateResponseResync = 1;
+}
+
+// Collect text lines outside of frames and look for the bootloader banners.
+static void fwuScanBanner(TFwu *fwu, uint8_t c)
+{
+    if (c == '\r' || c == '\n') {
+        if (fwuBannerLineIs(fwu, sBannerBootloader) || fwuBannerLineIs(fwu, sBannerDfuRequested)) {
+            fwu->bannerSeen = 1;
+            fwu->bannerMillisec = fwu->privateClockMillisec;
+            fwu->privateBannerSettleMillisec = FWU_BANNER_SETTLE_MILLISEC;
+        }
+        fwu->privateBannerLineLen = 0;
+    } else if (fwu->privateBannerLineLen < sizeof(fwu->privateBannerLine)) {
+        fwu->privateBannerLine[fwu->privateBannerLineLen++] = c;
+    }
+}
+
+static uint8_t fwuBannerLineIs(TFwu *fwu, const char *banner)
+{
+    uint8_t i;
+    for (i = 0; i < fwu->privateBannerLineLen; i++) {
+        if (banner[i] != fwu->privateBannerLine[i]) {
+            return 0;
+        }
+    }
+    return banner[i] == 0;
+}
+
+// Repeat the failed step if the error allows it; returns 0 if the update has to be given up.
+static uint8_t fwuRetry(TFwu *fwu)
+{
+    uint8_t partialFrame = fwu->privateRequestIx > 0 && fwu->privateRequestIx < fwu->privateRequestLen;
+    uint8_t state = fwu->privateProcessState;
+
+    if (partialFrame && fwu->traceFunction) {
+        // The rest of the frame is never sent; the target sees this much of it.
+        fwu->traceFunction(fwu, FWU_TRACE_TX, fwu->privateClockMillisec,
+                           fwu->privateRequestPtr, fwu->privateRequestIx);
+    }
+
+    if (fwu->errorClass == FWU_ERR_CLASS_PERMANENT
+        || fwu->privateObjectRetries >= fwu->maxRetries
+        || fwu->privateAbortRequested
+        || state == FWU_PS_IDLE || state == FWU_PS_ABORT) {
+        return 0;
+    }
+    if (fwu->errorClass == FWU_ERR_CLASS_RESOURCE) {
+        // Only the size of the data objects is up to us. They start on a flash page, and the size
+        // from SELECT is already the target's maximum: once it is down to one page, nothing helps.
+        uint32_t maxSize = fwu->privateDataObjectMaxSize / 2 / FWU_FLASH_PAGE_SIZE * FWU_FLASH_PAGE_SIZE;
+        if (state < FWU_PS_OBJ2_CREATE) {
+            return 0;
+        }
+        if (maxSize == 0) {
+            fwu->errorClass = FWU_ERR_CLASS_PERMANENT;
+            return 0;
+        }
+        fwu->privateDataObjectMaxSize = maxSize;
+    }
+    fwu->privateObjectRetries++;
+    fwu->retryCount++;
+    fwu->stats.retries++;
+    fwu->privateCommandAcceptError = 0;
+
+    if (state >= FWU_PS_OBJ1_CREATE && state <= FWU_PS_OBJ1_EXECUTE) {
+        // The command object is small; create it again from scratch.
+        fwuPrepareCreateObject(fwu, FWU_OBJ_TYPE_COMMAND, fwu->commandObjectLen);
+        fwu->privateProcessState = FWU_PS_OBJ1_CREATE;
+    } else if (state >= FWU_PS_OBJ2_CREATE) {
+        // Ask the target how far it got with the current data object.
+        fwuPrepareSelectObject(fwu, FWU_OBJ_TYPE_DATA);
+        fwu->privateProcessState = FWU_PS_OBJ2_RESUME;
+    } else {
+        // Repeat the last request as is.
+        fwu->privateRequestPtr = fwu->privateRequestBuf;
+        fwu->privateRequestIx = 0;
+        fwu->privateResponseLen = 0;
+        fwu->privateCommandRequest = FWU_CR_SEND;
+    }
+    if (partialFrame) {
+        fwuPrependEom(fwu);
+    }
+    fwu->privateCommandState = FWU_CS_IDLE;
+    return 1;
+}
+
+EFwuErrorClass fwuClassifyError(uint8_t resultCode, uint8_t extendedError)
+{
+    switch (resultCode) {
+        case FWU_RES_SUCCESS:
+            return FWU_ERR_CLASS_NONE;
+        case FWU_RES_INSUFFICIENT_RESOURCES:
+            return FWU_ERR_CLASS_RESOURCE;
+        case FWU_RES_INVALID_OBJECT:
+        case FWU_RES_OPERATION_NOT_PERMITTED:
+        case FWU_RES_OPERATION_FAILED:
+            // Incomplete or out-of-sequence object, or a flash operation that failed
+            return FWU_ERR_CLASS_TRANSIENT;
+        case FWU_RES_EXT_ERROR:
+            // The init packet and the image were rejected; only a different image helps.
+            switch (extendedError) {
+                case FWU_EXT_NO_ERROR:
+                case FWU_EXT_INVALID_ERROR_CODE:
+                    return FWU_ERR_CLASS_TRANSIENT;
+                default:
+                    return FWU_ERR_CLASS_PERMANENT;
+            }
+        case FWU_RES_OP_CODE_NOT_SUPPORTED:
+        case FWU_RES_INVALID_PARAMETER:
+        case FWU_RES_UNSUPPORTED_TYPE:
+            // Unsupported opcodes, parameters or object types
+            return FWU_ERR_CLASS_PERMANENT;
+        default:
+            // Not a defined result code: the response was corrupted on the line.
+            return FWU_ERR_CLASS_TRANSIENT;
+    }
+}
+
+// Statistics phase of a process state; FWU_NOF_PHASES for IDLE and the final states.
+static uint8_t fwuPhaseOf(uint8_t processState)
+{
+    switch (processState) {
+        case FWU_PS_BANNER:             return FWU_PHASE_BANNER;
+        case FWU_PS_PING:               return FWU_PHASE_PING;
+        case FWU_PS_PROTOCOL_VERSION:
+        case FWU_PS_HW_VERSION:
+        case FWU_PS_FW_VERSION:         return FWU_PHASE_VERSION;
+        case FWU_PS_RCPT_NOTIF:         return FWU_PHASE_RCPT_NOTIF;
+        case FWU_PS_MTU:                return FWU_PHASE_MTU;
+        case FWU_PS_OBJ1_SELECT:        return FWU_PHASE_OBJ1_SELECT;
+        case FWU_PS_OBJ1_CREATE:        return FWU_PHASE_OBJ1_CREATE;
+        case FWU_PS_OBJ1_WRITE:         return FWU_PHASE_OBJ1_WRITE;
+        case FWU_PS_OBJ1_CRC_GET:       return FWU_PHASE_OBJ1_CRC_GET;
+        case FWU_PS_OBJ1_EXECUTE:       return FWU_PHASE_OBJ1_EXECUTE;
+        case FWU_PS_OBJ2_SELECT:        return FWU_PHASE_OBJ2_SELECT;
+        case FWU_PS_OBJ2_CREATE:        return FWU_PHASE_OBJ2_CREATE;
+        case FWU_PS_OBJ2_WRITE:         return FWU_PHASE_OBJ2_WRITE;
+        case FWU_PS_OBJ2_CRC_GET:       return FWU_PHASE_OBJ2_CRC_GET;
+        case FWU_PS_OBJ2_EXECUTE:       return FWU_PHASE_OBJ2_EXECUTE;
+        case FWU_PS_OBJ2_RESUME:        return FWU_PHASE_OBJ2_RESUME;
+        case FWU_PS_ABORT:              return FWU_PHASE_ABORT;
+        default:                        return FWU_NOF_PHASES;
+    }
+}
+
+// Round trip time of the request the response in privateResponseBuf belongs to.
+static void fwuStatsRecordResponse(TFwu *fwu)
+{
+    uint8_t opcode = fwuRequestOpcode(fwu);
+    uint32_t rtt = fwu->privateClockMillisec - fwu->privateRequestSentMillisec;
+    TFwuRtt *stats;
+
+    fwu->stats.responses++;
+    if (opcode >= FWU_NOF_OPCODES) {
+        return;
+    }
+    stats = &fwu->stats.rtt[opcode];
+    if (stats->count == 0 || rtt < stats->minMillisec) {
+        stats->minMillisec = rtt;
+    }
+    if (rtt > stats->maxMillisec) {
+        stats->maxMillisec = rtt;
+    }
+    stats->totalMillisec += rtt;
+    stats->count++;
 }
 
-static void updateCrc(TFwu *fwu, uint8_t b)
+static EFwuErrorClass fwuClassifyStatus(EFwuResponseStatus status)
 {
+    switch (status) {
+        case FWU_RSP_OK:
+            return FWU_ERR_CLASS_NONE;
+        case FWU_RSP_INIT_COMMAND_TOO_LARGE:
+        case FWU_RSP_DATA_OBJECT_TOO_LARGE:
+        case FWU_RSP_ABORTED:
+        case FWU_RSP_FRAME_CACHE_MISMATCH:
+            return FWU_ERR_CLASS_PERMANENT;
+        default:
+            // Timeouts, framing and checksum errors
+            return FWU_ERR_CLASS_TRANSIENT;
+    }
+}
+
+// Send an ABORT and end the session with finalStatus once it has been sent.
+static void fwuStartAbort(TFwu *fwu, EFwuProcessStatus finalStatus)
+{
+    uint8_t partialFrame = fwu->privateRequestIx > 0 && fwu->privateRequestIx < fwu->privateRequestLen;
+    uint8_t request[1];
+
+    // Nothing sent yet, or the ABORT itself failed: end immediately.
+    if (fwu->privateProcessState == FWU_PS_ABORT) {
+        finalStatus = fwu->privateFinalStatus;
+    }
+    if (fwu->privateProcessState == FWU_PS_IDLE || fwu->privateProcessState == FWU_PS_ABORT) {
+        fwu->privateProcessState = (finalStatus == FWU_STATUS_COMPLETION) ? FWU_PS_DONE : FWU_PS_FAIL;
+        fwu->processStatus = finalStatus;
+        return;
+    }
+
+    request[0] = FWU_OP_ABORT;
+    fwuPrepareSendBuffer(fwu, request, sizeof(request));
+    if (partialFrame) {
+        // Terminate the interrupted frame first so the target sees the ABORT on its own.
+        fwuPrependEom(fwu);
+    }
+    fwu->privateCommandRequest = FWU_CR_SENDONLY;
+    fwu->privateCommandState = FWU_CS_IDLE;
+    fwu->privateFinalStatus = finalStatus;
+    fwu->privateProcessState = FWU_PS_ABORT;
+}
+
+uint32_t fwuCrc32Update(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    FWU_PROBE_BEGIN();
     uint8_t i;
-    uint32_t crc = fwu->privateObjectCrc;
-    crc ^= b;
-    for (i = 0; i < 8; i++) {
-        uint32_t m = (crc & 1) ? 0xffffffff : 0;
-        crc = (crc >> 1) ^ (0xedb88320u & m);
+    while (len--) {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++) {
+            uint32_t m = (crc & 1) ? 0xffffffff : 0;
+            crc = (crc >> 1) ^ (0xedb88320u & m);
+        }
     }
-    fwu->privateObjectCrc = crc;
+    FWU_PROBE_END(FWU_PROBE_UPDATE_CRC);
+    return crc;
 }
 
 static void fwuSignalFailure(TFwu *fwu, EFwuResponseStatus reason) {
-    fwu->responseStatus = reason;
+    // Keep the original reason if the ABORT after a failure fails as well.
+    if (fwu->privateProcessState != FWU_PS_ABORT) {
+        fwu->responseStatus = reason;
+        fwu->errorClass = (reason == FWU_RSP_ERROR_RESPONSE)
+            ? fwuClassifyError(fwu->resultCode, fwu->extendedError) : fwuClassifyStatus(reason);
+    }
     fwu->privateCommandState = FWU_CS_FAIL;
     // Signal failure to process state machine
     fwu->privateProcessRequest = FWU_PR_REQUEST_FAILED;
@@ -642,3 +1490,60 @@ static inline void fwuHostToLittleEndian32(uint32_t v, uint8_t *bytes)
         v = v >> 8;
     }
 }
+
+#ifdef FWU_PROFILE
+void fwuProfileReset(void)
+{
+    uint8_t i;
+#ifdef FWU_PROFILE_DWT
+    // DEMCR.TRCENA, then DWT_CTRL.CYCCNTENA
+    *(volatile uint32_t *)0xE000EDFC |= 1u << 24;
+    *(volatile uint32_t *)0xE0001000 |= 1u;
+#endif
+    for (i = 0; i < FWU_NOF_PROBES; i++) {
+        sProbes[i].count = 0;
+        sProbes[i].totalCycles = 0;
+        sProbes[i].maxCycles = 0;
+    }
+}
+
+const TFwuProbe *fwuProfileProbe(EFwuProbe probe)
+{
+    return &sProbes[probe];
+}
+
+const char *fwuProfileProbeName(EFwuProbe probe)
+{
+    static const char *names[FWU_NOF_PROBES] = {
+        "fwuYield", "fwuDidReceiveData", "fwuCrc32Update", "fwuPrepareSendBuffer", "fwuPrepareLargeObjectSendBuffer",
+    };
+    return probe < FWU_NOF_PROBES ? names[probe] : "?";
+}
+
+void fwuProfileDump(FFwuProfilePrint print, void *context)
+{
+    char line[96];
+    uint8_t i;
+
+    for (i = 0; i < FWU_NOF_PROBES; i++) {
+        const TFwuProbe *probe = &sProbes[i];
+        if (probe->count == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%s: %lu calls, avg %lu, max %lu cycles", fwuProfileProbeName(i),
+                 (unsigned long)probe->count, (unsigned long)(probe->totalCycles / probe->count),
+                 (unsigned long)probe->maxCycles);
+        print(line, context);
+    }
+}
+
+static inline void fwuProfileRecord(EFwuProbe probe, uint32_t cycles)
+{
+    TFwuProbe *p = &sProbes[probe];
+    p->count++;
+    p->totalCycles += cycles;
+    if (cycles > p->maxCycles) {
+        p->maxCycles = cycles;
+    }
+}
+#endif // FWU_PROFILE
@@ -33,7 +33,14 @@
 struct SFwu;
 
 #define FWU_REQUEST_BUF_SIZE 67
-#define FWU_RESPONSE_BUF_SIZE 16
+// Large enough for the hardware version response (3 + 20 bytes) and the EOM.
+#define FWU_RESPONSE_BUF_SIZE 32
+// Payload bytes per WRITE request; an escaped frame never exceeds FWU_REQUEST_BUF_SIZE.
+#define FWU_DATA_CHUNK_SIZE 32
+// Worst-case length of an encoded WRITE frame: opcode, escaped payload, EOM.
+#define FWU_MAX_FRAME_SIZE (2 + 2 * FWU_DATA_CHUNK_SIZE)
+// nRF52 flash page; every data object starts on one, as CREATE erases the pages from there.
+#define FWU_FLASH_PAGE_SIZE 4096
 
 typedef enum {
     FWU_STATUS_UNDEFINED = 0,
@@ -50,47 +57,243 @@ typedef enum {
     FWU_RSP_ERROR_RESPONSE = 5,
     FWU_RSP_TIMEOUT = 6,
     FWU_RSP_PING_ID_MISMATCH = 7,
-    FWU_RSP_RX_OVERFLOW = 8,
+    FWU_RSP_RX_OVERFLOW = 8, // not reported anymore; broken frames are skipped
     FWU_RSP_INIT_COMMAND_TOO_LARGE = 9,
     FWU_RSP_CHECKSUM_ERROR = 10,
     FWU_RSP_DATA_OBJECT_TOO_LARGE = 11,
-    FWU_RSP_RX_INVALID_ESCAPE_SEQ = 12,
+    FWU_RSP_RX_INVALID_ESCAPE_SEQ = 12, // not reported anymore; broken frames are skipped
+    FWU_RSP_ABORTED = 13,
+    FWU_RSP_FRAME_CACHE_MISMATCH = 14, // no dataObjectProviderFunction and the frame cache can't serve an object
 } EFwuResponseStatus;
 
+// Result codes sent by the target (see FWU_RSP_ERROR_RESPONSE).
+typedef enum {
+    FWU_RES_INVALID = 0x00,
+    FWU_RES_SUCCESS = 0x01,
+    FWU_RES_OP_CODE_NOT_SUPPORTED = 0x02,
+    FWU_RES_INVALID_PARAMETER = 0x03,
+    FWU_RES_INSUFFICIENT_RESOURCES = 0x04,
+    FWU_RES_INVALID_OBJECT = 0x05,
+    FWU_RES_UNSUPPORTED_TYPE = 0x07,
+    FWU_RES_OPERATION_NOT_PERMITTED = 0x08,
+    FWU_RES_OPERATION_FAILED = 0x0A,
+    FWU_RES_EXT_ERROR = 0x0B,
+} EFwuResultCode;
+
+// Extended error codes, following FWU_RES_EXT_ERROR in the response.
+typedef enum {
+    FWU_EXT_NO_ERROR = 0x00,
+    FWU_EXT_INVALID_ERROR_CODE = 0x01,
+    FWU_EXT_WRONG_COMMAND_FORMAT = 0x02,
+    FWU_EXT_UNKNOWN_COMMAND = 0x03,
+    FWU_EXT_INIT_COMMAND_INVALID = 0x04,
+    FWU_EXT_FW_VERSION_FAILURE = 0x05,
+    FWU_EXT_HW_VERSION_FAILURE = 0x06,
+    FWU_EXT_SD_VERSION_FAILURE = 0x07,
+    FWU_EXT_SIGNATURE_MISSING = 0x08,
+    FWU_EXT_WRONG_HASH_TYPE = 0x09,
+    FWU_EXT_HASH_FAILED = 0x0A,
+    FWU_EXT_WRONG_SIGNATURE_TYPE = 0x0B,
+    FWU_EXT_VERIFICATION_FAILED = 0x0C,
+    FWU_EXT_INSUFFICIENT_SPACE = 0x0D,
+} EFwuExtendedError;
+
+// What can be done about a failed request.
+typedef enum {
+    FWU_ERR_CLASS_NONE = 0,
+    FWU_ERR_CLASS_TRANSIENT = 1, // lost or corrupted data; repeat the request or object
+    FWU_ERR_CLASS_PERMANENT = 2, // the target rejected the image; repeating can't help
+    FWU_ERR_CLASS_RESOURCE = 3,  // the data object is too large; repeat with a smaller one, but no less than a page
+} EFwuErrorClass;
+
+// Pending work of a session, see fwuPendingWork.
+typedef enum {
+    FWU_WORK_NONE = 0,
+    FWU_WORK_INTERNAL = 1, // a state transition is pending; yield as soon as possible
+    FWU_WORK_TX = 2,       // request bytes are waiting to be sent; yield when TX space is available
+    FWU_WORK_RX = 4,       // waiting for a response; yield when data was received or on the deadline
+} EFwuWork;
+
+// Phases of an update for the statistics, one per process state.
+typedef enum {
+    FWU_PHASE_BANNER = 0,
+    FWU_PHASE_PING,
+    FWU_PHASE_VERSION,        // protocol, hardware and firmware version
+    FWU_PHASE_RCPT_NOTIF,
+    FWU_PHASE_MTU,
+    FWU_PHASE_OBJ1_SELECT,
+    FWU_PHASE_OBJ1_CREATE,
+    FWU_PHASE_OBJ1_WRITE,
+    FWU_PHASE_OBJ1_CRC_GET,
+    FWU_PHASE_OBJ1_EXECUTE,
+    FWU_PHASE_OBJ2_SELECT,
+    FWU_PHASE_OBJ2_CREATE,
+    FWU_PHASE_OBJ2_WRITE,
+    FWU_PHASE_OBJ2_CRC_GET,
+    FWU_PHASE_OBJ2_EXECUTE,
+    FWU_PHASE_OBJ2_RESUME,
+    FWU_PHASE_ABORT,
+    FWU_NOF_PHASES,
+} EFwuPhase;
+
+// Request opcodes 0x00..0x0C (ABORT) for the round trip statistics
+#define FWU_NOF_OPCODES 13
+
+// Round trip times of one request opcode, from handing the last byte of the request
+// to txFunction until the response has been processed in fwuYield.
+typedef struct {
+    uint32_t count;
+    uint32_t minMillisec;
+    uint32_t maxMillisec;
+    uint32_t totalMillisec;
+} TFwuRtt;
+
+// Statistics of an update session, filled in by the library from fwuInit on.
+typedef struct {
+    // Time spent in each phase (EFwuPhase)
+    uint32_t phaseMillisec[FWU_NOF_PHASES];
+    // Round trip times by request opcode; WRITE (0x08) has no response and is never counted
+    TFwuRtt rtt[FWU_NOF_OPCODES];
+    // Object bytes in WRITE requests sent completely, including repeated ones
+    uint32_t payloadBytes;
+    // All bytes passed to txFunction and the SLIP escape bytes among them
+    uint32_t wireBytes;
+    uint32_t escapeBytes;
+    // Bytes passed to fwuDidReceiveData
+    uint32_t rxBytes;
+    // Requests sent completely, and responses accepted (including error responses)
+    uint32_t framesSent;
+    uint32_t responses;
+    uint16_t retries;
+    uint16_t timeouts;
+} TFwuStats;
+
 typedef void (*FTxFunction)(struct SFwu *fwu, uint8_t *buf, uint8_t len);
 
-typedef uint8_t * (*FDataFunction)(struct SFwu *fwu, int pos, int len);
+// Direction of a traced frame, see FTraceFunction.
+typedef enum {
+    FWU_TRACE_TX = 0,
+    FWU_TRACE_RX = 1,
+} EFwuTraceDirection;
+
+// Called with the bytes exactly as they are on the wire: every request frame once it has been
+// passed to txFunction completely (or the part sent before a retry), and every chunk passed to
+// fwuDidReceiveData (responses, banner text and noise alike). millisec counts from fwuExec.
+typedef void (*FTraceFunction)(struct SFwu *fwu, EFwuTraceDirection direction, uint32_t millisec,
+                               const uint8_t *bytes, uint16_t len);
+
+// Returns a pointer to len bytes of the object at position pos. The library only reads
+// from the returned buffer, so it may point directly into flash or a read-only mapping.
+typedef const uint8_t * (*FDataFunction)(struct SFwu *fwu, int pos, int len);
+
+// Pre-encoded WRITE frames and running CRCs of a data object (.bin). The cache is
+// immutable once built and can be shared by any number of sessions sending the same
+// image; each session only keeps its own position. It is built at run time with
+// fwuFrameCacheBuild or ahead of time into flash with fwconvert --format frames.
+typedef struct {
+    // Length of the data object the cache was built from
+    uint32_t dataLen;
+    // Payload bytes per frame (the last frame may be shorter); only used by sessions whose
+    // dataChunkSize is the same
+    uint16_t chunkSize;
+    uint32_t nofFrames;
+    // Encoded frames back to back (08 <escaped payload> C0); frame i starts at
+    // frameOffsets[i] and ends before frameOffsets[i + 1]
+    const uint8_t *frames;
+    const uint32_t *frameOffsets;
+    // Running CRC (not inverted) after every crcStride payload bytes and at the end
+    uint32_t crcStride;
+    const uint32_t *crcs;
+} TFwuFrameCache;
 
 typedef struct SFwu {
 // --- public - define these before calling fwuInit ---
     // .dat
     FDataFunction commandObjectProviderFunction;
     uint32_t commandObjectLen;
-    // .bin
+    // .bin; may be NULL if frameCache serves every data object (see FWU_RSP_FRAME_CACHE_MISMATCH)
     FDataFunction dataObjectProviderFunction;
     uint32_t dataObjectLen;
     // Sending bytes to the target
     FTxFunction txFunction;
     // Timeout when waiting for a response from the target
     uint32_t responseTimeoutMillisec;
+    // Optional: frames of the data object encoded ahead of time (NULL = encode on the fly)
+    const TFwuFrameCache *frameCache;
+    // Optional: running CRC (not inverted) of the data object after every dataObjectCrcStride
+    // bytes and at the end, e.g. from a container (fwu_container.h); objects ending on an entry
+    // are then sent without CRC computation (NULL = compute)
+    const uint32_t *dataObjectCrcs;
+    uint32_t dataObjectCrcStride;
+    // Optional: query the protocol, hardware and firmware versions after PING and skip
+    // the update if the target's application already has imageFwVersion
+    uint8_t versionCheck;
+    uint32_t imageFwVersion;
+    // Number of times a failed request or object is repeated before giving up (0 = never);
+    // the count starts over after every executed object
+    uint8_t maxRetries;
+    // Optional: wait up to this long for the bootloader banner (@@BOOTLOADER, @@DFUR >)
+    // before sending the first PING (0 = send it right away)
+    uint32_t bannerTimeoutMillisec;
+    // Optional: payload bytes per WRITE request, 1..FWU_DATA_CHUNK_SIZE (0 = FWU_DATA_CHUNK_SIZE);
+    // smaller frames keep a target without flow control from overrunning its UART
+    uint8_t dataChunkSize;
+    // Optional: called for every frame sent and all data received (NULL = no tracing)
+    FTraceFunction traceFunction;
+    // Optional: passed through untouched, e.g. for the provider functions (see fwu_lz4.h)
+    void *providerContext;
 // --- public - result codes
     // Overall process status code
     EFwuProcessStatus processStatus;
     // Response status code
     EFwuResponseStatus responseStatus;
+    // Set if the update was skipped because the target already runs imageFwVersion
+    uint8_t updateSkipped;
+    // Result code (EFwuResultCode) and extended error (EFwuExtendedError) of the last response
+    uint8_t resultCode;
+    uint8_t extendedError;
+    // Classification of the last failure
+    EFwuErrorClass errorClass;
+    // Total number of retries during the update
+    uint16_t retryCount;
+    // Time from fwuExec to the last bootloader banner and to the first PING response
+    uint8_t bannerSeen;
+    uint32_t bannerMillisec;
+    uint32_t pingMillisec;
+    // Timings, byte counts and round trip times
+    TFwuStats stats;
+// --- public - target information, filled in if versionCheck is set
+    uint8_t targetProtocolVersion;
+    uint32_t targetHwPart;
+    uint32_t targetHwVariant;
+    uint8_t targetAppValid;
+    uint32_t targetAppVersion;
 // --- private, don't modify ---
     uint32_t privateDataObjectOffset;
     uint32_t privateDataObjectSize;
     uint32_t privateDataObjectMaxSize;
+    uint32_t privateDataObjectStartCrc;
+    uint8_t privateObjectRetries;
+    uint32_t privateClockMillisec;
+    uint32_t privateBannerWaitMillisec;
+    uint32_t privateBannerSettleMillisec;
+    uint8_t privateBannerLine[16];
+    uint8_t privateBannerLineLen;
     uint8_t privateProcessState;
     uint8_t privateCommandState;
     uint8_t privateCommandSendOnly;
+    uint8_t privateCommandAcceptError;
+    uint8_t privateImageNumber;
+    uint8_t privateAbortRequested;
+    EFwuProcessStatus privateFinalStatus;
     uint32_t privateCommandTimeoutRemainingMillisec;
     uint8_t privateRequestBuf[FWU_REQUEST_BUF_SIZE + 1];
+    const uint8_t *privateRequestPtr;
     uint8_t privateRequestLen;
     uint8_t privateRequestIx;
     uint8_t privateResponseBuf[FWU_RESPONSE_BUF_SIZE];
     uint8_t privateResponseEscapeCharacter;
+    uint8_t privateResponseResync;
     uint8_t privateResponseLen;
     uint32_t privateResponseTimeElapsedMillisec;
     uint8_t privateSendBufSpace;
@@ -102,9 +305,20 @@ typedef struct SFwu {
     uint32_t privateObjectLen;
     uint32_t privateObjectIx;
     uint32_t privateObjectCrc;
+    uint8_t privateObjectFromCache;
+    uint8_t privateObjectCrcFromTable;
+    uint8_t privateChunkSize;
+    uint32_t privateRequestSentMillisec;
+    // SLIP escapes in a frame sent from the frame cache, counted once it is complete
+    uint8_t privateRequestEscapes;
+    // Object bytes in the frame being sent, counted once it is complete
+    uint16_t privateRequestPayload;
 } TFwu;
 
 
+// All state of an update session lives in its TFwu structure; several sessions
+// can run concurrently, each with its own TFwu.
+
 // First function to call to set up the internal state in the FWU structure.
 void fwuInit(TFwu *fwu);
 
@@ -114,11 +328,55 @@ void fwuExec(TFwu *fwu);
 // Call regularly to allow asynchronous processing to continue.
 EFwuProcessStatus fwuYield(TFwu *fwu, uint32_t elapsedMillisec);
 
+// Abort the firmware update. The target is sent an ABORT request so it leaves DFU mode
+// immediately; the same happens automatically when the update fails.
+void fwuAbort(TFwu *fwu);
+
+// Classify a result code and extended error received from the target.
+EFwuErrorClass fwuClassifyError(uint8_t resultCode, uint8_t extendedError);
+
 // Call after data from the target has been received.
 void fwuDidReceiveData(TFwu *fwu, uint8_t *bytes, uint8_t len);
 
 // Inform the FWU module that it may send maxLen bytes of data to the target.
 void fwuCanSendData(TFwu *fwu, uint8_t maxLen);
 
+// What the session is waiting for (EFwuWork flags); FWU_WORK_NONE if there is nothing to do.
+uint8_t fwuPendingWork(TFwu *fwu);
+
+// Milliseconds until the current command times out; 0xffffffff if no command is active.
+uint32_t fwuDeadlineMillisec(TFwu *fwu);
+
+// Bytes of the data object (.bin) the target has received so far.
+uint32_t fwuStatsProgressBytes(TFwu *fwu);
+
+// Data object bytes per second over the time spent in the OBJ2 phases; 0 before the first WRITE.
+uint32_t fwuStatsThroughput(TFwu *fwu);
+
+// Estimated milliseconds until the data object is complete at the throughput so far;
+// 0xffffffff while there is no estimate yet.
+uint32_t fwuStatsEtaMillisec(TFwu *fwu);
+
+// Average round trip time of a request opcode; 0 if no response has been received.
+uint32_t fwuStatsRttAvgMillisec(TFwu *fwu, uint8_t opcode);
+
+// Short name of a phase for reports, e.g. "OBJ2_WRITE".
+const char *fwuPhaseName(EFwuPhase phase);
+
+// Number of frames and worst-case size of the frames buffer for a data object of len bytes.
+uint32_t fwuFrameCacheNofFrames(uint32_t len);
+uint32_t fwuFrameCacheMaxFramesSize(uint32_t len);
+
+// Encode the data object into caller-provided buffers: frames (fwuFrameCacheMaxFramesSize bytes),
+// frameOffsets (nofFrames + 1 entries) and crcs (one entry per crcStride bytes, rounded up).
+// crcStride must be a multiple of FWU_DATA_CHUNK_SIZE; use the target's maximum data object
+// size (or FWU_DATA_CHUNK_SIZE to be independent of it).
+void fwuFrameCacheBuild(TFwuFrameCache *cache, const uint8_t *data, uint32_t len, uint32_t crcStride,
+                        uint8_t *frames, uint32_t *frameOffsets, uint32_t *crcs);
+
+// CRC32 as used by the DFU CRC request (zlib polynomial). The running value is not inverted:
+// start with 0xffffffff and invert the result, e.g. ~fwuCrc32Update(0xffffffff, data, len).
+uint32_t fwuCrc32Update(uint32_t crc, const uint8_t *data, uint32_t len);
+
 
 #endif // __FWU_H__
@@ -0,0 +1,145 @@
+//
+//  fwu_chunks.c
+//  nrf52-dfu
+//
+//  Chunk store for many variants of an image: the chunks of all variants are stored
+//  once (fwconvert --format chunks) and a provider function reassembles one variant
+//  through its index while it is sent.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#include <string.h>
+#include "fwu_chunks.h"
+
+static void fwuChunkSeek(TFwuChunkReader *reader, uint32_t pos);
+static uint32_t fwuChunkLen(const TFwuChunkStore *store, uint32_t chunk);
+
+
+int fwuChunkInit(TFwuChunkReader *reader)
+{
+    const TFwuChunkStore *store = reader->store;
+    const TFwuChunkVariant *variant;
+    uint32_t len = 0;
+    uint32_t i;
+
+    reader->rewinds = 0;
+    reader->privateEntry = 0;
+    reader->privateEntryPos = 0;
+    reader->privateVariant = 0;
+
+    if (reader->variant >= store->nofVariants) {
+        return -1;
+    }
+    variant = &store->variants[reader->variant];
+    for (i = 0; i < variant->nofChunks; i++) {
+        if (variant->index[i] >= store->nofChunks) {
+            return -1;
+        }
+        len += fwuChunkLen(store, variant->index[i]);
+    }
+    if (len != variant->dataLen || (variant->dataLen > 0 && variant->nofChunks == 0)) {
+        return -1;
+    }
+    reader->privateVariant = variant;
+    return 0;
+}
+
+int fwuChunkFindVariant(const TFwuChunkStore *store, const char *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < store->nofVariants; i++) {
+        if (store->variants[i].name && !strcmp(store->variants[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const uint8_t *fwuChunkRead(TFwuChunkReader *reader, uint32_t pos, uint32_t len)
+{
+    const TFwuChunkStore *store = reader->store;
+    const uint32_t *index = reader->privateVariant->index;
+    uint32_t offset, chunkLen;
+    uint32_t n = 0;
+
+    fwuChunkSeek(reader, pos);
+    offset = pos - reader->privateEntryPos;
+    chunkLen = fwuChunkLen(store, index[reader->privateEntry]);
+    if (offset + len <= chunkLen) {
+        return &store->chunks[store->chunkOffsets[index[reader->privateEntry]] + offset];
+    }
+    // The read spans chunks; put it together in the staging buffer.
+    if (len > sizeof(reader->privateStaging)) {
+        len = sizeof(reader->privateStaging);
+    }
+    for (;;) {
+        uint32_t part = chunkLen - offset;
+        if (part > len - n) {
+            part = len - n;
+        }
+        memcpy(&reader->privateStaging[n], &store->chunks[store->chunkOffsets[index[reader->privateEntry]] + offset], part);
+        n += part;
+        if (n == len || reader->privateEntry + 1 == reader->privateVariant->nofChunks) {
+            break;
+        }
+        reader->privateEntryPos += chunkLen;
+        reader->privateEntry++;
+        chunkLen = fwuChunkLen(store, index[reader->privateEntry]);
+        offset = 0;
+    }
+    return reader->privateStaging;
+}
+
+const uint8_t *fwuChunkDataProvider(struct SFwu *fwu, int pos, int len)
+{
+    return fwuChunkRead((TFwuChunkReader *)fwu->providerContext, pos, len);
+}
+
+// Make the chunk containing pos the current one. The session reads front to back, so this
+// is one step at most, except when a data object is repeated or resumed.
+static void fwuChunkSeek(TFwuChunkReader *reader, uint32_t pos)
+{
+    const TFwuChunkStore *store = reader->store;
+    const TFwuChunkVariant *variant = reader->privateVariant;
+
+    if (pos < reader->privateEntryPos) {
+        reader->rewinds++;
+        while (pos < reader->privateEntryPos) {
+            reader->privateEntry--;
+            reader->privateEntryPos -= fwuChunkLen(store, variant->index[reader->privateEntry]);
+        }
+    }
+    while (reader->privateEntry + 1 < variant->nofChunks
+           && pos >= reader->privateEntryPos + fwuChunkLen(store, variant->index[reader->privateEntry])) {
+        reader->privateEntryPos += fwuChunkLen(store, variant->index[reader->privateEntry]);
+        reader->privateEntry++;
+    }
+}
+
+static uint32_t fwuChunkLen(const TFwuChunkStore *store, uint32_t chunk)
+{
+    return store->chunkOffsets[chunk + 1] - store->chunkOffsets[chunk];
+}
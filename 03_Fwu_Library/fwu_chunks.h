@@ -0,0 +1,97 @@
+//
+//  fwu_chunks.h
+//  nrf52-dfu
+//
+//  Chunk store for many variants of an image: the chunks of all variants are stored
+//  once (fwconvert --format chunks) and a provider function reassembles one variant
+//  through its index while it is sent.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#ifndef __FWU_CHUNKS_H__
+#define __FWU_CHUNKS_H__ 1
+
+#include <inttypes.h>
+#include "fwu.h"
+
+// One image as a list of chunks of the pool
+typedef struct {
+    // Name of the variant, e.g. the file name of the image
+    const char *name;
+    // Length of the data object (.bin)
+    uint32_t dataLen;
+    // CRC32 of the data object
+    uint32_t dataCrc;
+    uint32_t nofChunks;
+    // The chunks of the image in order, as indices into the pool
+    const uint32_t *index;
+} TFwuChunkVariant;
+
+// Variants that share most of their content. Every distinct chunk is stored once, so the
+// store grows with the content that differs, not with the number of variants.
+typedef struct {
+    // Distinct chunks back to back; chunk i starts at chunkOffsets[i] and ends before
+    // chunkOffsets[i + 1]
+    const uint8_t *chunks;
+    const uint32_t *chunkOffsets;
+    uint32_t nofChunks;
+    const TFwuChunkVariant *variants;
+    uint32_t nofVariants;
+} TFwuChunkStore;
+
+typedef struct {
+// --- public - define these before calling fwuChunkInit ---
+    const TFwuChunkStore *store;
+    // The variant to send, e.g. from fwuChunkFindVariant
+    uint32_t variant;
+// --- public - statistics
+    // Reads that went back in the image (repeated and resumed data objects)
+    uint32_t rewinds;
+// --- private, don't modify ---
+    const TFwuChunkVariant *privateVariant;
+    // The current chunk: its index entry and its position in the image
+    uint32_t privateEntry;
+    uint32_t privateEntryPos;
+    uint8_t privateStaging[FWU_DATA_CHUNK_SIZE];
+} TFwuChunkReader;
+
+
+// First function to call to set up the internal state of the reader. Returns 0 if the
+// variant exists and its index is consistent with the pool, -1 if not (don't start the
+// update then).
+int fwuChunkInit(TFwuChunkReader *reader);
+
+// Returns the number of the variant with the given name, or -1 if there is none.
+int fwuChunkFindVariant(const TFwuChunkStore *store, const char *name);
+
+// Returns a pointer to len (at most FWU_DATA_CHUNK_SIZE) bytes of the variant at position pos.
+// Reads within a chunk point into the pool; the pointer is valid until the next call.
+const uint8_t *fwuChunkRead(TFwuChunkReader *reader, uint32_t pos, uint32_t len);
+
+// FDataFunction for TFwu.dataObjectProviderFunction; TFwu.providerContext points to the reader.
+const uint8_t *fwuChunkDataProvider(struct SFwu *fwu, int pos, int len);
+
+
+#endif // __FWU_CHUNKS_H__
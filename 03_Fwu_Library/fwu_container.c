@@ -0,0 +1,109 @@
+//
+//  fwu_container.c
+//  nrf52-dfu
+//
+//  Firmware container: init packet, firmware image and everything needed to send
+//  them in one blob (fwconvert --format container), used in place from flash or a mapping.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <stddef.h>
+#include "fwu_container.h"
+
+static const uint8_t *fwuContainerCommandProvider(struct SFwu *fwu, int pos, int len);
+static const uint8_t *fwuContainerDataProvider(struct SFwu *fwu, int pos, int len);
+static uint8_t fwuContainerContains(const TFwuContainerHeader *container, uint32_t offset, uint32_t len);
+
+
+const TFwuContainerHeader *fwuContainerOpen(const uint8_t *base, uint32_t len)
+{
+    const TFwuContainerHeader *container = (const TFwuContainerHeader *)base;
+
+    if (((uintptr_t)base & 3) != 0 || len < sizeof(TFwuContainerHeader)) {
+        return NULL;
+    }
+    // On a big endian machine the magic doesn't match either.
+    if (container->magic != FWU_CONTAINER_MAGIC || container->version != FWU_CONTAINER_VERSION
+        || container->headerLen < sizeof(TFwuContainerHeader) || container->totalLen > len) {
+        return NULL;
+    }
+    if (~fwuCrc32Update(0xffffffff, base, offsetof(TFwuContainerHeader, headerCrc)) != container->headerCrc) {
+        return NULL;
+    }
+    if (!fwuContainerContains(container, container->datOffset, container->datLen)
+        || !fwuContainerContains(container, container->binOffset, container->binLen)
+        || container->crcStride == 0 || (container->crcsOffset & 3) != 0
+        || container->nofCrcs != container->binLen / container->crcStride
+                                 + (container->binLen % container->crcStride != 0)
+        || container->nofCrcs > container->totalLen / sizeof(uint32_t)
+        || !fwuContainerContains(container, container->crcsOffset, container->nofCrcs * sizeof(uint32_t))) {
+        return NULL;
+    }
+    return container;
+}
+
+const uint8_t *fwuContainerDat(const TFwuContainerHeader *container)
+{
+    return (const uint8_t *)container + container->datOffset;
+}
+
+const uint8_t *fwuContainerBin(const TFwuContainerHeader *container)
+{
+    return (const uint8_t *)container + container->binOffset;
+}
+
+const uint32_t *fwuContainerCrcs(const TFwuContainerHeader *container)
+{
+    return (const uint32_t *)((const uint8_t *)container + container->crcsOffset);
+}
+
+void fwuContainerSetup(TFwu *fwu, const TFwuContainerHeader *container)
+{
+    fwu->commandObjectProviderFunction = fwuContainerCommandProvider;
+    fwu->commandObjectLen = container->datLen;
+    fwu->dataObjectProviderFunction = fwuContainerDataProvider;
+    fwu->dataObjectLen = container->binLen;
+    fwu->dataObjectCrcs = fwuContainerCrcs(container);
+    fwu->dataObjectCrcStride = container->crcStride;
+    if (fwu->dataChunkSize == 0) {
+        fwu->dataChunkSize = container->chunkSize;
+    }
+    fwu->providerContext = (void *)container;
+}
+
+static const uint8_t *fwuContainerCommandProvider(struct SFwu *fwu, int pos, int len)
+{
+    return fwuContainerDat((const TFwuContainerHeader *)fwu->providerContext) + pos;
+}
+
+static const uint8_t *fwuContainerDataProvider(struct SFwu *fwu, int pos, int len)
+{
+    return fwuContainerBin((const TFwuContainerHeader *)fwu->providerContext) + pos;
+}
+
+static uint8_t fwuContainerContains(const TFwuContainerHeader *container, uint32_t offset, uint32_t len)
+{
+    return offset >= container->headerLen && offset <= container->totalLen
+        && len <= container->totalLen - offset;
+}
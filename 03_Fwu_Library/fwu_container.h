@@ -0,0 +1,92 @@
+//
+//  fwu_container.h
+//  nrf52-dfu
+//
+//  Firmware container: init packet, firmware image and everything needed to send
+//  them in one blob (fwconvert --format container), used in place from flash or a mapping.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef __FWU_CONTAINER_H__
+#define __FWU_CONTAINER_H__ 1
+
+#include <inttypes.h>
+#include "fwu.h"
+
+// "FWUC" read as a little endian word
+#define FWU_CONTAINER_MAGIC 0x43555746
+#define FWU_CONTAINER_VERSION 1
+
+// Header at the start of a container. All fields are little endian and naturally aligned,
+// and all offsets count from the start of the container, so a container at a 4-byte aligned
+// address of a little endian machine is used as it is, without parsing or copying.
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    // Size of the header; later versions may add fields before the objects
+    uint16_t headerLen;
+    uint32_t totalLen;
+    // Firmware type (EFwuInitFwType) and version of the image; 0xffffffff = not given
+    uint32_t imageType;
+    uint32_t fwVersion;
+    // Init packet (.dat)
+    uint32_t datOffset;
+    uint32_t datLen;
+    // Firmware image (.bin), aligned as requested when the container was made
+    uint32_t binOffset;
+    uint32_t binLen;
+    // CRC32 of the image as the target reports it
+    uint32_t binCrc;
+    // Running CRC (not inverted) after every crcStride bytes of the image and at the end;
+    // crcStride is the data object size the container was made for
+    uint32_t crcStride;
+    uint32_t crcsOffset;
+    uint32_t nofCrcs;
+    // Suggested MTU of the target and the payload bytes per WRITE request that fit into it
+    uint16_t mtu;
+    uint8_t chunkSize;
+    uint8_t reserved;
+    // SHA-256 of the image
+    uint8_t sha256[32];
+    // CRC32 of the header up to here
+    uint32_t headerCrc;
+} TFwuContainerHeader;
+
+
+// Check the container of len bytes at base: magic, version, header CRC and that all objects
+// lie within it. Returns the header, or NULL if it isn't a valid container. The image itself
+// is not checked; compare binCrc or sha256 for that.
+const TFwuContainerHeader *fwuContainerOpen(const uint8_t *base, uint32_t len);
+
+// The objects of an opened container.
+const uint8_t *fwuContainerDat(const TFwuContainerHeader *container);
+const uint8_t *fwuContainerBin(const TFwuContainerHeader *container);
+const uint32_t *fwuContainerCrcs(const TFwuContainerHeader *container);
+
+// Set up a session to send the container: provider functions, object lengths, the CRC table
+// and, if not set yet, dataChunkSize. Uses TFwu.providerContext; call before fwuInit.
+void fwuContainerSetup(TFwu *fwu, const TFwuContainerHeader *container);
+
+
+#endif // __FWU_CONTAINER_H__
@@ -0,0 +1,183 @@
+//
+//  fwu_delta.c
+//  nrf52-dfu
+//
+//  Delta updates: a patch against the previous image (fwconvert --format delta) and
+//  a provider function that rebuilds the new image from both while it is sent.
+//
+//  The target still receives a complete image; the patch only replaces the
+//  copy of the new image on the updating microcontroller.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <string.h>
+#include "fwu_delta.h"
+
+#define FWU_DELTA_NO_BLOCK 0xffffffff
+
+static void fwuDeltaLoad(TFwuDeltaReader *reader, uint32_t block);
+static int fwuDeltaGetVarint(const uint8_t **ip, const uint8_t *ipEnd, uint32_t *value);
+
+
+int fwuDeltaInit(TFwuDeltaReader *reader)
+{
+    reader->blocksRebuilt = 0;
+    reader->errors = 0;
+    reader->privateWindowBlock = FWU_DELTA_NO_BLOCK;
+
+    if (reader->patch->blockSize == 0 || reader->patch->blockSize > reader->windowSize) {
+        return -1;
+    }
+    if (reader->baseLen != reader->patch->baseLen
+        || ~fwuCrc32Update(0xffffffff, reader->base, reader->baseLen) != reader->patch->baseCrc) {
+        return -1;
+    }
+    return 0;
+}
+
+const uint8_t *fwuDeltaRead(TFwuDeltaReader *reader, uint32_t pos, uint32_t len)
+{
+    uint32_t blockSize = reader->patch->blockSize;
+    uint32_t block = pos / blockSize;
+    uint32_t offset = pos % blockSize;
+    uint32_t done;
+    uint32_t n;
+
+    if (offset + len <= blockSize) {
+        fwuDeltaLoad(reader, block);
+        return &reader->window[offset];
+    }
+    // The chunk spans blocks (more than two if they are smaller than a chunk); put it
+    // together in the staging buffer.
+    if (len > sizeof(reader->privateStaging)) {
+        len = sizeof(reader->privateStaging);
+    }
+    for (done = 0; done < len; done += n, block++, offset = 0) {
+        n = blockSize - offset;
+        if (n > len - done) {
+            n = len - done;
+        }
+        fwuDeltaLoad(reader, block);
+        memcpy(&reader->privateStaging[done], &reader->window[offset], n);
+    }
+    return reader->privateStaging;
+}
+
+const uint8_t *fwuDeltaDataProvider(struct SFwu *fwu, int pos, int len)
+{
+    return fwuDeltaRead((TFwuDeltaReader *)fwu->providerContext, pos, len);
+}
+
+int fwuDeltaApplyBlock(const uint8_t *ops, uint32_t opsLen, const uint8_t *base, uint32_t baseLen,
+                       uint32_t start, uint8_t *dst, uint32_t dstLen)
+{
+    const uint8_t *ip = ops;
+    const uint8_t *ipEnd = ops + opsLen;
+    uint32_t op = 0;
+
+    while (ip < ipEnd) {
+        uint8_t type = *ip >> 6;
+        uint32_t len = (*ip++ & 63) + 1;
+
+        if (len == 64) {
+            uint32_t more;
+            if (fwuDeltaGetVarint(&ip, ipEnd, &more) != 0) {
+                return -1;
+            }
+            len += more;
+        }
+        if (len > dstLen - op) {
+            return -1;
+        }
+        if (type == FWU_DELTA_OP_COPY) {
+            uint32_t zigzag;
+            if (fwuDeltaGetVarint(&ip, ipEnd, &zigzag) != 0) {
+                return -1;
+            }
+            // Unsigned arithmetic; a position before the image wraps around and fails below.
+            uint32_t from = start + op + ((zigzag & 1) ? ~(zigzag >> 1) : (zigzag >> 1));
+            if (from > baseLen || len > baseLen - from) {
+                return -1;
+            }
+            memcpy(&dst[op], &base[from], len);
+        } else if (type == FWU_DELTA_OP_LITERAL) {
+            if (len > (uint32_t)(ipEnd - ip)) {
+                return -1;
+            }
+            memcpy(&dst[op], ip, len);
+            ip += len;
+        } else if (type == FWU_DELTA_OP_RUN) {
+            if (ip == ipEnd) {
+                return -1;
+            }
+            memset(&dst[op], *ip++, len);
+        } else {
+            return -1;
+        }
+        op += len;
+    }
+    return op == dstLen ? 0 : -1;
+}
+
+static void fwuDeltaLoad(TFwuDeltaReader *reader, uint32_t block)
+{
+    const TFwuDeltaPatch *patch = reader->patch;
+    uint32_t start = block * patch->blockSize;
+    uint32_t len;
+
+    if (block == reader->privateWindowBlock) {
+        return;
+    }
+    len = patch->dataLen - start;
+    if (len > patch->blockSize) {
+        len = patch->blockSize;
+    }
+    if (fwuDeltaApplyBlock(&patch->ops[patch->blockOffsets[block]],
+                           patch->blockOffsets[block + 1] - patch->blockOffsets[block],
+                           reader->base, reader->baseLen, start, reader->window, len) != 0
+        || ~fwuCrc32Update(0xffffffff, reader->window, len) != patch->blockCrcs[block]) {
+        memset(reader->window, 0, len);
+        reader->errors++;
+    }
+    reader->blocksRebuilt++;
+    reader->privateWindowBlock = block;
+}
+
+static int fwuDeltaGetVarint(const uint8_t **ip, const uint8_t *ipEnd, uint32_t *value)
+{
+    uint32_t v = 0;
+    uint8_t shift = 0;
+    uint8_t b;
+
+    do {
+        if (*ip == ipEnd || shift > 28) {
+            return -1;
+        }
+        b = *(*ip)++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    *value = v;
+    return 0;
+}
@@ -0,0 +1,111 @@
+//
+//  fwu_delta.h
+//  nrf52-dfu
+//
+//  Delta updates: a patch against the previous image (fwconvert --format delta) and
+//  a provider function that rebuilds the new image from both while it is sent.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef __FWU_DELTA_H__
+#define __FWU_DELTA_H__ 1
+
+#include <inttypes.h>
+#include "fwu.h"
+
+// Operations of a patch block; the first byte is type << 6 | length - 1 for lengths
+// 1..63, or type << 6 | 63 followed by the length - 64 as a varint (7 bits per byte,
+// least significant first).
+typedef enum {
+    // Copy from the previous image; followed by the distance from the expected position
+    // as a zigzag varint. The expected position is the block's own position in the new
+    // image and advances with every byte produced, so unchanged code right after a
+    // changed byte costs a single 0.
+    FWU_DELTA_OP_COPY = 0,
+    // New bytes; followed by the bytes
+    FWU_DELTA_OP_LITERAL = 1,
+    // One byte repeated; followed by the byte
+    FWU_DELTA_OP_RUN = 2,
+} EFwuDeltaOp;
+
+// The new data object (.bin) as a patch against the previous one, block by block. Every
+// block can be rebuilt on its own, so repeated and resumed data objects only rebuild their
+// block again; the CRC of every block catches a wrong previous image.
+typedef struct {
+    // Length of the new data object
+    uint32_t dataLen;
+    // Bytes per block of the new image (the last block may be shorter)
+    uint32_t blockSize;
+    uint32_t nofBlocks;
+    // Length and CRC32 of the previous image the patch was made for
+    uint32_t baseLen;
+    uint32_t baseCrc;
+    // Operations of all blocks back to back; block i starts at blockOffsets[i] and ends
+    // before blockOffsets[i + 1]
+    const uint8_t *ops;
+    const uint32_t *blockOffsets;
+    // CRC32 of every rebuilt block
+    const uint32_t *blockCrcs;
+} TFwuDeltaPatch;
+
+typedef struct {
+// --- public - define these before calling fwuDeltaInit ---
+    const TFwuDeltaPatch *patch;
+    // The previous image, e.g. the application currently stored in flash
+    const uint8_t *base;
+    uint32_t baseLen;
+    // RAM for one rebuilt block (at least patch->blockSize bytes)
+    uint8_t *window;
+    uint32_t windowSize;
+// --- public - statistics
+    uint32_t blocksRebuilt;
+    // Blocks that failed to rebuild or have the wrong CRC; they read as zeros, so the
+    // target's CRC check fails
+    uint32_t errors;
+// --- private, don't modify ---
+    uint32_t privateWindowBlock;
+    uint8_t privateStaging[FWU_DATA_CHUNK_SIZE];
+} TFwuDeltaReader;
+
+
+// First function to call to set up the internal state of the reader. Returns 0 if base
+// is the image the patch was made for and a block fits into the window, -1 if not (don't
+// start the update then).
+int fwuDeltaInit(TFwuDeltaReader *reader);
+
+// Returns a pointer to len (at most FWU_DATA_CHUNK_SIZE) bytes of the new image at position pos.
+// The pointer is valid until the next call.
+const uint8_t *fwuDeltaRead(TFwuDeltaReader *reader, uint32_t pos, uint32_t len);
+
+// FDataFunction for TFwu.dataObjectProviderFunction; TFwu.providerContext points to the reader.
+const uint8_t *fwuDeltaDataProvider(struct SFwu *fwu, int pos, int len);
+
+// Rebuild the block at position start of the new image from opsLen bytes of operations into
+// exactly dstLen bytes; returns 0 on success, -1 if the operations are malformed or refer
+// outside the previous image.
+int fwuDeltaApplyBlock(const uint8_t *ops, uint32_t opsLen, const uint8_t *base, uint32_t baseLen,
+                       uint32_t start, uint8_t *dst, uint32_t dstLen);
+
+
+#endif // __FWU_DELTA_H__
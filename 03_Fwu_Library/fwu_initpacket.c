@@ -0,0 +1,401 @@
+//
+//  fwu_initpacket.c
+//  nrf52-dfu
+//
+//  Decoder for the init packet (.dat) of a Nordic DFU package.
+//
+//  The init packet is a protocol buffer (dfu-cc.proto in the nRF5 SDK):
+//  Packet { Command command = 1; SignedCommand signed_command = 2; }
+//  SignedCommand { Command command = 1; SignatureType signature_type = 2; bytes signature = 3; }
+//  Command { OpCode op_code = 1; InitCommand init = 2; }
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <string.h>
+#include "fwu_initpacket.h"
+
+#define PB_WT_VARINT 0
+#define PB_WT_64BIT 1
+#define PB_WT_LEN 2
+#define PB_WT_32BIT 5
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} TPbReader;
+
+typedef struct {
+    uint8_t *p;
+    uint8_t *end;
+    uint8_t overflow;
+} TPbWriter;
+
+static int pbReadVarint(TPbReader *r, uint32_t *value);
+static int pbReadTag(TPbReader *r, uint32_t *field, uint8_t *wireType);
+static int pbReadBytes(TPbReader *r, TPbReader *sub);
+static int pbSkip(TPbReader *r, uint8_t wireType);
+static int fwuDecodeCommand(TPbReader r, TFwuInitPacket *packet);
+static int fwuDecodeInitCommand(TPbReader r, TFwuInitPacket *packet);
+static int fwuDecodeHash(TPbReader r, TFwuInitPacket *packet);
+static void pbWriteVarint(TPbWriter *w, uint32_t value);
+static void pbWriteTag(TPbWriter *w, uint32_t field, uint8_t wireType);
+static void pbWriteBytes(TPbWriter *w, uint32_t field, const uint8_t *data, uint32_t len);
+
+
+int fwuInitPacketDecode(const uint8_t *dat, uint32_t len, TFwuInitPacket *packet)
+{
+    TPbReader r;
+    uint32_t field;
+    uint8_t wt;
+    int haveCommand = 0;
+
+    memset(packet, 0, sizeof(*packet));
+    r.p = dat;
+    r.end = dat + len;
+
+    while (r.p < r.end) {
+        if (pbReadTag(&r, &field, &wt) != 0) {
+            return -1;
+        }
+        if (field == 1 && wt == PB_WT_LEN) {
+            // unsigned command
+            TPbReader cmd;
+            if (pbReadBytes(&r, &cmd) != 0 || fwuDecodeCommand(cmd, packet) != 0) {
+                return -1;
+            }
+            haveCommand = 1;
+        } else if (field == 2 && wt == PB_WT_LEN) {
+            TPbReader signedCmd;
+            if (pbReadBytes(&r, &signedCmd) != 0) {
+                return -1;
+            }
+            while (signedCmd.p < signedCmd.end) {
+                uint32_t v;
+                if (pbReadTag(&signedCmd, &field, &wt) != 0) {
+                    return -1;
+                }
+                if (field == 1 && wt == PB_WT_LEN) {
+                    TPbReader cmd;
+                    if (pbReadBytes(&signedCmd, &cmd) != 0 || fwuDecodeCommand(cmd, packet) != 0) {
+                        return -1;
+                    }
+                    packet->command = cmd.p;
+                    packet->commandLen = (uint32_t)(cmd.end - cmd.p);
+                    haveCommand = 1;
+                } else if (field == 2 && wt == PB_WT_VARINT) {
+                    if (pbReadVarint(&signedCmd, &v) != 0) {
+                        return -1;
+                    }
+                    packet->signatureType = (uint8_t)v;
+                } else if (field == 3 && wt == PB_WT_LEN) {
+                    TPbReader sig;
+                    if (pbReadBytes(&signedCmd, &sig) != 0 || sig.end - sig.p > 255) {
+                        return -1;
+                    }
+                    packet->signature = sig.p;
+                    packet->signatureLen = (uint8_t)(sig.end - sig.p);
+                } else if (pbSkip(&signedCmd, wt) != 0) {
+                    return -1;
+                }
+            }
+        } else if (pbSkip(&r, wt) != 0) {
+            return -1;
+        }
+    }
+    return haveCommand ? 0 : -1;
+}
+
+int fwuInitPacketEncodeCommand(const TFwuInitPacket *packet, uint8_t *buf, uint32_t size)
+{
+    uint8_t init[256];
+    uint8_t sub[80];
+    TPbWriter w = { init, init + sizeof(init), 0 };
+    TPbWriter s = { sub, sub + sizeof(sub), 0 };
+    uint8_t i;
+
+    // InitCommand, fields in order
+    pbWriteTag(&w, 1, PB_WT_VARINT);
+    pbWriteVarint(&w, packet->fwVersion);
+    pbWriteTag(&w, 2, PB_WT_VARINT);
+    pbWriteVarint(&w, packet->hwVersion);
+    if (packet->nofSdReq > 0) {
+        for (i = 0; i < packet->nofSdReq && i < FWU_INIT_MAX_SD_REQ; i++) {
+            pbWriteVarint(&s, packet->sdReq[i]);
+        }
+        pbWriteBytes(&w, 3, sub, (uint32_t)(s.p - sub));
+    }
+    pbWriteTag(&w, 4, PB_WT_VARINT);
+    pbWriteVarint(&w, packet->type);
+    pbWriteTag(&w, 5, PB_WT_VARINT);
+    pbWriteVarint(&w, packet->sdSize);
+    pbWriteTag(&w, 6, PB_WT_VARINT);
+    pbWriteVarint(&w, packet->blSize);
+    pbWriteTag(&w, 7, PB_WT_VARINT);
+    pbWriteVarint(&w, packet->appSize);
+    if (packet->hash) {
+        s.p = sub;
+        pbWriteTag(&s, 1, PB_WT_VARINT);
+        pbWriteVarint(&s, packet->hashType);
+        pbWriteBytes(&s, 2, packet->hash, packet->hashLen);
+        pbWriteBytes(&w, 8, sub, (uint32_t)(s.p - sub));
+    }
+    pbWriteTag(&w, 9, PB_WT_VARINT);
+    pbWriteVarint(&w, packet->isDebug);
+    if (w.overflow || s.overflow) {
+        return -1;
+    }
+
+    // Command: op code INIT, then the init command
+    TPbWriter c = { buf, buf + size, 0 };
+    pbWriteTag(&c, 1, PB_WT_VARINT);
+    pbWriteVarint(&c, 1);
+    pbWriteBytes(&c, 2, init, (uint32_t)(w.p - init));
+    return c.overflow ? -1 : (int)(c.p - buf);
+}
+
+int fwuInitPacketEncode(const TFwuInitPacket *packet, uint8_t *buf, uint32_t size)
+{
+    uint8_t command[300];
+    uint8_t signedCommand[300 + 2 + 255 + 8];
+    int commandLen = fwuInitPacketEncodeCommand(packet, command, sizeof(command));
+    TPbWriter w = { buf, buf + size, 0 };
+
+    if (commandLen < 0) {
+        return -1;
+    }
+    if (!packet->signature) {
+        pbWriteBytes(&w, 1, command, commandLen);
+    } else {
+        TPbWriter s = { signedCommand, signedCommand + sizeof(signedCommand), 0 };
+        pbWriteBytes(&s, 1, command, commandLen);
+        pbWriteTag(&s, 2, PB_WT_VARINT);
+        pbWriteVarint(&s, packet->signatureType);
+        pbWriteBytes(&s, 3, packet->signature, packet->signatureLen);
+        pbWriteBytes(&w, 2, signedCommand, (uint32_t)(s.p - signedCommand));
+    }
+    return w.overflow ? -1 : (int)(w.p - buf);
+}
+
+static int fwuDecodeCommand(TPbReader r, TFwuInitPacket *packet)
+{
+    uint32_t field;
+    uint8_t wt;
+
+    while (r.p < r.end) {
+        if (pbReadTag(&r, &field, &wt) != 0) {
+            return -1;
+        }
+        if (field == 2 && wt == PB_WT_LEN) {
+            TPbReader init;
+            if (pbReadBytes(&r, &init) != 0 || fwuDecodeInitCommand(init, packet) != 0) {
+                return -1;
+            }
+        } else if (pbSkip(&r, wt) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int fwuDecodeInitCommand(TPbReader r, TFwuInitPacket *packet)
+{
+    uint32_t field;
+    uint8_t wt;
+    uint32_t v;
+
+    while (r.p < r.end) {
+        if (pbReadTag(&r, &field, &wt) != 0) {
+            return -1;
+        }
+        if (field == 3 && wt == PB_WT_LEN) {
+            // packed sd_req
+            TPbReader sdReq;
+            if (pbReadBytes(&r, &sdReq) != 0) {
+                return -1;
+            }
+            while (sdReq.p < sdReq.end) {
+                if (pbReadVarint(&sdReq, &v) != 0) {
+                    return -1;
+                }
+                if (packet->nofSdReq < FWU_INIT_MAX_SD_REQ) {
+                    packet->sdReq[packet->nofSdReq++] = v;
+                }
+            }
+        } else if (field == 8 && wt == PB_WT_LEN) {
+            TPbReader hash;
+            if (pbReadBytes(&r, &hash) != 0 || fwuDecodeHash(hash, packet) != 0) {
+                return -1;
+            }
+        } else if (wt == PB_WT_VARINT) {
+            if (pbReadVarint(&r, &v) != 0) {
+                return -1;
+            }
+            switch (field) {
+                case 1: packet->fwVersion = v; break;
+                case 2: packet->hwVersion = v; break;
+                case 3:
+                    if (packet->nofSdReq < FWU_INIT_MAX_SD_REQ) {
+                        packet->sdReq[packet->nofSdReq++] = v;
+                    }
+                    break;
+                case 4: packet->type = (EFwuInitFwType)v; break;
+                case 5: packet->sdSize = v; break;
+                case 6: packet->blSize = v; break;
+                case 7: packet->appSize = v; break;
+                case 9: packet->isDebug = (uint8_t)v; break;
+                default: break;
+            }
+        } else if (pbSkip(&r, wt) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int fwuDecodeHash(TPbReader r, TFwuInitPacket *packet)
+{
+    uint32_t field;
+    uint8_t wt;
+    uint32_t v;
+
+    while (r.p < r.end) {
+        if (pbReadTag(&r, &field, &wt) != 0) {
+            return -1;
+        }
+        if (field == 1 && wt == PB_WT_VARINT) {
+            if (pbReadVarint(&r, &v) != 0) {
+                return -1;
+            }
+            packet->hashType = (uint8_t)v;
+        } else if (field == 2 && wt == PB_WT_LEN) {
+            TPbReader hash;
+            if (pbReadBytes(&r, &hash) != 0 || hash.end - hash.p > 64) {
+                return -1;
+            }
+            packet->hash = hash.p;
+            packet->hashLen = (uint8_t)(hash.end - hash.p);
+        } else if (pbSkip(&r, wt) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int pbReadVarint(TPbReader *r, uint32_t *value)
+{
+    uint32_t v = 0;
+    uint8_t shift = 0;
+
+    while (r->p < r->end) {
+        uint8_t b = *r->p++;
+        if (shift < 32) {
+            v |= (uint32_t)(b & 0x7f) << shift;
+        }
+        shift += 7;
+        if (!(b & 0x80)) {
+            *value = v;
+            return 0;
+        }
+        if (shift >= 70) {
+            break;
+        }
+    }
+    return -1;
+}
+
+static int pbReadTag(TPbReader *r, uint32_t *field, uint8_t *wireType)
+{
+    uint32_t tag;
+    if (pbReadVarint(r, &tag) != 0) {
+        return -1;
+    }
+    *field = tag >> 3;
+    *wireType = tag & 0x07;
+    return 0;
+}
+
+static int pbReadBytes(TPbReader *r, TPbReader *sub)
+{
+    uint32_t len;
+    if (pbReadVarint(r, &len) != 0 || len > (uint32_t)(r->end - r->p)) {
+        return -1;
+    }
+    sub->p = r->p;
+    sub->end = r->p + len;
+    r->p += len;
+    return 0;
+}
+
+static int pbSkip(TPbReader *r, uint8_t wireType)
+{
+    uint32_t v;
+    TPbReader sub;
+
+    switch (wireType) {
+        case PB_WT_VARINT:
+            return pbReadVarint(r, &v);
+        case PB_WT_64BIT:
+            if (r->end - r->p < 8) {
+                return -1;
+            }
+            r->p += 8;
+            return 0;
+        case PB_WT_LEN:
+            return pbReadBytes(r, &sub);
+        case PB_WT_32BIT:
+            if (r->end - r->p < 4) {
+                return -1;
+            }
+            r->p += 4;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+static void pbWriteVarint(TPbWriter *w, uint32_t value)
+{
+    do {
+        if (w->p == w->end) {
+            w->overflow = 1;
+            return;
+        }
+        *w->p++ = (uint8_t)((value & 0x7f) | (value >= 0x80 ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+}
+
+static void pbWriteTag(TPbWriter *w, uint32_t field, uint8_t wireType)
+{
+    pbWriteVarint(w, field << 3 | wireType);
+}
+
+static void pbWriteBytes(TPbWriter *w, uint32_t field, const uint8_t *data, uint32_t len)
+{
+    pbWriteTag(w, field, PB_WT_LEN);
+    pbWriteVarint(w, len);
+    if (w->overflow || len > (uint32_t)(w->end - w->p)) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->p, data, len);
+    w->p += len;
+}
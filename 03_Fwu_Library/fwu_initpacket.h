@@ -0,0 +1,77 @@
+//
+//  fwu_initpacket.h
+//  nrf52-dfu
+//
+//  Decoder for the init packet (.dat) of a Nordic DFU package.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __FWU_INITPACKET_H__
+#define __FWU_INITPACKET_H__ 1
+
+#include <inttypes.h>
+
+#define FWU_INIT_MAX_SD_REQ 8
+
+// Firmware types in the init command
+typedef enum {
+    FWU_INIT_FW_TYPE_APPLICATION = 0,
+    FWU_INIT_FW_TYPE_SOFTDEVICE = 1,
+    FWU_INIT_FW_TYPE_BOOTLOADER = 2,
+    FWU_INIT_FW_TYPE_SOFTDEVICE_BOOTLOADER = 3,
+} EFwuInitFwType;
+
+// Fields of the init packet; pointers refer into the decoded .dat buffer.
+typedef struct {
+    uint32_t fwVersion;
+    uint32_t hwVersion;
+    uint32_t sdReq[FWU_INIT_MAX_SD_REQ];
+    uint8_t nofSdReq;
+    EFwuInitFwType type;
+    uint32_t sdSize;
+    uint32_t blSize;
+    uint32_t appSize;
+    uint8_t hashType;
+    const uint8_t *hash;
+    uint8_t hashLen;
+    uint8_t isDebug;
+    // The signed part of the packet (the encoded command); NULL if the packet is unsigned.
+    const uint8_t *command;
+    uint32_t commandLen;
+    uint8_t signatureType;
+    const uint8_t *signature;
+    uint8_t signatureLen;
+} TFwuInitPacket;
+
+
+// Decode the init packet; returns 0 on success, -1 if the packet is malformed.
+int fwuInitPacketDecode(const uint8_t *dat, uint32_t len, TFwuInitPacket *packet);
+
+// Encode the command (op code INIT and the init command) as it is signed; returns its length,
+// or -1 if it doesn't fit into size bytes. All fields are written, as nrfutil does.
+int fwuInitPacketEncodeCommand(const TFwuInitPacket *packet, uint8_t *buf, uint32_t size);
+
+// Encode the init packet: a signed command if packet->signature is set, an unsigned one
+// otherwise. Returns its length, or -1 if it doesn't fit into size bytes.
+int fwuInitPacketEncode(const TFwuInitPacket *packet, uint8_t *buf, uint32_t size);
+
+
+#endif // __FWU_INITPACKET_H__
@@ -0,0 +1,184 @@
+//
+//  fwu_lz4.c
+//  nrf52-dfu
+//
+//  Compressed data objects: a block-indexed LZ4 image (fwconvert --format lz4)
+//  and a provider function that decompresses it through a one-block RAM window.
+//
+//  Sessions read the data object sequentially in small chunks and only go back
+//  to the start of the current data object on a retry or resume, so a window
+//  of one block is decompressed once per pass over it.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <string.h>
+#include "fwu_lz4.h"
+
+#define FWU_LZ4_NO_BLOCK 0xffffffff
+#define FWU_LZ4_MIN_MATCH 4
+
+static void fwuLz4Load(TFwuLz4Reader *reader, uint32_t block);
+
+
+int fwuLz4Init(TFwuLz4Reader *reader)
+{
+    reader->blocksDecompressed = 0;
+    reader->errors = 0;
+    reader->privateWindowBlock = FWU_LZ4_NO_BLOCK;
+
+    if (reader->image->blockSize == 0 || reader->image->blockSize > reader->windowSize) {
+        return -1;
+    }
+    return 0;
+}
+
+const uint8_t *fwuLz4Read(TFwuLz4Reader *reader, uint32_t pos, uint32_t len)
+{
+    uint32_t blockSize = reader->image->blockSize;
+    uint32_t block = pos / blockSize;
+    uint32_t offset = pos % blockSize;
+    uint32_t done;
+    uint32_t n;
+
+    if (offset + len <= blockSize) {
+        fwuLz4Load(reader, block);
+        return &reader->window[offset];
+    }
+    // The chunk spans blocks (more than two if they are smaller than a chunk); put it
+    // together in the staging buffer.
+    if (len > sizeof(reader->privateStaging)) {
+        len = sizeof(reader->privateStaging);
+    }
+    for (done = 0; done < len; done += n, block++, offset = 0) {
+        n = blockSize - offset;
+        if (n > len - done) {
+            n = len - done;
+        }
+        fwuLz4Load(reader, block);
+        memcpy(&reader->privateStaging[done], &reader->window[offset], n);
+    }
+    return reader->privateStaging;
+}
+
+const uint8_t *fwuLz4DataProvider(struct SFwu *fwu, int pos, int len)
+{
+    return fwuLz4Read((TFwuLz4Reader *)fwu->providerContext, pos, len);
+}
+
+int fwuLz4DecompressBlock(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *ipEnd = src + srcLen;
+    uint8_t *op = dst;
+    uint8_t *opEnd = dst + dstLen;
+
+    if (srcLen == dstLen) {
+        // Stored; compressing didn't make the block smaller.
+        memcpy(dst, src, dstLen);
+        return 0;
+    }
+    while (ip < ipEnd) {
+        uint8_t token = *ip++;
+        uint32_t litLen = token >> 4;
+        uint32_t matchLen = token & 15;
+        uint32_t offset;
+        uint8_t b;
+
+        if (litLen == 15) {
+            do {
+                if (ip == ipEnd) {
+                    return -1;
+                }
+                b = *ip++;
+                litLen += b;
+            } while (b == 255);
+        }
+        if (litLen > (uint32_t)(ipEnd - ip) || litLen > (uint32_t)(opEnd - op)) {
+            return -1;
+        }
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == ipEnd) {
+            // The last sequence has literals only.
+            break;
+        }
+
+        if (ipEnd - ip < 2) {
+            return -1;
+        }
+        offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) {
+            return -1;
+        }
+        if (matchLen == 15) {
+            do {
+                if (ip == ipEnd) {
+                    return -1;
+                }
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += FWU_LZ4_MIN_MATCH;
+        if (matchLen > (uint32_t)(opEnd - op)) {
+            return -1;
+        }
+        if (offset >= matchLen) {
+            memcpy(op, op - offset, matchLen);
+            op += matchLen;
+        } else {
+            // Overlapping match, e.g. a run of one repeated byte
+            const uint8_t *m = op - offset;
+            while (matchLen--) {
+                *op++ = *m++;
+            }
+        }
+    }
+    return op == opEnd ? 0 : -1;
+}
+
+static void fwuLz4Load(TFwuLz4Reader *reader, uint32_t block)
+{
+    const TFwuLz4Image *image = reader->image;
+    uint32_t start = block * image->blockSize;
+    uint32_t len;
+
+    if (block == reader->privateWindowBlock) {
+        return;
+    }
+    len = image->dataLen - start;
+    if (len > image->blockSize) {
+        len = image->blockSize;
+    }
+    if (fwuLz4DecompressBlock(&image->blocks[image->blockOffsets[block]],
+                              image->blockOffsets[block + 1] - image->blockOffsets[block],
+                              reader->window, len) != 0) {
+        memset(reader->window, 0, len);
+        reader->errors++;
+    }
+    reader->blocksDecompressed++;
+    reader->privateWindowBlock = block;
+}
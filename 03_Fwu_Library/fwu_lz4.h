@@ -0,0 +1,85 @@
+//
+//  fwu_lz4.h
+//  nrf52-dfu
+//
+//  Compressed data objects: a block-indexed LZ4 image (fwconvert --format lz4)
+//  and a provider function that decompresses it through a one-block RAM window.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef __FWU_LZ4_H__
+#define __FWU_LZ4_H__ 1
+
+#include <inttypes.h>
+#include "fwu.h"
+
+// A data object (.bin) compressed block by block. Every block is an independent LZ4 block
+// (no frame header), so any block can be decompressed without the ones before it; a block
+// whose compressed size equals its size is stored uncompressed.
+typedef struct {
+    // Length of the uncompressed data object
+    uint32_t dataLen;
+    // Uncompressed bytes per block (the last block may be shorter); a multiple of the
+    // target's maximum data object size keeps retransmits and resumes within one block
+    uint32_t blockSize;
+    uint32_t nofBlocks;
+    // Compressed blocks back to back; block i starts at blockOffsets[i] and ends before
+    // blockOffsets[i + 1]
+    const uint8_t *blocks;
+    const uint32_t *blockOffsets;
+} TFwuLz4Image;
+
+typedef struct {
+// --- public - define these before calling fwuLz4Init ---
+    const TFwuLz4Image *image;
+    // RAM for one decompressed block (at least image->blockSize bytes)
+    uint8_t *window;
+    uint32_t windowSize;
+// --- public - statistics
+    uint32_t blocksDecompressed;
+    // Blocks that failed to decompress; they read as zeros, so the target's CRC check fails
+    uint32_t errors;
+// --- private, don't modify ---
+    uint32_t privateWindowBlock;
+    uint8_t privateStaging[FWU_DATA_CHUNK_SIZE];
+} TFwuLz4Reader;
+
+
+// First function to call to set up the internal state of the reader. Returns 0 on success,
+// -1 if a block of the image doesn't fit into the window (don't start the update then).
+int fwuLz4Init(TFwuLz4Reader *reader);
+
+// Returns a pointer to len (at most FWU_DATA_CHUNK_SIZE) uncompressed bytes at position pos.
+// The pointer is valid until the next call.
+const uint8_t *fwuLz4Read(TFwuLz4Reader *reader, uint32_t pos, uint32_t len);
+
+// FDataFunction for TFwu.dataObjectProviderFunction; TFwu.providerContext points to the reader.
+const uint8_t *fwuLz4DataProvider(struct SFwu *fwu, int pos, int len);
+
+// Decompress one block of srcLen bytes into exactly dstLen bytes; returns 0 on success,
+// -1 if the block is malformed. Never reads or writes outside the given buffers.
+int fwuLz4DecompressBlock(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen);
+
+
+#endif // __FWU_LZ4_H__
@@ -0,0 +1,96 @@
+//
+//  fwu_profile.h
+//  nrf52-dfu
+//
+//  Optional profiling probes in the hot paths of fwu.c. Compile the library
+//  with -DFWU_PROFILE to enable them; without it the probes compile to nothing.
+//
+//  Each probe counts calls and accumulates the total and maximum number of
+//  cycles per call, inclusive of the functions called from the probed one.
+//  The counter defaults to DWT CYCCNT on Cortex-M3/M4/M7/M33, the TSC on x86
+//  and CLOCK_MONOTONIC nanoseconds elsewhere; define FWU_PROFILE_CYCLES() as an
+//  expression returning a free-running uint32_t counter to use another one.
+//  The probe data is global, so profile from one thread (or task) only.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef __FWU_PROFILE_H__
+#define __FWU_PROFILE_H__ 1
+
+#include <inttypes.h>
+
+typedef enum {
+    FWU_PROBE_YIELD = 0,
+    FWU_PROBE_DID_RECEIVE_DATA,
+    FWU_PROBE_UPDATE_CRC,
+    FWU_PROBE_PREPARE_SEND_BUFFER,
+    FWU_PROBE_PREPARE_LARGE_OBJECT,
+    FWU_NOF_PROBES,
+} EFwuProbe;
+
+typedef struct {
+    uint32_t count;
+    uint64_t totalCycles;
+    uint32_t maxCycles;
+} TFwuProbe;
+
+// Receives one formatted line per probe from fwuProfileDump.
+typedef void (*FFwuProfilePrint)(const char *line, void *context);
+
+#ifdef FWU_PROFILE
+
+#ifndef FWU_PROFILE_CYCLES
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+// DWT cycle counter; fwuProfileReset enables it.
+#define FWU_PROFILE_CYCLES() (*(volatile uint32_t *)0xE0001004)
+#define FWU_PROFILE_DWT 1
+#elif defined(__x86_64__) || defined(__i386__)
+#define FWU_PROFILE_CYCLES() ((uint32_t)__builtin_ia32_rdtsc())
+#else
+#include <time.h>
+static inline uint32_t fwuProfileNanosec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+#define FWU_PROFILE_CYCLES() fwuProfileNanosec()
+#endif
+#endif // FWU_PROFILE_CYCLES
+
+// Clear all probes (and enable the cycle counter where it needs enabling).
+void fwuProfileReset(void);
+
+// Count, total and maximum cycles of a probe.
+const TFwuProbe *fwuProfileProbe(EFwuProbe probe);
+
+// Name of the probed function, e.g. "fwuYield".
+const char *fwuProfileProbeName(EFwuProbe probe);
+
+// Format every probe that has been hit as "name: count calls, avg a, max m cycles".
+void fwuProfileDump(FFwuProfilePrint print, void *context);
+
+#endif // FWU_PROFILE
+
+#endif // __FWU_PROFILE_H__
@@ -0,0 +1,178 @@
+//
+//  fwu_sched.c
+//  nrf52-dfu
+//
+//  Cooperative scheduler for driving several firmware update sessions
+//  (e.g. one per UART) from a single microcontroller main loop.
+//
+//  A session is only yielded to when it can make progress: it received data,
+//  has TX credit for pending request bytes, has an internal state transition
+//  pending or reached its response deadline. Among the ready sessions the one
+//  with the highest priority plus waiting time wins; ties go to the session
+//  served least recently.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "fwu_sched.h"
+
+static uint8_t fwuSchedIsReady(TFwuSchedSession *session);
+static uint32_t fwuSchedScore(TFwuSchedSession *session);
+
+
+void fwuSchedInit(TFwuSched *sched)
+{
+    sched->privateNofSessions = 0;
+    sched->privateServeCounter = 0;
+}
+
+int fwuSchedAdd(TFwuSched *sched, TFwu *fwu, uint8_t priority)
+{
+    TFwuSchedSession *session;
+
+    if (sched->privateNofSessions == FWU_SCHED_MAX_SESSIONS) {
+        return -1;
+    }
+    session = &sched->privateSessions[sched->privateNofSessions];
+    session->fwu = fwu;
+    session->priority = priority;
+    session->status = FWU_STATUS_UNDEFINED;
+    session->privateRxPending = 0;
+    session->privateTxCredit = 0;
+    session->privateElapsedMillisec = 0;
+    session->privateWaitRounds = 0;
+    session->privateLastServed = 0;
+
+    fwuExec(fwu);
+    return sched->privateNofSessions++;
+}
+
+void fwuSchedDidReceiveData(TFwuSched *sched, int ix, uint8_t *bytes, uint8_t len)
+{
+    TFwuSchedSession *session = &sched->privateSessions[ix];
+    fwuDidReceiveData(session->fwu, bytes, len);
+    session->privateRxPending = 1;
+}
+
+void fwuSchedCanSendData(TFwuSched *sched, int ix, uint8_t maxLen)
+{
+    TFwuSchedSession *session = &sched->privateSessions[ix];
+    fwuCanSendData(session->fwu, maxLen);
+    session->privateTxCredit = maxLen > 0;
+}
+
+uint8_t fwuSchedRun(TFwuSched *sched, uint32_t elapsedMillisec)
+{
+    uint8_t nofRunning = 0;
+    uint8_t budget = sched->maxYieldsPerRun ? sched->maxYieldsPerRun : sched->privateNofSessions;
+    uint8_t i;
+
+    // Time passes for all sessions, whether they are yielded to or not.
+    for (i = 0; i < sched->privateNofSessions; i++) {
+        sched->privateSessions[i].privateElapsedMillisec += elapsedMillisec;
+    }
+
+    while (budget > 0) {
+        TFwuSchedSession *best = 0;
+        uint32_t bestScore = 0;
+
+        for (i = 0; i < sched->privateNofSessions; i++) {
+            TFwuSchedSession *session = &sched->privateSessions[i];
+            if (!fwuSchedIsReady(session)) {
+                continue;
+            }
+            uint32_t score = fwuSchedScore(session);
+            if (!best || score > bestScore
+                || (score == bestScore && session->privateLastServed < best->privateLastServed)) {
+                best = session;
+                bestScore = score;
+            }
+        }
+        if (!best) {
+            break;
+        }
+
+        // Sessions that were ready but not chosen age by one round.
+        for (i = 0; i < sched->privateNofSessions; i++) {
+            TFwuSchedSession *session = &sched->privateSessions[i];
+            if (session != best && fwuSchedIsReady(session) && session->privateWaitRounds < 0xffff) {
+                session->privateWaitRounds++;
+            }
+        }
+
+        uint8_t hadTxCredit = best->privateTxCredit;
+        best->status = fwuYield(best->fwu, best->privateElapsedMillisec);
+        best->privateElapsedMillisec = 0;
+        best->privateRxPending = 0;
+        best->privateWaitRounds = 0;
+        best->privateLastServed = ++sched->privateServeCounter;
+        if (hadTxCredit) {
+            // The credit is used up by this yield, even if part of a long frame is still to be
+            // sent; wait for the next fwuSchedCanSendData.
+            best->privateTxCredit = 0;
+            fwuCanSendData(best->fwu, 0);
+        }
+        budget--;
+    }
+
+    for (i = 0; i < sched->privateNofSessions; i++) {
+        if (sched->privateSessions[i].status == FWU_STATUS_UNDEFINED) {
+            nofRunning++;
+        }
+    }
+    return nofRunning;
+}
+
+TFwuSchedSession *fwuSchedSession(TFwuSched *sched, int ix)
+{
+    return &sched->privateSessions[ix];
+}
+
+static uint8_t fwuSchedIsReady(TFwuSchedSession *session)
+{
+    uint8_t work;
+
+    if (session->status != FWU_STATUS_UNDEFINED) {
+        return 0;
+    }
+    // Finished sessions report their final status on the next yield.
+    if (session->fwu->processStatus != FWU_STATUS_UNDEFINED) {
+        return 1;
+    }
+    work = fwuPendingWork(session->fwu);
+    if (work & FWU_WORK_INTERNAL) {
+        return 1;
+    }
+    if ((work & FWU_WORK_TX) && session->privateTxCredit) {
+        return 1;
+    }
+    if ((work & FWU_WORK_RX) && session->privateRxPending) {
+        return 1;
+    }
+    // Let the session notice its timeout.
+    return work != FWU_WORK_NONE && session->privateElapsedMillisec >= fwuDeadlineMillisec(session->fwu);
+}
+
+// Priority dominates; every 256 rounds of waiting count as one priority level,
+// so lower priorities get through eventually.
+static uint32_t fwuSchedScore(TFwuSchedSession *session)
+{
+    return ((uint32_t)session->priority << 8) + session->privateWaitRounds;
+}
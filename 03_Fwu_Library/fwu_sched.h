@@ -0,0 +1,87 @@
+//
+//  fwu_sched.h
+//  nrf52-dfu
+//
+//  Cooperative scheduler for driving several firmware update sessions
+//  (e.g. one per UART) from a single microcontroller main loop.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __FWU_SCHED_H__
+#define __FWU_SCHED_H__ 1
+
+#include <inttypes.h>
+#include "fwu.h"
+
+#ifndef FWU_SCHED_MAX_SESSIONS
+#define FWU_SCHED_MAX_SESSIONS 4
+#endif
+
+typedef struct {
+// --- public - define with fwuSchedAdd ---
+    TFwu *fwu;
+    // Higher priorities are served first; waiting sessions age so none of them starves.
+    uint8_t priority;
+// --- public - result codes
+    EFwuProcessStatus status;
+// --- private, don't modify ---
+    uint8_t privateRxPending;
+    uint8_t privateTxCredit;
+    uint32_t privateElapsedMillisec;
+    uint16_t privateWaitRounds;
+    uint32_t privateLastServed;
+} TFwuSchedSession;
+
+typedef struct {
+// --- public - define these before calling fwuSchedInit ---
+    // Maximum number of fwuYield calls per fwuSchedRun (the scheduler's time slice);
+    // 0 = one per registered session.
+    uint8_t maxYieldsPerRun;
+// --- private, don't modify ---
+    TFwuSchedSession privateSessions[FWU_SCHED_MAX_SESSIONS];
+    uint8_t privateNofSessions;
+    uint32_t privateServeCounter;
+} TFwuSched;
+
+
+// First function to call to set up the internal state of the scheduler.
+void fwuSchedInit(TFwuSched *sched);
+
+// Register a session that has been set up with fwuInit; returns the session index or -1.
+// The session is started (fwuExec) by the scheduler.
+int fwuSchedAdd(TFwuSched *sched, TFwu *fwu, uint8_t priority);
+
+// Call after data from the target of session ix has been received (instead of fwuDidReceiveData).
+void fwuSchedDidReceiveData(TFwuSched *sched, int ix, uint8_t *bytes, uint8_t len);
+
+// Inform the scheduler that session ix may send maxLen bytes (instead of fwuCanSendData).
+// The credit is used up by the next fwuYield of that session.
+void fwuSchedCanSendData(TFwuSched *sched, int ix, uint8_t maxLen);
+
+// Call regularly; yields to the sessions that are ready, most urgent first.
+// Returns the number of sessions that are still running.
+uint8_t fwuSchedRun(TFwuSched *sched, uint32_t elapsedMillisec);
+
+// Session state, e.g. to read the status of a finished session.
+TFwuSchedSession *fwuSchedSession(TFwuSched *sched, int ix);
+
+
+#endif // __FWU_SCHED_H__
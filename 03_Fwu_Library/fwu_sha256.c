@@ -0,0 +1,131 @@
+//
+//  fwu_sha256.c
+//  nrf52-dfu
+//
+//  SHA-256 for the hash of the init packet, small enough for the updating
+//  microcontroller; shared by fwuVerify and fwconvert.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#include <string.h>
+#include "fwu_sha256.h"
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void fwuSha256Block(TFwuSha256 *sha, const uint8_t *block);
+
+static const uint32_t sSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+void fwuSha256Init(TFwuSha256 *sha)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sha->privateState, init, sizeof(init));
+    sha->privateLen = 0;
+}
+
+void fwuSha256Update(TFwuSha256 *sha, const uint8_t *data, uint32_t len)
+{
+    while (len > 0) {
+        uint32_t fill = sha->privateLen % 64;
+        uint32_t n = 64 - fill;
+        if (n > len) {
+            n = len;
+        }
+        if (fill == 0 && n == 64) {
+            // Whole blocks are hashed in place.
+            fwuSha256Block(sha, data);
+        } else {
+            memcpy(&sha->privateBlock[fill], data, n);
+            if (fill + n == 64) {
+                fwuSha256Block(sha, sha->privateBlock);
+            }
+        }
+        sha->privateLen += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void fwuSha256Final(TFwuSha256 *sha, uint8_t digest[32])
+{
+    uint64_t bits = sha->privateLen * 8;
+    uint32_t fill = sha->privateLen % 64;
+    uint8_t i;
+
+    sha->privateBlock[fill++] = 0x80;
+    if (fill > 56) {
+        memset(&sha->privateBlock[fill], 0, 64 - fill);
+        fwuSha256Block(sha, sha->privateBlock);
+        fill = 0;
+    }
+    memset(&sha->privateBlock[fill], 0, 56 - fill);
+    // Length in bits, big endian
+    for (i = 0; i < 8; i++) {
+        sha->privateBlock[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    fwuSha256Block(sha, sha->privateBlock);
+    for (i = 0; i < 32; i++) {
+        digest[i] = (uint8_t)(sha->privateState[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+static void fwuSha256Block(TFwuSha256 *sha, const uint8_t *block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    uint8_t i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16
+             | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = sha->privateState[0]; b = sha->privateState[1]; c = sha->privateState[2]; d = sha->privateState[3];
+    e = sha->privateState[4]; f = sha->privateState[5]; g = sha->privateState[6]; h = sha->privateState[7];
+    for (i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sSha256K[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    sha->privateState[0] += a; sha->privateState[1] += b; sha->privateState[2] += c; sha->privateState[3] += d;
+    sha->privateState[4] += e; sha->privateState[5] += f; sha->privateState[6] += g; sha->privateState[7] += h;
+}
@@ -0,0 +1,55 @@
+//
+//  fwu_sha256.h
+//  nrf52-dfu
+//
+//  SHA-256 for the hash of the init packet, small enough for the updating
+//  microcontroller; shared by fwuVerify and fwconvert.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#ifndef __FWU_SHA256_H__
+#define __FWU_SHA256_H__ 1
+
+#include <inttypes.h>
+
+typedef struct {
+// --- private, don't modify ---
+    uint32_t privateState[8];
+    uint64_t privateLen;
+    uint8_t privateBlock[64];
+} TFwuSha256;
+
+
+// Start a new hash.
+void fwuSha256Init(TFwuSha256 *sha);
+
+// Add len bytes; may be called any number of times with any lengths.
+void fwuSha256Update(TFwuSha256 *sha, const uint8_t *data, uint32_t len);
+
+// Finish the hash; digest is big endian as usual (the init packet stores it reversed).
+void fwuSha256Final(TFwuSha256 *sha, uint8_t digest[32]);
+
+
+#endif // __FWU_SHA256_H__
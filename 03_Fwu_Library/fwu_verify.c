@@ -0,0 +1,164 @@
+//
+//  fwu_verify.c
+//  nrf52-dfu
+//
+//  Pre-flight check of an update before anything is sent: decodes the init packet
+//  (.dat) and checks it against the image (.bin), the target and the bootloader's
+//  public key, so updates the target would reject don't start.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#include <string.h>
+#include "fwu_verify.h"
+#include "fwu_sha256.h"
+
+// Init packet values (dfu-cc.proto)
+#define FWU_VERIFY_HASH_TYPE_CRC 1
+#define FWU_VERIFY_HASH_TYPE_SHA256 3
+#define FWU_VERIFY_SIGNATURE_TYPE_ECDSA_P256_SHA256 0
+
+static EFwuVerifyResult fwuVerifyHash(TFwuVerify *verify, TFwu *fwu);
+
+
+EFwuVerifyResult fwuVerify(TFwuVerify *verify, TFwu *fwu)
+{
+    TFwuInitPacket *packet = &verify->packet;
+    uint32_t pos;
+    uint32_t size;
+    uint8_t i;
+
+    verify->hashChecked = 0;
+    verify->signatureChecked = 0;
+
+    if (fwu->commandObjectLen > sizeof(verify->privateDat)) {
+        return FWU_VERIFY_MALFORMED;
+    }
+    for (pos = 0; pos < fwu->commandObjectLen; pos += size) {
+        size = fwu->commandObjectLen - pos;
+        if (size > FWU_DATA_CHUNK_SIZE) {
+            size = FWU_DATA_CHUNK_SIZE;
+        }
+        memcpy(&verify->privateDat[pos], fwu->commandObjectProviderFunction(fwu, pos, size), size);
+    }
+    if (fwuInitPacketDecode(verify->privateDat, fwu->commandObjectLen, packet) != 0) {
+        return FWU_VERIFY_MALFORMED;
+    }
+
+    // What the bootloader checks first
+    if (verify->hwVersion && packet->hwVersion != verify->hwVersion) {
+        return FWU_VERIFY_HW_VERSION_MISMATCH;
+    }
+    if (verify->sdId) {
+        for (i = 0; i < packet->nofSdReq; i++) {
+            if (packet->sdReq[i] == verify->sdId || packet->sdReq[i] == FWU_VERIFY_SD_REQ_ANY) {
+                break;
+            }
+        }
+        if (i == packet->nofSdReq) {
+            return FWU_VERIFY_SD_REQ_MISMATCH;
+        }
+    }
+    switch (packet->type) {
+        case FWU_INIT_FW_TYPE_APPLICATION:            size = packet->appSize; break;
+        case FWU_INIT_FW_TYPE_SOFTDEVICE:             size = packet->sdSize; break;
+        case FWU_INIT_FW_TYPE_BOOTLOADER:             size = packet->blSize; break;
+        case FWU_INIT_FW_TYPE_SOFTDEVICE_BOOTLOADER:  size = packet->sdSize + packet->blSize; break;
+        default:                                      return FWU_VERIFY_MALFORMED;
+    }
+    if (size != fwu->dataObjectLen) {
+        return FWU_VERIFY_SIZE_MISMATCH;
+    }
+
+    // The signature covers the command, so it is checked before the whole image is read.
+    if (verify->publicKey && verify->verifySignatureFunction) {
+        TFwuSha256 sha;
+        uint8_t digest[32];
+        if (!packet->command) {
+            return FWU_VERIFY_SIGNATURE_MISSING;
+        }
+        if (packet->signatureType != FWU_VERIFY_SIGNATURE_TYPE_ECDSA_P256_SHA256 || packet->signatureLen != 64) {
+            return FWU_VERIFY_SIGNATURE_INVALID;
+        }
+        fwuSha256Init(&sha);
+        fwuSha256Update(&sha, packet->command, packet->commandLen);
+        fwuSha256Final(&sha, digest);
+        if (verify->verifySignatureFunction(verify->publicKey, digest, packet->signature) != 0) {
+            return FWU_VERIFY_SIGNATURE_INVALID;
+        }
+        verify->signatureChecked = 1;
+    }
+
+    if (fwu->dataObjectProviderFunction) {
+        return fwuVerifyHash(verify, fwu);
+    }
+    return FWU_VERIFY_OK;
+}
+
+// The hash of the init packet is stored in little endian byte order.
+static EFwuVerifyResult fwuVerifyHash(TFwuVerify *verify, TFwu *fwu)
+{
+    const TFwuInitPacket *packet = &verify->packet;
+    uint32_t pos;
+    uint32_t n;
+    uint8_t i;
+
+    if (packet->hash && packet->hashType == FWU_VERIFY_HASH_TYPE_SHA256 && packet->hashLen == 32) {
+        TFwuSha256 sha;
+        uint8_t digest[32];
+        fwuSha256Init(&sha);
+        for (pos = 0; pos < fwu->dataObjectLen; pos += n) {
+            n = fwu->dataObjectLen - pos;
+            if (n > FWU_DATA_CHUNK_SIZE) {
+                n = FWU_DATA_CHUNK_SIZE;
+            }
+            fwuSha256Update(&sha, fwu->dataObjectProviderFunction(fwu, pos, n), n);
+        }
+        fwuSha256Final(&sha, digest);
+        for (i = 0; i < 32; i++) {
+            if (packet->hash[i] != digest[31 - i]) {
+                return FWU_VERIFY_HASH_MISMATCH;
+            }
+        }
+    } else if (packet->hash && packet->hashType == FWU_VERIFY_HASH_TYPE_CRC && packet->hashLen == 4) {
+        uint32_t crc = 0xffffffff;
+        for (pos = 0; pos < fwu->dataObjectLen; pos += n) {
+            n = fwu->dataObjectLen - pos;
+            if (n > FWU_DATA_CHUNK_SIZE) {
+                n = FWU_DATA_CHUNK_SIZE;
+            }
+            crc = fwuCrc32Update(crc, fwu->dataObjectProviderFunction(fwu, pos, n), n);
+        }
+        crc = ~crc;
+        for (i = 0; i < 4; i++) {
+            if (packet->hash[i] != (uint8_t)(crc >> (8 * i))) {
+                return FWU_VERIFY_HASH_MISMATCH;
+            }
+        }
+    } else {
+        return FWU_VERIFY_HASH_UNSUPPORTED;
+    }
+    verify->hashChecked = 1;
+    return FWU_VERIFY_OK;
+}
@@ -0,0 +1,95 @@
+//
+//  fwu_verify.h
+//  nrf52-dfu
+//
+//  Pre-flight check of an update before anything is sent: decodes the init packet
+//  (.dat) and checks it against the image (.bin), the target and the bootloader's
+//  public key, so updates the target would reject don't start.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __FWU_VERIFY_H__
+#define __FWU_VERIFY_H__ 1
+
+#include <inttypes.h>
+#include "fwu.h"
+#include "fwu_initpacket.h"
+
+// Largest init packet the check reads (the bootloader's limit is 512 bytes)
+#define FWU_VERIFY_MAX_DAT_SIZE 512
+
+// SoftDevice requirement that any SoftDevice satisfies
+#define FWU_VERIFY_SD_REQ_ANY 0xfffe
+
+typedef enum {
+    FWU_VERIFY_OK = 0,
+    // The init packet doesn't decode or is larger than FWU_VERIFY_MAX_DAT_SIZE
+    FWU_VERIFY_MALFORMED = 1,
+    // hw_version isn't the target's
+    FWU_VERIFY_HW_VERSION_MISMATCH = 2,
+    // sd_req doesn't allow the target's SoftDevice
+    FWU_VERIFY_SD_REQ_MISMATCH = 3,
+    // The size for the firmware type isn't the length of the image
+    FWU_VERIFY_SIZE_MISMATCH = 4,
+    // The hash isn't the image's
+    FWU_VERIFY_HASH_MISMATCH = 5,
+    // The hash type can't be checked (only CRC32 and SHA-256 are supported, like the bootloader)
+    FWU_VERIFY_HASH_UNSUPPORTED = 6,
+    // A public key is given but the init packet is unsigned
+    FWU_VERIFY_SIGNATURE_MISSING = 7,
+    // The signature isn't ECDSA P-256 or doesn't verify with the public key
+    FWU_VERIFY_SIGNATURE_INVALID = 8,
+} EFwuVerifyResult;
+
+// ECDSA P-256 verification, e.g. with micro-ecc (uECC_verify) or OpenSSL. publicKey and
+// signature are in the byte order of dfu_public_key.c and the init packet: x and y (r and s)
+// each in little endian. hash is the SHA-256 of the signed command as the digest bytes.
+// Returns 0 if the signature is valid.
+typedef int (*FFwuVerifySignatureFunction)(const uint8_t *publicKey, const uint8_t *hash, const uint8_t *signature);
+
+typedef struct {
+// --- public - define these before calling fwuVerify ---
+    // Optional: the bootloader's public key (pk[] in dfu_public_key.c) and the function that
+    // checks signatures with it (NULL = the signature isn't checked)
+    const uint8_t *publicKey;
+    FFwuVerifySignatureFunction verifySignatureFunction;
+    // Optional: the target's hardware version and SoftDevice FWID (0 = not checked)
+    uint32_t hwVersion;
+    uint32_t sdId;
+// --- public - results
+    // The decoded init packet; its pointers refer to privateDat
+    TFwuInitPacket packet;
+    uint8_t hashChecked;
+    uint8_t signatureChecked;
+// --- private, don't modify ---
+    uint8_t privateDat[FWU_VERIFY_MAX_DAT_SIZE];
+} TFwuVerify;
+
+
+// Check the command object against the data object of a session that is set up but not yet
+// started (call it before fwuExec). Both objects are read through the provider functions;
+// without a dataObjectProviderFunction (frame cache only) the hash isn't checked.
+EFwuVerifyResult fwuVerify(TFwuVerify *verify, struct SFwu *fwu);
+
+
+#endif // __FWU_VERIFY_H__
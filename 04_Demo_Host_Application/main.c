@@ -34,10 +34,39 @@
 #include <termios.h> // POSIX terminal control definitions
 #include <time.h>
 #include "fwu.h"
+#include "report.h"
 
 // Input objects
+#ifdef FWU_USE_CONTAINER
+#include "fwu_container.h"
+#include "dfu_firmware_container.h" // .dat and .bin in one container (fwconvert --format container)
+#else
 #include "dfu_firmware_dat.h" // blob
+#endif
+#if !defined(FWU_USE_LZ4) && !defined(FWU_USE_DELTA) && !defined(FWU_USE_CONTAINER) \
+    && !defined(FWU_USE_CHUNKS)
 #include "dfu_firmware_bin.h" // blob
+#endif
+#ifdef FWU_USE_FRAMES
+#include "dfu_firmware_frames.h" // pre-encoded WRITE frames of the .bin (fwconvert --format frames)
+#endif
+#ifdef FWU_USE_LZ4
+#include "dfu_firmware_lz4.h" // the .bin compressed (fwconvert --format lz4)
+#endif
+#ifdef FWU_USE_DELTA
+#include "dfu_firmware_base.h" // the previous .bin (fwconvert --const)
+#include "dfu_firmware_delta.h" // the .bin as a patch against it (fwconvert --format delta)
+#endif
+#ifdef FWU_USE_CHUNKS
+#include "fwu_chunks.h"
+#include "dfu_firmware_chunks.h" // several .bin variants in shared chunks (fwconvert --format chunks)
+#ifndef FWU_CHUNK_VARIANT
+#define FWU_CHUNK_VARIANT 0
+#endif
+#endif
+#ifdef FWU_USE_VERIFY
+#include "fwu_verify.h"
+#endif
 
 
 static char *sSerialDevice;
@@ -48,9 +77,23 @@ static int sSubticks;
 static int sBytesSent;
 
 static TFwu sFwu;
+#ifdef FWU_USE_LZ4
+static uint8_t sLz4Window[4096]; // --block-size of fwconvert
+static TFwuLz4Reader sLz4Reader;
+#endif
+#ifdef FWU_USE_DELTA
+static uint8_t sDeltaWindow[4096]; // --block-size of fwconvert
+static TFwuDeltaReader sDeltaReader;
+#endif
+#ifdef FWU_USE_CHUNKS
+static TFwuChunkReader sChunkReader;
+#endif
+#ifdef FWU_USE_VERIFY
+static TFwuVerify sVerify;
+#endif
 
-uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len);
-uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len);
+const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len);
+const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len);
 void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len);
 static uint8_t readData(uint8_t *data, int maxLen);
 static void openSerialDevice(void);
@@ -72,15 +115,88 @@ int main(int argc, char *argv[])
     openSerialDevice();
     configureSerialDevice();
 
+#ifdef FWU_USE_CONTAINER
+    // Everything comes from the container, used in place.
+    const TFwuContainerHeader *container = fwuContainerOpen(gFirmwareContainer, sizeof(gFirmwareContainer));
+    if (!container) {
+        fprintf(stderr, "invalid firmware container\n");
+        return -1;
+    }
+    fwuContainerSetup(&sFwu, container);
+#else
     // sFwu.commandObject = gFirmwareDat;
     sFwu.commandObjectProviderFunction = commandObjectProvider;
     sFwu.commandObjectLen = sizeof(gFirmwareDat);
+#endif
+#if !defined(FWU_USE_LZ4) && !defined(FWU_USE_DELTA) && !defined(FWU_USE_CONTAINER) \
+    && !defined(FWU_USE_CHUNKS)
     // sFwu.dataObject = gFirmwareBin;
     sFwu.dataObjectProviderFunction = dataObjectProvider;
     sFwu.dataObjectLen = sizeof(gFirmwareBin);
+#endif
+#ifdef FWU_USE_FRAMES
+    // The data object is sent straight from the frames; no escaping and CRC work at run time.
+    sFwu.frameCache = &gFirmwareFrames;
+    // The frames are only used if the session sends chunks of the size they were built for
+    // (fwconvert --chunk-size / --mtu).
+    sFwu.dataChunkSize = gFirmwareFrames.chunkSize;
+#endif
+#ifdef FWU_USE_LZ4
+    // Decompress the data object block by block while it is sent.
+    sLz4Reader.image = &gFirmwareLz4;
+    sLz4Reader.window = sLz4Window;
+    sLz4Reader.windowSize = sizeof(sLz4Window);
+    if (fwuLz4Init(&sLz4Reader) != 0) {
+        fprintf(stderr, "the blocks of the image don't fit into the window\n");
+        return -1;
+    }
+    sFwu.dataObjectProviderFunction = fwuLz4DataProvider;
+    sFwu.dataObjectLen = gFirmwareLz4.dataLen;
+    sFwu.providerContext = &sLz4Reader;
+#endif
+#ifdef FWU_USE_DELTA
+    // Rebuild the new data object from the previous one while it is sent.
+    sDeltaReader.patch = &gFirmwareDelta;
+    sDeltaReader.base = gFirmwareBase;
+    sDeltaReader.baseLen = sizeof(gFirmwareBase);
+    sDeltaReader.window = sDeltaWindow;
+    sDeltaReader.windowSize = sizeof(sDeltaWindow);
+    if (fwuDeltaInit(&sDeltaReader) != 0) {
+        fprintf(stderr, "the patch doesn't apply to the previous image or its blocks don't fit into the window\n");
+        return -1;
+    }
+    sFwu.dataObjectProviderFunction = fwuDeltaDataProvider;
+    sFwu.dataObjectLen = gFirmwareDelta.dataLen;
+    sFwu.providerContext = &sDeltaReader;
+#endif
+#ifdef FWU_USE_CHUNKS
+    // Reassemble the data object of one variant from the shared chunks while it is sent.
+    sChunkReader.store = &gFirmwareChunks;
+    sChunkReader.variant = FWU_CHUNK_VARIANT;
+    if (fwuChunkInit(&sChunkReader) != 0) {
+        fprintf(stderr, "invalid firmware variant\n");
+        return -1;
+    }
+    sFwu.dataObjectProviderFunction = fwuChunkDataProvider;
+    sFwu.dataObjectLen = gFirmwareChunks.variants[FWU_CHUNK_VARIANT].dataLen;
+    sFwu.providerContext = &sChunkReader;
+#endif
     sFwu.txFunction = txFunction;
     sFwu.responseTimeoutMillisec = 5000;
+    // Repeat failed requests and objects; errors that retrying can't fix fail at once.
+    sFwu.maxRetries = 3;
     
+#ifdef FWU_USE_VERIFY
+    // Don't start an update the bootloader would reject. To check the signature too, set
+    // sVerify.publicKey to pk[] of dfu_public_key.c and verifySignatureFunction to a wrapper
+    // of uECC_verify (micro-ecc, as in the bootloader).
+    EFwuVerifyResult verifyResult = fwuVerify(&sVerify, &sFwu);
+    if (verifyResult != FWU_VERIFY_OK) {
+        fprintf(stderr, "firmware rejected before the update (fwuVerify %d)\n", verifyResult);
+        return -1;
+    }
+#endif
+
     // Prepare the firmware update process.
     fwuInit(&sFwu);
     
@@ -114,6 +230,7 @@ int main(int argc, char *argv[])
 
         if (status == FWU_STATUS_COMPLETION) {
             printf("\n***** Success! *****\n");
+            printSessionStats(stdout, "fwu", &sFwu);
             return 0;
         }
         
@@ -121,28 +238,42 @@ int main(int argc, char *argv[])
             printf("\n***** Failed! Response Status = %d (", sFwu.responseStatus);
             printResponseStatus();
             printf(") *****\n");
+            if (sFwu.responseStatus == FWU_RSP_ERROR_RESPONSE) {
+                printf("Result code 0x%02X, extended error 0x%02X\n", sFwu.resultCode, sFwu.extendedError);
+            }
+            printSessionStats(stdout, "fwu", &sFwu);
             return -1;
         }
     }
 }
 
-uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len)
+#ifndef FWU_USE_CONTAINER
+const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len)
 {
     return &gFirmwareDat[pos];
 }
+#endif
 
-uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len)
+#if !defined(FWU_USE_LZ4) && !defined(FWU_USE_DELTA) && !defined(FWU_USE_CONTAINER) \
+    && !defined(FWU_USE_CHUNKS)
+const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len)
 {
     return &gFirmwareBin[pos];
 }
+#endif
 
 void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len)
 {
     while (len--) {
         uint8_t c = *buf++;
         uint8_t n = write(sFd, &c, 1);
-        if (++sBytesSent % 1000 == 0) {
-            printf(".");
+        if (++sBytesSent % 4096 == 0) {
+            uint32_t eta = fwuStatsEtaMillisec(fwu);
+            printf("\r%u of %u bytes, %u B/s", fwuStatsProgressBytes(fwu), fwu->dataObjectLen,
+                   fwuStatsThroughput(fwu));
+            if (eta != 0xffffffff) {
+                printf(", %u s left  ", (eta + 999) / 1000);
+            }
             fflush(stdout);
         }
     }
@@ -243,6 +374,8 @@ static void printResponseStatus(void)
         case FWU_RSP_CHECKSUM_ERROR:            printf("FWU_RSP_CHECKSUM_ERROR"); break;
         case FWU_RSP_DATA_OBJECT_TOO_LARGE:     printf("FWU_RSP_DATA_OBJECT_TOO_LARGE"); break;
         case FWU_RSP_RX_INVALID_ESCAPE_SEQ:     printf("FWU_RSP_RX_INVALID_ESCAPE_SEQ"); break;
+        case FWU_RSP_ABORTED:                   printf("FWU_RSP_ABORTED"); break;
+        case FWU_RSP_FRAME_CACHE_MISMATCH:      printf("FWU_RSP_FRAME_CACHE_MISMATCH"); break;
         default: printf("unknown response status: %d", sFwu.responseStatus); break;
     }
 }
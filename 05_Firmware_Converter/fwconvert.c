@@ -25,62 +25,1698 @@
 // OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 
+#define _DEFAULT_SOURCE 1 // realpath
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "fwu.h"
+#include "fwu_container.h"
+#include "fwu_sha256.h"
+#include "ihex.h"
+
+// Header lines carry 16 bytes of "0xNN, " each.
+#define BYTES_PER_LINE 16
+#define LINE_SIZE (4 + BYTES_PER_LINE * 6 + 1)
+#define MAX_VARIANTS 64
+// Application flash of 01_Demo_App/main.ld (FLASH ORIGIN and LENGTH); Intel HEX input must lie within
+#define APP_FLASH_ORIGIN 0x26000
+#define APP_FLASH_LENGTH 0x5a000
+
+typedef enum {
+    FORMAT_HEADER = 0, // C header with an initialized array
+    FORMAT_ASM = 1,    // assembler source with .incbin
+    FORMAT_OBJECT = 2, // ELF relocatable object
+    FORMAT_FRAMES = 3, // C header with the SLIP encoded WRITE frames (TFwuFrameCache)
+    FORMAT_LZ4 = 4,    // C header with the image compressed block by block (TFwuLz4Image)
+    FORMAT_DELTA = 5,  // C header with a patch against the previous image (TFwuDeltaPatch)
+    FORMAT_CONTAINER = 6, // binary container with init packet, image and CRC table (fwu_container.h)
+    FORMAT_CHUNKS = 7, // C header with several images as shared chunks plus an index each (TFwuChunkStore)
+    FORMAT_BIN = 8,    // the raw image, e.g. converted from Intel HEX
+} EFormat;
+
+typedef struct {
+    EFormat format;
+    int isConst;
+    int metadata;
+    unsigned long align;
+    const char *section;
+    const char *machine;
+    const char *headerPath;
+    unsigned long chunkSize;
+    unsigned long crcStride;
+    unsigned long blockSize;
+    const char *basePath;
+    const char *datPath;
+    unsigned long mtu;
+    unsigned long imageType;
+    unsigned long fwVersion;
+    int contentDefined;
+    // Further images for the chunk store; inPath is the first one
+    const char *variantPaths[MAX_VARIANTS];
+    int nofVariants;
+    // Images are Intel HEX if hexInput is 1, or -1 and the file name ends in .hex or .ihex
+    int hexInput;
+    unsigned long flashOrigin;
+    unsigned long flashLength;
+    const char *inPath;
+    const char *name;
+    // GCC attributes of the array and of the metadata
+    char attributes[256];
+    char sectionAttribute[256];
+} TOptions;
+
+static int writeHeader(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static void writeArray(FILE *b, const uint8_t *data, uint32_t len);
+static void writeDeclarations(FILE *b, const TOptions *options, uint32_t len);
+static void writeMetadata(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static int writeAsm(FILE *b, const TOptions *options, const char *outPath);
+static char *relativePath(const char *path, const char *fromFile);
+static int writeObject(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static int writeFrames(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static void writeWords(FILE *b, const uint32_t *words, uint32_t n);
+static int writeLz4(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static uint32_t lz4CompressBlock(const uint8_t *src, uint32_t len, uint8_t *dst);
+static uint32_t lz4MaxOverhead(uint32_t len);
+static int writeDelta(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static uint8_t *readFile(const char *path, long *len);
+static uint8_t *readImage(const TOptions *options, const char *path, long *len);
+static int isHexInput(const TOptions *options, const char *path);
+static uint8_t *readHex(const TOptions *options, const char *path, long *len);
+static int readLinkerScript(TOptions *options, const char *path);
+static int writeContainer(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static int writeChunks(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len);
+static void usage(const char *prog);
+
 
 int main(int argc, char *argv[])
 {
-    int c = 0;
-    int i = 0;
-    int isFirstByte = 1;
-    
-    if (argc != 4) {
-        fprintf(stderr, "usage: %s <firmware-file> <output-headerfile> <array-name>\n", argv[0]);
-        fprintf(stderr, "Generate a C header file with an array <array-name>\n");
-        fprintf(stderr, "from the specified binary firmware file (bin, dat).\n");
+    TOptions options;
+    const char *outPath;
+    uint8_t *data;
+    long len;
+    int result;
+    int i;
+
+    memset(&options, 0, sizeof(options));
+    options.machine = "arm";
+    options.chunkSize = 32;    // FWU_DATA_CHUNK_SIZE
+    options.crcStride = 4096;  // maximum data object size of the nRF52 bootloader
+    options.blockSize = 4096;
+    options.imageType = 0xffffffff;
+    options.fwVersion = 0xffffffff;
+    options.hexInput = -1;
+    options.flashOrigin = APP_FLASH_ORIGIN;
+    options.flashLength = APP_FLASH_LENGTH;
+
+    // Options come before the three positional arguments.
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "--const")) {
+            options.isConst = 1;
+        } else if (!strcmp(argv[i], "--metadata")) {
+            options.metadata = 1;
+        } else if (!strcmp(argv[i], "--align") && i + 1 < argc) {
+            options.align = strtoul(argv[++i], NULL, 0);
+            if (options.align == 0 || (options.align & (options.align - 1)) != 0) {
+                fprintf(stderr, "alignment must be a power of two\n");
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--section") && i + 1 < argc) {
+            options.section = argv[++i];
+        } else if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "header")) {
+                options.format = FORMAT_HEADER;
+            } else if (!strcmp(argv[i], "asm")) {
+                options.format = FORMAT_ASM;
+            } else if (!strcmp(argv[i], "object")) {
+                options.format = FORMAT_OBJECT;
+            } else if (!strcmp(argv[i], "frames")) {
+                options.format = FORMAT_FRAMES;
+            } else if (!strcmp(argv[i], "lz4")) {
+                options.format = FORMAT_LZ4;
+            } else if (!strcmp(argv[i], "delta")) {
+                options.format = FORMAT_DELTA;
+            } else if (!strcmp(argv[i], "container")) {
+                options.format = FORMAT_CONTAINER;
+            } else if (!strcmp(argv[i], "chunks")) {
+                options.format = FORMAT_CHUNKS;
+            } else if (!strcmp(argv[i], "bin")) {
+                options.format = FORMAT_BIN;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--machine") && i + 1 < argc) {
+            options.machine = argv[++i];
+        } else if (!strcmp(argv[i], "--header") && i + 1 < argc) {
+            options.headerPath = argv[++i];
+        } else if (!strcmp(argv[i], "--chunk-size") && i + 1 < argc) {
+            options.chunkSize = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--mtu") && i + 1 < argc) {
+            options.mtu = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--crc-stride") && i + 1 < argc) {
+            options.crcStride = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--base") && i + 1 < argc) {
+            options.basePath = argv[++i];
+        } else if (!strcmp(argv[i], "--dat") && i + 1 < argc) {
+            options.datPath = argv[++i];
+        } else if (!strcmp(argv[i], "--image-type") && i + 1 < argc) {
+            // EFwuInitFwType
+            static const char *types[] = { "application", "softdevice", "bootloader", "softdevice_bootloader" };
+            i++;
+            for (options.imageType = 0; options.imageType < 4; options.imageType++) {
+                if (!strcmp(argv[i], types[options.imageType])) {
+                    break;
+                }
+            }
+            if (options.imageType == 4) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--fw-version") && i + 1 < argc) {
+            options.fwVersion = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--variant") && i + 1 < argc) {
+            if (options.nofVariants == MAX_VARIANTS - 1) {
+                fprintf(stderr, "at most %d variants\n", MAX_VARIANTS);
+                return -1;
+            }
+            options.variantPaths[options.nofVariants++] = argv[++i];
+        } else if (!strcmp(argv[i], "--content-defined")) {
+            options.contentDefined = 1;
+        } else if (!strcmp(argv[i], "--input") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "bin")) {
+                options.hexInput = 0;
+            } else if (!strcmp(argv[i], "hex")) {
+                options.hexInput = 1;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--flash-origin") && i + 1 < argc) {
+            options.flashOrigin = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--flash-length") && i + 1 < argc) {
+            options.flashLength = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--linker-script") && i + 1 < argc) {
+            if (readLinkerScript(&options, argv[++i]) != 0) {
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--block-size") && i + 1 < argc) {
+            options.blockSize = strtoul(argv[++i], NULL, 0);
+            // LZ4 offsets reach back 65535 bytes
+            if (options.blockSize < 1 || options.blockSize > 65536) {
+                fprintf(stderr, "block size must be 1..65536\n");
+                return -1;
+            }
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    // A container and a raw image need no array name.
+    if (argc - i != 3 && !((options.format == FORMAT_CONTAINER || options.format == FORMAT_BIN) && argc - i == 2)) {
+        usage(argv[0]);
         return -1;
     }
-    
-    FILE *f = fopen(argv[1], "rb");
-    if (!f) {
-        fprintf(stderr, "failed to open firmware input file\n");
+    if (options.mtu) {
+        // The payload must fit into the MTU even if every byte is escaped, and the frames
+        // of every data object must start at the beginning of the object.
+        options.chunkSize = options.mtu >= 5 ? (options.mtu - 1) / 2 - 1 : 0;
+        if (options.chunkSize > 32) {
+            options.chunkSize = 32;
+        }
+        while (options.chunkSize > 1 && options.crcStride % options.chunkSize != 0) {
+            options.chunkSize--;
+        }
+    }
+    if (options.chunkSize < 1 || options.chunkSize > 32) {
+        fprintf(stderr, "chunk size must be 1..32 (FWU_DATA_CHUNK_SIZE)\n");
+        return -1;
+    }
+    // Sessions start every data object with a new frame; the cache only serves objects that
+    // start on a frame and end on a CRC entry.
+    if (options.crcStride == 0 || options.crcStride % options.chunkSize != 0) {
+        fprintf(stderr, "CRC stride (data object size) must be a multiple of the chunk size\n");
+        return -1;
+    }
+    if (options.format == FORMAT_CONTAINER && !options.datPath) {
+        fprintf(stderr, "--format container needs the init packet (--dat)\n");
+        return -1;
+    }
+    if (options.contentDefined && options.blockSize < 64) {
+        fprintf(stderr, "content-defined chunks need a block size of at least 64\n");
+        return -1;
+    }
+    if (options.format == FORMAT_DELTA && !options.basePath) {
+        fprintf(stderr, "--format delta needs the previous image (--base)\n");
+        return -1;
+    }
+    options.inPath = argv[i];
+    outPath = argv[i + 1];
+    options.name = (argc - i == 3) ? argv[i + 2] : "container";
+    if (options.flashLength == 0 || options.flashOrigin + options.flashLength - 1 < options.flashOrigin
+        || options.flashOrigin + options.flashLength - 1 > 0xffffffff) {
+        fprintf(stderr, "flash region must lie within 32 bit addresses\n");
+        return -1;
+    }
+
+    if (options.align && options.section) {
+        snprintf(options.attributes, sizeof(options.attributes),
+                 " __attribute__((aligned(%lu), section(\"%s\")))", options.align, options.section);
+    } else if (options.align) {
+        snprintf(options.attributes, sizeof(options.attributes), " __attribute__((aligned(%lu)))", options.align);
+    } else if (options.section) {
+        snprintf(options.attributes, sizeof(options.attributes), " __attribute__((section(\"%s\")))", options.section);
+    }
+    if (options.section) {
+        snprintf(options.sectionAttribute, sizeof(options.sectionAttribute),
+                 " __attribute__((section(\"%s\")))", options.section);
+    }
+
+    // .incbin takes the file as it is
+    if (options.format == FORMAT_ASM && isHexInput(&options, options.inPath)) {
+        fprintf(stderr, "--format asm needs a binary image; use --format object for Intel HEX\n");
+        return -1;
+    }
+    data = readImage(&options, options.inPath, &len);
+    if (!data) {
         return -1;
     }
     
-    FILE *b = fopen(argv[2], "w");
+    FILE *b = fopen(outPath, (options.format == FORMAT_OBJECT || options.format == FORMAT_CONTAINER
+                              || options.format == FORMAT_BIN) ? "wb" : "w");
     if (!b) {
         fprintf(stderr, "failed to open firmware output file\n");
         return -1;
     }
+    // All output goes through one large stdio buffer.
+    setvbuf(b, NULL, _IOFBF, 1 << 16);
 
+    if (options.format == FORMAT_ASM) {
+        result = writeAsm(b, &options, outPath);
+    } else if (options.format == FORMAT_OBJECT) {
+        result = writeObject(b, &options, data, len);
+    } else if (options.format == FORMAT_FRAMES) {
+        result = writeFrames(b, &options, data, len);
+    } else if (options.format == FORMAT_LZ4) {
+        result = writeLz4(b, &options, data, len);
+    } else if (options.format == FORMAT_DELTA) {
+        result = writeDelta(b, &options, data, len);
+    } else if (options.format == FORMAT_CONTAINER) {
+        result = writeContainer(b, &options, data, len);
+    } else if (options.format == FORMAT_CHUNKS) {
+        result = writeChunks(b, &options, data, len);
+    } else if (options.format == FORMAT_BIN) {
+        result = fwrite(data, 1, len, b) == (size_t)len ? 0 : -1;
+    } else {
+        result = writeHeader(b, &options, data, len);
+    }
+    if (fclose(b) != 0) {
+        result = -1;
+    }
+
+    // The array lives in the .S/.o file; the header only declares it.
+    if (result == 0 && (options.format == FORMAT_ASM || options.format == FORMAT_OBJECT) && options.headerPath) {
+        FILE *h = fopen(options.headerPath, "w");
+        if (!h) {
+            fprintf(stderr, "failed to open header output file\n");
+            return -1;
+        }
+        fprintf(h, "// Firmware BLOB - automatically generated\n");
+        fprintf(h, "\n");
+        fprintf(h, "#ifndef __FW_BLOB_%s_H__\n", options.name);
+        fprintf(h, "#define __FW_BLOB_%s_H__ 1\n", options.name);
+        fprintf(h, "\n");
+        fprintf(h, "#include <stdint.h>\n");
+        fprintf(h, "\n");
+        writeDeclarations(h, &options, len);
+        if (options.metadata) {
+            writeMetadata(h, &options, data, len);
+        }
+        fprintf(h, "\n");
+        fprintf(h, "#endif // __FW_BLOB_%s_H__\n", options.name);
+        fclose(h);
+    }
+    free(data);
+    return result;
+}
+
+static int writeHeader(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
     fprintf(b, "// Firmware BLOB - automatically generated\n");
     fprintf(b, "\n");
-    fprintf(b, "#ifndef __FW_BLOB_%s_H__\n", argv[3]);
-    fprintf(b, "#define __FW_BLOB_%s_H__ 1\n", argv[3]);
+    fprintf(b, "#ifndef __FW_BLOB_%s_H__\n", options->name);
+    fprintf(b, "#define __FW_BLOB_%s_H__ 1\n", options->name);
+    fprintf(b, "\n");
+    fprintf(b, "#include <stdint.h>\n");
+    fprintf(b, "\n");
+
+    // A const array stays in flash; without const the C startup copies it into RAM.
+    fprintf(b, "%suint8_t %s[]%s = {\n", options->isConst ? "const " : "", options->name, options->attributes);
+    writeArray(b, data, len);
+    fprintf(b, "};\n");
+
+    if (options->metadata) {
+        writeMetadata(b, options, data, len);
+    }
+
+    fprintf(b, "\n");
+    fprintf(b, "#endif // __FW_BLOB_%s_H__\n", options->name);
+    return 0;
+}
+
+// The initializer, formatted from a table instead of one fprintf per byte.
+static void writeArray(FILE *b, const uint8_t *data, uint32_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[LINE_SIZE];
+    uint32_t pos;
+
+    for (pos = 0; pos < len; pos += BYTES_PER_LINE) {
+        uint32_t n = (len - pos < BYTES_PER_LINE) ? len - pos : BYTES_PER_LINE;
+        char *p = line;
+        uint32_t i;
+        memcpy(p, "    ", 4);
+        p += 4;
+        for (i = 0; i < n; i++) {
+            uint8_t c = data[pos + i];
+            p[0] = '0';
+            p[1] = 'x';
+            p[2] = hex[c >> 4];
+            p[3] = hex[c & 15];
+            p[4] = ',';
+            p[5] = ' ';
+            p += 6;
+        }
+        p[-1] = '\n';
+        fwrite(line, 1, p - line, b);
+    }
+}
+
+// extern declarations of the symbols defined by the .S/.o output
+static void writeDeclarations(FILE *b, const TOptions *options, uint32_t len)
+{
+    fprintf(b, "extern const uint8_t %s[];\n", options->name);
+    fprintf(b, "extern const uint8_t %s_end[];\n", options->name);
+    fprintf(b, "// Absolute symbol; its address is the size: (uint32_t)(uintptr_t)%s_size\n", options->name);
+    fprintf(b, "extern const uint8_t %s_size[];\n", options->name);
+    fprintf(b, "\n");
+    fprintf(b, "#define %s_LEN %uu\n", options->name, len);
+}
+
+static void writeMetadata(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    TFwuSha256 sha;
+    uint8_t digest[32];
+    int i;
+
+    fwuSha256Init(&sha);
+    fwuSha256Update(&sha, data, len);
+    fwuSha256Final(&sha, digest);
+
+    fprintf(b, "\n");
+    fprintf(b, "#ifndef __FW_BLOB_INFO__\n");
+    fprintf(b, "#define __FW_BLOB_INFO__ 1\n");
+    fprintf(b, "// Length, CRC32 (as reported by the DFU CRC request) and SHA-256 of a BLOB\n");
+    fprintf(b, "typedef struct {\n");
+    fprintf(b, "    uint32_t len;\n");
+    fprintf(b, "    uint32_t crc32;\n");
+    fprintf(b, "    uint8_t sha256[32];\n");
+    fprintf(b, "} TFwBlobInfo;\n");
+    fprintf(b, "#endif\n");
+    fprintf(b, "\n");
+    if (options->format != FORMAT_ASM && options->format != FORMAT_OBJECT) {
+        fprintf(b, "#define %s_LEN %uu\n", options->name, len);
+        fprintf(b, "\n");
+    }
+    fprintf(b, "%sTFwBlobInfo %sInfo%s = {\n", options->isConst ? "const " : "", options->name,
+            options->sectionAttribute);
+    fprintf(b, "    %uu,\n", len);
+    fprintf(b, "    0x%08xu,\n", ~fwuCrc32Update(0xffffffff, data, len));
+    fprintf(b, "    {");
+    for (i = 0; i < 32; i++) {
+        fprintf(b, "%s0x%02x", i == 0 ? " " : (i % 16 == 0 ? ",\n      " : ", "), digest[i]);
+    }
+    fprintf(b, " }\n");
+    fprintf(b, "};\n");
+}
+
+// The assembler reads the image itself; nothing is converted.
+static int writeAsm(FILE *b, const TOptions *options, const char *outPath)
+{
+    // Relative to the .S file, so the source builds in any checkout. .incbin searches the
+    // assembler's working directory and its -I directories; assemble from another directory
+    // with -Wa,-I<directory of the .S file>.
+    char *path = relativePath(options->inPath, outPath);
+    if (!path) {
+        fprintf(stderr, "failed to resolve firmware input path\n");
+        return -1;
+    }
+    fprintf(b, "// Firmware BLOB - automatically generated\n");
     fprintf(b, "\n");
+    if (options->section) {
+        fprintf(b, "    .section %s, \"a\"\n", options->section);
+    } else {
+        fprintf(b, "    .section .rodata.%s, \"a\"\n", options->name);
+    }
+    fprintf(b, "    .balign %lu\n", options->align ? options->align : 4);
+    fprintf(b, "    .global %s\n", options->name);
+    fprintf(b, "    .global %s_end\n", options->name);
+    fprintf(b, "    .global %s_size\n", options->name);
+    fprintf(b, "%s:\n", options->name);
+    fprintf(b, "    .incbin \"%s\"\n", path);
+    fprintf(b, "%s_end:\n", options->name);
+    fprintf(b, "    .set %s_size, %s_end - %s\n", options->name, options->name, options->name);
+    fprintf(b, "    .section .note.GNU-stack, \"\", %%progbits\n");
+    free(path);
+    return 0;
+}
+
+// path as seen from the directory of fromFile (which must exist), e.g. "../bin/app.bin".
+static char *relativePath(const char *path, const char *fromFile)
+{
+    char *to = realpath(path, NULL);
+    char *from = realpath(fromFile, NULL);
+    char *result = NULL;
+    size_t common = 0;
+    size_t i;
+    int nofUp = 0;
+
+    if (to && from) {
+        // Longest common directory prefix
+        for (i = 0; to[i] && to[i] == from[i]; i++) {
+            if (to[i] == '/') {
+                common = i + 1;
+            }
+        }
+        // One ".." for every directory of fromFile below the common prefix
+        for (i = common; from[i]; i++) {
+            nofUp += from[i] == '/';
+        }
+        result = malloc(3 * nofUp + strlen(to) - common + 1);
+        if (result) {
+            result[0] = 0;
+            while (nofUp-- > 0) {
+                strcat(result, "../");
+            }
+            strcat(result, &to[common]);
+        }
+    }
+    free(to);
+    free(from);
+    return result;
+}
+
+// ELF relocatable object: one section with the image and the symbols name, name_end and name_size.
+typedef struct {
+    uint16_t machine;
+    uint8_t is64;
+    uint32_t flags;
+} TElfMachine;
+
+#define NOF_SECTIONS 6
+
+static void elfPut(uint8_t *p, uint64_t v, int size)
+{
+    int i;
+    for (i = 0; i < size; i++) {
+        p[i] = (uint8_t)(v >> (8 * i)); // little endian
+    }
+}
+
+static int writeObject(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    TElfMachine machine;
+    char section[256];
+    char strtab[1024];
+    char shstrtab[512];
+    uint32_t strtabLen = 1;
+    uint32_t shstrtabLen = 1;
+    uint32_t nameIx[3];
+    uint32_t shNameIx[5];
+    uint8_t ehdr[64];
+    uint8_t shdr[NOF_SECTIONS][64];
+    uint8_t symtab[5][24];
+    static const uint8_t zeros[64];
+    int i;
+
+    if (!strcmp(options->machine, "arm")) {
+        machine = (TElfMachine){ 40, 0, 0x05000000 }; // EM_ARM, EABI version 5
+    } else if (!strcmp(options->machine, "aarch64")) {
+        machine = (TElfMachine){ 183, 1, 0 };
+    } else if (!strcmp(options->machine, "x86_64")) {
+        machine = (TElfMachine){ 62, 1, 0 };
+    } else if (!strcmp(options->machine, "i386")) {
+        machine = (TElfMachine){ 3, 0, 0 };
+    } else {
+        fprintf(stderr, "unknown machine '%s' (arm, aarch64, x86_64, i386)\n", options->machine);
+        return -1;
+    }
+    if (options->section) {
+        snprintf(section, sizeof(section), "%s", options->section);
+    } else {
+        snprintf(section, sizeof(section), ".rodata.%s", options->name);
+    }
+    if (strlen(options->name) > 300 || strlen(section) > 200) {
+        fprintf(stderr, "name too long\n");
+        return -1;
+    }
+
+    // String tables (index 0 is the empty string)
+    strtab[0] = 0;
+    nameIx[0] = strtabLen;
+    strtabLen += sprintf(&strtab[strtabLen], "%s", options->name) + 1;
+    nameIx[1] = strtabLen;
+    strtabLen += sprintf(&strtab[strtabLen], "%s_end", options->name) + 1;
+    nameIx[2] = strtabLen;
+    strtabLen += sprintf(&strtab[strtabLen], "%s_size", options->name) + 1;
+    shstrtab[0] = 0;
+    shNameIx[0] = shstrtabLen;
+    shstrtabLen += sprintf(&shstrtab[shstrtabLen], "%s", section) + 1;
+    shNameIx[1] = shstrtabLen;
+    shstrtabLen += sprintf(&shstrtab[shstrtabLen], ".symtab") + 1;
+    shNameIx[2] = shstrtabLen;
+    shstrtabLen += sprintf(&shstrtab[shstrtabLen], ".strtab") + 1;
+    shNameIx[3] = shstrtabLen;
+    shstrtabLen += sprintf(&shstrtab[shstrtabLen], ".shstrtab") + 1;
+    shNameIx[4] = shstrtabLen;
+    shstrtabLen += sprintf(&shstrtab[shstrtabLen], ".note.GNU-stack") + 1;
+
+    // Layout: ELF header, data, symtab, strtab, shstrtab, section headers
+    uint32_t ehdrSize = machine.is64 ? 64 : 52;
+    uint32_t shdrSize = machine.is64 ? 64 : 40;
+    uint32_t symSize = machine.is64 ? 24 : 16;
+    uint32_t align = options->align ? options->align : 4;
+    uint32_t dataOffset = (ehdrSize + align - 1) & ~(align - 1);
+    uint32_t symtabOffset = (dataOffset + len + 7) & ~7u;
+    uint32_t strtabOffset = symtabOffset + 5 * symSize;
+    uint32_t shstrtabOffset = strtabOffset + strtabLen;
+    uint32_t shdrOffset = (shstrtabOffset + shstrtabLen + 7) & ~7u;
+
+    // Symbols: null, section, name, name_end, name_size
+    memset(symtab, 0, sizeof(symtab));
+    for (i = 1; i < 5; i++) {
+        uint8_t *s = symtab[i];
+        uint32_t name = (i == 1) ? 0 : nameIx[i - 2];
+        uint8_t info = (i == 1) ? 0x03 : (i == 2) ? 0x11 : 0x10; // LOCAL SECTION, GLOBAL OBJECT, GLOBAL NOTYPE
+        uint16_t shndx = (i == 4) ? 0xfff1 : 1;                  // name_size is absolute
+        uint64_t value = (i >= 3) ? len : 0;
+        uint64_t size = (i == 2) ? len : 0;
+        if (machine.is64) {
+            elfPut(s, name, 4);
+            s[4] = info;
+            elfPut(s + 6, shndx, 2);
+            elfPut(s + 8, value, 8);
+            elfPut(s + 16, size, 8);
+        } else {
+            elfPut(s, name, 4);
+            elfPut(s + 4, value, 4);
+            elfPut(s + 8, size, 4);
+            s[12] = info;
+            elfPut(s + 14, shndx, 2);
+        }
+    }
+
+    // Section headers: null, data, symtab, strtab, shstrtab, .note.GNU-stack (no executable stack)
+    memset(shdr, 0, sizeof(shdr));
+    struct {
+        uint32_t name, type;
+        uint64_t flags, offset, size;
+        uint32_t link, info;
+        uint64_t align, entsize;
+    } sections[NOF_SECTIONS] = {
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+        { shNameIx[0], 1, 2, dataOffset, len, 0, 0, align, 0 },              // PROGBITS, ALLOC
+        { shNameIx[1], 2, 0, symtabOffset, 5 * symSize, 3, 2, 8, symSize },  // SYMTAB, first global 2
+        { shNameIx[2], 3, 0, strtabOffset, strtabLen, 0, 0, 1, 0 },          // STRTAB
+        { shNameIx[3], 3, 0, shstrtabOffset, shstrtabLen, 0, 0, 1, 0 },
+        { shNameIx[4], 1, 0, shstrtabOffset, 0, 0, 0, 1, 0 },
+    };
+    for (i = 1; i < NOF_SECTIONS; i++) {
+        uint8_t *h = shdr[i];
+        if (machine.is64) {
+            elfPut(h, sections[i].name, 4);
+            elfPut(h + 4, sections[i].type, 4);
+            elfPut(h + 8, sections[i].flags, 8);
+            elfPut(h + 24, sections[i].offset, 8);
+            elfPut(h + 32, sections[i].size, 8);
+            elfPut(h + 40, sections[i].link, 4);
+            elfPut(h + 44, sections[i].info, 4);
+            elfPut(h + 48, sections[i].align, 8);
+            elfPut(h + 56, sections[i].entsize, 8);
+        } else {
+            elfPut(h, sections[i].name, 4);
+            elfPut(h + 4, sections[i].type, 4);
+            elfPut(h + 8, sections[i].flags, 4);
+            elfPut(h + 16, sections[i].offset, 4);
+            elfPut(h + 20, sections[i].size, 4);
+            elfPut(h + 24, sections[i].link, 4);
+            elfPut(h + 28, sections[i].info, 4);
+            elfPut(h + 32, sections[i].align, 4);
+            elfPut(h + 36, sections[i].entsize, 4);
+        }
+    }
+
+    memset(ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr, "\x7f" "ELF", 4);
+    ehdr[4] = machine.is64 ? 2 : 1;
+    ehdr[5] = 1; // little endian
+    ehdr[6] = 1;
+    elfPut(ehdr + 16, 1, 2); // ET_REL
+    elfPut(ehdr + 18, machine.machine, 2);
+    elfPut(ehdr + 20, 1, 4);
+    if (machine.is64) {
+        elfPut(ehdr + 40, shdrOffset, 8);
+        elfPut(ehdr + 48, machine.flags, 4);
+        elfPut(ehdr + 52, ehdrSize, 2);
+        elfPut(ehdr + 58, shdrSize, 2);
+        elfPut(ehdr + 60, NOF_SECTIONS, 2);
+        elfPut(ehdr + 62, 4, 2);
+    } else {
+        elfPut(ehdr + 32, shdrOffset, 4);
+        elfPut(ehdr + 36, machine.flags, 4);
+        elfPut(ehdr + 40, ehdrSize, 2);
+        elfPut(ehdr + 46, shdrSize, 2);
+        elfPut(ehdr + 48, NOF_SECTIONS, 2);
+        elfPut(ehdr + 50, 4, 2);
+    }
+
+    fwrite(ehdr, 1, ehdrSize, b);
+    fwrite(zeros, 1, dataOffset - ehdrSize, b);
+    fwrite(data, 1, len, b);
+    fwrite(zeros, 1, symtabOffset - dataOffset - len, b);
+    for (i = 0; i < 5; i++) {
+        fwrite(symtab[i], 1, symSize, b);
+    }
+    fwrite(strtab, 1, strtabLen, b);
+    fwrite(shstrtab, 1, shstrtabLen, b);
+    fwrite(zeros, 1, shdrOffset - shstrtabOffset - shstrtabLen, b);
+    for (i = 0; i < NOF_SECTIONS; i++) {
+        fwrite(shdr[i], 1, shdrSize, b);
+    }
+    return 0;
+}
+
+// A TFwuFrameCache (fwu.h) for the library to send the data object from: every WRITE frame
+// encoded as it goes on the wire, the index of the frames and the running CRC at the end of
+// every data object. The session only passes pointers into flash to txFunction.
+static int writeFrames(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    uint32_t chunkSize = options->chunkSize;
+    uint32_t nofFrames = (len + chunkSize - 1) / chunkSize;
+    uint32_t nofCrcs = (len + options->crcStride - 1) / options->crcStride;
+    uint8_t *frames = malloc(nofFrames * 2 + 2 * len + 1);
+    uint32_t *frameOffsets = malloc((nofFrames + 1) * sizeof(uint32_t));
+    uint32_t *crcs = malloc((nofCrcs + 1) * sizeof(uint32_t));
+    uint32_t crc = 0xffffffff;
+    uint32_t offset = 0;
+    uint32_t escapes = 0;
+    uint32_t pos = 0;
+    uint32_t frame;
 
-    fprintf(b, "uint8_t %s[] = {\n", argv[3]);
-    while (EOF != (c = fgetc(f))) {
-        if (i == 0) {
-            fprintf(b, "   ");
+    if (!frames || !frameOffsets || !crcs) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    // Same encoding as fwuFrameCacheBuild, for any chunk size.
+    for (frame = 0; frame < nofFrames; frame++) {
+        uint32_t n = (len - pos < chunkSize) ? len - pos : chunkSize;
+        uint32_t i;
+        frameOffsets[frame] = offset;
+        frames[offset++] = 0x08; // WRITE OBJECT
+        for (i = 0; i < n; i++) {
+            uint8_t c = data[pos + i];
+            if (c == 0xC0 || c == 0xDB) {
+                frames[offset++] = 0xDB;
+                frames[offset++] = (c == 0xC0) ? 0xDC : 0xDD;
+                escapes++;
+            } else {
+                frames[offset++] = c;
+            }
         }
-        if (i > 0 || !isFirstByte) {
-            fprintf(b,",");
+        frames[offset++] = 0xC0;
+        crc = fwuCrc32Update(crc, &data[pos], n);
+        pos += n;
+        if (pos % options->crcStride == 0 || pos == len) {
+            crcs[(pos - 1) / options->crcStride] = crc;
+        }
+    }
+    frameOffsets[nofFrames] = offset;
+
+    fprintf(b, "// Firmware BLOB - automatically generated\n");
+    fprintf(b, "\n");
+    fprintf(b, "#ifndef __FW_BLOB_%s_H__\n", options->name);
+    fprintf(b, "#define __FW_BLOB_%s_H__ 1\n", options->name);
+    fprintf(b, "\n");
+    fprintf(b, "#include <stdint.h>\n");
+    fprintf(b, "#include \"fwu.h\"\n");
+    fprintf(b, "\n");
+    fprintf(b, "// %u WRITE frames of %u payload bytes (08 <escaped payload> C0), %u escapes\n",
+            nofFrames, chunkSize, escapes);
+    fprintf(b, "const uint8_t %sFrames[]%s = {\n", options->name, options->attributes);
+    writeArray(b, frames, offset);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "// Frame i starts at %sFrameOffsets[i] and ends before %sFrameOffsets[i + 1]\n",
+            options->name, options->name);
+    fprintf(b, "const uint32_t %sFrameOffsets[]%s = {\n", options->name, options->sectionAttribute);
+    writeWords(b, frameOffsets, nofFrames + 1);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "// Running CRC32 (not inverted) after every %lu bytes and at the end\n", options->crcStride);
+    fprintf(b, "const uint32_t %sCrcs[]%s = {\n", options->name, options->sectionAttribute);
+    writeWords(b, crcs, nofCrcs);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "const TFwuFrameCache %s%s = {\n", options->name, options->sectionAttribute);
+    fprintf(b, "    .dataLen = %uu,\n", len);
+    fprintf(b, "    .chunkSize = %u,\n", chunkSize);
+    fprintf(b, "    .nofFrames = %uu,\n", nofFrames);
+    fprintf(b, "    .frames = %sFrames,\n", options->name);
+    fprintf(b, "    .frameOffsets = %sFrameOffsets,\n", options->name);
+    fprintf(b, "    .crcStride = %luu,\n", options->crcStride);
+    fprintf(b, "    .crcs = %sCrcs,\n", options->name);
+    fprintf(b, "};\n");
+
+    if (options->metadata) {
+        writeMetadata(b, options, data, len);
+    } else {
+        fprintf(b, "\n");
+        fprintf(b, "#define %s_LEN %uu\n", options->name, len);
+    }
+
+    fprintf(b, "\n");
+    fprintf(b, "#endif // __FW_BLOB_%s_H__\n", options->name);
+    free(frames);
+    free(frameOffsets);
+    free(crcs);
+    return 0;
+}
+
+// uint32_t initializers, 8 per line
+static void writeWords(FILE *b, const uint32_t *words, uint32_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[4 + 8 * 13 + 1];
+    uint32_t pos;
+
+    for (pos = 0; pos < n; pos += 8) {
+        uint32_t count = (n - pos < 8) ? n - pos : 8;
+        char *p = line;
+        uint32_t i;
+        int k;
+        memcpy(p, "    ", 4);
+        p += 4;
+        for (i = 0; i < count; i++) {
+            uint32_t w = words[pos + i];
+            *p++ = '0';
+            *p++ = 'x';
+            for (k = 28; k >= 0; k -= 4) {
+                *p++ = hex[(w >> k) & 15];
+            }
+            *p++ = 'u';
+            *p++ = ',';
+            *p++ = ' ';
         }
-        fprintf(b, " 0x%02x", c);
-        i++;
-        if (i == 16) {
-            fprintf(b, "\n");
-            i = 0;
+        p[-1] = '\n';
+        fwrite(line, 1, p - line, b);
+    }
+}
+
+// A TFwuLz4Image (fwu_lz4.h): every block compressed on its own, so the reader can start
+// at any block when a data object is repeated or resumed.
+static int writeLz4(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    uint32_t blockSize = options->blockSize;
+    uint32_t nofBlocks = (len + blockSize - 1) / blockSize;
+    // Incompressible blocks are stored, so the output never exceeds the input.
+    uint8_t *blocks = malloc(len + lz4MaxOverhead(blockSize));
+    uint32_t *blockOffsets = malloc((nofBlocks + 1) * sizeof(uint32_t));
+    uint32_t offset = 0;
+    uint32_t nofStored = 0;
+    uint32_t block;
+
+    // The reader puts a chunk spanning blocks together from the window of each block.
+    if (blockSize < 32) {
+        fprintf(stderr, "lz4 needs a block size of at least 32 (FWU_DATA_CHUNK_SIZE)\n");
+        free(blocks);
+        free(blockOffsets);
+        return -1;
+    }
+    if (!blocks || !blockOffsets) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    for (block = 0; block < nofBlocks; block++) {
+        uint32_t pos = block * blockSize;
+        uint32_t n = (len - pos < blockSize) ? len - pos : blockSize;
+        uint32_t compressedLen = lz4CompressBlock(&data[pos], n, &blocks[offset]);
+        blockOffsets[block] = offset;
+        if (compressedLen >= n) {
+            memcpy(&blocks[offset], &data[pos], n);
+            compressedLen = n;
+            nofStored++;
         }
-        isFirstByte = 0;
+        offset += compressedLen;
     }
+    blockOffsets[nofBlocks] = offset;
+
+    fprintf(b, "// Firmware BLOB - automatically generated\n");
+    fprintf(b, "\n");
+    fprintf(b, "#ifndef __FW_BLOB_%s_H__\n", options->name);
+    fprintf(b, "#define __FW_BLOB_%s_H__ 1\n", options->name);
+    fprintf(b, "\n");
+    fprintf(b, "#include <stdint.h>\n");
+    fprintf(b, "#include \"fwu_lz4.h\"\n");
+    fprintf(b, "\n");
+    fprintf(b, "// %u blocks of %u bytes (%u stored), %u -> %u bytes (%.1f%%)\n",
+            nofBlocks, blockSize, nofStored, len, offset, len ? 100.0 * offset / len : 0.0);
+    fprintf(b, "const uint8_t %sBlocks[]%s = {\n", options->name, options->attributes);
+    writeArray(b, blocks, offset);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "// Block i starts at %sBlockOffsets[i] and ends before %sBlockOffsets[i + 1]\n",
+            options->name, options->name);
+    fprintf(b, "const uint32_t %sBlockOffsets[]%s = {\n", options->name, options->sectionAttribute);
+    writeWords(b, blockOffsets, nofBlocks + 1);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "const TFwuLz4Image %s%s = {\n", options->name, options->sectionAttribute);
+    fprintf(b, "    .dataLen = %uu,\n", len);
+    fprintf(b, "    .blockSize = %uu,\n", blockSize);
+    fprintf(b, "    .nofBlocks = %uu,\n", nofBlocks);
+    fprintf(b, "    .blocks = %sBlocks,\n", options->name);
+    fprintf(b, "    .blockOffsets = %sBlockOffsets,\n", options->name);
     fprintf(b, "};\n");
 
+    if (options->metadata) {
+        writeMetadata(b, options, data, len);
+    } else {
+        fprintf(b, "\n");
+        fprintf(b, "#define %s_LEN %uu\n", options->name, len);
+    }
+
     fprintf(b, "\n");
-    fprintf(b, "#endif // __FW_BLOB_%s_H__\n", argv[3]);
+    fprintf(b, "#endif // __FW_BLOB_%s_H__\n", options->name);
+    fprintf(stderr, "%s: %u -> %u bytes (%.1f%%)\n", options->name, len, offset, len ? 100.0 * offset / len : 0.0);
+    free(blocks);
+    free(blockOffsets);
+    return 0;
+}
+
+// LZ4 block format: sequences of a token (literal length << 4 | match length - 4), more
+// length bytes for values from 15 on, the literals, a 16 bit little endian match offset and
+// more match length bytes. The last 5 bytes are always literals and the last match starts
+// at least 12 bytes before the end, as the reference decoder requires.
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 14
+// Candidates tried per position; compression runs on the host, so it can search hard.
+#define LZ4_MAX_CHAIN 4096
 
-    fclose(b);
+static uint32_t lz4MaxOverhead(uint32_t len)
+{
+    return len / 255 + 16;
+}
+
+static uint8_t *lz4PutLength(uint8_t *p, uint32_t len)
+{
+    while (len >= 255) {
+        *p++ = 255;
+        len -= 255;
+    }
+    *p++ = (uint8_t)len;
+    return p;
+}
+
+static uint8_t *lz4PutSequence(uint8_t *p, const uint8_t *literals, uint32_t litLen, uint32_t offset,
+                               uint32_t matchLen)
+{
+    uint8_t *token = p++;
+    *token = (uint8_t)((litLen < 15 ? litLen : 15) << 4);
+    if (litLen >= 15) {
+        p = lz4PutLength(p, litLen - 15);
+    }
+    memcpy(p, literals, litLen);
+    p += litLen;
+    if (matchLen == 0) {
+        return p; // last sequence
+    }
+    *p++ = offset & 0xff;
+    *p++ = offset >> 8;
+    matchLen -= LZ4_MIN_MATCH;
+    *token |= (uint8_t)(matchLen < 15 ? matchLen : 15);
+    if (matchLen >= 15) {
+        p = lz4PutLength(p, matchLen - 15);
+    }
+    return p;
+}
+
+static uint32_t lz4Hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Greedy parse with the longest match from a hash chain; returns the compressed length.
+// dst must hold len + lz4MaxOverhead(len) bytes.
+static uint32_t lz4CompressBlock(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+    int32_t head[1 << LZ4_HASH_BITS];
+    int32_t *chain = malloc((len ? len : 1) * sizeof(int32_t));
+    uint8_t *p = dst;
+    uint32_t anchor = 0;
+    uint32_t ip = 0;
+    uint32_t i;
+
+    for (i = 0; i < (1 << LZ4_HASH_BITS); i++) {
+        head[i] = -1;
+    }
+    while (len > LZ4_MATCH_LIMIT && ip < len - LZ4_MATCH_LIMIT) {
+        uint32_t h = lz4Hash(&src[ip]);
+        uint32_t limit = len - LZ4_LAST_LITERALS - ip;
+        uint32_t bestLen = 0;
+        uint32_t bestOffset = 0;
+        int32_t candidate = head[h];
+        int depth = LZ4_MAX_CHAIN;
+
+        while (candidate >= 0 && ip - candidate <= LZ4_MAX_OFFSET && depth-- > 0) {
+            uint32_t n = 0;
+            while (n < limit && src[candidate + n] == src[ip + n]) {
+                n++;
+            }
+            if (n > bestLen) {
+                bestLen = n;
+                bestOffset = ip - candidate;
+                if (n == limit) {
+                    break;
+                }
+            }
+            candidate = chain[candidate];
+        }
+        chain[ip] = head[h];
+        head[h] = ip;
+
+        if (bestLen < LZ4_MIN_MATCH) {
+            ip++;
+            continue;
+        }
+        p = lz4PutSequence(p, &src[anchor], ip - anchor, bestOffset, bestLen);
+        // Positions inside the match become candidates for later matches.
+        for (i = 1; i < bestLen && ip + i + LZ4_MIN_MATCH <= len; i++) {
+            uint32_t hi = lz4Hash(&src[ip + i]);
+            chain[ip + i] = head[hi];
+            head[hi] = ip + i;
+        }
+        ip += bestLen;
+        anchor = ip;
+    }
+    p = lz4PutSequence(p, &src[anchor], len - anchor, 0, 0);
+    free(chain);
+    return (uint32_t)(p - dst);
+}
+
+static uint8_t *readFile(const char *path, long *len)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *data;
+
+    if (!f) {
+        fprintf(stderr, "failed to open firmware input file %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(*len > 0 ? *len : 1);
+    if (*len < 0 || !data || fread(data, 1, *len, f) != (size_t)*len) {
+        fprintf(stderr, "failed to read firmware input file %s\n", path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static int isHexInput(const TOptions *options, const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (options->hexInput >= 0) {
+        return options->hexInput;
+    }
+    return ext && (!strcmp(ext, ".hex") || !strcmp(ext, ".ihex"));
+}
+
+// Firmware images are raw binaries or Intel HEX files (converted as they are read).
+static uint8_t *readImage(const TOptions *options, const char *path, long *len)
+{
+    return isHexInput(options, path) ? readHex(options, path, len) : readFile(path, len);
+}
+
+// Intel HEX input (ihex.c), placed in the flash region given by the options
+static uint8_t *readHex(const TOptions *options, const char *path, long *len)
+{
+    long textLen;
+    uint8_t *text = readFile(path, &textLen);
+    uint8_t *image;
+    TIhexInfo info;
+
+    if (!text) {
+        return NULL;
+    }
+    image = ihexParse(path, text, textLen, options->flashOrigin, options->flashLength, &info);
+    free(text);
+    if (image) {
+        *len = info.len;
+        fprintf(stderr, "%s: 0x%08x..0x%08x, %u bytes (%u filled with 0xff)\n",
+                path, info.start, info.start + info.len - 1, info.len, info.len - info.nofDataBytes);
+    }
+    return image;
+}
+
+// Takes the flash region from the FLASH line of a GNU ld MEMORY command, e.g.
+// "FLASH (rx) : ORIGIN = 0x26000, LENGTH = 0x5a000" in 01_Demo_App/main.ld.
+static int readLinkerScript(TOptions *options, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+
+    if (!f) {
+        fprintf(stderr, "failed to open linker script %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *name = line + strspn(line, " \t");
+        char *origin = strstr(line, "ORIGIN");
+        char *length = strstr(line, "LENGTH");
+        if (strncmp(name, "FLASH", 5) != 0 || !origin || !length) {
+            continue;
+        }
+        origin += strcspn(origin, "=");
+        length += strcspn(length, "=");
+        if (*origin && *length) {
+            options->flashOrigin = strtoul(origin + 1, NULL, 0);
+            options->flashLength = strtoul(length + 1, NULL, 0);
+            fclose(f);
+            return 0;
+        }
+    }
     fclose(f);
+    fprintf(stderr, "%s: no FLASH memory region\n", path);
+    return -1;
+}
+
+// Patch operations, see EFwuDeltaOp in fwu_delta.h.
+#define DELTA_OP_COPY 0
+#define DELTA_OP_LITERAL 1
+#define DELTA_OP_RUN 2
+// Shortest copy from a new position in the previous image and shortest run worth an
+// operation; continuing at the expected position pays off from 4 bytes on.
+#define DELTA_MIN_COPY 8
+#define DELTA_MIN_CONTINUE 4
+#define DELTA_MIN_RUN 6
+#define DELTA_HASH_BITS 16
+#define DELTA_MAX_CHAIN 1024
+
+typedef struct {
+    const uint8_t *base;
+    uint32_t baseLen;
+    int32_t *head;
+    int32_t *chain;
+} TDeltaIndex;
+
+static uint32_t deltaHash(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - DELTA_HASH_BITS);
+}
+
+static uint8_t *deltaPutVarint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint8_t *deltaPutOp(uint8_t *p, uint8_t type, uint32_t len)
+{
+    if (len <= 63) {
+        *p++ = (uint8_t)((type << 6) | (len - 1));
+    } else {
+        *p++ = (uint8_t)((type << 6) | 63);
+        p = deltaPutVarint(p, len - 64);
+    }
+    return p;
+}
+
+static uint32_t deltaMatch(const TDeltaIndex *index, uint32_t from, const uint8_t *src, uint32_t len)
+{
+    uint32_t n = 0;
+    while (n < len && from + n < index->baseLen && index->base[from + n] == src[n]) {
+        n++;
+    }
+    return n;
+}
+
+// Encode one block of the new image at position start; dst must hold 2 * len + 16 bytes.
+static uint32_t deltaEncodeBlock(const TDeltaIndex *index, uint32_t start, const uint8_t *src, uint32_t len,
+                                 uint8_t *dst)
+{
+    uint8_t *p = dst;
+    uint32_t literals = 0;
+    uint32_t ip = 0;
+
+    while (ip < len) {
+        uint32_t expected = start + ip;
+        uint32_t remaining = len - ip;
+        uint32_t bestLen = 0;
+        uint32_t bestFrom = 0;
+        uint32_t runLen = 1;
+
+        // The same position as in the new image, usually right after a changed byte
+        if (expected < index->baseLen) {
+            bestLen = deltaMatch(index, expected, &src[ip], remaining);
+            bestFrom = expected;
+            if (bestLen < DELTA_MIN_CONTINUE) {
+                bestLen = 0;
+            }
+        }
+        // Anywhere in the previous image, for moved code
+        if (bestLen < remaining && remaining >= 4 && index->baseLen >= 4) {
+            int32_t candidate = index->head[deltaHash(&src[ip])];
+            int depth = DELTA_MAX_CHAIN;
+            while (candidate >= 0 && depth-- > 0) {
+                uint32_t n = deltaMatch(index, candidate, &src[ip], remaining);
+                // Moving costs address bytes; only a clearly longer match is worth it.
+                if (n >= DELTA_MIN_COPY && n > bestLen + 4) {
+                    bestLen = n;
+                    bestFrom = candidate;
+                }
+                candidate = index->chain[candidate];
+            }
+        }
+        while (runLen < remaining && src[ip + runLen] == src[ip]) {
+            runLen++;
+        }
+
+        if (bestLen == 0 && runLen < DELTA_MIN_RUN) {
+            literals++;
+            ip++;
+            continue;
+        }
+        if (literals) {
+            p = deltaPutOp(p, DELTA_OP_LITERAL, literals);
+            memcpy(p, &src[ip - literals], literals);
+            p += literals;
+            literals = 0;
+        }
+        if (runLen >= DELTA_MIN_RUN && runLen > bestLen) {
+            p = deltaPutOp(p, DELTA_OP_RUN, runLen);
+            *p++ = src[ip];
+            ip += runLen;
+        } else {
+            int32_t distance = (int32_t)(bestFrom - expected);
+            p = deltaPutOp(p, DELTA_OP_COPY, bestLen);
+            p = deltaPutVarint(p, distance < 0 ? ((uint32_t)~distance << 1) | 1 : (uint32_t)distance << 1);
+            ip += bestLen;
+        }
+    }
+    if (literals) {
+        p = deltaPutOp(p, DELTA_OP_LITERAL, literals);
+        memcpy(p, &src[ip - literals], literals);
+        p += literals;
+    }
+    return (uint32_t)(p - dst);
+}
+
+// A TFwuDeltaPatch (fwu_delta.h): the new image block by block as copies from the previous
+// image, new bytes and runs, with a CRC per block to catch a wrong previous image.
+static int writeDelta(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    TDeltaIndex index;
+    long baseLen;
+    uint32_t blockSize = options->blockSize;
+    uint32_t nofBlocks = (len + blockSize - 1) / blockSize;
+    uint8_t *ops = malloc(2 * len + 16 * nofBlocks + 1);
+    uint32_t *blockOffsets = malloc((nofBlocks + 1) * sizeof(uint32_t));
+    uint32_t *blockCrcs = malloc((nofBlocks + 1) * sizeof(uint32_t));
+    uint32_t offset = 0;
+    uint32_t block;
+    uint32_t i;
+
+    // The reader puts a chunk spanning blocks together from the window of each block.
+    if (blockSize < 32) {
+        fprintf(stderr, "delta needs a block size of at least 32 (FWU_DATA_CHUNK_SIZE)\n");
+        free(ops);
+        free(blockOffsets);
+        free(blockCrcs);
+        return -1;
+    }
+    index.base = readImage(options, options->basePath, &baseLen);
+    if (!index.base) {
+        return -1;
+    }
+    index.baseLen = baseLen;
+    index.head = malloc((1 << DELTA_HASH_BITS) * sizeof(int32_t));
+    index.chain = malloc((baseLen ? baseLen : 1) * sizeof(int32_t));
+    if (!ops || !blockOffsets || !blockCrcs || !index.head || !index.chain) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    // Chains run from the lowest position up, so equal matches prefer the nearest code.
+    for (i = 0; i < (1 << DELTA_HASH_BITS); i++) {
+        index.head[i] = -1;
+    }
+    for (i = index.baseLen >= 4 ? index.baseLen - 4 + 1 : 0; i-- > 0;) {
+        uint32_t h = deltaHash(&index.base[i]);
+        index.chain[i] = index.head[h];
+        index.head[h] = i;
+    }
+
+    for (block = 0; block < nofBlocks; block++) {
+        uint32_t pos = block * blockSize;
+        uint32_t n = (len - pos < blockSize) ? len - pos : blockSize;
+        blockOffsets[block] = offset;
+        offset += deltaEncodeBlock(&index, pos, &data[pos], n, &ops[offset]);
+        blockCrcs[block] = ~fwuCrc32Update(0xffffffff, &data[pos], n);
+    }
+    blockOffsets[nofBlocks] = offset;
+
+    fprintf(b, "// Firmware BLOB - automatically generated\n");
+    fprintf(b, "\n");
+    fprintf(b, "#ifndef __FW_BLOB_%s_H__\n", options->name);
+    fprintf(b, "#define __FW_BLOB_%s_H__ 1\n", options->name);
+    fprintf(b, "\n");
+    fprintf(b, "#include <stdint.h>\n");
+    fprintf(b, "#include \"fwu_delta.h\"\n");
+    fprintf(b, "\n");
+    fprintf(b, "// %u byte image as a patch of %u bytes (%.1f%%) against a %ld byte image, %u blocks of %u bytes\n",
+            len, offset, len ? 100.0 * offset / len : 0.0, baseLen, nofBlocks, blockSize);
+    fprintf(b, "const uint8_t %sOps[]%s = {\n", options->name, options->attributes);
+    writeArray(b, ops, offset);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "// Block i starts at %sBlockOffsets[i] and ends before %sBlockOffsets[i + 1]\n",
+            options->name, options->name);
+    fprintf(b, "const uint32_t %sBlockOffsets[]%s = {\n", options->name, options->sectionAttribute);
+    writeWords(b, blockOffsets, nofBlocks + 1);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "// CRC32 of every block of the new image\n");
+    fprintf(b, "const uint32_t %sBlockCrcs[]%s = {\n", options->name, options->sectionAttribute);
+    writeWords(b, blockCrcs, nofBlocks);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "const TFwuDeltaPatch %s%s = {\n", options->name, options->sectionAttribute);
+    fprintf(b, "    .dataLen = %uu,\n", len);
+    fprintf(b, "    .blockSize = %uu,\n", blockSize);
+    fprintf(b, "    .nofBlocks = %uu,\n", nofBlocks);
+    fprintf(b, "    .baseLen = %ldu,\n", baseLen);
+    fprintf(b, "    .baseCrc = 0x%08xu,\n", ~fwuCrc32Update(0xffffffff, index.base, index.baseLen));
+    fprintf(b, "    .ops = %sOps,\n", options->name);
+    fprintf(b, "    .blockOffsets = %sBlockOffsets,\n", options->name);
+    fprintf(b, "    .blockCrcs = %sBlockCrcs,\n", options->name);
+    fprintf(b, "};\n");
+
+    if (options->metadata) {
+        writeMetadata(b, options, data, len);
+    } else {
+        fprintf(b, "\n");
+        fprintf(b, "#define %s_LEN %uu\n", options->name, len);
+    }
+
+    fprintf(b, "\n");
+    fprintf(b, "#endif // __FW_BLOB_%s_H__\n", options->name);
+    fprintf(stderr, "%s: %u bytes as a %u byte patch (%.1f%%)\n", options->name, len, offset,
+            len ? 100.0 * offset / len : 0.0);
+    free((void *)index.base);
+    free(index.head);
+    free(index.chain);
+    free(ops);
+    free(blockOffsets);
+    free(blockCrcs);
+    return 0;
+}
+
+// The header is written field by field, little endian, at the offsets of TFwuContainerHeader
+// (fwu_container.h); the target reads it in place.
+#define CONTAINER_HEADER_CRC_OFFSET offsetof(TFwuContainerHeader, headerCrc)
+#define CONTAINER_HEADER_LEN sizeof(TFwuContainerHeader)
+#define PUT_HEADER_FIELD(header, field, v) \
+    putLe(&(header)[offsetof(TFwuContainerHeader, field)], (v), sizeof(((TFwuContainerHeader *)0)->field))
+
+// No padding: the CRC covers every byte before it and ends the header.
+typedef char TContainerHeaderPacked[CONTAINER_HEADER_CRC_OFFSET + 4 == CONTAINER_HEADER_LEN ? 1 : -1];
+
+static void putLe(uint8_t *p, uint32_t v, int size)
+{
+    int i;
+    for (i = 0; i < size; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+// Header, init packet, image and CRC table in one binary blob; every object starts on the
+// alignment (--align, default 16) so the image can be executed or DMA'd in place.
+static int writeContainer(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    long datLen;
+    uint8_t *dat = readFile(options->datPath, &datLen);
+    uint32_t align = options->align ? options->align : 16;
+    uint32_t nofCrcs = (len + options->crcStride - 1) / options->crcStride;
+    uint8_t header[CONTAINER_HEADER_LEN];
+    uint8_t *blob;
+    uint32_t datOffset, binOffset, crcsOffset, totalLen;
+    uint32_t crc = 0xffffffff;
+    uint32_t pos;
+    TFwuSha256 sha;
+
+    if (!dat) {
+        return -1;
+    }
+    if (align < 4) {
+        align = 4;
+    }
+    datOffset = (CONTAINER_HEADER_LEN + align - 1) & ~(align - 1);
+    binOffset = (datOffset + datLen + align - 1) & ~(align - 1);
+    crcsOffset = (binOffset + len + align - 1) & ~(align - 1);
+    totalLen = crcsOffset + nofCrcs * 4;
+    blob = calloc(1, totalLen);
+    if (!blob) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    memcpy(&blob[datOffset], dat, datLen);
+    memcpy(&blob[binOffset], data, len);
+    for (pos = 0; pos < len; pos += options->crcStride) {
+        uint32_t n = (len - pos < options->crcStride) ? len - pos : options->crcStride;
+        crc = fwuCrc32Update(crc, &data[pos], n);
+        putLe(&blob[crcsOffset + pos / options->crcStride * 4], crc, 4);
+    }
+
+    memset(header, 0, sizeof(header));
+    PUT_HEADER_FIELD(header, magic, FWU_CONTAINER_MAGIC);
+    PUT_HEADER_FIELD(header, version, FWU_CONTAINER_VERSION);
+    PUT_HEADER_FIELD(header, headerLen, CONTAINER_HEADER_LEN);
+    PUT_HEADER_FIELD(header, totalLen, totalLen);
+    PUT_HEADER_FIELD(header, imageType, options->imageType);
+    PUT_HEADER_FIELD(header, fwVersion, options->fwVersion);
+    PUT_HEADER_FIELD(header, datOffset, datOffset);
+    PUT_HEADER_FIELD(header, datLen, datLen);
+    PUT_HEADER_FIELD(header, binOffset, binOffset);
+    PUT_HEADER_FIELD(header, binLen, len);
+    PUT_HEADER_FIELD(header, binCrc, ~crc);
+    PUT_HEADER_FIELD(header, crcStride, options->crcStride);
+    PUT_HEADER_FIELD(header, crcsOffset, crcsOffset);
+    PUT_HEADER_FIELD(header, nofCrcs, nofCrcs);
+    PUT_HEADER_FIELD(header, mtu, options->mtu);
+    PUT_HEADER_FIELD(header, chunkSize, options->chunkSize);
+    fwuSha256Init(&sha);
+    fwuSha256Update(&sha, data, len);
+    fwuSha256Final(&sha, &header[offsetof(TFwuContainerHeader, sha256)]);
+    PUT_HEADER_FIELD(header, headerCrc, ~fwuCrc32Update(0xffffffff, header, CONTAINER_HEADER_CRC_OFFSET));
+    memcpy(blob, header, sizeof(header));
+
+    if (fwrite(blob, 1, totalLen, b) != totalLen) {
+        fprintf(stderr, "failed to write the container\n");
+        free(blob);
+        free(dat);
+        return -1;
+    }
+    fprintf(stderr, "container: init packet %ld bytes at %u, image %u bytes at %u, %u CRCs every %lu bytes, %u bytes\n",
+            datLen, datOffset, len, binOffset, nofCrcs, options->crcStride, totalLen);
+    free(blob);
+    free(dat);
     return 0;
 }
+
+// Content-defined chunks end where the gear hash of the last 32 bytes has its top bits
+// clear, so a change only moves the boundaries near it and the chunks after it match
+// again. Chunks are a quarter to four times the block size, about the block size on
+// average.
+#define CHUNK_MIN_DIVISOR 4
+#define CHUNK_MAX_FACTOR 4
+
+typedef struct {
+    uint8_t *chunks;
+    uint32_t len;
+    uint32_t *offsets;
+    uint32_t *crcs;
+    uint32_t nofChunks;
+    // Open addressing hash table of chunk numbers + 1 by CRC
+    uint32_t *table;
+    uint32_t tableMask;
+} TChunkPool;
+
+static uint32_t sChunkGear[256];
+
+static void chunkInitGear(void)
+{
+    // Fixed xorshift sequence, so the same images always give the same chunks
+    uint32_t x = 0x9e3779b9;
+    int i;
+    for (i = 0; i < 256; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        sChunkGear[i] = x;
+    }
+}
+
+// Length of the chunk at the start of data
+static uint32_t chunkLen(const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    uint32_t blockSize = options->blockSize;
+    uint32_t minLen = blockSize / CHUNK_MIN_DIVISOR;
+    uint32_t maxLen = blockSize * CHUNK_MAX_FACTOR;
+    uint32_t mask = 0;
+    uint32_t hash = 0;
+    uint32_t i;
+
+    if (!options->contentDefined) {
+        return len < blockSize ? len : blockSize;
+    }
+    // One top bit per doubling of the distance from the minimum to the average length
+    for (i = 1; (1u << i) <= blockSize - minLen; i++) {
+        mask = (mask >> 1) | 0x80000000u;
+    }
+    for (i = 0; i < len && i < maxLen; i++) {
+        hash = (hash << 1) + sChunkGear[data[i]];
+        if (i + 1 >= minLen && (hash & mask) == 0) {
+            return i + 1;
+        }
+    }
+    return i;
+}
+
+// Returns the number of the chunk in the pool, adding it if it is new.
+static uint32_t chunkAdd(TChunkPool *pool, const uint8_t *data, uint32_t len)
+{
+    uint32_t crc = ~fwuCrc32Update(0xffffffff, data, len);
+    uint32_t slot;
+
+    for (slot = crc & pool->tableMask; pool->table[slot]; slot = (slot + 1) & pool->tableMask) {
+        uint32_t chunk = pool->table[slot] - 1;
+        if (pool->crcs[chunk] == crc && pool->offsets[chunk + 1] - pool->offsets[chunk] == len
+            && !memcmp(&pool->chunks[pool->offsets[chunk]], data, len)) {
+            return chunk;
+        }
+    }
+    memcpy(&pool->chunks[pool->len], data, len);
+    pool->crcs[pool->nofChunks] = crc;
+    pool->len += len;
+    pool->offsets[++pool->nofChunks] = pool->len;
+    pool->table[slot] = pool->nofChunks;
+    return pool->nofChunks - 1;
+}
+
+static void writeCString(FILE *b, const char *s)
+{
+    fputc('"', b);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', b);
+        }
+        fputc(*s, b);
+    }
+    fputc('"', b);
+}
+
+// A TFwuChunkStore (fwu_chunks.h): the images (the input file and every --variant) cut into
+// chunks, every distinct chunk stored once, and the list of chunks of every image.
+static int writeChunks(FILE *b, const TOptions *options, const uint8_t *data, uint32_t len)
+{
+    const char *paths[MAX_VARIANTS];
+    uint8_t *images[MAX_VARIANTS];
+    uint32_t lens[MAX_VARIANTS];
+    uint32_t *indices[MAX_VARIANTS];
+    uint32_t nofEntries[MAX_VARIANTS];
+    int nofVariants = options->nofVariants + 1;
+    uint32_t minLen = options->contentDefined ? options->blockSize / CHUNK_MIN_DIVISOR : options->blockSize;
+    uint32_t totalLen = 0;
+    uint32_t maxChunks = 0;
+    TChunkPool pool;
+    int v;
+
+    paths[0] = options->inPath;
+    images[0] = (uint8_t *)data;
+    lens[0] = len;
+    for (v = 1; v < nofVariants; v++) {
+        long n;
+        paths[v] = options->variantPaths[v - 1];
+        images[v] = readImage(options, paths[v], &n);
+        if (!images[v]) {
+            return -1;
+        }
+        lens[v] = n;
+    }
+    for (v = 0; v < nofVariants; v++) {
+        totalLen += lens[v];
+        maxChunks += lens[v] / minLen + 1;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    for (pool.tableMask = 1; pool.tableMask < 2 * maxChunks; pool.tableMask <<= 1) {
+    }
+    pool.table = calloc(pool.tableMask, sizeof(uint32_t));
+    pool.tableMask--;
+    pool.chunks = malloc(totalLen ? totalLen : 1);
+    pool.offsets = calloc(maxChunks + 1, sizeof(uint32_t));
+    pool.crcs = malloc(maxChunks * sizeof(uint32_t));
+    if (!pool.table || !pool.chunks || !pool.offsets || !pool.crcs) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    chunkInitGear();
+    for (v = 0; v < nofVariants; v++) {
+        uint32_t pos = 0;
+        indices[v] = malloc((lens[v] / minLen + 1) * sizeof(uint32_t));
+        if (!indices[v]) {
+            fprintf(stderr, "out of memory\n");
+            return -1;
+        }
+        nofEntries[v] = 0;
+        while (pos < lens[v]) {
+            uint32_t n = chunkLen(options, &images[v][pos], lens[v] - pos);
+            indices[v][nofEntries[v]++] = chunkAdd(&pool, &images[v][pos], n);
+            pos += n;
+        }
+    }
+
+    fprintf(b, "// Firmware BLOB - automatically generated\n");
+    fprintf(b, "\n");
+    fprintf(b, "#ifndef __FW_BLOB_%s_H__\n", options->name);
+    fprintf(b, "#define __FW_BLOB_%s_H__ 1\n", options->name);
+    fprintf(b, "\n");
+    fprintf(b, "#include <stdint.h>\n");
+    fprintf(b, "#include \"fwu_chunks.h\"\n");
+    fprintf(b, "\n");
+    fprintf(b, "// %d images of %u bytes in %u distinct %s chunks of %u bytes (%.1f%%)\n",
+            nofVariants, totalLen, pool.nofChunks, options->contentDefined ? "content-defined" : "fixed",
+            pool.len, totalLen ? 100.0 * pool.len / totalLen : 0.0);
+    fprintf(b, "const uint8_t %sChunks[]%s = {\n", options->name, options->attributes);
+    writeArray(b, pool.chunks, pool.len);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "// Chunk i starts at %sChunkOffsets[i] and ends before %sChunkOffsets[i + 1]\n",
+            options->name, options->name);
+    fprintf(b, "const uint32_t %sChunkOffsets[]%s = {\n", options->name, options->sectionAttribute);
+    writeWords(b, pool.offsets, pool.nofChunks + 1);
+    fprintf(b, "};\n");
+    for (v = 0; v < nofVariants; v++) {
+        fprintf(b, "\n");
+        fprintf(b, "// Chunks of %s\n", paths[v]);
+        fprintf(b, "const uint32_t %sIndex%d[]%s = {\n", options->name, v, options->sectionAttribute);
+        writeWords(b, indices[v], nofEntries[v]);
+        fprintf(b, "};\n");
+    }
+    fprintf(b, "\n");
+    fprintf(b, "const TFwuChunkVariant %sVariants[]%s = {\n", options->name, options->sectionAttribute);
+    for (v = 0; v < nofVariants; v++) {
+        const char *base = strrchr(paths[v], '/');
+        fprintf(b, "    { .name = ");
+        writeCString(b, base ? base + 1 : paths[v]);
+        fprintf(b, ", .dataLen = %uu, .dataCrc = 0x%08xu, .nofChunks = %uu, .index = %sIndex%d },\n",
+                lens[v], ~fwuCrc32Update(0xffffffff, images[v], lens[v]), nofEntries[v], options->name, v);
+    }
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "const TFwuChunkStore %s%s = {\n", options->name, options->sectionAttribute);
+    fprintf(b, "    .chunks = %sChunks,\n", options->name);
+    fprintf(b, "    .chunkOffsets = %sChunkOffsets,\n", options->name);
+    fprintf(b, "    .nofChunks = %uu,\n", pool.nofChunks);
+    fprintf(b, "    .variants = %sVariants,\n", options->name);
+    fprintf(b, "    .nofVariants = %du,\n", nofVariants);
+    fprintf(b, "};\n");
+    fprintf(b, "\n");
+    fprintf(b, "#endif // __FW_BLOB_%s_H__\n", options->name);
+    fprintf(stderr, "%s: %d images, %u bytes in %u chunks of %u bytes (%.1f%%)\n", options->name, nofVariants,
+            totalLen, pool.nofChunks, pool.len, totalLen ? 100.0 * pool.len / totalLen : 0.0);
+
+    for (v = 0; v < nofVariants; v++) {
+        if (v > 0) {
+            free(images[v]);
+        }
+        free(indices[v]);
+    }
+    free(pool.table);
+    free(pool.chunks);
+    free(pool.offsets);
+    free(pool.crcs);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [--format header|asm|object|frames|lz4|delta|container|chunks|bin] [--const]\n", prog);
+    fprintf(stderr, "          [--align <bytes>] [--section <name>] [--metadata] [--machine <arch>] [--header <file>]\n");
+    fprintf(stderr, "          [--chunk-size <bytes> | --mtu <bytes>] [--crc-stride <bytes>] [--block-size <bytes>]\n");
+    fprintf(stderr, "          [--base <previous-firmware-file>] [--dat <init-packet>] [--image-type <type>]\n");
+    fprintf(stderr, "          [--fw-version <n>] [--variant <firmware-file>]... [--content-defined]\n");
+    fprintf(stderr, "          [--input bin|hex] [--flash-origin <addr>] [--flash-length <bytes>] [--linker-script <file>]\n");
+    fprintf(stderr, "          <firmware-file> <output-file> <array-name>\n");
+    fprintf(stderr, "Generate a C header file with an array <array-name>\n");
+    fprintf(stderr, "from the specified firmware file (bin, dat or Intel HEX).\n");
+    fprintf(stderr, "  --format     header: C array (default); asm: assembler source that .incbin's the\n");
+    fprintf(stderr, "               file; object: ELF object. Both define <name>, <name>_end and <name>_size\n");
+    fprintf(stderr, "               in a read-only section; frames: the WRITE frames as a const TFwuFrameCache\n");
+    fprintf(stderr, "               <array-name> for TFwu.frameCache; lz4: the image compressed block by block as\n");
+    fprintf(stderr, "               a const TFwuLz4Image for fwu_lz4.h; delta: a patch against --base as a const\n");
+    fprintf(stderr, "               TFwuDeltaPatch for fwu_delta.h (include path: 03_Fwu_Library); container: one\n");
+    fprintf(stderr, "               binary file with the init packet, the image and its CRC table for\n");
+    fprintf(stderr, "               fwu_container.h (<array-name> may be omitted); chunks: the image and every\n");
+    fprintf(stderr, "               --variant in shared chunks as a const TFwuChunkStore for fwu_chunks.h; bin: the\n");
+    fprintf(stderr, "               raw image (<array-name> may be omitted)\n");
+    fprintf(stderr, "  --const      declare the array const so it stays in flash instead of RAM\n");
+    fprintf(stderr, "  --align      align the array to a power of two, e.g. a flash page (container: each object, 16)\n");
+    fprintf(stderr, "  --section    place the array (and its metadata) in a linker section\n");
+    fprintf(stderr, "  --metadata   add <array-name>Info with the length, CRC32 and SHA-256\n");
+    fprintf(stderr, "  --machine    ELF machine of the object: arm (default), aarch64, x86_64, i386\n");
+    fprintf(stderr, "  --header     with asm or object: also write a header declaring the symbols\n");
+    fprintf(stderr, "  --chunk-size frames, container: payload bytes per WRITE frame, the session's dataChunkSize (32)\n");
+    fprintf(stderr, "  --mtu        frames, container: largest chunk size whose frames fit into the target's MTU\n");
+    fprintf(stderr, "  --crc-stride frames, container: CRC table interval, the target's maximum data object size (4096)\n");
+    fprintf(stderr, "  --block-size lz4, delta: bytes per block, also the RAM window of the reader (4096);\n");
+    fprintf(stderr, "               chunks: bytes per chunk, the average with --content-defined\n");
+    fprintf(stderr, "  --base       delta: the previous image, as stored on the updating microcontroller\n");
+    fprintf(stderr, "  --dat        container: the init packet (.dat)\n");
+    fprintf(stderr, "  --image-type container: application, softdevice, bootloader or softdevice_bootloader\n");
+    fprintf(stderr, "  --fw-version container: version of the image\n");
+    fprintf(stderr, "  --variant    chunks: another image to store, e.g. for another board revision\n");
+    fprintf(stderr, "  --content-defined chunks: cut where the content says so, so insertions only change\n");
+    fprintf(stderr, "               the chunks around them\n");
+    fprintf(stderr, "  --input      firmware files are bin or Intel HEX (default: hex for *.hex and *.ihex);\n");
+    fprintf(stderr, "               HEX data is placed from its lowest address, gaps filled with 0xff\n");
+    fprintf(stderr, "  --flash-origin, --flash-length\n");
+    fprintf(stderr, "               flash region Intel HEX data must lie in (0x%x, 0x%x: 01_Demo_App/main.ld)\n",
+            APP_FLASH_ORIGIN, APP_FLASH_LENGTH);
+    fprintf(stderr, "  --linker-script  take the flash region from the FLASH line of a GNU ld script\n");
+}
@@ -0,0 +1,176 @@
+//
+//  ihex.c
+//  nrf52-dfu
+//
+//  Intel HEX parser shared by fwconvert and the package builder.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "ihex.h"
+
+static int ihexValue(uint8_t c);
+
+
+// Records (":LLAAAATT<data>CC") in one pass over the text, straight into an image of the flash
+// region filled with 0xff. The image runs from the lowest to the highest address written, as
+// with nrfutil.
+uint8_t *ihexParse(const char *name, const uint8_t *text, long textLen,
+                   uint32_t flashOrigin, uint32_t flashLength, TIhexInfo *info)
+{
+    const uint8_t *p = text;
+    const uint8_t *end = text + textLen;
+    uint32_t origin = flashOrigin;
+    uint32_t last = flashOrigin + flashLength - 1;
+    uint8_t *image = malloc(flashLength);
+    uint8_t *written = calloc((flashLength + 7) / 8, 1);
+    uint32_t base = 0;
+    uint32_t lowest = 0xffffffff;
+    uint32_t highest = 0;
+    uint32_t nofDataBytes = 0;
+    uint32_t line = 1;
+    int eof = 0;
+
+    if (!image || !written) {
+        fprintf(stderr, "out of memory\n");
+        goto fail;
+    }
+    memset(image, 0xff, flashLength);
+
+    while (!eof) {
+        uint8_t rec[5 + 255];
+        uint32_t recLen;
+        uint32_t addr;
+        uint8_t sum = 0;
+        uint32_t i;
+
+        while (p < end && (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t')) {
+            line += *p++ == '\n';
+        }
+        if (p == end) {
+            fprintf(stderr, "%s: no end of file record\n", name);
+            goto fail;
+        }
+        if (*p++ != ':') {
+            fprintf(stderr, "%s:%u: records start with ':'\n", name, line);
+            goto fail;
+        }
+        // Byte count, address, type, data and checksum
+        for (i = 0, recLen = 5; i < recLen; i++) {
+            int hi = (end - p >= 2) ? ihexValue(p[0]) : -1;
+            int lo = (end - p >= 2) ? ihexValue(p[1]) : -1;
+            if (hi < 0 || lo < 0) {
+                fprintf(stderr, "%s:%u: malformed record\n", name, line);
+                goto fail;
+            }
+            rec[i] = (uint8_t)(hi << 4 | lo);
+            sum += rec[i];
+            p += 2;
+            if (i == 0) {
+                recLen = 5 + rec[0];
+            }
+        }
+        if (sum != 0) {
+            fprintf(stderr, "%s:%u: checksum error\n", name, line);
+            goto fail;
+        }
+        addr = base + (rec[1] << 8 | rec[2]);
+        switch (rec[3]) {
+        case 0x00: // data
+            if (rec[0] == 0) {
+                break;
+            }
+            if (addr < origin || addr > last || (uint32_t)rec[0] - 1 > last - addr) {
+                fprintf(stderr, "%s:%u: data at 0x%08x..0x%08x is outside the flash region 0x%08x..0x%08x\n",
+                        name, line, addr, addr + rec[0] - 1, origin, last);
+                goto fail;
+            }
+            for (i = 0; i < rec[0]; i++) {
+                uint32_t offset = addr - origin + i;
+                if (written[offset / 8] & (1 << (offset % 8))) {
+                    fprintf(stderr, "%s:%u: data at 0x%08x was already written\n", name, line, addr + i);
+                    goto fail;
+                }
+                written[offset / 8] |= 1 << (offset % 8);
+                image[offset] = rec[4 + i];
+            }
+            if (addr < lowest) {
+                lowest = addr;
+            }
+            if (addr + rec[0] - 1 > highest) {
+                highest = addr + rec[0] - 1;
+            }
+            nofDataBytes += rec[0];
+            break;
+        case 0x01: // end of file
+            eof = 1;
+            break;
+        case 0x02: // extended segment address
+        case 0x04: // extended linear address
+            if (rec[0] != 2) {
+                fprintf(stderr, "%s:%u: malformed address record\n", name, line);
+                goto fail;
+            }
+            base = (uint32_t)(rec[4] << 8 | rec[5]) << (rec[3] == 0x02 ? 4 : 16);
+            break;
+        case 0x03: // start segment address
+        case 0x05: // start linear address
+            break;
+        default:
+            fprintf(stderr, "%s:%u: unknown record type %u\n", name, line, rec[3]);
+            goto fail;
+        }
+    }
+    if (nofDataBytes == 0) {
+        fprintf(stderr, "%s: no data\n", name);
+        goto fail;
+    }
+
+    info->start = lowest;
+    info->len = highest - lowest + 1;
+    info->nofDataBytes = nofDataBytes;
+    memmove(image, &image[lowest - origin], info->len);
+    free(written);
+    return image;
+
+fail:
+    free(image);
+    free(written);
+    return NULL;
+}
+
+static int ihexValue(uint8_t c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
@@ -0,0 +1,54 @@
+//
+//  ihex.h
+//  nrf52-dfu
+//
+//  Intel HEX parser shared by fwconvert and the package builder.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#ifndef __IHEX_H__
+#define __IHEX_H__ 1
+
+#include <inttypes.h>
+
+typedef struct {
+    // Address of the first byte of the image
+    uint32_t start;
+    // Length of the image, from the lowest to the highest address written
+    uint32_t len;
+    // Bytes written by data records; the rest of the image is gap fill (0xff)
+    uint32_t nofDataBytes;
+} TIhexInfo;
+
+
+// Parse the Intel HEX records of a file (name is used in messages) into an image of the flash
+// region flashOrigin..flashOrigin + flashLength - 1. Returns the image (free() it) with its
+// address and length in info, or prints what is wrong to stderr and returns NULL if the file
+// is malformed or writes outside the region or twice to the same address.
+uint8_t *ihexParse(const char *name, const uint8_t *text, long textLen,
+                   uint32_t flashOrigin, uint32_t flashLength, TIhexInfo *info);
+
+
+#endif // __IHEX_H__
@@ -0,0 +1,325 @@
+//
+//  capture.c
+//  nrf52-dfu
+//
+//  Serial DFU captures in pcapng format.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "capture.h"
+
+#define BLOCK_SHB 0x0A0D0D0A
+#define BLOCK_IDB 0x00000001
+#define BLOCK_EPB 0x00000006
+#define BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define OPT_ENDOFOPT 0
+#define OPT_COMMENT 1
+#define OPT_SHB_USERAPPL 4
+#define OPT_IF_NAME 2
+#define OPT_IF_SPEED 8
+#define OPT_IF_TSRESOL 9
+#define OPT_EPB_FLAGS 2
+
+// epb_flags direction bits
+#define EPB_INBOUND 1
+#define EPB_OUTBOUND 2
+
+static uint32_t optionSize(uint32_t len);
+static void writeU32(TCapture *capture, uint32_t v);
+static void writeU16(TCapture *capture, uint16_t v);
+static void writeOption(TCapture *capture, uint16_t code, const void *value, uint16_t len);
+static void writePadding(TCapture *capture, uint32_t len);
+static uint32_t readU32(const uint8_t *p);
+static uint16_t readU16(const uint8_t *p);
+
+
+int captureCreate(TCapture *capture, const char *path, const char *application)
+{
+    uint32_t len = 28 + optionSize(strlen(application)) + 4;
+
+    memset(capture, 0, sizeof(*capture));
+    capture->file = fopen(path, "wb");
+    if (!capture->file) {
+        perror(path);
+        return -1;
+    }
+    // Records are small and frequent; let stdio collect them.
+    setvbuf(capture->file, NULL, _IOFBF, 1 << 16);
+
+    writeU32(capture, BLOCK_SHB);
+    writeU32(capture, len);
+    writeU32(capture, BYTE_ORDER_MAGIC);
+    writeU16(capture, 1);          // version 1.0
+    writeU16(capture, 0);
+    writeU32(capture, 0xffffffff); // section length unknown
+    writeU32(capture, 0xffffffff);
+    writeOption(capture, OPT_SHB_USERAPPL, application, strlen(application));
+    writeOption(capture, OPT_ENDOFOPT, NULL, 0);
+    writeU32(capture, len);
+    return 0;
+}
+
+int captureAddInterface(TCapture *capture, const char *name, uint32_t baudrate, const char *comment)
+{
+    uint64_t speed = baudrate;
+    uint8_t tsresol = 6; // microseconds
+    uint32_t len = 20 + optionSize(strlen(name)) + optionSize(sizeof(speed)) + optionSize(1)
+        + optionSize(strlen(comment)) + 4;
+
+    writeU32(capture, BLOCK_IDB);
+    writeU32(capture, len);
+    writeU16(capture, CAPTURE_LINKTYPE);
+    writeU16(capture, 0);
+    writeU32(capture, 0);                // no snap length
+    writeOption(capture, OPT_IF_NAME, name, strlen(name));
+    writeOption(capture, OPT_IF_SPEED, &speed, sizeof(speed));
+    writeOption(capture, OPT_IF_TSRESOL, &tsresol, 1);
+    writeOption(capture, OPT_COMMENT, comment, strlen(comment));
+    writeOption(capture, OPT_ENDOFOPT, NULL, 0);
+    writeU32(capture, len);
+    return capture->nofInterfaces++;
+}
+
+void captureWrite(TCapture *capture, uint32_t interface, ECaptureDirection direction, uint64_t micros,
+                  const uint8_t *data, uint32_t len)
+{
+    uint32_t flags = (direction == CAPTURE_RX) ? EPB_INBOUND : EPB_OUTBOUND;
+    uint32_t blockLen = 28 + ((len + 3) & ~3u) + optionSize(sizeof(flags)) + 4 + 4;
+
+    writeU32(capture, BLOCK_EPB);
+    writeU32(capture, blockLen);
+    writeU32(capture, interface);
+    writeU32(capture, (uint32_t)(micros >> 32));
+    writeU32(capture, (uint32_t)micros);
+    writeU32(capture, len);
+    writeU32(capture, len);
+    fwrite(data, 1, len, capture->file);
+    writePadding(capture, len);
+    writeOption(capture, OPT_EPB_FLAGS, &flags, sizeof(flags));
+    writeOption(capture, OPT_ENDOFOPT, NULL, 0);
+    writeU32(capture, blockLen);
+}
+
+uint64_t captureMicros(void)
+{
+    static uint64_t sEpochOffset;
+    struct timespec mono;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    uint64_t monoMicros = (uint64_t)mono.tv_sec * 1000000 + mono.tv_nsec / 1000;
+    if (sEpochOffset == 0) {
+        struct timespec real;
+        clock_gettime(CLOCK_REALTIME, &real);
+        sEpochOffset = (uint64_t)real.tv_sec * 1000000 + real.tv_nsec / 1000 - monoMicros;
+    }
+    return sEpochOffset + monoMicros;
+}
+
+int captureLoad(TCapture *capture, const char *path)
+{
+    uint64_t unitsPerSecond[CAPTURE_MAX_INTERFACES];
+    uint8_t linkTypeOk[CAPTURE_MAX_INTERFACES];
+    FILE *f;
+    long size;
+    uint32_t pos;
+    int pass;
+
+    memset(capture, 0, sizeof(*capture));
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    capture->buffer = malloc(size > 0 ? size : 1);
+    if (size < 28 || fread(capture->buffer, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "%s: can't read capture\n", path);
+        fclose(f);
+        captureClose(capture);
+        return -1;
+    }
+    fclose(f);
+    if (readU32(capture->buffer) != BLOCK_SHB || readU32(capture->buffer + 8) != BYTE_ORDER_MAGIC) {
+        fprintf(stderr, "%s: not a pcapng file in host byte order\n", path);
+        captureClose(capture);
+        return -1;
+    }
+
+    // First pass counts the packets, the second one fills in the records.
+    for (pass = 0; pass < 2; pass++) {
+        capture->nofInterfaces = 0;
+        capture->nofRecords = 0;
+        for (pos = 0; pos + 12 <= (uint32_t)size; ) {
+            const uint8_t *block = capture->buffer + pos;
+            uint32_t type = readU32(block);
+            uint32_t len = readU32(block + 4);
+            if (len < 12 || len % 4 != 0 || len > size - pos) {
+                fprintf(stderr, "%s: broken block at offset %u\n", path, pos);
+                captureClose(capture);
+                return -1;
+            }
+            if (type == BLOCK_IDB && len >= 20 && capture->nofInterfaces < CAPTURE_MAX_INTERFACES) {
+                TCaptureInterface *interface = &capture->interfaces[capture->nofInterfaces];
+                uint32_t o = 16;
+                unitsPerSecond[capture->nofInterfaces] = 1000000;
+                linkTypeOk[capture->nofInterfaces] = readU16(block + 8) == CAPTURE_LINKTYPE;
+                while (o + 4 <= len - 4) {
+                    uint16_t code = readU16(block + o);
+                    uint16_t optLen = readU16(block + o + 2);
+                    const uint8_t *value = block + o + 4;
+                    if (code == OPT_ENDOFOPT || o + 4 + optLen > len - 4) {
+                        break;
+                    }
+                    if (code == OPT_IF_NAME || code == OPT_COMMENT) {
+                        char *dst = (code == OPT_IF_NAME) ? interface->name : interface->comment;
+                        size_t max = (code == OPT_IF_NAME) ? sizeof(interface->name) : sizeof(interface->comment);
+                        size_t n = optLen < max - 1 ? optLen : max - 1;
+                        memcpy(dst, value, n);
+                        dst[n] = 0;
+                    } else if (code == OPT_IF_SPEED && optLen == 8) {
+                        uint64_t speed;
+                        memcpy(&speed, value, sizeof(speed));
+                        interface->baudrate = (uint32_t)speed;
+                    } else if (code == OPT_IF_TSRESOL && optLen == 1
+                               && (*value & 0x7f) <= ((*value & 0x80) ? 63 : 19)) {
+                        // Larger exponents don't fit 64 bits; such an interface keeps microseconds.
+                        uint64_t units = 1;
+                        uint8_t i;
+                        for (i = 0; i < (*value & 0x7f); i++) {
+                            units *= (*value & 0x80) ? 2 : 10;
+                        }
+                        unitsPerSecond[capture->nofInterfaces] = units;
+                    }
+                    o += 4 + ((optLen + 3) & ~3u);
+                }
+                capture->nofInterfaces++;
+            } else if (type == BLOCK_EPB && len >= 32) {
+                uint32_t interface = readU32(block + 8);
+                uint32_t capLen = readU32(block + 20);
+                uint32_t o;
+                uint32_t flags = 0;
+                // The packet data and its padding must fit between the header and the trailing length.
+                if (interface >= capture->nofInterfaces || !linkTypeOk[interface] || capLen > len - 32) {
+                    pos += len;
+                    continue;
+                }
+                o = 28 + ((capLen + 3) & ~3u);
+                if (o > len - 4) {
+                    pos += len;
+                    continue;
+                }
+                while (o + 4 <= len - 4) {
+                    uint16_t code = readU16(block + o);
+                    uint16_t optLen = readU16(block + o + 2);
+                    if (code == OPT_ENDOFOPT || o + 4 + optLen > len - 4) {
+                        break;
+                    }
+                    if (code == OPT_EPB_FLAGS && optLen == 4) {
+                        flags = readU32(block + o + 4);
+                    }
+                    o += 4 + ((optLen + 3) & ~3u);
+                }
+                if (pass == 1) {
+                    TCaptureRecord *record = &capture->records[capture->nofRecords];
+                    uint64_t ts = ((uint64_t)readU32(block + 12) << 32) | readU32(block + 16);
+                    record->interface = interface;
+                    record->direction = ((flags & 3) == EPB_INBOUND) ? CAPTURE_RX : CAPTURE_TX;
+                    record->micros = ts / unitsPerSecond[interface] * 1000000
+                        + ts % unitsPerSecond[interface] * 1000000 / unitsPerSecond[interface];
+                    record->data = block + 28;
+                    record->len = capLen;
+                }
+                capture->nofRecords++;
+            }
+            pos += len;
+        }
+        if (pass == 0) {
+            capture->records = calloc(capture->nofRecords + 1, sizeof(TCaptureRecord));
+        }
+    }
+    return 0;
+}
+
+void captureClose(TCapture *capture)
+{
+    if (capture->file) {
+        fclose(capture->file);
+    }
+    free(capture->records);
+    free(capture->buffer);
+    memset(capture, 0, sizeof(*capture));
+}
+
+static uint32_t optionSize(uint32_t len)
+{
+    return 4 + ((len + 3) & ~3u);
+}
+
+static void writeU32(TCapture *capture, uint32_t v)
+{
+    fwrite(&v, sizeof(v), 1, capture->file);
+}
+
+static void writeU16(TCapture *capture, uint16_t v)
+{
+    fwrite(&v, sizeof(v), 1, capture->file);
+}
+
+static void writeOption(TCapture *capture, uint16_t code, const void *value, uint16_t len)
+{
+    writeU16(capture, code);
+    writeU16(capture, len);
+    if (len > 0) {
+        fwrite(value, 1, len, capture->file);
+        writePadding(capture, len);
+    }
+}
+
+static void writePadding(TCapture *capture, uint32_t len)
+{
+    static const uint8_t zeros[3];
+    if (len % 4 != 0) {
+        fwrite(zeros, 1, 4 - len % 4, capture->file);
+    }
+}
+
+static uint32_t readU32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint16_t readU16(const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
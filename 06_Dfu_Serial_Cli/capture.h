@@ -0,0 +1,97 @@
+//
+//  capture.h
+//  nrf52-dfu
+//
+//  Serial DFU captures in pcapng format: one interface per serial port, one
+//  packet per traced TX frame or RX chunk (see FTraceFunction), with the raw
+//  UART bytes as payload under the user link type LINKTYPE_USER0 (147).
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__ 1
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#define CAPTURE_LINKTYPE 147
+#define CAPTURE_MAX_INTERFACES 64
+
+// Direction of a record; the same values as EFwuTraceDirection
+typedef enum {
+    CAPTURE_TX = 0,
+    CAPTURE_RX = 1,
+} ECaptureDirection;
+
+typedef struct {
+    uint32_t interface;
+    ECaptureDirection direction;
+    // Microseconds since the Unix epoch
+    uint64_t micros;
+    const uint8_t *data;
+    uint32_t len;
+} TCaptureRecord;
+
+typedef struct {
+    char name[64];
+    uint32_t baudrate;
+    // Options of the capturing tool, e.g. "-t 5000 -r 3 --chunk-size 32"
+    char comment[128];
+} TCaptureInterface;
+
+// A capture being written, or a capture loaded into memory
+typedef struct {
+    FILE *file;
+    uint32_t nofInterfaces;
+    // Loaded captures only
+    TCaptureInterface interfaces[CAPTURE_MAX_INTERFACES];
+    TCaptureRecord *records;
+    uint32_t nofRecords;
+    uint8_t *buffer;
+} TCapture;
+
+
+// Create a capture file; returns 0 on success, -1 on error.
+int captureCreate(TCapture *capture, const char *path, const char *application);
+
+// Describe a serial port; returns its interface number. All interfaces must be added before
+// the first record. Only the first CAPTURE_MAX_INTERFACES are loaded by captureLoad.
+int captureAddInterface(TCapture *capture, const char *name, uint32_t baudrate, const char *comment);
+
+// Append a record; micros is taken from captureMicros.
+void captureWrite(TCapture *capture, uint32_t interface, ECaptureDirection direction, uint64_t micros,
+                  const uint8_t *data, uint32_t len);
+
+// Wall clock in microseconds for captureWrite, advancing monotonically.
+uint64_t captureMicros(void);
+
+// Load a capture written by captureCreate/captureWrite; returns 0 on success, -1 if the file
+// can't be read or isn't a capture of serial DFU traffic.
+int captureLoad(TCapture *capture, const char *path);
+
+// Flush and close a capture being written, or free a loaded capture.
+void captureClose(TCapture *capture);
+
+
+#endif // __CAPTURE_H__
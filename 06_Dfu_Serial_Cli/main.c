@@ -0,0 +1,768 @@
+//
+//  main.c
+//  nrf52-dfu
+//
+//  Command line tool to perform a serial DFU with our C library for the Nordic
+//  firmware update protocol. Accepts the same arguments as 'nrfutil dfu serial'
+//  so it can be used as a drop-in replacement. Several serial ports can be given to
+//  update many targets in parallel from one event loop; the WRITE frames are then
+//  encoded once and shared by all sessions (fan-out).
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>  // UNIX standard function definitions
+#include <fcntl.h>   // File control definitions
+#include <errno.h>   // Error number definitions
+#include <termios.h> // POSIX terminal control definitions
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "fwu.h"
+#include "fwu_initpacket.h"
+#include "fwu_verify.h"
+#include "pkg.h"
+#include "report.h"
+#include "capture.h"
+#include "pubkey.h"
+
+#define TX_BUF_SIZE 256
+// Number of FSM steps per loop iteration; the library advances one step per fwuYield.
+#define YIELDS_PER_ITERATION 16
+#define MAX_EPOLL_EVENTS 64
+
+typedef struct {
+    const char *port;
+    int fd;
+    TFwu fwu;
+    uint8_t txBuf[TX_BUF_SIZE];
+    uint16_t txLen;
+    uint8_t pollingOut;
+    uint32_t bytesSent;
+    uint32_t bytesReceived;
+    uint8_t progressStep;
+    uint32_t captureInterface;
+    EFwuProcessStatus status;
+    uint64_t tStart;
+    uint64_t tEnd;
+} TSession;
+
+static TDfuPackage sPackage;
+static TFwuFrameCache sFrameCache;
+static int sVerbose;
+static int sStats;
+static TCapture sCapture;
+static const char *sCapturePath;
+static volatile sig_atomic_t sInterrupted;
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len);
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len);
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len);
+static void traceFunction(struct SFwu *fwu, EFwuTraceDirection direction, uint32_t millisec,
+                          const uint8_t *bytes, uint16_t len);
+static int openSerialDevice(TSession *session, int baudrate, int flowControl);
+static speed_t baudrateToSpeed(int baudrate);
+static int buildFrameCache(void);
+static int verifyPackage(const char *publicKeyPath, uint32_t hwVersion, uint32_t sdId);
+static void runSessions(TSession *sessions, int nofSessions);
+static void receiveData(TSession *session);
+static void flushTxBuffer(TSession *session);
+static void updatePollEvents(int epfd, TSession *session);
+static void onInterrupt(int sig);
+static uint64_t monotonicMicros(void);
+static const char *responseStatusName(EFwuResponseStatus status);
+static const char *extendedErrorName(uint8_t extendedError);
+static const char *errorClassName(EFwuErrorClass errorClass);
+static const char *verifyResultName(EFwuVerifyResult result);
+static void printScalingReport(TSession *sessions, int nofSessions);
+static int compareMicros(const void *a, const void *b);
+static void usage(const char *prog);
+
+
+int main(int argc, char *argv[])
+{
+    const char *packagePath = NULL;
+    const char **ports = calloc(argc, sizeof(char *));
+    int nofPorts = 0;
+    int baudrate = 115200;
+    int flowControl = 0;
+    int fanOut = -1;
+    int skipIfCurrent = 0;
+    int verify = 0;
+    const char *publicKeyPath = NULL;
+    uint32_t hwVersion = 0;
+    uint32_t sdId = 0;
+    TFwuInitPacket initPacket;
+    uint32_t timeout = 5000;
+    int retries = 3;
+    uint32_t bannerTimeout = 0;
+    int chunkSize = 0;
+    int nofSucceeded = 0;
+    int nofTransferred = 0;
+    int i;
+
+    // Same options as 'nrfutil dfu serial'; --port may be repeated.
+    for (i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(a, "-v") || !strcmp(a, "--verbose")) {
+            sVerbose = 1;
+        } else if ((!strcmp(a, "-pkg") || !strcmp(a, "--package")) && v) {
+            packagePath = v;
+            i++;
+        } else if ((!strcmp(a, "-p") || !strcmp(a, "--port")) && v) {
+            ports[nofPorts++] = v;
+            i++;
+        } else if ((!strcmp(a, "-b") || !strcmp(a, "--baud-rate")) && v) {
+            baudrate = atoi(v);
+            i++;
+        } else if ((!strcmp(a, "-fc") || !strcmp(a, "--flow-control")) && v) {
+            flowControl = atoi(v);
+            i++;
+        } else if ((!strcmp(a, "-t") || !strcmp(a, "--timeout")) && v) {
+            timeout = atoi(v);
+            i++;
+        } else if ((!strcmp(a, "-r") || !strcmp(a, "--retries")) && v) {
+            retries = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--banner-timeout") && v) {
+            bannerTimeout = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--chunk-size") && v) {
+            chunkSize = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--capture") && v) {
+            sCapturePath = v;
+            i++;
+        } else if (!strcmp(a, "--stats")) {
+            sStats = 1;
+        } else if (!strcmp(a, "--verify")) {
+            verify = 1;
+        } else if (!strcmp(a, "--public-key") && v) {
+            publicKeyPath = v;
+            verify = 1;
+            i++;
+        } else if (!strcmp(a, "--hw-version") && v) {
+            hwVersion = strtoul(v, NULL, 0);
+            verify = 1;
+            i++;
+        } else if (!strcmp(a, "--sd-id") && v) {
+            sdId = strtoul(v, NULL, 0);
+            verify = 1;
+            i++;
+        } else if (!strcmp(a, "--skip-if-current")) {
+            skipIfCurrent = 1;
+        } else if (!strcmp(a, "--fan-out")) {
+            fanOut = 1;
+        } else if (!strcmp(a, "--no-fan-out")) {
+            fanOut = 0;
+        } else if (!strcmp(a, "dfu") || !strcmp(a, "serial")) {
+            // tolerate the nrfutil sub-command words
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!packagePath || nofPorts == 0 || chunkSize < 0 || chunkSize > FWU_DATA_CHUNK_SIZE) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (pkgLoad(packagePath, &sPackage) != 0) {
+        return -1;
+    }
+    printf("package '%s': init packet %u bytes, firmware %u bytes\n",
+           packagePath, sPackage.datLen, sPackage.binLen);
+
+    // Reject a package the targets would refuse before any port is touched.
+    if (verify && verifyPackage(publicKeyPath, hwVersion, sdId) != 0) {
+        pkgFree(&sPackage);
+        return -1;
+    }
+
+    if (skipIfCurrent && fwuInitPacketDecode(sPackage.dat, sPackage.datLen, &initPacket) != 0) {
+        fprintf(stderr, "failed to decode the init packet\n");
+        return -1;
+    }
+
+    // Fan-out by default when several targets receive the same image.
+    if (fanOut < 0) {
+        fanOut = nofPorts > 1;
+    }
+    if (fanOut && buildFrameCache() != 0) {
+        return -1;
+    }
+
+    // One descriptor per port
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (sCapturePath && captureCreate(&sCapture, sCapturePath, "dfuserial") != 0) {
+        return -1;
+    }
+
+    TSession *sessions = calloc(nofPorts, sizeof(TSession));
+    for (i = 0; i < nofPorts; i++) {
+        TSession *session = &sessions[i];
+        session->port = ports[i];
+        if (openSerialDevice(session, baudrate, flowControl) != 0) {
+            return -1;
+        }
+        session->fwu.commandObjectProviderFunction = commandObjectProvider;
+        session->fwu.commandObjectLen = sPackage.datLen;
+        session->fwu.dataObjectProviderFunction = dataObjectProvider;
+        session->fwu.dataObjectLen = sPackage.binLen;
+        session->fwu.txFunction = txFunction;
+        session->fwu.responseTimeoutMillisec = timeout;
+        session->fwu.maxRetries = retries;
+        session->fwu.bannerTimeoutMillisec = bannerTimeout;
+        session->fwu.dataChunkSize = chunkSize;
+        session->fwu.frameCache = fanOut ? &sFrameCache : NULL;
+        if (sPackage.container) {
+            // A container brings the running CRCs of the image along.
+            session->fwu.dataObjectCrcs = fwuContainerCrcs(sPackage.container);
+            session->fwu.dataObjectCrcStride = sPackage.container->crcStride;
+        }
+        session->fwu.versionCheck = skipIfCurrent;
+        session->fwu.imageFwVersion = skipIfCurrent ? initPacket.fwVersion : 0;
+        if (sCapturePath) {
+            // The options that shape the traffic, so dfureplay can run the session the same way.
+            char options[128];
+            snprintf(options, sizeof(options), "-t %u -r %d --banner-timeout %u --chunk-size %d%s",
+                     timeout, retries, bannerTimeout, chunkSize, skipIfCurrent ? " --skip-if-current" : "");
+            session->captureInterface = captureAddInterface(&sCapture, session->port, baudrate, options);
+            session->fwu.traceFunction = traceFunction;
+        }
+        fwuInit(&session->fwu);
+    }
+
+    // Ctrl-C aborts all sessions, so the targets don't stay in DFU mode.
+    signal(SIGINT, onInterrupt);
+
+    uint64_t tStart = monotonicMicros();
+    runSessions(sessions, nofPorts);
+    uint64_t tEnd = monotonicMicros();
+
+    printf("\n");
+    for (i = 0; i < nofPorts; i++) {
+        TSession *session = &sessions[i];
+        double seconds = (session->tEnd - session->tStart) / 1e6;
+        if (session->status == FWU_STATUS_COMPLETION && session->fwu.updateSkipped) {
+            nofSucceeded++;
+            printf("%s: Already up to date (version %u), %.3f s\n", session->port,
+                   session->fwu.targetAppVersion, seconds);
+        } else if (session->status == FWU_STATUS_COMPLETION) {
+            nofSucceeded++;
+            nofTransferred++;
+            printf("%s: Success, %.3f s, %.0f B/s, %u retries\n", session->port, seconds,
+                   seconds > 0 ? sPackage.binLen / seconds : 0, session->fwu.retryCount);
+            if (session->fwu.bannerSeen) {
+                printf("%s: bootloader banner after %u ms, first PING answered after %u ms\n", session->port,
+                       session->fwu.bannerMillisec, session->fwu.pingMillisec);
+            }
+        } else {
+            printf("%s: Failed! Response Status = %d (%s), %.3f s\n", session->port,
+                   session->fwu.responseStatus, responseStatusName(session->fwu.responseStatus), seconds);
+            if (session->fwu.responseStatus == FWU_RSP_ERROR_RESPONSE) {
+                printf("%s: Result code 0x%02X, extended error 0x%02X (%s), %s after %u retries\n", session->port,
+                       session->fwu.resultCode, session->fwu.extendedError,
+                       extendedErrorName(session->fwu.extendedError),
+                       errorClassName(session->fwu.errorClass), session->fwu.retryCount);
+            } else {
+                printf("%s: %s after %u retries\n", session->port,
+                       errorClassName(session->fwu.errorClass), session->fwu.retryCount);
+            }
+        }
+        if (sStats) {
+            printSessionStats(stdout, session->port, &session->fwu);
+        }
+        close(session->fd);
+    }
+
+    double seconds = (tEnd - tStart) / 1e6;
+    printf("***** %d of %d updates succeeded *****\n", nofSucceeded, nofPorts);
+    printf("wall time: %.3f s\n", seconds);
+    if (seconds > 0) {
+        uint64_t wireBytes = 0;
+        for (i = 0; i < nofPorts; i++) {
+            wireBytes += sessions[i].bytesSent;
+        }
+        printf("aggregate throughput: %.0f B/s firmware, %.0f B/s on the wire\n",
+               (double)nofTransferred * sPackage.binLen / seconds, wireBytes / seconds);
+    }
+    if (nofPorts > 1) {
+        printScalingReport(sessions, nofPorts);
+    }
+    if (sCapturePath) {
+        captureClose(&sCapture);
+        printf("capture written to %s\n", sCapturePath);
+    }
+
+    free(sessions);
+    free(ports);
+    pkgFree(&sPackage);
+    return nofSucceeded == nofPorts ? 0 : -1;
+}
+
+// Update time percentiles and CPU time per session; with many ports they show where the
+// single event loop stops keeping up.
+static void printScalingReport(TSession *sessions, int nofSessions)
+{
+    uint64_t *micros = malloc(nofSessions * sizeof(uint64_t));
+    struct rusage usage;
+    double cpu = 0;
+    int n = 0;
+    int i;
+
+    for (i = 0; i < nofSessions; i++) {
+        if (sessions[i].status == FWU_STATUS_COMPLETION) {
+            micros[n++] = sessions[i].tEnd - sessions[i].tStart;
+        }
+    }
+    if (n > 0) {
+        qsort(micros, n, sizeof(uint64_t), compareMicros);
+        printf("update time: p50 %.3f s, p90 %.3f s, p99 %.3f s, max %.3f s\n", micros[n / 2] / 1e6,
+               micros[n * 9 / 10] / 1e6, micros[n * 99 / 100] / 1e6, micros[n - 1] / 1e6);
+    }
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+    printf("CPU time: %.3f s, %.2f ms per session\n", cpu, 1e3 * cpu / nofSessions);
+    free(micros);
+}
+
+static int compareMicros(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-v] -pkg <package.zip> -p <serial-port> [-p <serial-port> ...]\n", prog);
+    fprintf(stderr, "          [-b <baudrate>] [-fc <0|1>] [-t <timeout-ms>] [--fan-out | --no-fan-out]\n");
+    fprintf(stderr, "          [-r <retries>] [--banner-timeout <ms>] [--chunk-size <bytes>] [--skip-if-current]\n");
+    fprintf(stderr, "          [--stats] [--capture <file.pcapng>] [--verify] [--public-key <dfu_public_key.c>]\n");
+    fprintf(stderr, "          [--hw-version <n>] [--sd-id <id>]\n");
+    fprintf(stderr, "Perform a serial DFU of an nrfutil package; drop-in for 'nrfutil dfu serial'.\n");
+    fprintf(stderr, "  -pkg, --package       DFU package (zip) created by 'nrfutil pkg generate', or a\n");
+    fprintf(stderr, "                        container (fwconvert --format container)\n");
+    fprintf(stderr, "  -p, --port            serial device; repeat to update several targets in parallel\n");
+    fprintf(stderr, "  -b, --baud-rate       baud rate (default 115200)\n");
+    fprintf(stderr, "  -fc, --flow-control   1 to enable RTS/CTS hardware flow control (default 0)\n");
+    fprintf(stderr, "  -t, --timeout         response timeout in ms (default 5000)\n");
+    fprintf(stderr, "  -r, --retries         repeat a failed request or object up to n times (default 3);\n");
+    fprintf(stderr, "                        errors that can't go away by retrying fail at once\n");
+    fprintf(stderr, "  --banner-timeout      wait up to ms for the bootloader banner before the first PING,\n");
+    fprintf(stderr, "                        e.g. when the target is reset into the bootloader (default 0)\n");
+    fprintf(stderr, "  --chunk-size          payload bytes per WRITE request (1..%d, default %d); smaller\n",
+            FWU_DATA_CHUNK_SIZE, FWU_DATA_CHUNK_SIZE);
+    fprintf(stderr, "                        requests keep a target without flow control from overrunning\n");
+    fprintf(stderr, "  --stats               print time per phase, round trip times and byte counts per port\n");
+    fprintf(stderr, "  --capture             record all frames with timestamps for dfureplay and Wireshark\n");
+    fprintf(stderr, "  --skip-if-current     skip targets whose application already has the package's version\n");
+    fprintf(stderr, "  --verify              check the init packet against the image (size, hash) before\n");
+    fprintf(stderr, "                        the transfer; nothing is sent if the target would reject it\n");
+    fprintf(stderr, "  --public-key          also verify the signature with the bootloader's public key\n");
+    fprintf(stderr, "                        (dfu_public_key.c); implies --verify\n");
+    fprintf(stderr, "  --hw-version          also check hw_version against the targets'; implies --verify\n");
+    fprintf(stderr, "  --sd-id               also check sd_req against the targets' SoftDevice FWID (e.g.\n");
+    fprintf(stderr, "                        0xAF); implies --verify\n");
+    fprintf(stderr, "  --fan-out             encode the WRITE frames once and share them between all\n");
+    fprintf(stderr, "                        sessions (default when more than one port is given)\n");
+}
+
+// Encode all WRITE frames and running CRCs of the image once; the cache is immutable
+// afterwards and every session only advances its own position in it.
+static int buildFrameCache(void)
+{
+    uint32_t nofFrames = fwuFrameCacheNofFrames(sPackage.binLen);
+    uint8_t *frames = malloc(fwuFrameCacheMaxFramesSize(sPackage.binLen) + 1);
+    uint32_t *frameOffsets = malloc((nofFrames + 1) * sizeof(uint32_t));
+    uint32_t *crcs = malloc((nofFrames + 1) * sizeof(uint32_t));
+
+    if (!frames || !frameOffsets || !crcs) {
+        fprintf(stderr, "out of memory for the frame cache\n");
+        return -1;
+    }
+    uint64_t t0 = monotonicMicros();
+    fwuFrameCacheBuild(&sFrameCache, sPackage.bin, sPackage.binLen, FWU_DATA_CHUNK_SIZE,
+                       frames, frameOffsets, crcs);
+    uint64_t t1 = monotonicMicros();
+    printf("frame cache: %u frames, %u bytes encoded in %.3f ms\n",
+           nofFrames, frameOffsets[nofFrames], (t1 - t0) / 1e3);
+    return 0;
+}
+
+// Run the checks of the bootloader on the host: a package that fails here would only be
+// rejected after the init packet (or the whole image) has been transferred.
+static int verifyPackage(const char *publicKeyPath, uint32_t hwVersion, uint32_t sdId)
+{
+    static TFwuVerify verify;
+    uint8_t publicKey[64];
+    TFwu fwu;
+    EFwuVerifyResult result;
+
+    memset(&verify, 0, sizeof(verify));
+    if (publicKeyPath) {
+        if (pubkeyLoad(publicKeyPath, publicKey) != 0) {
+            return -1;
+        }
+        verify.publicKey = publicKey;
+        verify.verifySignatureFunction = pubkeyVerify;
+    }
+    verify.hwVersion = hwVersion;
+    verify.sdId = sdId;
+
+    memset(&fwu, 0, sizeof(fwu));
+    fwu.commandObjectProviderFunction = commandObjectProvider;
+    fwu.commandObjectLen = sPackage.datLen;
+    fwu.dataObjectProviderFunction = dataObjectProvider;
+    fwu.dataObjectLen = sPackage.binLen;
+
+    uint64_t t0 = monotonicMicros();
+    result = fwuVerify(&verify, &fwu);
+    uint64_t t1 = monotonicMicros();
+    if (result != FWU_VERIFY_OK) {
+        fprintf(stderr, "package rejected before the transfer: %s\n", verifyResultName(result));
+        return -1;
+    }
+    printf("package verified in %.3f ms: hw_version %u, fw_version %u, %s, %s\n", (t1 - t0) / 1e3,
+           verify.packet.hwVersion, verify.packet.fwVersion,
+           verify.hashChecked ? "hash ok" : "hash not checked",
+           verify.signatureChecked ? "signature ok" : "signature not checked");
+    return 0;
+}
+
+// Drive all sessions from a single epoll loop; every session has its own TFwu state
+// and output buffer, the image is shared through the read-only package mapping.
+static void runSessions(TSession *sessions, int nofSessions)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nofActive = nofSessions;
+    uint64_t tLast = monotonicMicros();
+    uint64_t remainderMicros = 0;
+    int abortRequested = 0;
+    int i;
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(-1);
+    }
+    for (i = 0; i < nofSessions; i++) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &sessions[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, sessions[i].fd, &ev) != 0) {
+            perror("epoll_ctl");
+            exit(-1);
+        }
+        sessions[i].tStart = tLast;
+        fwuExec(&sessions[i].fwu);
+    }
+
+    while (nofActive > 0) {
+        int n = epoll_wait(epfd, events, MAX_EPOLL_EVENTS, 1);
+        for (i = 0; i < n; i++) {
+            TSession *session = events[i].data.ptr;
+            if (events[i].events & EPOLLIN) {
+                receiveData(session);
+            }
+            if (events[i].events & EPOLLOUT) {
+                flushTxBuffer(session);
+            }
+        }
+
+        if (sInterrupted && !abortRequested) {
+            for (i = 0; i < nofSessions; i++) {
+                fwuAbort(&sessions[i].fwu);
+            }
+            abortRequested = 1;
+        }
+
+        uint64_t now = monotonicMicros();
+        remainderMicros += now - tLast;
+        tLast = now;
+        uint32_t elapsedMillisec = remainderMicros / 1000;
+        remainderMicros -= (uint64_t)elapsedMillisec * 1000;
+
+        for (i = 0; i < nofSessions; i++) {
+            TSession *session = &sessions[i];
+            int k;
+            if (session->status != FWU_STATUS_UNDEFINED) {
+                continue;
+            }
+            for (k = 0; k < YIELDS_PER_ITERATION && session->status == FWU_STATUS_UNDEFINED; k++) {
+                fwuCanSendData(&session->fwu, TX_BUF_SIZE - 1 - session->txLen);
+                session->status = fwuYield(&session->fwu, k == 0 ? elapsedMillisec : 0);
+                flushTxBuffer(session);
+            }
+            if (session->status != FWU_STATUS_UNDEFINED) {
+                session->tEnd = now;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, session->fd, NULL);
+                nofActive--;
+                if (sVerbose) {
+                    printf("\n%s: %s\n", session->port,
+                           session->status == FWU_STATUS_COMPLETION ? "done" : "failed");
+                }
+            } else {
+                updatePollEvents(epfd, session);
+            }
+        }
+    }
+    close(epfd);
+}
+
+static void receiveData(TSession *session)
+{
+    uint8_t rxBuf[255];
+    ssize_t n;
+    while ((n = read(session->fd, rxBuf, sizeof(rxBuf))) > 0) {
+        session->bytesReceived += n;
+        fwuDidReceiveData(&session->fwu, rxBuf, (uint8_t)n);
+    }
+}
+
+static void flushTxBuffer(TSession *session)
+{
+    if (session->txLen == 0) {
+        return;
+    }
+    ssize_t n = write(session->fd, session->txBuf, session->txLen);
+    if (n > 0) {
+        memmove(session->txBuf, &session->txBuf[n], session->txLen - n);
+        session->txLen -= n;
+    }
+}
+
+// Only wait for EPOLLOUT while output is pending, otherwise the loop would spin.
+static void updatePollEvents(int epfd, TSession *session)
+{
+    uint8_t wantOut = session->txLen > 0;
+    if (wantOut != session->pollingOut) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | (wantOut ? EPOLLOUT : 0);
+        ev.data.ptr = session;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, session->fd, &ev);
+        session->pollingOut = wantOut;
+    }
+}
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sPackage.dat[pos];
+}
+
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sPackage.bin[pos];
+}
+
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len)
+{
+    TSession *session = (TSession *)((char *)fwu - offsetof(TSession, fwu));
+    memcpy(&session->txBuf[session->txLen], buf, len);
+    session->txLen += len;
+    session->bytesSent += len;
+    if (sVerbose && sPackage.binLen > 0) {
+        // Progress in steps of 10% of the image, with the estimate from the library.
+        uint8_t step = (uint64_t)fwuStatsProgressBytes(fwu) * 10 / sPackage.binLen;
+        if (step != session->progressStep) {
+            uint32_t eta = fwuStatsEtaMillisec(fwu);
+            session->progressStep = step;
+            if (eta == 0xffffffff) {
+                printf("%s: %u%%\n", session->port, step * 10);
+            } else {
+                printf("%s: %u%%, %u B/s, %.1f s left\n", session->port, step * 10,
+                       fwuStatsThroughput(fwu), eta / 1e3);
+            }
+            fflush(stdout);
+        }
+    }
+}
+static void traceFunction(struct SFwu *fwu, EFwuTraceDirection direction, uint32_t millisec,
+                          const uint8_t *bytes, uint16_t len)
+{
+    TSession *session = (TSession *)((char *)fwu - offsetof(TSession, fwu));
+    captureWrite(&sCapture, session->captureInterface,
+                 direction == FWU_TRACE_RX ? CAPTURE_RX : CAPTURE_TX, captureMicros(), bytes, len);
+}
+
+static int openSerialDevice(TSession *session, int baudrate, int flowControl)
+{
+    struct termios settings;
+    speed_t speed = baudrateToSpeed(baudrate);
+
+    if (speed == B0) {
+        fprintf(stderr, "unsupported baud rate %d\n", baudrate);
+        return -1;
+    }
+
+    //  O_NOCTTY: the program doesn't want to be the "controlling terminal" for the port.
+    session->fd = open(session->port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (session->fd < 0) {
+        fprintf(stderr, "opening serial device '%s' failed: %s\n", session->port, strerror(errno));
+        return -1;
+    }
+
+    if (tcgetattr(session->fd, &settings) < 0) {
+        perror("tcgetattr");
+        close(session->fd);
+        return -1;
+    }
+
+    settings.c_cflag &= ~(CSIZE | CSTOPB | HUPCL | PARENB | CRTSCTS);
+    settings.c_cflag |= (CLOCAL | CREAD | CS8);
+    if (flowControl) {
+        settings.c_cflag |= CRTSCTS;
+    }
+    settings.c_iflag = IGNPAR;
+    settings.c_oflag = 0;
+    settings.c_lflag = 0;
+    settings.c_cc[VMIN] = 0;
+    settings.c_cc[VTIME] = 0;
+    cfsetispeed(&settings, speed);
+    cfsetospeed(&settings, speed);
+
+    tcflush(session->fd, TCIOFLUSH);
+    if (tcsetattr(session->fd, TCSANOW, &settings) < 0) {
+        perror("tcsetattr");
+        close(session->fd);
+        return -1;
+    }
+    printf("serial device '%s' opened at %d baud, flow control %s\n",
+           session->port, baudrate, flowControl ? "on" : "off");
+    return 0;
+}
+
+static speed_t baudrateToSpeed(int baudrate)
+{
+    switch (baudrate) {
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+#ifdef B460800
+        case 460800:  return B460800;
+#endif
+#ifdef B921600
+        case 921600:  return B921600;
+#endif
+#ifdef B1000000
+        case 1000000: return B1000000;
+#endif
+        default:      return B0;
+    }
+}
+
+static void onInterrupt(int sig)
+{
+    sInterrupted = 1;
+}
+
+static uint64_t monotonicMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const char *responseStatusName(EFwuResponseStatus status)
+{
+    switch (status) {
+        case FWU_RSP_OK:                        return "FWU_RSP_OK";
+        case FWU_RSP_TOO_SHORT:                 return "FWU_RSP_TOO_SHORT";
+        case FWU_RSP_START_MARKER_MISSING:      return "FWU_RSP_START_MARKER_MISSING";
+        case FWU_RSP_END_MARKER_MISSING:        return "FWU_RSP_END_MARKER_MISSING";
+        case FWU_RSP_REQUEST_REFERENCE_INVALID: return "FWU_RSP_REQUEST_REFERENCE_INVALID";
+        case FWU_RSP_ERROR_RESPONSE:            return "FWU_RSP_ERROR_RESPONSE";
+        case FWU_RSP_TIMEOUT:                   return "FWU_RSP_TIMEOUT";
+        case FWU_RSP_PING_ID_MISMATCH:          return "FWU_RSP_PING_ID_MISMATCH";
+        case FWU_RSP_RX_OVERFLOW:               return "FWU_RSP_RX_OVERFLOW";
+        case FWU_RSP_INIT_COMMAND_TOO_LARGE:    return "FWU_RSP_INIT_COMMAND_TOO_LARGE";
+        case FWU_RSP_CHECKSUM_ERROR:            return "FWU_RSP_CHECKSUM_ERROR";
+        case FWU_RSP_DATA_OBJECT_TOO_LARGE:     return "FWU_RSP_DATA_OBJECT_TOO_LARGE";
+        case FWU_RSP_RX_INVALID_ESCAPE_SEQ:     return "FWU_RSP_RX_INVALID_ESCAPE_SEQ";
+        case FWU_RSP_ABORTED:                   return "FWU_RSP_ABORTED";
+        case FWU_RSP_FRAME_CACHE_MISMATCH:      return "FWU_RSP_FRAME_CACHE_MISMATCH";
+        default:                                return "unknown";
+    }
+}
+
+static const char *extendedErrorName(uint8_t extendedError)
+{
+    switch (extendedError) {
+        case FWU_EXT_NO_ERROR:              return "no error";
+        case FWU_EXT_INVALID_ERROR_CODE:    return "invalid error code";
+        case FWU_EXT_WRONG_COMMAND_FORMAT:  return "wrong command format";
+        case FWU_EXT_UNKNOWN_COMMAND:       return "unknown command";
+        case FWU_EXT_INIT_COMMAND_INVALID:  return "init command invalid";
+        case FWU_EXT_FW_VERSION_FAILURE:    return "firmware version rejected";
+        case FWU_EXT_HW_VERSION_FAILURE:    return "hardware version rejected";
+        case FWU_EXT_SD_VERSION_FAILURE:    return "SoftDevice version rejected";
+        case FWU_EXT_SIGNATURE_MISSING:     return "signature missing";
+        case FWU_EXT_WRONG_HASH_TYPE:       return "wrong hash type";
+        case FWU_EXT_HASH_FAILED:           return "hash failed";
+        case FWU_EXT_WRONG_SIGNATURE_TYPE:  return "wrong signature type";
+        case FWU_EXT_VERIFICATION_FAILED:   return "signature verification failed";
+        case FWU_EXT_INSUFFICIENT_SPACE:    return "insufficient space";
+        default:                            return "unknown";
+    }
+}
+
+static const char *errorClassName(EFwuErrorClass errorClass)
+{
+    switch (errorClass) {
+        case FWU_ERR_CLASS_TRANSIENT:   return "transient error";
+        case FWU_ERR_CLASS_PERMANENT:   return "permanent error";
+        case FWU_ERR_CLASS_RESOURCE:    return "resource error";
+        default:                        return "no error";
+    }
+}
+
+static const char *verifyResultName(EFwuVerifyResult result)
+{
+    switch (result) {
+        case FWU_VERIFY_OK:                     return "ok";
+        case FWU_VERIFY_MALFORMED:              return "init packet malformed";
+        case FWU_VERIFY_HW_VERSION_MISMATCH:    return "hardware version mismatch";
+        case FWU_VERIFY_SD_REQ_MISMATCH:        return "SoftDevice requirement not met";
+        case FWU_VERIFY_SIZE_MISMATCH:          return "image size doesn't match the init packet";
+        case FWU_VERIFY_HASH_MISMATCH:          return "image hash doesn't match the init packet";
+        case FWU_VERIFY_HASH_UNSUPPORTED:       return "hash type not supported";
+        case FWU_VERIFY_SIGNATURE_MISSING:      return "signature missing";
+        case FWU_VERIFY_SIGNATURE_INVALID:      return "signature invalid";
+        default:                                return "unknown";
+    }
+}
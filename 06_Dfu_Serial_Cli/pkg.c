@@ -0,0 +1,357 @@
+//
+//  pkg.c
+//  nrf52-dfu
+//
+//  Loading of nrfutil DFU packages (zip archive with manifest.json, .dat and .bin).
+//
+//  Only the subset of the zip format produced by nrfutil is supported:
+//  single-disk archives with stored or deflated entries.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "pkg.h"
+
+#define ZIP_LOCAL_HEADER_SIG 0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG 0x02014b50
+#define ZIP_END_OF_CENTRAL_DIR_SIG 0x06054b50
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+
+typedef struct {
+    uint8_t *data;
+    uint32_t len;
+} TZipArchive;
+
+static int zipExtract(TZipArchive *zip, const char *name, uint8_t **out, uint32_t *outLen);
+static int pkgMapReadOnly(TDfuPackage *pkg, uint8_t *dat, uint32_t datLen, uint8_t *bin, uint32_t binLen);
+static int pkgMapContainer(TDfuPackage *pkg, const char *path);
+static int manifestGetString(const char *manifest, const char *key, char *value, int maxLen);
+static uint8_t *readFile(const char *path, uint32_t *len);
+static inline uint16_t zipLe16(const uint8_t *p);
+static inline uint32_t zipLe32(const uint8_t *p);
+
+
+int pkgLoad(const char *path, TDfuPackage *pkg)
+{
+    TZipArchive zip;
+    uint8_t *manifest = NULL;
+    uint32_t manifestLen = 0;
+    uint8_t *dat = NULL;
+    uint32_t datLen = 0;
+    uint8_t *bin = NULL;
+    uint32_t binLen = 0;
+    char datName[256];
+    char binName[256];
+    int res = -1;
+
+    memset(pkg, 0, sizeof(*pkg));
+
+    res = pkgMapContainer(pkg, path);
+    if (res != 1) {
+        return res;
+    }
+    res = -1;
+
+    zip.data = readFile(path, &zip.len);
+    if (!zip.data) {
+        fprintf(stderr, "failed to read package '%s'\n", path);
+        return -1;
+    }
+
+    if (zipExtract(&zip, "manifest.json", &manifest, &manifestLen) != 0) {
+        goto done;
+    }
+    // zero-terminate for the string functions
+    uint8_t *terminated = realloc(manifest, manifestLen + 1);
+    if (!terminated) {
+        fprintf(stderr, "out of memory\n");
+        goto done;
+    }
+    manifest = terminated;
+    manifest[manifestLen] = 0;
+
+    if (manifestGetString((char *)manifest, "dat_file", datName, sizeof(datName)) != 0
+        || manifestGetString((char *)manifest, "bin_file", binName, sizeof(binName)) != 0) {
+        fprintf(stderr, "manifest.json in '%s' does not reference a .dat and .bin file\n", path);
+        goto done;
+    }
+
+    if (zipExtract(&zip, datName, &dat, &datLen) != 0
+        || zipExtract(&zip, binName, &bin, &binLen) != 0) {
+        goto done;
+    }
+    res = pkgMapReadOnly(pkg, dat, datLen, bin, binLen);
+
+done:
+    free(bin);
+    free(dat);
+    free(manifest);
+    free(zip.data);
+    return res;
+}
+
+void pkgFree(TDfuPackage *pkg)
+{
+    if (pkg->mapping) {
+        munmap(pkg->mapping, pkg->mappingLen);
+    }
+    memset(pkg, 0, sizeof(*pkg));
+}
+
+static int pkgMapReadOnly(TDfuPackage *pkg, uint8_t *dat, uint32_t datLen, uint8_t *bin, uint32_t binLen)
+{
+    uint8_t *m;
+
+    pkg->mappingLen = (size_t)datLen + binLen;
+    if (pkg->mappingLen == 0) {
+        pkg->mappingLen = 1;
+    }
+    pkg->mapping = mmap(NULL, pkg->mappingLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pkg->mapping == MAP_FAILED) {
+        pkg->mapping = NULL;
+        perror("mmap");
+        return -1;
+    }
+    m = pkg->mapping;
+    memcpy(m, dat, datLen);
+    memcpy(m + datLen, bin, binLen);
+    if (mprotect(pkg->mapping, pkg->mappingLen, PROT_READ) != 0) {
+        perror("mprotect");
+        pkgFree(pkg);
+        return -1;
+    }
+    pkg->dat = m;
+    pkg->datLen = datLen;
+    pkg->bin = m + datLen;
+    pkg->binLen = binLen;
+    return 0;
+}
+
+// Map a container file read-only and use it in place; returns 1 if the file isn't a container.
+static int pkgMapContainer(TDfuPackage *pkg, const char *path)
+{
+    uint32_t magic = 0;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || read(fd, &magic, sizeof(magic)) != sizeof(magic) || magic != FWU_CONTAINER_MAGIC
+        || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    pkg->mappingLen = st.st_size;
+    pkg->mapping = mmap(NULL, pkg->mappingLen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pkg->mapping == MAP_FAILED) {
+        pkg->mapping = NULL;
+        perror("mmap");
+        return -1;
+    }
+    pkg->container = fwuContainerOpen(pkg->mapping, (uint32_t)pkg->mappingLen);
+    if (!pkg->container) {
+        fprintf(stderr, "'%s' is not a valid container\n", path);
+        pkgFree(pkg);
+        return -1;
+    }
+    pkg->dat = fwuContainerDat(pkg->container);
+    pkg->datLen = pkg->container->datLen;
+    pkg->bin = fwuContainerBin(pkg->container);
+    pkg->binLen = pkg->container->binLen;
+    return 0;
+}
+
+static int zipExtract(TZipArchive *zip, const char *name, uint8_t **out, uint32_t *outLen)
+{
+    const uint8_t *eocd = NULL;
+    const uint8_t *p;
+    uint32_t pos;
+    uint32_t i;
+    uint16_t nofEntries;
+    size_t nameLen = strlen(name);
+
+    // The end of central directory record is at the end, followed by a comment of up to 64K.
+    if (zip->len < 22) {
+        fprintf(stderr, "package is not a zip archive\n");
+        return -1;
+    }
+    for (i = zip->len - 22; ; i--) {
+        if (zipLe32(&zip->data[i]) == ZIP_END_OF_CENTRAL_DIR_SIG) {
+            eocd = &zip->data[i];
+            break;
+        }
+        if (i == 0 || zip->len - i > 22 + 0xffff) {
+            break;
+        }
+    }
+    if (!eocd) {
+        fprintf(stderr, "package is not a zip archive\n");
+        return -1;
+    }
+
+    nofEntries = zipLe16(&eocd[10]);
+    // Offsets and lengths come from the file; every one is checked against the archive
+    // before anything behind it is read.
+    pos = zipLe32(&eocd[16]);
+
+    while (nofEntries--) {
+        if (pos > zip->len || zip->len - pos < 46) {
+            break;
+        }
+        p = &zip->data[pos];
+        if (zipLe32(p) != ZIP_CENTRAL_HEADER_SIG) {
+            break;
+        }
+        uint16_t method = zipLe16(&p[10]);
+        uint32_t compSize = zipLe32(&p[20]);
+        uint32_t uncompSize = zipLe32(&p[24]);
+        uint16_t entryNameLen = zipLe16(&p[28]);
+        uint32_t localHeaderOffset = zipLe32(&p[42]);
+        uint64_t entryLen = 46 + (uint64_t)entryNameLen + zipLe16(&p[30]) + zipLe16(&p[32]);
+
+        if (entryLen > zip->len - pos) {
+            break;
+        }
+        if (entryNameLen == nameLen && memcmp(&p[46], name, nameLen) == 0) {
+            if (localHeaderOffset > zip->len || zip->len - localHeaderOffset < 30) {
+                break;
+            }
+            const uint8_t *lh = &zip->data[localHeaderOffset];
+            if (zipLe32(lh) != ZIP_LOCAL_HEADER_SIG) {
+                break;
+            }
+            uint64_t dataOffset = (uint64_t)localHeaderOffset + 30 + zipLe16(&lh[26]) + zipLe16(&lh[28]);
+            if (dataOffset > zip->len || compSize > zip->len - dataOffset) {
+                break;
+            }
+
+            *out = malloc(uncompSize ? uncompSize : 1);
+            *outLen = uncompSize;
+            if (!*out) {
+                fprintf(stderr, "out of memory for '%s' (%u bytes)\n", name, uncompSize);
+                *outLen = 0;
+                return -1;
+            }
+
+            if (method == ZIP_METHOD_STORED && compSize == uncompSize) {
+                memcpy(*out, &zip->data[dataOffset], uncompSize);
+                return 0;
+            }
+            if (method == ZIP_METHOD_DEFLATED) {
+                z_stream zs;
+                memset(&zs, 0, sizeof(zs));
+                zs.next_in = &zip->data[dataOffset];
+                zs.avail_in = compSize;
+                zs.next_out = *out;
+                zs.avail_out = uncompSize;
+                // negative window bits: raw deflate data without zlib header
+                if (inflateInit2(&zs, -MAX_WBITS) == Z_OK) {
+                    int zres = inflate(&zs, Z_FINISH);
+                    inflateEnd(&zs);
+                    if (zres == Z_STREAM_END && zs.total_out == uncompSize) {
+                        return 0;
+                    }
+                }
+            }
+            fprintf(stderr, "failed to extract '%s' from package (method %d)\n", name, method);
+            free(*out);
+            *out = NULL;
+            *outLen = 0;
+            return -1;
+        }
+
+        pos += (uint32_t)entryLen;
+    }
+
+    fprintf(stderr, "'%s' not found in package\n", name);
+    return -1;
+}
+
+// Minimal lookup of "key": "value" in the manifest; nrfutil packages for a single
+// application only contain one dat_file and one bin_file entry.
+static int manifestGetString(const char *manifest, const char *key, char *value, int maxLen)
+{
+    char quotedKey[64];
+    const char *p;
+    int n = 0;
+
+    snprintf(quotedKey, sizeof(quotedKey), "\"%s\"", key);
+    p = strstr(manifest, quotedKey);
+    if (!p) {
+        return -1;
+    }
+    p = strchr(p + strlen(quotedKey), ':');
+    if (!p) {
+        return -1;
+    }
+    p = strchr(p, '"');
+    if (!p) {
+        return -1;
+    }
+    p++;
+    while (*p && *p != '"' && n < maxLen - 1) {
+        value[n++] = *p++;
+    }
+    value[n] = 0;
+    return (*p == '"' && n > 0) ? 0 : -1;
+}
+
+static uint8_t *readFile(const char *path, uint32_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf;
+    long size;
+
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(size > 0 ? size : 1);
+    if (!buf || size < 0 || fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = (uint32_t)size;
+    return buf;
+}
+
+static inline uint16_t zipLe16(const uint8_t *p)
+{
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static inline uint32_t zipLe32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
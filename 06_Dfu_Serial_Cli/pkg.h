@@ -0,0 +1,57 @@
+//
+//  pkg.h
+//  nrf52-dfu
+//
+//  Loading of nrfutil DFU packages (zip archive with manifest.json, .dat and .bin).
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __PKG_H__
+#define __PKG_H__ 1
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "fwu_container.h"
+
+typedef struct {
+    // init packet (.dat)
+    const uint8_t *dat;
+    uint32_t datLen;
+    // firmware image (.bin)
+    const uint8_t *bin;
+    uint32_t binLen;
+    // read-only mapping holding both objects, shared by all sessions
+    void *mapping;
+    size_t mappingLen;
+    // the container header if the package is a container (fwconvert --format container)
+    const TFwuContainerHeader *container;
+} TDfuPackage;
+
+// Load the application .dat and .bin referenced by the manifest of the zip package
+// into a single read-only memory mapping. A container file is mapped as it is.
+// Returns 0 on success; prints a message to stderr and returns -1 otherwise.
+int pkgLoad(const char *path, TDfuPackage *pkg);
+
+// Release the memory held by the package.
+void pkgFree(TDfuPackage *pkg);
+
+
+#endif // __PKG_H__
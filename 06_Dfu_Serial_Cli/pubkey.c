@@ -0,0 +1,127 @@
+//
+//  pubkey.c
+//  nrf52-dfu
+//
+//  The bootloader's public key (dfu_public_key.c) and ECDSA P-256 verification
+//  with OpenSSL; used by the pre-flight check of dfuserial (fwuVerify) and by dfupkg.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/ecdsa.h>
+#include <openssl/x509.h>
+#include "pubkey.h"
+
+// SubjectPublicKeyInfo of a P-256 key up to the uncompressed point
+static const uint8_t sSpkiPrefix[] = {
+    0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08,
+    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00, 0x04,
+};
+
+
+int pubkeyLoad(const char *path, uint8_t publicKey[64])
+{
+    FILE *f = fopen(path, "r");
+    char *text;
+    char *p;
+    long len;
+    int n = 0;
+
+    if (!f) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    text = malloc(len + 1);
+    if (!text || fread(text, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "failed to read %s\n", path);
+        fclose(f);
+        free(text);
+        return -1;
+    }
+    fclose(f);
+    text[len] = 0;
+
+    p = strstr(text, "pk[64]");
+    p = p ? strchr(p, '{') : NULL;
+    while (p && n < 64 && (p = strstr(p, "0x")) != NULL) {
+        publicKey[n++] = (uint8_t)strtoul(p, &p, 16);
+    }
+    free(text);
+    if (n != 64) {
+        fprintf(stderr, "%s: no public key pk[64]\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int pubkeyVerify(const uint8_t *publicKey, const uint8_t *hash, const uint8_t *signature)
+{
+    uint8_t spki[sizeof(sSpkiPrefix) + 64];
+    const uint8_t *q = spki;
+    uint8_t be[64];
+    uint8_t *der = NULL;
+    int derLen = 0;
+    EVP_PKEY *key;
+    EVP_PKEY_CTX *ctx = NULL;
+    ECDSA_SIG *sig = ECDSA_SIG_new();
+    int result = -1;
+    int i;
+
+    // OpenSSL wants the point and the signature big endian.
+    memcpy(spki, sSpkiPrefix, sizeof(sSpkiPrefix));
+    for (i = 0; i < 32; i++) {
+        spki[sizeof(sSpkiPrefix) + i] = publicKey[31 - i];
+        spki[sizeof(sSpkiPrefix) + 32 + i] = publicKey[63 - i];
+        be[i] = signature[31 - i];
+        be[32 + i] = signature[63 - i];
+    }
+    key = d2i_PUBKEY(NULL, &q, sizeof(spki));
+    if (key && sig) {
+        BIGNUM *r = BN_bin2bn(be, 32, NULL);
+        BIGNUM *s = BN_bin2bn(&be[32], 32, NULL);
+        if (r && s && ECDSA_SIG_set0(sig, r, s) == 1) {
+            derLen = i2d_ECDSA_SIG(sig, &der);
+        } else {
+            BN_free(r);
+            BN_free(s);
+        }
+    }
+    // The digest is already computed, so verify without hashing again.
+    if (derLen > 0 && (ctx = EVP_PKEY_CTX_new(key, NULL)) != NULL && EVP_PKEY_verify_init(ctx) == 1
+        && EVP_PKEY_verify(ctx, der, derLen, hash, 32) == 1) {
+        result = 0;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    OPENSSL_free(der);
+    ECDSA_SIG_free(sig);
+    EVP_PKEY_free(key);
+    return result;
+}
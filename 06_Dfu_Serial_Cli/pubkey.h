@@ -0,0 +1,47 @@
+//
+//  pubkey.h
+//  nrf52-dfu
+//
+//  The bootloader's public key (dfu_public_key.c) and ECDSA P-256 verification
+//  with OpenSSL; used by the pre-flight check of dfuserial (fwuVerify) and by dfupkg.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#ifndef __PUBKEY_H__
+#define __PUBKEY_H__ 1
+
+#include <inttypes.h>
+
+// Read the 64 bytes of pk[] from the bootloader's dfu_public_key.c (generated by nrfutil):
+// x and y, each in little endian byte order.
+// Returns 0 on success; prints a message to stderr and returns -1 otherwise.
+int pubkeyLoad(const char *path, uint8_t publicKey[64]);
+
+// Verify a signature of the init packet (r and s, each in little endian) over the SHA-256
+// digest hash; an FFwuVerifySignatureFunction. Returns 0 if the signature is valid.
+int pubkeyVerify(const uint8_t *publicKey, const uint8_t *hash, const uint8_t *signature);
+
+
+#endif // __PUBKEY_H__
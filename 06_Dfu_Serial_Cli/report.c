@@ -0,0 +1,78 @@
+//
+//  report.c
+//  nrf52-dfu
+//
+//  Printing the statistics of an update session (TFwuStats).
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include "report.h"
+
+static const char *opcodeName(uint8_t opcode)
+{
+    static const char *names[FWU_NOF_OPCODES] = {
+        "PROTOCOL_VERSION", "CREATE", "RCPT_NOTIF", "CRC", "EXECUTE", "0x05", "SELECT",
+        "MTU", "WRITE", "PING", "HW_VERSION", "FW_VERSION", "ABORT",
+    };
+    return opcode < FWU_NOF_OPCODES ? names[opcode] : "?";
+}
+
+void printSessionStats(FILE *out, const char *name, TFwu *fwu)
+{
+    const TFwuStats *stats = &fwu->stats;
+    uint32_t totalMillisec = 0;
+    uint32_t framingBytes;
+    int i;
+
+    for (i = 0; i < FWU_NOF_PHASES; i++) {
+        totalMillisec += stats->phaseMillisec[i];
+    }
+    fprintf(out, "%s: time per phase:", name);
+    for (i = 0; i < FWU_NOF_PHASES; i++) {
+        if (stats->phaseMillisec[i] > 0) {
+            fprintf(out, " %s %u ms (%.1f%%)", fwuPhaseName(i), stats->phaseMillisec[i],
+                    100.0 * stats->phaseMillisec[i] / totalMillisec);
+        }
+    }
+    fprintf(out, "\n");
+
+    fprintf(out, "%s: round trip min/avg/max:", name);
+    for (i = 0; i < FWU_NOF_OPCODES; i++) {
+        const TFwuRtt *rtt = &stats->rtt[i];
+        if (rtt->count > 0) {
+            fprintf(out, " %s %u/%u/%u ms (%u)", opcodeName(i), rtt->minMillisec,
+                    fwuStatsRttAvgMillisec(fwu, i), rtt->maxMillisec, rtt->count);
+        }
+    }
+    fprintf(out, "\n");
+
+    // Whatever isn't payload or escape bytes: opcodes, command parameters and EOMs.
+    framingBytes = stats->wireBytes - stats->escapeBytes - stats->payloadBytes;
+    fprintf(out, "%s: %u payload bytes, %u bytes on the wire (%.1f%% escapes, %.1f%% framing), "
+            "%u bytes received\n", name, stats->payloadBytes, stats->wireBytes,
+            stats->wireBytes ? 100.0 * stats->escapeBytes / stats->wireBytes : 0,
+            stats->wireBytes ? 100.0 * framingBytes / stats->wireBytes : 0, stats->rxBytes);
+    fprintf(out, "%s: %u frames sent, %u responses, %u retries, %u timeouts, %u B/s data object throughput\n",
+            name, stats->framesSent, stats->responses, stats->retries, stats->timeouts, fwuStatsThroughput(fwu));
+}
@@ -0,0 +1,675 @@
+//
+//  dfu_target.c
+//  nrf52-dfu
+//
+//  Emulation of the Nordic serial DFU target (the bootloader side of the protocol)
+//  on a virtual clock, to exercise the FWU library without hardware.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <string.h>
+#include "dfu_target.h"
+#include "fwu_initpacket.h"
+
+#define DFU_EOM 0xC0
+#define DFU_RESPONSE 0x60
+
+#define DFU_OP_PROTOCOL_VERSION 0x00
+#define DFU_OP_CREATE 0x01
+#define DFU_OP_RECEIPT_NOTIF_SET 0x02
+#define DFU_OP_CRC_GET 0x03
+#define DFU_OP_EXECUTE 0x04
+#define DFU_OP_SELECT 0x06
+#define DFU_OP_MTU_GET 0x07
+#define DFU_OP_WRITE 0x08
+#define DFU_OP_PING 0x09
+#define DFU_OP_HARDWARE_VERSION 0x0A
+#define DFU_OP_FIRMWARE_VERSION 0x0B
+#define DFU_OP_ABORT 0x0C
+
+#define DFU_RES_SUCCESS 0x01
+#define DFU_RES_OP_CODE_NOT_SUPPORTED 0x02
+#define DFU_RES_INVALID_PARAMETER 0x03
+#define DFU_RES_INSUFFICIENT_RESOURCES 0x04
+#define DFU_RES_INVALID_OBJECT 0x05
+#define DFU_RES_UNSUPPORTED_TYPE 0x07
+#define DFU_RES_OPERATION_NOT_PERMITTED 0x08
+#define DFU_RES_EXT_ERROR 0x0B
+
+#define DFU_EXT_INIT_COMMAND_INVALID 0x04
+#define DFU_EXT_INSUFFICIENT_SPACE 0x0D
+
+#define DFU_OBJ_TYPE_COMMAND 0x01
+#define DFU_OBJ_TYPE_DATA 0x02
+
+#define DFU_FW_TYPE_APPLICATION 0x01
+#define DFU_FW_TYPE_BOOTLOADER 0x02
+
+static uint32_t sCrcTable[256];
+
+static uint64_t dfuTargetRxFifo(TDfuTarget *target, uint64_t *arrivalMicrosec, uint64_t byteMicrosec);
+static int dfuTargetAllocRxBuffer(TDfuTarget *target, uint64_t nowMicrosec);
+static void dfuTargetStall(TDfuTarget *target, uint64_t startMicrosec, uint64_t endMicrosec);
+static void dfuTargetHandleRequest(TDfuTarget *target, uint64_t nowMicrosec);
+static void dfuTargetRespond(TDfuTarget *target, uint64_t readyMicrosec, uint8_t opcode, uint8_t result,
+                             const uint8_t *payload, uint8_t len);
+static void dfuTargetRespondOffsetCrc(TDfuTarget *target, uint64_t readyMicrosec, uint8_t opcode,
+                                      uint32_t offset, uint32_t crc);
+static void dfuTargetRespondExtError(TDfuTarget *target, uint64_t readyMicrosec, uint8_t opcode, uint8_t extError);
+static void dfuTargetCreate(TDfuTarget *target, uint64_t nowMicrosec);
+static void dfuTargetWrite(TDfuTarget *target, uint64_t nowMicrosec);
+static void dfuTargetExecute(TDfuTarget *target, uint64_t nowMicrosec);
+static uint64_t dfuTargetFlashOperation(TDfuTarget *target, uint64_t nowMicrosec, uint32_t durationMicrosec);
+static uint32_t crc32Update(uint32_t crc, const uint8_t *data, uint32_t len);
+static inline uint32_t littleEndianToHost32(const uint8_t *bytes);
+static inline void hostToLittleEndian32(uint32_t v, uint8_t *bytes);
+
+
+// First function to call to set up the internal state of the target.
+void dfuTargetInit(TDfuTarget *target)
+{
+    uint32_t i, j;
+
+    if (sCrcTable[1] == 0) {
+        for (i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (j = 0; j < 8; j++) {
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+            }
+            sCrcTable[i] = c;
+        }
+    }
+
+    target->commandLen = 0;
+    target->commandExecuted = 0;
+    target->executedLen = 0;
+    target->executedCrc = 0;
+    target->appSize = 0;
+    target->activated = 0;
+    target->aborted = 0;
+    target->nofRequests = 0;
+    target->nofFramingErrors = 0;
+    target->nofErrorResponses = 0;
+    target->nofOverrunBytes = 0;
+    target->nofDroppedRequests = 0;
+    target->maxFifoLevel = 0;
+    target->maxBuffersInUse = 0;
+
+    target->privateRxLen = 0;
+    target->privateRxEscape = 0;
+    target->privateRxOverflow = 0;
+    target->privateObjectType = DFU_OBJ_TYPE_COMMAND;
+    target->privateDataObjectSize = 0;
+    target->privateOffset = 0;
+    target->privateCrc = 0;
+    target->privatePrn = 0;
+    target->privateWritesSincePrn = 0;
+    target->privateBusyUntilMicrosec = 0;
+    target->privateFlashBusyUntilMicrosec = 0;
+    target->privateNofStalls = 0;
+    target->privateFifoStallMicrosec = UINT64_MAX;
+    target->privateFifoLevel = 0;
+    memset(target->privateRxBufferFreeMicrosec, 0, sizeof(target->privateRxBufferFreeMicrosec));
+    target->privateTxHead = 0;
+    target->privateTxLen = 0;
+    target->privateTxFreeMicrosec = 0;
+}
+
+// Microseconds the UART needs for len bytes.
+uint64_t dfuTargetByteMicrosec(TDfuTarget *target, uint32_t len)
+{
+    return (uint64_t)len * 10 * 1000000 / target->baudrate;
+}
+
+// Bytes sent by the host; returns the time the last byte has been received.
+uint64_t dfuTargetReceive(TDfuTarget *target, uint64_t startMicrosec, const uint8_t *bytes, uint32_t len)
+{
+    uint64_t byteMicrosec = dfuTargetByteMicrosec(target, 1);
+    uint64_t t = startMicrosec;
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        uint8_t c = bytes[i];
+        uint64_t isrMicrosec;
+        t += byteMicrosec;
+
+        // The interrupt handler reads the byte from the FIFO once the CPU runs.
+        isrMicrosec = dfuTargetRxFifo(target, &t, byteMicrosec);
+        if (isrMicrosec == UINT64_MAX) {
+            continue;
+        }
+
+        if (c == DFU_EOM) {
+            if (target->privateRxOverflow || target->privateRxEscape) {
+                target->nofFramingErrors++;
+            } else if (target->privateRxLen > 0) {
+                int buffer = dfuTargetAllocRxBuffer(target, isrMicrosec);
+                if (buffer >= 0) {
+                    dfuTargetHandleRequest(target, isrMicrosec);
+                    // The buffer is released when the main loop is done with the request.
+                    target->privateRxBufferFreeMicrosec[buffer] = target->privateBusyUntilMicrosec;
+                }
+            }
+            target->privateRxLen = 0;
+            target->privateRxEscape = 0;
+            target->privateRxOverflow = 0;
+            continue;
+        }
+        if (target->privateRxEscape) {
+            target->privateRxEscape = 0;
+            if (c == 0xDC) {
+                c = 0xC0;
+            } else if (c == 0xDD) {
+                c = 0xDB;
+            } else {
+                target->privateRxOverflow = 1; // drop the frame
+                continue;
+            }
+        } else if (c == 0xDB) {
+            target->privateRxEscape = 1;
+            continue;
+        }
+        if (target->privateRxLen == DFU_TARGET_RX_BUF_SIZE) {
+            target->privateRxOverflow = 1;
+            continue;
+        }
+        target->privateRxBuf[target->privateRxLen++] = c;
+    }
+    return t;
+}
+
+// Returns the time the byte that arrives at *arrivalMicrosec is read from the RX FIFO, or
+// UINT64_MAX if it is lost. With flow control, a full FIFO holds the host back instead
+// and *arrivalMicrosec is moved accordingly.
+static uint64_t dfuTargetRxFifo(TDfuTarget *target, uint64_t *arrivalMicrosec, uint64_t byteMicrosec)
+{
+    while (1) {
+        uint64_t t = *arrivalMicrosec;
+
+        while (target->privateNofStalls > 0 && target->privateStallEndMicrosec[0] <= t) {
+            target->privateNofStalls--;
+            memmove(&target->privateStallStartMicrosec[0], &target->privateStallStartMicrosec[1],
+                    target->privateNofStalls * sizeof(uint64_t));
+            memmove(&target->privateStallEndMicrosec[0], &target->privateStallEndMicrosec[1],
+                    target->privateNofStalls * sizeof(uint64_t));
+        }
+        if (target->privateNofStalls == 0 || t < target->privateStallStartMicrosec[0]) {
+            return t;
+        }
+
+        // The CPU is halted; the FIFO is emptied when the stall ends.
+        if (target->privateFifoStallMicrosec != target->privateStallStartMicrosec[0]) {
+            target->privateFifoStallMicrosec = target->privateStallStartMicrosec[0];
+            target->privateFifoLevel = 0;
+        }
+        if (target->rxFifoSize == 0 || target->privateFifoLevel < target->rxFifoSize) {
+            target->privateFifoLevel++;
+            if (target->privateFifoLevel > target->maxFifoLevel) {
+                target->maxFifoLevel = target->privateFifoLevel;
+            }
+            return target->privateStallEndMicrosec[0];
+        }
+        if (!target->hwfc) {
+            target->nofOverrunBytes++;
+            return UINT64_MAX;
+        }
+        // RTS is deasserted; the host sends the byte after the stall.
+        *arrivalMicrosec = target->privateStallEndMicrosec[0] + byteMicrosec;
+    }
+}
+
+// The SLIP decoder hands a complete request to the main loop and needs a free buffer
+// for the next one; with all buffers queued the request is lost. Returns the slot that
+// tracks the request's buffer, or -1.
+static int dfuTargetAllocRxBuffer(TDfuTarget *target, uint64_t nowMicrosec)
+{
+    uint8_t inUse = 0;
+    int slot = -1;
+    uint8_t i;
+
+    for (i = 0; i < DFU_TARGET_MAX_RX_BUFFERS; i++) {
+        if (target->privateRxBufferFreeMicrosec[i] > nowMicrosec) {
+            inUse++;
+        } else if (slot < 0) {
+            slot = i;
+        }
+    }
+    // One buffer always belongs to the decoder.
+    if (target->rxBufferCount != 0 && inUse + 1 >= target->rxBufferCount) {
+        target->nofDroppedRequests++;
+        return -1;
+    }
+    if (inUse + 2 > target->maxBuffersInUse) {
+        target->maxBuffersInUse = inUse + 2;
+    }
+    // Without a limit, requests beyond the tracked ones share the last slot.
+    return slot >= 0 ? slot : DFU_TARGET_MAX_RX_BUFFERS - 1;
+}
+
+// Copy the response bytes that have arrived at the host by nowMicrosec into buf.
+uint32_t dfuTargetTransmit(TDfuTarget *target, uint64_t nowMicrosec, uint8_t *buf, uint32_t maxLen)
+{
+    uint32_t n = 0;
+    while (n < maxLen && target->privateTxLen > 0
+           && target->privateTxTimeMicrosec[target->privateTxHead] <= nowMicrosec) {
+        buf[n++] = target->privateTxBuf[target->privateTxHead];
+        target->privateTxHead = (target->privateTxHead + 1) % DFU_TARGET_TX_BUF_SIZE;
+        target->privateTxLen--;
+    }
+    return n;
+}
+
+// Time the next response byte arrives at the host; UINT64_MAX if nothing is pending.
+uint64_t dfuTargetNextTxMicrosec(TDfuTarget *target)
+{
+    if (target->privateTxLen == 0) {
+        return UINT64_MAX;
+    }
+    return target->privateTxTimeMicrosec[target->privateTxHead];
+}
+
+static void dfuTargetHandleRequest(TDfuTarget *target, uint64_t nowMicrosec)
+{
+    uint8_t *req = target->privateRxBuf;
+    uint8_t payload[20];
+    uint64_t ready;
+
+    // Requests are handled one after the other.
+    if (nowMicrosec < target->privateBusyUntilMicrosec) {
+        nowMicrosec = target->privateBusyUntilMicrosec;
+    }
+    nowMicrosec += target->requestMicrosec;
+    target->privateBusyUntilMicrosec = nowMicrosec;
+    ready = nowMicrosec + target->turnaroundMicrosec;
+    target->nofRequests++;
+
+    switch (req[0]) {
+        case DFU_OP_PING:
+            // 09 <id> -> 60 09 01 <id>
+            dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, &req[1], 1);
+            break;
+
+        case DFU_OP_RECEIPT_NOTIF_SET:
+            // 02 <prn lo> <prn hi> -> 60 02 01
+            target->privatePrn = req[1] | (req[2] << 8);
+            target->privateWritesSincePrn = 0;
+            dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, NULL, 0);
+            break;
+
+        case DFU_OP_MTU_GET:
+            // 07 -> 60 07 01 <mtu lo> <mtu hi>
+            payload[0] = target->mtu & 0xff;
+            payload[1] = target->mtu >> 8;
+            dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, payload, 2);
+            break;
+
+        case DFU_OP_PROTOCOL_VERSION:
+            payload[0] = 1;
+            dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, payload, 1);
+            break;
+
+        case DFU_OP_HARDWARE_VERSION:
+            // part, variant, ROM size, RAM size, ROM page size
+            hostToLittleEndian32(target->hwPart, &payload[0]);
+            hostToLittleEndian32(0x41414230, &payload[4]);
+            hostToLittleEndian32(0x80000, &payload[8]);
+            hostToLittleEndian32(0x10000, &payload[12]);
+            hostToLittleEndian32(target->pageSize, &payload[16]);
+            dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, payload, 20);
+            break;
+
+        case DFU_OP_FIRMWARE_VERSION:
+            // Image 0 is the bootloader, image 1 the application (if there is one).
+            if (req[1] == 0 || (req[1] == 1 && target->appVersion != 0)) {
+                payload[0] = req[1] == 0 ? DFU_FW_TYPE_BOOTLOADER : DFU_FW_TYPE_APPLICATION;
+                hostToLittleEndian32(req[1] == 0 ? 1 : target->appVersion, &payload[1]);
+                hostToLittleEndian32(req[1] == 0 ? 0x78000 : 0x26000, &payload[5]);
+                hostToLittleEndian32(req[1] == 0 ? 0x6000 : target->executedLen, &payload[9]);
+                dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, payload, 13);
+            } else {
+                dfuTargetRespond(target, ready, req[0], DFU_RES_INVALID_PARAMETER, NULL, 0);
+            }
+            break;
+
+        case DFU_OP_SELECT:
+            // 06 <type> -> 60 06 01 <max size> <offset> <crc>
+            if (req[1] == DFU_OBJ_TYPE_COMMAND) {
+                target->privateObjectType = req[1];
+                hostToLittleEndian32(DFU_TARGET_MAX_COMMAND_SIZE, &payload[0]);
+                hostToLittleEndian32(target->commandLen, &payload[4]);
+                hostToLittleEndian32(crc32Update(0, target->command, target->commandLen), &payload[8]);
+                dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, payload, 12);
+            } else if (req[1] == DFU_OBJ_TYPE_DATA) {
+                target->privateObjectType = req[1];
+                hostToLittleEndian32(target->maxObjectSize, &payload[0]);
+                hostToLittleEndian32(target->privateOffset, &payload[4]);
+                hostToLittleEndian32(target->privateCrc, &payload[8]);
+                dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, payload, 12);
+            } else {
+                dfuTargetRespond(target, ready, req[0], DFU_RES_UNSUPPORTED_TYPE, NULL, 0);
+            }
+            break;
+
+        case DFU_OP_CREATE:
+            dfuTargetCreate(target, nowMicrosec);
+            break;
+
+        case DFU_OP_WRITE:
+            dfuTargetWrite(target, nowMicrosec);
+            break;
+
+        case DFU_OP_CRC_GET:
+            if (target->privateObjectType == DFU_OBJ_TYPE_COMMAND) {
+                dfuTargetRespondOffsetCrc(target, ready, req[0], target->commandLen,
+                                          crc32Update(0, target->command, target->commandLen));
+            } else {
+                dfuTargetRespondOffsetCrc(target, ready, req[0], target->privateOffset, target->privateCrc);
+            }
+            break;
+
+        case DFU_OP_EXECUTE:
+            dfuTargetExecute(target, nowMicrosec);
+            break;
+
+        case DFU_OP_ABORT:
+            // The bootloader resets; whatever has not been executed is lost.
+            target->aborted = 1;
+            target->commandExecuted = 0;
+            target->privateOffset = target->executedLen;
+            target->privateCrc = target->executedCrc;
+            break;
+
+        default:
+            dfuTargetRespond(target, ready, req[0], DFU_RES_OP_CODE_NOT_SUPPORTED, NULL, 0);
+            break;
+    }
+}
+
+static void dfuTargetCreate(TDfuTarget *target, uint64_t nowMicrosec)
+{
+    uint8_t *req = target->privateRxBuf;
+    uint64_t ready = nowMicrosec + target->turnaroundMicrosec;
+    uint32_t size = littleEndianToHost32(&req[2]);
+
+    // 01 <type> <size> -> 60 01 01
+    if (req[1] == DFU_OBJ_TYPE_COMMAND) {
+        if (size > DFU_TARGET_MAX_COMMAND_SIZE) {
+            dfuTargetRespond(target, ready, req[0], DFU_RES_INSUFFICIENT_RESOURCES, NULL, 0);
+            return;
+        }
+        target->privateObjectType = req[1];
+        target->commandLen = 0;
+        target->commandExecuted = 0;
+        dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, NULL, 0);
+
+    } else if (req[1] == DFU_OBJ_TYPE_DATA) {
+        uint32_t offset = target->executedLen;
+        uint32_t page;
+
+        if (!target->commandExecuted) {
+            dfuTargetRespond(target, ready, req[0], DFU_RES_OPERATION_NOT_PERMITTED, NULL, 0);
+            return;
+        }
+        if (size == 0 || size > target->maxObjectSize) {
+            dfuTargetRespond(target, ready, req[0], DFU_RES_INSUFFICIENT_RESOURCES, NULL, 0);
+            return;
+        }
+        if (offset + size > target->flashSize) {
+            dfuTargetRespondExtError(target, ready, req[0], DFU_EXT_INSUFFICIENT_SPACE);
+            return;
+        }
+        if (offset % target->pageSize != 0) {
+            // CREATE erases the pages from the write offset on, so an object can only start on a
+            // page: only the last one may be shorter than a whole number of pages.
+            dfuTargetRespond(target, ready, req[0], DFU_RES_INVALID_PARAMETER, NULL, 0);
+            return;
+        }
+
+        // Discard everything since the last EXECUTE.
+        target->privateObjectType = req[1];
+        target->privateDataObjectSize = size;
+        target->privateOffset = offset;
+        target->privateCrc = target->executedCrc;
+
+        // Erase the pages of the object; the last one may be cut short by the end of the flash.
+        for (page = offset / target->pageSize; page * target->pageSize < offset + size; page++) {
+            uint32_t pageStart = page * target->pageSize;
+            uint32_t eraseLen = target->flashSize - pageStart;
+            if (eraseLen > target->pageSize) {
+                eraseLen = target->pageSize;
+            }
+            memset(&target->flash[pageStart], 0xff, eraseLen);
+            dfuTargetFlashOperation(target, nowMicrosec, target->pageEraseMicrosec);
+        }
+        dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, NULL, 0);
+
+    } else {
+        dfuTargetRespond(target, ready, req[0], DFU_RES_UNSUPPORTED_TYPE, NULL, 0);
+    }
+}
+
+static void dfuTargetWrite(TDfuTarget *target, uint64_t nowMicrosec)
+{
+    uint8_t *data = &target->privateRxBuf[1];
+    uint32_t len = target->privateRxLen - 1;
+
+    // 08 <data> (no response)
+    if (target->privateObjectType == DFU_OBJ_TYPE_COMMAND) {
+        if (target->commandLen + len > DFU_TARGET_MAX_COMMAND_SIZE) {
+            target->nofErrorResponses++;
+            return;
+        }
+        memcpy(&target->command[target->commandLen], data, len);
+        target->commandLen += len;
+        return;
+    }
+
+    if (target->privateOffset + len > target->executedLen + target->privateDataObjectSize) {
+        // Beyond the object that was created
+        dfuTargetRespond(target, nowMicrosec + target->turnaroundMicrosec, DFU_OP_WRITE,
+                         DFU_RES_INVALID_OBJECT, NULL, 0);
+        return;
+    }
+    memcpy(&target->flash[target->privateOffset], data, len);
+    dfuTargetFlashOperation(target, nowMicrosec, ((len + 3) / 4) * target->wordWriteMicrosec);
+    target->privateCrc = crc32Update(target->privateCrc, data, len);
+    target->privateOffset += len;
+
+    // Packet receipt notification: a CRC response after every prn WRITE requests
+    if (target->privatePrn != 0 && ++target->privateWritesSincePrn == target->privatePrn) {
+        target->privateWritesSincePrn = 0;
+        dfuTargetRespondOffsetCrc(target, nowMicrosec + target->turnaroundMicrosec, DFU_OP_CRC_GET,
+                                  target->privateOffset, target->privateCrc);
+    }
+}
+
+static void dfuTargetExecute(TDfuTarget *target, uint64_t nowMicrosec)
+{
+    uint8_t *req = target->privateRxBuf;
+    uint64_t ready = nowMicrosec + target->turnaroundMicrosec;
+
+    if (target->privateObjectType == DFU_OBJ_TYPE_COMMAND) {
+        TFwuInitPacket packet;
+        if (target->commandLen == 0) {
+            dfuTargetRespond(target, ready, req[0], DFU_RES_OPERATION_NOT_PERMITTED, NULL, 0);
+            return;
+        }
+        if (fwuInitPacketDecode(target->command, target->commandLen, &packet) != 0) {
+            dfuTargetRespondExtError(target, ready, req[0], DFU_EXT_INIT_COMMAND_INVALID);
+            return;
+        }
+        if (packet.appSize > target->flashSize) {
+            dfuTargetRespondExtError(target, ready, req[0], DFU_EXT_INSUFFICIENT_SPACE);
+            return;
+        }
+        // A different image starts over; the same one continues where it stopped.
+        if (packet.appSize != target->appSize) {
+            target->executedLen = 0;
+            target->executedCrc = 0;
+        }
+        target->appSize = packet.appSize;
+        target->commandExecuted = 1;
+        target->activated = 0;
+        target->privateOffset = target->executedLen;
+        target->privateCrc = target->executedCrc;
+        // Signature verification keeps the CPU busy.
+        target->privateBusyUntilMicrosec = nowMicrosec + target->commandExecuteMicrosec;
+        dfuTargetRespond(target, ready + target->commandExecuteMicrosec, req[0], DFU_RES_SUCCESS, NULL, 0);
+        return;
+    }
+
+    // The object must be complete, except for the last one of the image.
+    if (target->privateOffset - target->executedLen != target->privateDataObjectSize
+        && target->privateOffset != target->appSize) {
+        dfuTargetRespond(target, ready, req[0], DFU_RES_OPERATION_NOT_PERMITTED, NULL, 0);
+        return;
+    }
+    target->executedLen = target->privateOffset;
+    target->executedCrc = target->privateCrc;
+    target->privateDataObjectSize = 0;
+    if (target->executedLen == target->appSize) {
+        // Store the settings page; the bootloader then activates the image.
+        dfuTargetFlashOperation(target, nowMicrosec, target->pageEraseMicrosec + 64 * target->wordWriteMicrosec);
+        target->activated = 1;
+    }
+    // The response is sent once all data is in flash.
+    if (ready < target->privateFlashBusyUntilMicrosec + target->turnaroundMicrosec) {
+        ready = target->privateFlashBusyUntilMicrosec + target->turnaroundMicrosec;
+    }
+    dfuTargetRespond(target, ready, req[0], DFU_RES_SUCCESS, NULL, 0);
+}
+
+// Queue a flash operation; returns the time it completes.
+static uint64_t dfuTargetFlashOperation(TDfuTarget *target, uint64_t nowMicrosec, uint32_t durationMicrosec)
+{
+    if (target->privateFlashBusyUntilMicrosec < nowMicrosec) {
+        target->privateFlashBusyUntilMicrosec = nowMicrosec;
+    }
+    if (target->flashStallsCpu) {
+        // The operation runs right away and the CPU waits for it.
+        uint64_t start = target->privateFlashBusyUntilMicrosec > target->privateBusyUntilMicrosec
+            ? target->privateFlashBusyUntilMicrosec : target->privateBusyUntilMicrosec;
+        dfuTargetStall(target, start, start + durationMicrosec);
+        target->privateFlashBusyUntilMicrosec = start + durationMicrosec;
+        target->privateBusyUntilMicrosec = start + durationMicrosec;
+        return target->privateFlashBusyUntilMicrosec;
+    }
+    target->privateFlashBusyUntilMicrosec += durationMicrosec;
+    return target->privateFlashBusyUntilMicrosec;
+}
+
+static void dfuTargetStall(TDfuTarget *target, uint64_t startMicrosec, uint64_t endMicrosec)
+{
+    uint8_t n = target->privateNofStalls;
+
+    // Back-to-back operations are one stall; the list is bounded by the queued requests.
+    if (n > 0 && (target->privateStallEndMicrosec[n - 1] >= startMicrosec || n == DFU_TARGET_MAX_RX_BUFFERS)) {
+        target->privateStallEndMicrosec[n - 1] = endMicrosec;
+        return;
+    }
+    target->privateStallStartMicrosec[n] = startMicrosec;
+    target->privateStallEndMicrosec[n] = endMicrosec;
+    target->privateNofStalls++;
+}
+
+static void dfuTargetRespond(TDfuTarget *target, uint64_t readyMicrosec, uint8_t opcode, uint8_t result,
+                             const uint8_t *payload, uint8_t len)
+{
+    uint8_t frame[3 + 20];
+    uint64_t byteMicrosec = dfuTargetByteMicrosec(target, 1);
+    uint64_t t;
+    uint8_t i;
+
+    if (result != DFU_RES_SUCCESS) {
+        target->nofErrorResponses++;
+    }
+    // The response is sent once the main loop is done with the request.
+    if (target->flashStallsCpu && readyMicrosec < target->privateBusyUntilMicrosec) {
+        readyMicrosec = target->privateBusyUntilMicrosec;
+    }
+    frame[0] = DFU_RESPONSE;
+    frame[1] = opcode;
+    frame[2] = result;
+    memcpy(&frame[3], payload, len);
+    len += 3;
+
+    // SLIP-encode into the TX queue; each byte arrives one byte time after the previous one.
+    t = readyMicrosec > target->privateTxFreeMicrosec ? readyMicrosec : target->privateTxFreeMicrosec;
+    for (i = 0; i <= len; i++) {
+        uint8_t c = (i == len) ? DFU_EOM : frame[i];
+        uint8_t escaped[2];
+        uint8_t n = 1, k;
+        escaped[0] = c;
+        if (i < len && (c == 0xC0 || c == 0xDB)) {
+            escaped[0] = 0xDB;
+            escaped[1] = (c == 0xC0) ? 0xDC : 0xDD;
+            n = 2;
+        }
+        for (k = 0; k < n; k++) {
+            if (target->privateTxLen == DFU_TARGET_TX_BUF_SIZE) {
+                return; // nobody reads; drop
+            }
+            uint16_t ix = (target->privateTxHead + target->privateTxLen) % DFU_TARGET_TX_BUF_SIZE;
+            t += byteMicrosec;
+            target->privateTxBuf[ix] = escaped[k];
+            target->privateTxTimeMicrosec[ix] = t;
+            target->privateTxLen++;
+        }
+    }
+    target->privateTxFreeMicrosec = t;
+}
+
+static void dfuTargetRespondOffsetCrc(TDfuTarget *target, uint64_t readyMicrosec, uint8_t opcode,
+                                      uint32_t offset, uint32_t crc)
+{
+    uint8_t payload[8];
+    hostToLittleEndian32(offset, &payload[0]);
+    hostToLittleEndian32(crc, &payload[4]);
+    dfuTargetRespond(target, readyMicrosec, opcode, DFU_RES_SUCCESS, payload, sizeof(payload));
+}
+
+static void dfuTargetRespondExtError(TDfuTarget *target, uint64_t readyMicrosec, uint8_t opcode, uint8_t extError)
+{
+    dfuTargetRespond(target, readyMicrosec, opcode, DFU_RES_EXT_ERROR, &extError, 1);
+}
+
+// CRC-32 as used by the DFU protocol (same as zlib's crc32)
+static uint32_t crc32Update(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc = sCrcTable[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static inline uint32_t littleEndianToHost32(const uint8_t *bytes)
+{
+    return bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static inline void hostToLittleEndian32(uint32_t v, uint8_t *bytes)
+{
+    bytes[0] = v & 0xff;
+    bytes[1] = (v >> 8) & 0xff;
+    bytes[2] = (v >> 16) & 0xff;
+    bytes[3] = (v >> 24) & 0xff;
+}
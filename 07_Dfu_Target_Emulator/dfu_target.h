@@ -0,0 +1,142 @@
+//
+//  dfu_target.h
+//  nrf52-dfu
+//
+//  Emulation of the Nordic serial DFU target (the bootloader side of the protocol)
+//  on a virtual clock, to exercise the FWU library without hardware.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef __DFU_TARGET_H__
+#define __DFU_TARGET_H__ 1
+
+#include <inttypes.h>
+
+#define DFU_TARGET_RX_BUF_SIZE 160
+#define DFU_TARGET_TX_BUF_SIZE 256
+#define DFU_TARGET_MAX_COMMAND_SIZE 256
+#define DFU_TARGET_MAX_RX_BUFFERS 8
+
+// All times are in microseconds on a virtual clock owned by the caller.
+typedef struct {
+// --- public - define these before calling dfuTargetInit ---
+    // Flash the image is written to, starting at offset 0 (the application region)
+    uint8_t *flash;
+    uint32_t flashSize;
+    uint32_t pageSize;
+    // UART speed in bits/s; every byte takes 10 bit times (8N1)
+    uint32_t baudrate;
+    // From the end of a request to the start of its response
+    uint32_t turnaroundMicrosec;
+    // Flash timings
+    uint32_t pageEraseMicrosec;
+    uint32_t wordWriteMicrosec;
+    // Set if the CPU halts while the flash is erased or written (NVMC without SoftDevice):
+    // received bytes then wait in the RX FIFO and responses are sent afterwards.
+    // Otherwise the flash works in the background.
+    uint8_t flashStallsCpu;
+    // UART receive path of nrf_dfu_serial_uart: bytes pass the hardware RX FIFO (rxFifoSize
+    // bytes, 0 = unlimited) to the SLIP decoder, which fills one of rxBufferCount request
+    // buffers (NRF_DFU_SERIAL_UART_RX_BUFFERS, at most DFU_TARGET_MAX_RX_BUFFERS, 0 = unlimited).
+    // Without hardware flow control bytes arriving at a full FIFO are lost, and so are
+    // requests when no buffer is free.
+    uint8_t rxFifoSize;
+    uint8_t rxBufferCount;
+    uint8_t hwfc;
+    // Main loop time per request, before it is handled
+    uint32_t requestMicrosec;
+    // Validation of the init command (signature check) on EXECUTE
+    uint32_t commandExecuteMicrosec;
+    // Values reported by SELECT, MTU and the version requests
+    uint32_t maxObjectSize;
+    uint16_t mtu;
+    uint32_t hwPart;
+    uint32_t appVersion;
+// --- public - results
+    // Init command as received and executed
+    uint8_t command[DFU_TARGET_MAX_COMMAND_SIZE];
+    uint32_t commandLen;
+    uint8_t commandExecuted;
+    // Bytes of the image executed (written for good) so far and their CRC
+    uint32_t executedLen;
+    uint32_t executedCrc;
+    // Application size announced by the init command (0 if it couldn't be decoded)
+    uint32_t appSize;
+    // Set when the whole image has been executed; the bootloader would now activate it
+    uint8_t activated;
+    uint8_t aborted;
+    // Counters
+    uint32_t nofRequests;
+    uint32_t nofFramingErrors;
+    uint32_t nofErrorResponses;
+    // Bytes lost to RX FIFO overruns and requests lost for lack of an RX buffer
+    uint32_t nofOverrunBytes;
+    uint32_t nofDroppedRequests;
+    // Highest RX FIFO level and number of occupied request buffers (with the decoder's) seen
+    uint8_t maxFifoLevel;
+    uint8_t maxBuffersInUse;
+// --- private, don't modify ---
+    uint8_t privateRxBuf[DFU_TARGET_RX_BUF_SIZE];
+    uint16_t privateRxLen;
+    uint8_t privateRxEscape;
+    uint8_t privateRxOverflow;
+    uint8_t privateObjectType;
+    uint32_t privateDataObjectSize;
+    uint32_t privateOffset;
+    uint32_t privateCrc;
+    uint16_t privatePrn;
+    uint16_t privateWritesSincePrn;
+    uint64_t privateBusyUntilMicrosec;
+    uint64_t privateFlashBusyUntilMicrosec;
+    uint64_t privateStallStartMicrosec[DFU_TARGET_MAX_RX_BUFFERS];
+    uint64_t privateStallEndMicrosec[DFU_TARGET_MAX_RX_BUFFERS];
+    uint8_t privateNofStalls;
+    uint64_t privateFifoStallMicrosec;
+    uint8_t privateFifoLevel;
+    uint64_t privateRxBufferFreeMicrosec[DFU_TARGET_MAX_RX_BUFFERS];
+    uint8_t privateTxBuf[DFU_TARGET_TX_BUF_SIZE];
+    uint64_t privateTxTimeMicrosec[DFU_TARGET_TX_BUF_SIZE];
+    uint16_t privateTxHead;
+    uint16_t privateTxLen;
+    uint64_t privateTxFreeMicrosec;
+} TDfuTarget;
+
+
+// First function to call to set up the internal state of the target.
+void dfuTargetInit(TDfuTarget *target);
+
+// Microseconds the UART needs for len bytes.
+uint64_t dfuTargetByteMicrosec(TDfuTarget *target, uint32_t len);
+
+// Bytes sent by the host; the first byte starts on the wire at startMicrosec and each
+// byte is received one byte time after the previous one.
+// Returns the time the last byte has been received.
+uint64_t dfuTargetReceive(TDfuTarget *target, uint64_t startMicrosec, const uint8_t *bytes, uint32_t len);
+
+// Copy the response bytes that have arrived at the host by nowMicrosec into buf.
+// Returns the number of bytes copied.
+uint32_t dfuTargetTransmit(TDfuTarget *target, uint64_t nowMicrosec, uint8_t *buf, uint32_t maxLen);
+
+// Time the next response byte arrives at the host; UINT64_MAX if nothing is pending.
+uint64_t dfuTargetNextTxMicrosec(TDfuTarget *target);
+
+
+#endif // __DFU_TARGET_H__
@@ -0,0 +1,487 @@
+//
+//  dfureplay.c
+//  nrf52-dfu
+//
+//  Replays a capture of dfuserial (--capture) against the FWU library: the
+//  recorded target responses are fed back at the recorded delay after the
+//  request they follow, on a virtual clock that runs as fast as possible or
+//  paced to a multiple of real time. Every request the library sends is
+//  compared with the recording, and the time between requests is compared per
+//  opcode, so timing differences between library versions show up exactly.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include "fwu.h"
+#include "fwu_initpacket.h"
+#include "pkg.h"
+#include "capture.h"
+#include "report.h"
+
+#define HOST_TX_CREDIT 255
+#define RX_CHUNK_SIZE 255
+#define NOF_OPCODES 256
+
+// Per request opcode: time since the previous request, recorded and replayed
+typedef struct {
+    uint32_t count;
+    uint64_t recordedMicros;
+    uint64_t replayMicros;
+} TOpcodeTiming;
+
+static TDfuPackage sPackage;
+static TFwu sFwu;
+static const TCaptureRecord **sRecords;
+static uint32_t sNofRecords;
+static uint32_t sBaudrate;
+static uint64_t sNowMicrosec;
+static uint64_t sTxFreeMicrosec;
+// Next record to feed (RX) and next request expected (TX)
+static uint32_t sRxCursor;
+static uint32_t sTxCursor;
+// The last matched request, in replay time and in recorded time
+static uint64_t sAnchorMicros;
+static uint64_t sAnchorRecordedMicros;
+static uint32_t sNofMatched;
+static int sDiverged;
+static uint64_t sFirstTxMicros[2];
+static uint64_t sLastTxMicros[2];
+static TOpcodeTiming sTimings[NOF_OPCODES];
+static FILE *sCsv;
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len);
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len);
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len);
+static void traceFunction(struct SFwu *fwu, EFwuTraceDirection direction, uint32_t millisec,
+                          const uint8_t *bytes, uint16_t len);
+static int feedResponses(void);
+static uint64_t nextRxMicros(void);
+static void pace(double speed, uint64_t wallStart);
+static uint64_t wallMicros(void);
+static uint8_t frameOpcode(const uint8_t *frame, uint32_t len);
+static void printFrame(const char *label, const uint8_t *frame, uint32_t len);
+static void parseOptions(const char *options, uint32_t *timeout, int *retries, uint32_t *bannerTimeout,
+                         int *chunkSize, int *skipIfCurrent);
+static void usage(const char *prog);
+
+
+int main(int argc, const char *argv[])
+{
+    const char *capturePath = NULL;
+    const char *packagePath = NULL;
+    const char *csvPath = NULL;
+    TCapture capture;
+    TFwuInitPacket initPacket;
+    uint32_t interface = 0;
+    uint32_t timeout = 5000;
+    int retries = 3;
+    uint32_t bannerTimeout = 0;
+    int chunkSize = 0;
+    int skipIfCurrent = 0;
+    long timeoutOverride = -1;
+    long retriesOverride = -1;
+    uint32_t baudrateOverride = 0;
+    double speed = 0;
+    int stats = 0;
+    uint32_t i;
+
+    for (i = 1; i < (uint32_t)argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < (uint32_t)argc) ? argv[i + 1] : NULL;
+        if ((!strcmp(a, "-pkg") || !strcmp(a, "--package")) && v) {
+            packagePath = v;
+            i++;
+        } else if ((!strcmp(a, "-i") || !strcmp(a, "--interface")) && v) {
+            interface = strtoul(v, NULL, 0);
+            i++;
+        } else if ((!strcmp(a, "-b") || !strcmp(a, "--baud-rate")) && v) {
+            baudrateOverride = strtoul(v, NULL, 0);
+            i++;
+        } else if ((!strcmp(a, "-t") || !strcmp(a, "--timeout")) && v) {
+            timeoutOverride = strtol(v, NULL, 0);
+            i++;
+        } else if ((!strcmp(a, "-r") || !strcmp(a, "--retries")) && v) {
+            retriesOverride = strtol(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--speed") && v) {
+            speed = atof(v);
+            i++;
+        } else if (!strcmp(a, "--csv") && v) {
+            csvPath = v;
+            i++;
+        } else if (!strcmp(a, "--stats")) {
+            stats = 1;
+        } else if (a[0] != '-' && !capturePath) {
+            capturePath = a;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!capturePath || !packagePath || speed < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (captureLoad(&capture, capturePath) != 0) {
+        return -1;
+    }
+    if (interface >= capture.nofInterfaces) {
+        fprintf(stderr, "%s has %u interface(s)\n", capturePath, capture.nofInterfaces);
+        return -1;
+    }
+    if (pkgLoad(packagePath, &sPackage) != 0) {
+        return -1;
+    }
+
+    // The records of the chosen port, in recorded order.
+    sRecords = calloc(capture.nofRecords + 1, sizeof(*sRecords));
+    for (i = 0; i < capture.nofRecords; i++) {
+        if (capture.records[i].interface == interface) {
+            sRecords[sNofRecords++] = &capture.records[i];
+        }
+    }
+    if (sNofRecords == 0) {
+        fprintf(stderr, "no records for interface %u\n", interface);
+        return -1;
+    }
+    const TCaptureInterface *port = &capture.interfaces[interface];
+    parseOptions(port->comment, &timeout, &retries, &bannerTimeout, &chunkSize, &skipIfCurrent);
+    sBaudrate = baudrateOverride;
+    if (skipIfCurrent && fwuInitPacketDecode(sPackage.dat, sPackage.datLen, &initPacket) != 0) {
+        fprintf(stderr, "can't decode the init packet\n");
+        return -1;
+    }
+    printf("%s: %s at %u baud (%s), %u records, %.3f s recorded\n", capturePath, port->name, port->baudrate,
+           port->comment, sNofRecords, (sRecords[sNofRecords - 1]->micros - sRecords[0]->micros) / 1e6);
+
+    if (csvPath) {
+        sCsv = fopen(csvPath, "w");
+        if (!sCsv) {
+            perror(csvPath);
+            return -1;
+        }
+        fprintf(sCsv, "frame,opcode,recorded_us,replay_us\n");
+    }
+
+    sFwu.commandObjectProviderFunction = commandObjectProvider;
+    sFwu.commandObjectLen = sPackage.datLen;
+    sFwu.dataObjectProviderFunction = dataObjectProvider;
+    sFwu.dataObjectLen = sPackage.binLen;
+    sFwu.txFunction = txFunction;
+    sFwu.traceFunction = traceFunction;
+    sFwu.responseTimeoutMillisec = timeoutOverride >= 0 ? (uint32_t)timeoutOverride : timeout;
+    sFwu.maxRetries = retriesOverride >= 0 ? (uint8_t)retriesOverride : retries;
+    sFwu.bannerTimeoutMillisec = bannerTimeout;
+    sFwu.dataChunkSize = chunkSize;
+    sFwu.versionCheck = skipIfCurrent;
+    sFwu.imageFwVersion = skipIfCurrent ? initPacket.fwVersion : 0;
+    fwuInit(&sFwu);
+    fwuExec(&sFwu);
+
+    // Until the first request, responses (e.g. the banner) count from the first record.
+    sAnchorRecordedMicros = sRecords[0]->micros;
+
+    uint64_t wallStart = wallMicros();
+    uint64_t lastMillisec = 0;
+    EFwuProcessStatus status = FWU_STATUS_UNDEFINED;
+    while (!sDiverged) {
+        int fed = feedResponses();
+        if (sTxFreeMicrosec <= sNowMicrosec) {
+            fwuCanSendData(&sFwu, HOST_TX_CREDIT);
+        }
+        uint32_t elapsed = sNowMicrosec / 1000 - lastMillisec;
+        lastMillisec = sNowMicrosec / 1000;
+        status = fwuYield(&sFwu, elapsed);
+        if (status != FWU_STATUS_UNDEFINED || sDiverged) {
+            break;
+        }
+
+        // Next event: a state transition, a free UART, a recorded response or the deadline.
+        uint8_t work = fwuPendingWork(&sFwu);
+        uint64_t next = nextRxMicros();
+        uint64_t t;
+        if ((work & FWU_WORK_INTERNAL) || fed) {
+            next = sNowMicrosec;
+        }
+        if (work & FWU_WORK_TX) {
+            t = sTxFreeMicrosec > sNowMicrosec ? sTxFreeMicrosec : sNowMicrosec;
+            next = t < next ? t : next;
+        }
+        uint32_t deadline = fwuDeadlineMillisec(&sFwu);
+        if (deadline != 0xffffffff) {
+            t = (lastMillisec + (deadline ? deadline : 1)) * 1000;
+            next = t < next ? t : next;
+        }
+        if (next == UINT64_MAX) {
+            fprintf(stderr, "replay stalled at %.3f s\n", sNowMicrosec / 1e6);
+            break;
+        }
+        if (next > sNowMicrosec) {
+            sNowMicrosec = next;
+            pace(speed, wallStart);
+        }
+    }
+
+    uint32_t nofRequests = 0;
+    for (i = 0; i < sNofRecords; i++) {
+        nofRequests += sRecords[i]->direction == CAPTURE_TX;
+    }
+    printf("replay: %s, %.3f s, %u of %u recorded requests matched\n",
+           sDiverged ? "diverged from the recording"
+               : status == FWU_STATUS_COMPLETION ? "Success" : status == FWU_STATUS_FAILURE ? "Failed" : "stalled",
+           sNowMicrosec / 1e6, sNofMatched, nofRequests);
+    if (sNofMatched > 1) {
+        double recorded = (sLastTxMicros[0] - sFirstTxMicros[0]) / 1e3;
+        double replayed = (sLastTxMicros[1] - sFirstTxMicros[1]) / 1e3;
+        printf("first to last matched request: %.1f ms recorded, %.1f ms replayed (%+.1f%%)\n",
+               recorded, replayed, recorded > 0 ? 100.0 * (replayed - recorded) / recorded : 0);
+        printf("time before each request by opcode:   count  recorded ms  replayed ms\n");
+        for (i = 0; i < NOF_OPCODES; i++) {
+            TOpcodeTiming *timing = &sTimings[i];
+            if (timing->count > 0) {
+                printf("  0x%02X %33u %12.1f %12.1f\n", i, timing->count,
+                       timing->recordedMicros / 1e3, timing->replayMicros / 1e3);
+            }
+        }
+    }
+    if (stats) {
+        printSessionStats(stdout, "replay", &sFwu);
+    }
+    if (sCsv) {
+        fclose(sCsv);
+    }
+    captureClose(&capture);
+    pkgFree(&sPackage);
+    free(sRecords);
+    return (!sDiverged && status == FWU_STATUS_COMPLETION) ? 0 : -1;
+}
+
+// Feed the recorded responses that are due; a response never overtakes the request it follows.
+static int feedResponses(void)
+{
+    int fed = 0;
+
+    while (sRxCursor < sNofRecords) {
+        const TCaptureRecord *record = sRecords[sRxCursor];
+        if (record->direction == CAPTURE_TX) {
+            if (sRxCursor >= sTxCursor) {
+                break;
+            }
+            sRxCursor++;
+            continue;
+        }
+        if (nextRxMicros() > sNowMicrosec) {
+            break;
+        }
+        uint32_t pos;
+        for (pos = 0; pos < record->len; pos += RX_CHUNK_SIZE) {
+            uint32_t n = record->len - pos < RX_CHUNK_SIZE ? record->len - pos : RX_CHUNK_SIZE;
+            fwuDidReceiveData(&sFwu, (uint8_t *)&record->data[pos], n);
+        }
+        sRxCursor++;
+        fed = 1;
+    }
+    return fed;
+}
+
+// When the next recorded response is due: at its recorded distance from the last matched request.
+static uint64_t nextRxMicros(void)
+{
+    uint32_t i = sRxCursor;
+
+    while (i < sNofRecords && sRecords[i]->direction == CAPTURE_TX) {
+        if (i >= sTxCursor) {
+            return UINT64_MAX; // waiting for the library to send this request
+        }
+        i++;
+    }
+    if (i == sNofRecords) {
+        return UINT64_MAX;
+    }
+    if (sRecords[i]->micros <= sAnchorRecordedMicros) {
+        return sAnchorMicros;
+    }
+    return sAnchorMicros + (sRecords[i]->micros - sAnchorRecordedMicros);
+}
+
+static void traceFunction(struct SFwu *fwu, EFwuTraceDirection direction, uint32_t millisec,
+                          const uint8_t *bytes, uint16_t len)
+{
+    if (direction != FWU_TRACE_TX || sDiverged) {
+        return;
+    }
+    while (sTxCursor < sNofRecords && sRecords[sTxCursor]->direction != CAPTURE_TX) {
+        sTxCursor++;
+    }
+    if (sTxCursor == sNofRecords) {
+        printf("request %u: not in the recording\n", sNofMatched);
+        printFrame("  replayed", bytes, len);
+        sDiverged = 1;
+        return;
+    }
+    const TCaptureRecord *record = sRecords[sTxCursor];
+    if (record->len != len || memcmp(record->data, bytes, len) != 0) {
+        printf("request %u at %.3f s: differs from the recording\n", sNofMatched, sNowMicrosec / 1e6);
+        printFrame("  recorded", record->data, record->len);
+        printFrame("  replayed", bytes, len);
+        sDiverged = 1;
+        return;
+    }
+
+    if (sNofMatched == 0) {
+        sFirstTxMicros[0] = record->micros;
+        sFirstTxMicros[1] = sNowMicrosec;
+    } else {
+        TOpcodeTiming *timing = &sTimings[frameOpcode(bytes, len)];
+        timing->count++;
+        timing->recordedMicros += record->micros - sLastTxMicros[0];
+        timing->replayMicros += sNowMicrosec - sLastTxMicros[1];
+    }
+    sLastTxMicros[0] = record->micros;
+    sLastTxMicros[1] = sNowMicrosec;
+    if (sCsv) {
+        fprintf(sCsv, "%u,%u,%llu,%llu\n", sNofMatched, frameOpcode(bytes, len),
+                (unsigned long long)(record->micros - sFirstTxMicros[0]),
+                (unsigned long long)(sNowMicrosec - sFirstTxMicros[1]));
+    }
+    sAnchorMicros = sNowMicrosec;
+    sAnchorRecordedMicros = record->micros;
+    sTxCursor++;
+    sNofMatched++;
+}
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sPackage.dat[pos];
+}
+
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sPackage.bin[pos];
+}
+
+// Like the capturing host, hand the requests to a buffer that takes them at once; the time the
+// UART needed to send them is part of the recorded response delays. With -b, model the UART
+// draining the buffer at the baud rate (10 bits per byte) instead.
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len)
+{
+    if (sBaudrate == 0) {
+        return;
+    }
+    uint64_t start = sTxFreeMicrosec > sNowMicrosec ? sTxFreeMicrosec : sNowMicrosec;
+    sTxFreeMicrosec = start + (uint64_t)len * 10000000 / sBaudrate;
+}
+
+// With --speed, let the virtual clock run at most speed times faster than real time.
+static void pace(double speed, uint64_t wallStart)
+{
+    if (speed <= 0) {
+        return;
+    }
+    uint64_t due = wallStart + (uint64_t)(sNowMicrosec / speed);
+    uint64_t now = wallMicros();
+    if (due > now + 1000) {
+        struct timespec delay;
+        delay.tv_sec = (due - now) / 1000000;
+        delay.tv_nsec = (due - now) % 1000000 * 1000;
+        nanosleep(&delay, NULL);
+    }
+}
+
+static uint64_t wallMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// The opcode, after the EOM that terminates an interrupted frame
+static uint8_t frameOpcode(const uint8_t *frame, uint32_t len)
+{
+    if (len > 1 && frame[0] == 0xC0) {
+        return frame[1];
+    }
+    return len > 0 ? frame[0] : 0;
+}
+
+static void printFrame(const char *label, const uint8_t *frame, uint32_t len)
+{
+    uint32_t i;
+    printf("%s:", label);
+    for (i = 0; i < len && i < 24; i++) {
+        printf(" %02X", frame[i]);
+    }
+    printf("%s (%u bytes)\n", len > 24 ? " ..." : "", len);
+}
+
+// The options dfuserial stored with the port, e.g. "-t 5000 -r 3 --banner-timeout 0 --chunk-size 0"
+static void parseOptions(const char *options, uint32_t *timeout, int *retries, uint32_t *bannerTimeout,
+                         int *chunkSize, int *skipIfCurrent)
+{
+    char option[32];
+    long value;
+    int n;
+
+    while (sscanf(options, "%31s%n", option, &n) == 1) {
+        options += n;
+        if (!strcmp(option, "--skip-if-current")) {
+            *skipIfCurrent = 1;
+            continue;
+        }
+        if (sscanf(options, "%ld%n", &value, &n) != 1) {
+            continue;
+        }
+        options += n;
+        if (!strcmp(option, "-t")) {
+            *timeout = value;
+        } else if (!strcmp(option, "-r")) {
+            *retries = value;
+        } else if (!strcmp(option, "--banner-timeout")) {
+            *bannerTimeout = value;
+        } else if (!strcmp(option, "--chunk-size")) {
+            *chunkSize = value;
+        }
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s <capture.pcapng> -pkg <package.zip> [-i <interface>] [-b <baudrate>]\n", prog);
+    fprintf(stderr, "          [-t <timeout-ms>] [-r <retries>] [--speed <factor>] [--csv <file>] [--stats]\n");
+    fprintf(stderr, "Replay a capture of 'dfuserial --capture' against the FWU library.\n");
+    fprintf(stderr, "  -pkg, --package       the DFU package of the captured update\n");
+    fprintf(stderr, "  -i, --interface       port to replay when several were captured (default 0)\n");
+    fprintf(stderr, "  -b, --baud-rate       model a UART at this rate between library and target; by default\n");
+    fprintf(stderr, "                        requests go to a host buffer and the recorded delays include the UART\n");
+    fprintf(stderr, "  -t, --timeout         response timeout in ms (default: as captured)\n");
+    fprintf(stderr, "  -r, --retries         retries (default: as captured)\n");
+    fprintf(stderr, "  --speed               1 = recorded speed, 10 = ten times faster (default 0: no waiting)\n");
+    fprintf(stderr, "  --csv                 write the recorded and replayed time of every request\n");
+    fprintf(stderr, "  --stats               print the library's statistics of the replay\n");
+}
@@ -0,0 +1,605 @@
+//
+//  dfutargetd.c
+//  nrf52-dfu
+//
+//  Serial DFU target emulator on pseudo-terminals: behaves like the bootloader
+//  at the configured baud rate in real time, with optional error injection, so that
+//  host programs can be tested end to end without a board. With --targets a whole
+//  fleet is emulated by one process, each target with its own link quality and
+//  flash timing, and the update times are reported on exit.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "dfu_target.h"
+
+#define DEFAULT_FLASH_SIZE (1024 * 1024)
+#define READ_CHUNK_SIZE 64
+#define MAX_TARGETS 4000
+#define PORT_NAME_SIZE 64
+
+typedef struct {
+    double rxDrop;      // probability that a byte from the host is lost
+    double rxFlip;      // probability that a byte from the host has one bit flipped
+    double txDrop;      // probability that a response is lost
+    double txFlip;      // probability that a response byte has one bit flipped
+    double delayRate;   // probability that a response is delayed
+    uint32_t delayMillisec;
+} TInjection;
+
+// One emulated target and its pseudo-terminal
+typedef struct {
+    TDfuTarget target;
+    TInjection injection;
+    unsigned short rng[3];
+    int master;
+    int slave;
+    char name[PORT_NAME_SIZE];
+    uint8_t linked;
+    uint64_t bannerAt;
+    uint8_t bannerSent;
+    uint64_t rxLineFree;
+    uint64_t txShift;
+    uint8_t txInFrame;
+    uint8_t txDropFrame;
+    // Time of the first request of the current session (0 = none yet)
+    uint64_t sessionStart;
+} TPort;
+
+// Results of all sessions of the fleet
+typedef struct {
+    uint32_t nofUpdates;
+    uint32_t nofAborted;
+    uint64_t bytesExecuted;
+    uint64_t firstRequest;
+    uint64_t lastActivation;
+    uint64_t *updateMicros;
+    uint32_t updateMicrosSize;
+} TFleetStats;
+
+static volatile sig_atomic_t sTerminate;
+static int sVerbose;
+static TFleetStats sStats;
+
+static uint64_t monotonicMicros(void);
+static int openPty(TPort *port, const char *link);
+static void randomizePort(TPort *port, const TDfuTarget *targetConfig, const TInjection *injection, double spread);
+static double spreadValue(TPort *port, double value, double spread);
+static void serve(TPort *ports, int nofPorts, const char *outputPath, uint32_t exitAfter);
+static void transmit(TPort *port, uint64_t now, uint64_t *next);
+static void receive(TPort *port, uint64_t now);
+static void endSession(TPort *port, uint64_t now, const char *outputPath, int nofPorts, int ix);
+static void saveImage(TDfuTarget *target, const char *path);
+static void printReport(int nofPorts, uint64_t wallMicros);
+static int compareMicros(const void *a, const void *b);
+static void onSignal(int sig);
+static void usage(const char *prog);
+
+
+int main(int argc, const char *argv[])
+{
+    TDfuTarget targetConfig;
+    TInjection injection;
+    TPort *ports;
+    const char *link = NULL;
+    const char *outputPath = NULL;
+    uint32_t baudrate = 115200;
+    uint32_t bannerDelay = 0;
+    uint32_t exitAfter = 0;
+    double spread = 0;
+    int nofPorts = 1;
+    long seed = 1;
+    int i;
+
+    memset(&targetConfig, 0, sizeof(targetConfig));
+    targetConfig.flashSize = DEFAULT_FLASH_SIZE;
+    targetConfig.pageSize = 4096;
+    targetConfig.turnaroundMicrosec = 100;
+    targetConfig.pageEraseMicrosec = 85000;
+    targetConfig.wordWriteMicrosec = 41;
+    targetConfig.maxObjectSize = 4096;
+    targetConfig.mtu = 131;
+    targetConfig.hwPart = 0x52832;
+    memset(&injection, 0, sizeof(injection));
+
+    for (i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(a, "-v") || !strcmp(a, "--verbose")) {
+            sVerbose = 1;
+            continue;
+        }
+        if (!strcmp(a, "--uart-model")) {
+            // nRF52 UART without flow control, 3 RX buffers, CPU halted by NVMC operations
+            targetConfig.rxFifoSize = 6;
+            targetConfig.rxBufferCount = 3;
+            targetConfig.requestMicrosec = 20;
+            targetConfig.flashStallsCpu = 1;
+            continue;
+        }
+        if (!v) {
+            usage(argv[0]);
+            return -1;
+        }
+        i++;
+        if (!strcmp(a, "-b") || !strcmp(a, "--baud-rate")) {
+            baudrate = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--link")) {
+            link = v;
+        } else if (!strcmp(a, "-o") || !strcmp(a, "--output")) {
+            outputPath = v;
+        } else if (!strcmp(a, "--app-version")) {
+            targetConfig.appVersion = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--banner-delay")) {
+            bannerDelay = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--turnaround")) {
+            targetConfig.turnaroundMicrosec = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--page-erase")) {
+            targetConfig.pageEraseMicrosec = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--word-write")) {
+            targetConfig.wordWriteMicrosec = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--command-execute")) {
+            targetConfig.commandExecuteMicrosec = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--flash-size")) {
+            targetConfig.flashSize = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--rx-drop")) {
+            injection.rxDrop = atof(v);
+        } else if (!strcmp(a, "--rx-flip")) {
+            injection.rxFlip = atof(v);
+        } else if (!strcmp(a, "--tx-drop")) {
+            injection.txDrop = atof(v);
+        } else if (!strcmp(a, "--tx-flip")) {
+            injection.txFlip = atof(v);
+        } else if (!strcmp(a, "--delay-rate")) {
+            injection.delayRate = atof(v);
+        } else if (!strcmp(a, "--delay")) {
+            injection.delayMillisec = strtoul(v, NULL, 0);
+        } else if (!strcmp(a, "--seed")) {
+            seed = atol(v);
+        } else if (!strcmp(a, "--targets")) {
+            nofPorts = atoi(v);
+        } else if (!strcmp(a, "--spread")) {
+            spread = atof(v);
+        } else if (!strcmp(a, "--exit-after")) {
+            exitAfter = strtoul(v, NULL, 0);
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (baudrate == 0 || nofPorts < 1 || nofPorts > MAX_TARGETS || spread < 0 || spread > 1) {
+        usage(argv[0]);
+        return -1;
+    }
+    targetConfig.baudrate = baudrate;
+
+    // Two descriptors per target
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    ports = calloc(nofPorts, sizeof(TPort));
+    for (i = 0; i < nofPorts; i++) {
+        TPort *port = &ports[i];
+        char portLink[PORT_NAME_SIZE];
+
+        // Every target draws from its own sequence, so its errors don't depend on the others.
+        port->rng[0] = 0x330E;
+        port->rng[1] = (unsigned short)(seed + i);
+        port->rng[2] = (unsigned short)((seed + i) >> 16);
+        randomizePort(port, &targetConfig, &injection, spread);
+        port->target.flash = malloc(port->target.flashSize);
+        port->bannerAt = (uint64_t)bannerDelay * 1000;
+        port->bannerSent = bannerDelay == 0;
+
+        if (link && nofPorts > 1) {
+            snprintf(portLink, sizeof(portLink), "%s%d", link, i);
+        }
+        if (openPty(port, link ? (nofPorts > 1 ? portLink : link) : NULL) != 0) {
+            return -1;
+        }
+        dfuTargetInit(&port->target);
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    uint64_t t0 = monotonicMicros();
+    serve(ports, nofPorts, outputPath, exitAfter);
+    if (nofPorts > 1 || exitAfter) {
+        printReport(nofPorts, monotonicMicros() - t0);
+    }
+
+    for (i = 0; i < nofPorts; i++) {
+        if (ports[i].linked) {
+            unlink(ports[i].name);
+        }
+        close(ports[i].slave);
+        close(ports[i].master);
+        free(ports[i].target.flash);
+    }
+    free(ports);
+    free(sStats.updateMicros);
+    return 0;
+}
+
+// Copy the configuration; with a spread, each timing and error rate of the target is
+// drawn from value * [1 - spread, 1 + spread].
+static void randomizePort(TPort *port, const TDfuTarget *targetConfig, const TInjection *injection, double spread)
+{
+    port->target = *targetConfig;
+    port->injection = *injection;
+    if (spread == 0) {
+        return;
+    }
+    port->target.turnaroundMicrosec = spreadValue(port, targetConfig->turnaroundMicrosec, spread);
+    port->target.pageEraseMicrosec = spreadValue(port, targetConfig->pageEraseMicrosec, spread);
+    port->target.wordWriteMicrosec = spreadValue(port, targetConfig->wordWriteMicrosec, spread);
+    port->target.commandExecuteMicrosec = spreadValue(port, targetConfig->commandExecuteMicrosec, spread);
+    port->injection.rxDrop = spreadValue(port, injection->rxDrop, spread);
+    port->injection.rxFlip = spreadValue(port, injection->rxFlip, spread);
+    port->injection.txDrop = spreadValue(port, injection->txDrop, spread);
+    port->injection.txFlip = spreadValue(port, injection->txFlip, spread);
+    port->injection.delayRate = spreadValue(port, injection->delayRate, spread);
+}
+
+static double spreadValue(TPort *port, double value, double spread)
+{
+    return value * (1 + spread * (2 * erand48(port->rng) - 1));
+}
+
+// Serve DFU sessions until terminated or until exitAfter images have been activated;
+// every target restarts after an activation or ABORT.
+static void serve(TPort *ports, int nofPorts, const char *outputPath, uint32_t exitAfter)
+{
+    uint64_t t0 = monotonicMicros();
+    struct pollfd *pfds = calloc(nofPorts, sizeof(struct pollfd));
+    int i;
+
+    while (!sTerminate && (exitAfter == 0 || sStats.nofUpdates < exitAfter)) {
+        uint64_t now = monotonicMicros() - t0;
+        uint64_t next = now + 100000;
+
+        for (i = 0; i < nofPorts; i++) {
+            TPort *port = &ports[i];
+            TDfuTarget *target = &port->target;
+
+            // The bootloader prints its banner before it takes over the UART.
+            if (!port->bannerSent && now >= port->bannerAt) {
+                static const char banner[] = "@@BOOTLOADER\r\n@@DFUR >\r\n";
+                if (write(port->master, banner, sizeof(banner) - 1) < 0 && sVerbose) {
+                    perror("write");
+                }
+                port->bannerSent = 1;
+            }
+            if (!port->bannerSent && port->bannerAt < next) {
+                next = port->bannerAt;
+            }
+
+            transmit(port, now, &next);
+
+            // Restart once the last response has been sent.
+            if ((target->activated || target->aborted) && dfuTargetNextTxMicrosec(target) == UINT64_MAX) {
+                endSession(port, now, outputPath, nofPorts, i);
+            }
+
+            // Read from the host only as fast as the UART would deliver, so the host sees
+            // back-pressure from the pseudo-terminal. Before the banner the application owns
+            // the UART and whatever arrives is discarded.
+            pfds[i].fd = port->master;
+            pfds[i].events = (port->rxLineFree <= now || !port->bannerSent) ? POLLIN : 0;
+            pfds[i].revents = 0;
+            if (port->rxLineFree > now && port->rxLineFree < next) {
+                next = port->rxLineFree;
+            }
+        }
+
+        // Sleep until the next event or until a host sends data.
+        now = monotonicMicros() - t0;
+        int timeoutMillisec = next > now ? (int)((next - now + 999) / 1000) : 0;
+        if (poll(pfds, nofPorts, timeoutMillisec) <= 0) {
+            continue;
+        }
+        now = monotonicMicros() - t0;
+        for (i = 0; i < nofPorts; i++) {
+            if (pfds[i].revents & POLLIN) {
+                receive(&ports[i], now);
+            }
+        }
+    }
+    free(pfds);
+}
+
+// Send the response bytes that are due, with injected errors, in one write.
+static void transmit(TPort *port, uint64_t now, uint64_t *next)
+{
+    TDfuTarget *target = &port->target;
+    uint8_t out[DFU_TARGET_TX_BUF_SIZE];
+    int n = 0;
+
+    while (n < (int)sizeof(out)) {
+        uint64_t due = dfuTargetNextTxMicrosec(target);
+        if (due == UINT64_MAX) {
+            break;
+        }
+        if (!port->txInFrame) {
+            // A new response: decide whether it is lost or delayed.
+            port->txInFrame = 1;
+            port->txDropFrame = erand48(port->rng) < port->injection.txDrop;
+            port->txShift = erand48(port->rng) < port->injection.delayRate
+                ? (uint64_t)port->injection.delayMillisec * 1000 : 0;
+            if (sVerbose && port->txDropFrame) {
+                fprintf(stderr, "%s: dropping response\n", port->name);
+            }
+            if (sVerbose && port->txShift) {
+                fprintf(stderr, "%s: delaying response by %u ms\n", port->name, port->injection.delayMillisec);
+            }
+        }
+        if (due + port->txShift > now) {
+            if (due + port->txShift < *next) {
+                *next = due + port->txShift;
+            }
+            break;
+        }
+        uint8_t c;
+        dfuTargetTransmit(target, due, &c, 1);
+        if (c == 0xC0) {
+            port->txInFrame = 0;
+        }
+        if (port->txDropFrame) {
+            continue;
+        }
+        if (erand48(port->rng) < port->injection.txFlip) {
+            c ^= 1 << (nrand48(port->rng) % 8);
+        }
+        out[n++] = c;
+    }
+    if (n > 0 && write(port->master, out, n) < 0 && errno != EAGAIN) {
+        perror("write");
+    }
+}
+
+static void receive(TPort *port, uint64_t now)
+{
+    uint8_t buf[READ_CHUNK_SIZE];
+    uint8_t out[READ_CHUNK_SIZE];
+    int n, m = 0, i;
+
+    if (!port->bannerSent) {
+        while (read(port->master, buf, sizeof(buf)) > 0) {
+        }
+        return;
+    }
+    n = read(port->master, buf, sizeof(buf));
+    if (n <= 0) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        if (erand48(port->rng) < port->injection.rxDrop) {
+            continue;
+        }
+        out[m] = buf[i];
+        if (erand48(port->rng) < port->injection.rxFlip) {
+            out[m] ^= 1 << (nrand48(port->rng) % 8);
+        }
+        m++;
+    }
+    if (port->sessionStart == 0) {
+        port->sessionStart = now > 0 ? now : 1;
+        if (sStats.firstRequest == 0) {
+            sStats.firstRequest = port->sessionStart;
+        }
+    }
+    port->rxLineFree = dfuTargetReceive(&port->target, port->rxLineFree > now ? port->rxLineFree : now, out, m);
+    // Account for the dropped bytes' line time as well.
+    port->rxLineFree += dfuTargetByteMicrosec(&port->target, n - m);
+}
+
+// The bootloader resets after an activation or ABORT; the next session starts from scratch.
+static void endSession(TPort *port, uint64_t now, const char *outputPath, int nofPorts, int ix)
+{
+    TDfuTarget *target = &port->target;
+    uint32_t appVersion = target->appVersion;
+
+    if (target->activated) {
+        uint64_t micros = now - port->sessionStart;
+        if (nofPorts == 1 || sVerbose) {
+            fprintf(stderr, "%s: image activated: %u bytes, crc 0x%08X, %.3f s\n", port->name,
+                    target->executedLen, target->executedCrc, micros / 1e6);
+        }
+        if (outputPath && nofPorts > 1) {
+            char path[256];
+            snprintf(path, sizeof(path), "%s.%d", outputPath, ix);
+            saveImage(target, path);
+        } else {
+            saveImage(target, outputPath);
+        }
+        if (sStats.nofUpdates == sStats.updateMicrosSize) {
+            uint32_t size = sStats.updateMicrosSize ? 2 * sStats.updateMicrosSize : 256;
+            uint64_t *updateMicros = realloc(sStats.updateMicros, size * sizeof(uint64_t));
+            if (updateMicros) {
+                sStats.updateMicros = updateMicros;
+                sStats.updateMicrosSize = size;
+            }
+        }
+        if (sStats.nofUpdates < sStats.updateMicrosSize) {
+            sStats.updateMicros[sStats.nofUpdates++] = micros;
+            sStats.bytesExecuted += target->executedLen;
+            sStats.lastActivation = now;
+        } else {
+            // Keep the durations collected so far and stop; they are printed on the way out.
+            fprintf(stderr, "out of memory for the update statistics\n");
+            sTerminate = 1;
+        }
+    } else {
+        if (nofPorts == 1 || sVerbose) {
+            fprintf(stderr, "%s: aborted after %u bytes\n", port->name, target->executedLen);
+        }
+        sStats.nofAborted++;
+    }
+    if (target->nofOverrunBytes || target->nofDroppedRequests) {
+        fprintf(stderr, "%s: UART: %u bytes overrun, %u requests dropped\n", port->name,
+                target->nofOverrunBytes, target->nofDroppedRequests);
+    }
+    dfuTargetInit(target);
+    target->appVersion = appVersion;
+    port->sessionStart = 0;
+    port->txInFrame = 0;
+}
+
+static void printReport(int nofPorts, uint64_t wallMicros)
+{
+    struct rusage usage;
+    double cpu = 0;
+    uint32_t n = sStats.nofUpdates;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+            + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+    printf("***** %d targets: %u updates, %u aborted, %.3f s *****\n", nofPorts, n, sStats.nofAborted,
+           wallMicros / 1e6);
+    if (n > 0) {
+        double seconds = (sStats.lastActivation - sStats.firstRequest) / 1e6;
+        qsort(sStats.updateMicros, n, sizeof(uint64_t), compareMicros);
+        printf("aggregate throughput: %.0f B/s from the first request to the last activation\n",
+               seconds > 0 ? sStats.bytesExecuted / seconds : 0);
+        printf("update time: p50 %.3f s, p90 %.3f s, p99 %.3f s, max %.3f s\n",
+               sStats.updateMicros[n / 2] / 1e6, sStats.updateMicros[n * 9 / 10] / 1e6,
+               sStats.updateMicros[n * 99 / 100] / 1e6, sStats.updateMicros[n - 1] / 1e6);
+    }
+    printf("emulator CPU: %.3f s (%.1f%% of one core)\n", cpu, wallMicros > 0 ? 100 * cpu * 1e6 / wallMicros : 0);
+    fflush(stdout);
+}
+
+static int compareMicros(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void saveImage(TDfuTarget *target, const char *path)
+{
+    FILE *f;
+    if (!path) {
+        return;
+    }
+    f = fopen(path, "wb");
+    if (!f || fwrite(target->flash, 1, target->executedLen, f) != target->executedLen) {
+        perror(path);
+    }
+    if (f) {
+        fclose(f);
+    }
+}
+
+static int openPty(TPort *port, const char *link)
+{
+    struct termios settings;
+    const char *name;
+
+    port->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (port->master < 0 || grantpt(port->master) != 0 || unlockpt(port->master) != 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+    name = ptsname(port->master);
+    // Keep the slave open so the master doesn't see EIO between host sessions.
+    port->slave = open(name, O_RDWR | O_NOCTTY);
+    if (port->slave < 0) {
+        perror(name);
+        return -1;
+    }
+    tcgetattr(port->slave, &settings);
+    cfmakeraw(&settings);
+    tcsetattr(port->slave, TCSANOW, &settings);
+    fcntl(port->master, F_SETFL, fcntl(port->master, F_GETFL) | O_NONBLOCK);
+
+    if (link) {
+        unlink(link);
+        if (symlink(name, link) != 0) {
+            perror(link);
+            return -1;
+        }
+        port->linked = 1;
+    }
+    snprintf(port->name, sizeof(port->name), "%s", link ? link : name);
+    printf("%s\n", port->name);
+    fflush(stdout);
+    return 0;
+}
+
+static uint64_t monotonicMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void onSignal(int sig)
+{
+    sTerminate = 1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-v] [-b <baudrate>] [--link <path>] [-o <image-file>] [--app-version <n>]\n", prog);
+    fprintf(stderr, "          [--banner-delay <ms>] [--turnaround <us>] [--page-erase <us>] [--word-write <us>]\n");
+    fprintf(stderr, "          [--command-execute <us>] [--flash-size <bytes>] [--rx-drop <p>] [--rx-flip <p>]\n");
+    fprintf(stderr, "          [--tx-drop <p>] [--tx-flip <p>] [--delay-rate <p> --delay <ms>] [--seed <n>]\n");
+    fprintf(stderr, "          [--uart-model] [--targets <n>] [--spread <f>] [--exit-after <n>]\n");
+    fprintf(stderr, "Emulate serial DFU targets on pseudo-terminals; prints the devices to open.\n");
+    fprintf(stderr, "  -b, --baud-rate       UART speed enforced in real time (default 115200)\n");
+    fprintf(stderr, "  --link                create a symlink to the pseudo-terminal, e.g. /tmp/ttyDFU;\n");
+    fprintf(stderr, "                        with several targets the index is appended\n");
+    fprintf(stderr, "  -o, --output          write the activated image to a file (.<index> with several targets)\n");
+    fprintf(stderr, "  --app-version         report an application with this version (default none)\n");
+    fprintf(stderr, "  --banner-delay        ignore input and print the bootloader banner after ms\n");
+    fprintf(stderr, "  --rx-drop, --rx-flip  probability of a lost or bit-flipped byte from the host\n");
+    fprintf(stderr, "  --tx-drop             probability of a lost response\n");
+    fprintf(stderr, "  --tx-flip             probability of a bit-flipped response byte\n");
+    fprintf(stderr, "  --delay-rate, --delay probability and length of an extra response delay\n");
+    fprintf(stderr, "  --seed                seed of the error injection (default 1)\n");
+    fprintf(stderr, "  --uart-model          lose bytes like an nRF52 without flow control when the host\n");
+    fprintf(stderr, "                        sends while the flash halts the CPU (6 byte FIFO, 3 buffers)\n");
+    fprintf(stderr, "  --targets             number of targets served by this process (1..%d, default 1)\n",
+            MAX_TARGETS);
+    fprintf(stderr, "  --spread              draw each target's timings and error rates from\n");
+    fprintf(stderr, "                        value * [1 - f, 1 + f] (default 0)\n");
+    fprintf(stderr, "  --exit-after          exit after n activated images; with several targets or this\n");
+    fprintf(stderr, "                        option the update time percentiles, aggregate throughput and\n");
+    fprintf(stderr, "                        CPU time are printed on exit (also on Ctrl-C)\n");
+}
@@ -0,0 +1,591 @@
+//
+//  main.c
+//  nrf52-dfu
+//
+//  Deterministic benchmark of the FWU library: up to FWU_SCHED_MAX_SESSIONS update
+//  sessions, driven by the cooperative scheduler, against emulated DFU targets on a
+//  virtual clock. A full update is simulated in milliseconds.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include "fwu.h"
+#include "fwu_sched.h"
+#include "fwu_profile.h"
+#include "dfu_target.h"
+#include "pkg.h"
+#include "report.h"
+
+#define DEFAULT_IMAGE_SIZE (400 * 1024)
+#define DEFAULT_FLASH_SIZE (1024 * 1024)
+// A host OS buffers whole requests; the UART drains them at the baud rate.
+#define HOST_TX_CREDIT 255
+#define RX_CHUNK_SIZE 255
+// Give up if the virtual clock doesn't advance (a bug in the library or the emulator).
+#define MAX_STEPS_WITHOUT_PROGRESS 1000000
+
+typedef struct {
+    TFwu fwu;
+    TDfuTarget target;
+    uint64_t txFreeMicrosec;
+    uint64_t tEndMicrosec;
+    uint32_t bytesSent;
+    EFwuProcessStatus status;
+} TBenchSession;
+
+static const uint8_t *sDat;
+static uint32_t sDatLen;
+static const uint8_t *sBin;
+static uint32_t sBinLen;
+static uint64_t sNowMicrosec;
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len);
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len);
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len);
+static TBenchSession *runSessions(const TDfuTarget *targetConfig, const TFwu *fwuConfig, int nofSessions,
+                                  int *stalled);
+static int runBenchmark(TFwuSched *sched, TBenchSession *sessions, int nofSessions);
+static int sessionSucceeded(TBenchSession *session);
+static void freeSessions(TBenchSession *sessions, int nofSessions);
+static void sweepBaudRates(const TDfuTarget *targetConfig, const TFwu *fwuConfig);
+static uint32_t makeInitPacket(uint8_t *dat, uint32_t appSize);
+static uint32_t encodeVarint(uint8_t *dst, uint32_t v);
+static void usage(const char *prog);
+#ifdef FWU_PROFILE
+static void printProfileLine(const char *line, void *context);
+#endif
+
+
+int main(int argc, const char *argv[])
+{
+    const char *packagePath = NULL;
+    TDfuPackage package;
+    uint32_t imageSize = DEFAULT_IMAGE_SIZE;
+    uint32_t flashSize = DEFAULT_FLASH_SIZE;
+    uint32_t baudrate = 115200;
+    uint32_t turnaround = 100;
+    uint32_t pageErase = 85000;
+    uint32_t wordWrite = 41;
+    uint32_t commandExecute = 0;
+    uint32_t requestTime = 20;
+    int rxFifo = 6;
+    int rxBuffers = 3;
+    int hwfc = 0;
+    int flashStallsCpu = 1;
+    int chunkSize = 0;
+    uint32_t timeout = 5000;
+    int retries = 3;
+    int nofSessions = 1;
+    int fanOut = 0;
+    int sweep = 0;
+    int stats = 0;
+    uint8_t dat[128];
+    TFwuFrameCache frameCache;
+    uint8_t *frames = NULL;
+    uint32_t *frameOffsets = NULL;
+    uint32_t *crcs = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if ((!strcmp(a, "-pkg") || !strcmp(a, "--package")) && v) {
+            packagePath = v;
+            i++;
+        } else if (!strcmp(a, "--size") && v) {
+            imageSize = strtoul(v, NULL, 0);
+            i++;
+        } else if ((!strcmp(a, "-b") || !strcmp(a, "--baud-rate")) && v) {
+            baudrate = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--sessions") && v) {
+            nofSessions = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--turnaround") && v) {
+            turnaround = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--page-erase") && v) {
+            pageErase = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--word-write") && v) {
+            wordWrite = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--command-execute") && v) {
+            commandExecute = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--flash-size") && v) {
+            flashSize = strtoul(v, NULL, 0);
+            i++;
+        } else if ((!strcmp(a, "-t") || !strcmp(a, "--timeout")) && v) {
+            timeout = strtoul(v, NULL, 0);
+            i++;
+        } else if ((!strcmp(a, "-r") || !strcmp(a, "--retries")) && v) {
+            retries = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--request-time") && v) {
+            requestTime = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--rx-fifo") && v) {
+            rxFifo = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--rx-buffers") && v) {
+            rxBuffers = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--hwfc")) {
+            hwfc = 1;
+        } else if (!strcmp(a, "--no-flash-stall")) {
+            flashStallsCpu = 0;
+        } else if (!strcmp(a, "--chunk-size") && v) {
+            chunkSize = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--fan-out")) {
+            fanOut = 1;
+        } else if (!strcmp(a, "--stats")) {
+            stats = 1;
+        } else if (!strcmp(a, "--sweep")) {
+            sweep = 1;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (nofSessions < 1 || nofSessions > FWU_SCHED_MAX_SESSIONS || baudrate == 0
+        || rxFifo < 0 || rxFifo > 255 || rxBuffers < 0 || rxBuffers > DFU_TARGET_MAX_RX_BUFFERS
+        || chunkSize < 0 || chunkSize > FWU_DATA_CHUNK_SIZE) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (packagePath) {
+        if (pkgLoad(packagePath, &package) != 0) {
+            return -1;
+        }
+        sDat = package.dat;
+        sDatLen = package.datLen;
+        sBin = package.bin;
+        sBinLen = package.binLen;
+    } else {
+        // Pseudo-random image (xorshift, fixed seed) so every run sends the same bytes.
+        uint8_t *bin = malloc(imageSize);
+        uint32_t x = 2463534242u;
+        if (!bin) {
+            fprintf(stderr, "out of memory for a %u byte image\n", imageSize);
+            return -1;
+        }
+        for (i = 0; i < (int)imageSize; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            bin[i] = x & 0xff;
+        }
+        sBin = bin;
+        sBinLen = imageSize;
+        sDatLen = makeInitPacket(dat, imageSize);
+        sDat = dat;
+    }
+
+    if (fanOut) {
+        frames = malloc(fwuFrameCacheMaxFramesSize(sBinLen));
+        frameOffsets = malloc((fwuFrameCacheNofFrames(sBinLen) + 1) * sizeof(uint32_t));
+        crcs = malloc(fwuFrameCacheNofFrames(sBinLen) * sizeof(uint32_t));
+        if (!frames || !frameOffsets || !crcs) {
+            fprintf(stderr, "out of memory for the frame cache\n");
+            return -1;
+        }
+        fwuFrameCacheBuild(&frameCache, sBin, sBinLen, FWU_DATA_CHUNK_SIZE, frames, frameOffsets, crcs);
+    }
+
+    TDfuTarget targetConfig;
+    memset(&targetConfig, 0, sizeof(targetConfig));
+    targetConfig.flashSize = flashSize;
+    targetConfig.pageSize = 4096;
+    targetConfig.baudrate = baudrate;
+    targetConfig.turnaroundMicrosec = turnaround;
+    targetConfig.pageEraseMicrosec = pageErase;
+    targetConfig.wordWriteMicrosec = wordWrite;
+    targetConfig.commandExecuteMicrosec = commandExecute;
+    targetConfig.flashStallsCpu = flashStallsCpu;
+    targetConfig.rxFifoSize = rxFifo;
+    targetConfig.rxBufferCount = rxBuffers;
+    targetConfig.hwfc = hwfc;
+    targetConfig.requestMicrosec = requestTime;
+    targetConfig.maxObjectSize = 4096;
+    targetConfig.mtu = 131;
+    targetConfig.hwPart = 0x52840;
+    targetConfig.appVersion = 0;
+
+    TFwu fwuConfig;
+    memset(&fwuConfig, 0, sizeof(fwuConfig));
+    fwuConfig.commandObjectProviderFunction = commandObjectProvider;
+    fwuConfig.commandObjectLen = sDatLen;
+    fwuConfig.dataObjectProviderFunction = dataObjectProvider;
+    fwuConfig.dataObjectLen = sBinLen;
+    fwuConfig.txFunction = txFunction;
+    fwuConfig.responseTimeoutMillisec = timeout;
+    fwuConfig.maxRetries = retries;
+    fwuConfig.dataChunkSize = chunkSize;
+    fwuConfig.frameCache = fanOut ? &frameCache : NULL;
+    if (packagePath && package.container) {
+        fwuConfig.dataObjectCrcs = fwuContainerCrcs(package.container);
+        fwuConfig.dataObjectCrcStride = package.container->crcStride;
+    }
+
+    if (sweep) {
+        printf("image %u bytes, init packet %u bytes, RX FIFO %d bytes, %d RX buffers%s\n",
+               sBinLen, sDatLen, rxFifo, rxBuffers, hwfc ? ", HWFC" : "");
+        sweepBaudRates(&targetConfig, &fwuConfig);
+        nofSessions = 0;
+    } else {
+        printf("image %u bytes, init packet %u bytes, %d session(s) at %u baud\n",
+               sBinLen, sDatLen, nofSessions, baudrate);
+
+        struct timespec c0, c1;
+        int stalled;
+#ifdef FWU_PROFILE
+        fwuProfileReset();
+#endif
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c0);
+        TBenchSession *sessions = runSessions(&targetConfig, &fwuConfig, nofSessions, &stalled);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c1);
+
+        int nofSucceeded = 0;
+        for (i = 0; i < nofSessions; i++) {
+            TBenchSession *session = &sessions[i];
+            TDfuTarget *target = &session->target;
+            double seconds = session->tEndMicrosec / 1e6;
+            int verified = target->activated && target->executedLen == sBinLen
+                && memcmp(target->flash, sBin, sBinLen) == 0;
+            if (sessionSucceeded(session)) {
+                nofSucceeded++;
+            }
+            if (session->status == FWU_STATUS_COMPLETION) {
+                printf("session %d: Success, %.3f s simulated, %.0f B/s, ", i, seconds,
+                       seconds > 0 ? sBinLen / seconds : 0);
+            } else {
+                // The image didn't get through, so there is no throughput to report.
+                printf("session %d: Failed, %.3f s simulated, ", i, seconds);
+            }
+            printf("%u bytes on the wire, %u requests, %u retries, flash %s\n", session->bytesSent,
+                   target->nofRequests, session->fwu.retryCount, verified ? "verified" : "MISMATCH");
+            printf("  UART: %u bytes overrun, %u requests dropped, FIFO peak %u/%d, RX buffers peak %u/%d\n",
+                   target->nofOverrunBytes, target->nofDroppedRequests, target->maxFifoLevel, rxFifo,
+                   target->maxBuffersInUse, rxBuffers);
+            if (stats) {
+                char name[16];
+                snprintf(name, sizeof(name), "  session %d", i);
+                printSessionStats(stdout, name, &session->fwu);
+            }
+        }
+        double seconds = sNowMicrosec / 1e6;
+        double cpu = (c1.tv_sec - c0.tv_sec) + (c1.tv_nsec - c0.tv_nsec) / 1e9;
+        printf("***** %d of %d updates succeeded%s *****\n", nofSucceeded, nofSessions, stalled ? " (stalled)" : "");
+        printf("simulated time: %.3f s, aggregate %.0f B/s, computed in %.3f s CPU\n",
+               seconds, seconds > 0 ? (double)nofSucceeded * sBinLen / seconds : 0, cpu);
+#ifdef FWU_PROFILE
+        fwuProfileDump(printProfileLine, NULL);
+#endif
+        freeSessions(sessions, nofSessions);
+        nofSessions -= nofSucceeded;
+    }
+
+    free(frames);
+    free(frameOffsets);
+    free(crcs);
+    if (packagePath) {
+        pkgFree(&package);
+    } else {
+        free((void *)sBin);
+    }
+    return nofSessions == 0 ? 0 : -1;
+}
+
+// Run nofSessions updates to completion; release the returned sessions with freeSessions.
+static TBenchSession *runSessions(const TDfuTarget *targetConfig, const TFwu *fwuConfig, int nofSessions,
+                                  int *stalled)
+{
+    TFwuSched sched;
+    int i;
+
+    sched.maxYieldsPerRun = 0;
+    fwuSchedInit(&sched);
+    sNowMicrosec = 0;
+
+    TBenchSession *sessions = calloc(nofSessions, sizeof(TBenchSession));
+    if (!sessions) {
+        fprintf(stderr, "out of memory for %d sessions\n", nofSessions);
+        exit(-1);
+    }
+    for (i = 0; i < nofSessions; i++) {
+        TBenchSession *session = &sessions[i];
+        session->target = *targetConfig;
+        session->target.flash = malloc(targetConfig->flashSize);
+        if (!session->target.flash) {
+            fprintf(stderr, "out of memory for the flash of session %d\n", i);
+            exit(-1);
+        }
+        dfuTargetInit(&session->target);
+        session->fwu = *fwuConfig;
+        fwuInit(&session->fwu);
+        fwuSchedAdd(&sched, &session->fwu, 0);
+    }
+    *stalled = runBenchmark(&sched, sessions, nofSessions);
+    return sessions;
+}
+
+static int sessionSucceeded(TBenchSession *session)
+{
+    TDfuTarget *target = &session->target;
+    return session->status == FWU_STATUS_COMPLETION && target->activated && target->executedLen == sBinLen
+        && memcmp(target->flash, sBin, sBinLen) == 0;
+}
+
+static void freeSessions(TBenchSession *sessions, int nofSessions)
+{
+    int i;
+    for (i = 0; i < nofSessions; i++) {
+        free(sessions[i].target.flash);
+    }
+    free(sessions);
+}
+
+// Update time for every WRITE payload size and standard baud rate. A combination is safe
+// if the target loses no byte and no request; the fastest safe one is recommended.
+static void sweepBaudRates(const TDfuTarget *targetConfig, const TFwu *fwuConfig)
+{
+    static const uint32_t baudrates[] = { 57600, 115200, 230400, 460800, 921600, 1000000 };
+    const int nofBaudrates = sizeof(baudrates) / sizeof(baudrates[0]);
+    uint8_t chunkSize;
+    uint32_t bestBaudrate = 0;
+    uint8_t bestChunkSize = 0;
+    double bestSeconds = 0;
+    int i;
+
+    printf("chunk ");
+    for (i = 0; i < nofBaudrates; i++) {
+        printf("%10u", baudrates[i]);
+    }
+    printf("   max safe baud\n");
+
+    for (chunkSize = FWU_DATA_CHUNK_SIZE; chunkSize >= 4; chunkSize /= 2) {
+        uint32_t maxSafe = 0;
+        if (fwuConfig->dataChunkSize != 0 && chunkSize != fwuConfig->dataChunkSize) {
+            continue;
+        }
+        printf("%5u ", chunkSize);
+        for (i = 0; i < nofBaudrates; i++) {
+            TDfuTarget target = *targetConfig;
+            TFwu fwu = *fwuConfig;
+            int stalled;
+            target.baudrate = baudrates[i];
+            fwu.dataChunkSize = chunkSize;
+
+            TBenchSession *session = runSessions(&target, &fwu, 1, &stalled);
+            double seconds = session->tEndMicrosec / 1e6;
+            if (sessionSucceeded(session) && session->target.nofOverrunBytes == 0
+                && session->target.nofDroppedRequests == 0) {
+                printf("%9.2fs", seconds);
+                maxSafe = baudrates[i];
+                if (bestBaudrate == 0 || seconds < bestSeconds) {
+                    bestBaudrate = baudrates[i];
+                    bestChunkSize = chunkSize;
+                    bestSeconds = seconds;
+                }
+            } else {
+                printf("%10s", sessionSucceeded(session) ? "lossy" : "failed");
+            }
+            freeSessions(session, 1);
+        }
+        printf("   %u\n", maxSafe);
+    }
+    if (bestBaudrate) {
+        printf("fastest without loss: %u baud, %u byte chunks, %.2f s\n", bestBaudrate, bestChunkSize, bestSeconds);
+    } else {
+        printf("no combination without loss\n");
+    }
+}
+
+// Advance the virtual clock from event to event until all sessions have ended.
+// Returns 1 if the simulation stopped making progress.
+static int runBenchmark(TFwuSched *sched, TBenchSession *sessions, int nofSessions)
+{
+    uint64_t lastMillisec = 0;
+    uint32_t stepsWithoutProgress = 0;
+    uint8_t rxBuf[RX_CHUNK_SIZE];
+    int i;
+
+    while (1) {
+        for (i = 0; i < nofSessions; i++) {
+            TBenchSession *session = &sessions[i];
+            uint32_t n;
+            if (session->txFreeMicrosec <= sNowMicrosec) {
+                fwuSchedCanSendData(sched, i, HOST_TX_CREDIT);
+            }
+            n = dfuTargetTransmit(&session->target, sNowMicrosec, rxBuf, sizeof(rxBuf));
+            if (n > 0) {
+                fwuSchedDidReceiveData(sched, i, rxBuf, n);
+            }
+        }
+
+        uint32_t elapsed = sNowMicrosec / 1000 - lastMillisec;
+        lastMillisec = sNowMicrosec / 1000;
+        uint8_t nofRunning = fwuSchedRun(sched, elapsed);
+
+        // Find the next event: pending work, a response byte, a free UART or a deadline.
+        uint64_t next = UINT64_MAX;
+        for (i = 0; i < nofSessions; i++) {
+            TBenchSession *session = &sessions[i];
+            if (session->status == FWU_STATUS_UNDEFINED && fwuSchedSession(sched, i)->status != FWU_STATUS_UNDEFINED) {
+                session->status = fwuSchedSession(sched, i)->status;
+                session->tEndMicrosec = sNowMicrosec;
+            }
+            if (session->status != FWU_STATUS_UNDEFINED) {
+                continue;
+            }
+            uint8_t work = fwuPendingWork(&session->fwu);
+            uint64_t t;
+            if (work & FWU_WORK_INTERNAL) {
+                next = sNowMicrosec;
+            }
+            if (work & FWU_WORK_TX) {
+                t = session->txFreeMicrosec > sNowMicrosec ? session->txFreeMicrosec : sNowMicrosec;
+                next = t < next ? t : next;
+            }
+            t = dfuTargetNextTxMicrosec(&session->target);
+            next = t < next ? t : next;
+            uint32_t deadline = fwuDeadlineMillisec(&session->fwu);
+            if (deadline != 0xffffffff) {
+                t = (lastMillisec + (deadline ? deadline : 1)) * 1000;
+                next = t < next ? t : next;
+            }
+        }
+        if (nofRunning == 0) {
+            return 0;
+        }
+        if (next == UINT64_MAX) {
+            return 1;
+        }
+        if (next > sNowMicrosec) {
+            sNowMicrosec = next;
+            stepsWithoutProgress = 0;
+        } else if (++stepsWithoutProgress > MAX_STEPS_WITHOUT_PROGRESS) {
+            return 1;
+        }
+    }
+}
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sDat[pos];
+}
+
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sBin[pos];
+}
+
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len)
+{
+    TBenchSession *session = (TBenchSession *)((char *)fwu - offsetof(TBenchSession, fwu));
+    uint64_t start = session->txFreeMicrosec > sNowMicrosec ? session->txFreeMicrosec : sNowMicrosec;
+    session->txFreeMicrosec = dfuTargetReceive(&session->target, start, buf, len);
+    session->bytesSent += len;
+}
+
+// Unsigned init packet for an application of appSize bytes:
+// Packet { command { op_code = INIT, init { fw_version = 1, hw_version = 52, type = APPLICATION,
+// app_size, hash { type = SHA256, 32 zero bytes } } } }
+static uint32_t makeInitPacket(uint8_t *dat, uint32_t appSize)
+{
+    uint8_t init[64];
+    uint8_t command[80];
+    uint32_t n = 0, m = 0, k = 0;
+
+    init[n++] = 0x08; n += encodeVarint(&init[n], 1);       // fw_version
+    init[n++] = 0x10; n += encodeVarint(&init[n], 52);      // hw_version
+    init[n++] = 0x20; n += encodeVarint(&init[n], 0);       // type
+    init[n++] = 0x38; n += encodeVarint(&init[n], appSize); // app_size
+    init[n++] = 0x42; init[n++] = 36;                       // hash
+    init[n++] = 0x08; init[n++] = 3;
+    init[n++] = 0x12; init[n++] = 32;
+    memset(&init[n], 0, 32);
+    n += 32;
+
+    command[m++] = 0x08; command[m++] = 1;                  // op_code
+    command[m++] = 0x12; m += encodeVarint(&command[m], n); // init
+    memcpy(&command[m], init, n);
+    m += n;
+
+    dat[k++] = 0x0A; k += encodeVarint(&dat[k], m);         // command
+    memcpy(&dat[k], command, m);
+    return k + m;
+}
+
+static uint32_t encodeVarint(uint8_t *dst, uint32_t v)
+{
+    uint32_t n = 0;
+    while (v >= 0x80) {
+        dst[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    dst[n++] = v;
+    return n;
+}
+
+#ifdef FWU_PROFILE
+static void printProfileLine(const char *line, void *context)
+{
+    printf("profile: %s\n", line);
+}
+#endif
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-pkg <package.zip> | --size <bytes>] [-b <baudrate>] [--sessions <n>]\n", prog);
+    fprintf(stderr, "          [--turnaround <us>] [--page-erase <us>] [--word-write <us>] [--command-execute <us>]\n");
+    fprintf(stderr, "          [--flash-size <bytes>] [-t <timeout-ms>] [-r <retries>] [--fan-out]\n");
+    fprintf(stderr, "          [--rx-fifo <bytes>] [--rx-buffers <n>] [--request-time <us>] [--hwfc]\n");
+    fprintf(stderr, "          [--no-flash-stall] [--chunk-size <bytes>] [--sweep] [--stats]\n");
+    fprintf(stderr, "Simulate serial DFU sessions against emulated targets on a virtual clock.\n");
+    fprintf(stderr, "  -pkg, --package       DFU package (zip) or container; default is a synthetic image\n");
+    fprintf(stderr, "  --size                size of the synthetic image (default %d)\n", DEFAULT_IMAGE_SIZE);
+    fprintf(stderr, "  -b, --baud-rate       baud rate (default 115200)\n");
+    fprintf(stderr, "  --sessions            number of sessions run by fwu_sched (1..%d, default 1)\n",
+            FWU_SCHED_MAX_SESSIONS);
+    fprintf(stderr, "  --turnaround          target response delay in us (default 100)\n");
+    fprintf(stderr, "  --page-erase          flash page erase time in us (default 85000)\n");
+    fprintf(stderr, "  --word-write          flash word write time in us (default 41)\n");
+    fprintf(stderr, "  --command-execute     init command validation time in us (default 0)\n");
+    fprintf(stderr, "  --flash-size          application flash of the target (default %d)\n", DEFAULT_FLASH_SIZE);
+    fprintf(stderr, "  --fan-out             send from a shared frame cache\n");
+    fprintf(stderr, "  --rx-fifo             target UART RX FIFO in bytes, 0 = unlimited (default 6)\n");
+    fprintf(stderr, "  --rx-buffers          target request buffers, 0 = unlimited (default 3, max %d)\n",
+            DFU_TARGET_MAX_RX_BUFFERS);
+    fprintf(stderr, "  --request-time        target main loop time per request in us (default 20)\n");
+    fprintf(stderr, "  --hwfc                RTS/CTS flow control: a full FIFO holds the host back\n");
+    fprintf(stderr, "  --no-flash-stall      the CPU keeps running while the flash is busy (SoftDevice)\n");
+    fprintf(stderr, "  --chunk-size          payload bytes per WRITE request (default %d)\n", FWU_DATA_CHUNK_SIZE);
+    fprintf(stderr, "  --sweep               find the fastest baud rate and chunk size without lost bytes\n");
+    fprintf(stderr, "  --stats               print time per phase, round trip times and byte counts per session\n");
+}
@@ -0,0 +1,147 @@
+//
+//  retrytest.c
+//  nrf52-dfu
+//
+//  Drives the FWU library by hand through retries the bench can't provoke
+//  deterministically, and checks what goes on the wire. Exits non-zero on the
+//  first failed check.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "fwu.h"
+
+#define TIMEOUT_MILLISEC 100
+
+static TFwu sFwu;
+static uint8_t sDat[16];
+static uint8_t sBin[64];
+// Everything passed to txFunction since the last clearTx
+static uint8_t sTx[256];
+static uint32_t sTxLen;
+static int sFailed;
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len);
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len);
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len);
+static void startSession(void);
+static void send(uint8_t maxLen);
+static void check(int ok, const char *what);
+static void testRepeatedPartialPing(void);
+
+
+int main(int argc, char *argv[])
+{
+    testRepeatedPartialPing();
+    printf("%s\n", sFailed ? "FAILED" : "OK");
+    return sFailed ? -1 : 0;
+}
+
+// The PING is cut short after one byte and times out, three times in a row. Each repeat
+// has to start with a single EOM, and the response to the complete PING must be accepted.
+static void testRepeatedPartialPing(void)
+{
+    static const uint8_t expectedPing[] = { 0xC0, 0x09, 0x01, 0xC0 };
+    static uint8_t pingResponse[] = { 0x60, 0x09, 0x01, 0x01, 0xC0 };
+    int i;
+
+    startSession();
+    for (i = 0; i < 3; i++) {
+        sTxLen = 0;
+        send(1);
+        check(sTxLen == 1, "one byte of the PING sent");
+        fwuYield(&sFwu, TIMEOUT_MILLISEC + 1);
+        fwuYield(&sFwu, 0);
+    }
+    check(sFwu.retryCount == 3, "three retries");
+
+    sTxLen = 0;
+    send(255);
+    check(sTxLen == sizeof(expectedPing) && !memcmp(sTx, expectedPing, sizeof(expectedPing)),
+          "the repeated PING starts with one EOM");
+
+    sTxLen = 0;
+    fwuDidReceiveData(&sFwu, pingResponse, sizeof(pingResponse));
+    fwuYield(&sFwu, 0);
+    send(255);
+    check(sFwu.stats.responses == 1, "the PING response is accepted");
+    check(sTxLen > 0 && sTx[0] != 0x09 && sTx[0] != 0xC0, "the next request follows the PING");
+}
+
+static void startSession(void)
+{
+    memset(&sFwu, 0, sizeof(sFwu));
+    sFwu.commandObjectProviderFunction = commandObjectProvider;
+    sFwu.commandObjectLen = sizeof(sDat);
+    sFwu.dataObjectProviderFunction = dataObjectProvider;
+    sFwu.dataObjectLen = sizeof(sBin);
+    sFwu.txFunction = txFunction;
+    sFwu.responseTimeoutMillisec = TIMEOUT_MILLISEC;
+    sFwu.maxRetries = 5;
+    fwuInit(&sFwu);
+    fwuExec(&sFwu);
+}
+
+// Offer the library maxLen bytes of the UART once, as soon as it has a request to send.
+static void send(uint8_t maxLen)
+{
+    uint32_t txLen = sTxLen;
+    int i;
+
+    fwuCanSendData(&sFwu, maxLen);
+    for (i = 0; i < 8 && sTxLen == txLen; i++) {
+        fwuYield(&sFwu, 0);
+    }
+    fwuCanSendData(&sFwu, 0);
+}
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "retrytest: %s: failed\n", what);
+        sFailed = 1;
+    }
+}
+
+static const uint8_t *commandObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sDat[pos];
+}
+
+static const uint8_t *dataObjectProvider(struct SFwu *fwu, int pos, int len)
+{
+    return &sBin[pos];
+}
+
+static void txFunction(struct SFwu *fwu, uint8_t *buf, uint8_t len)
+{
+    if (sTxLen + len <= sizeof(sTx)) {
+        memcpy(&sTx[sTxLen], buf, len);
+        sTxLen += len;
+    }
+}
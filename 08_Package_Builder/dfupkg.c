@@ -0,0 +1,706 @@
+//
+//  dfupkg.c
+//  nrf52-dfu
+//
+//  Command line tool to build signed DFU packages without nrfutil: encodes the init
+//  packet, signs it with ECDSA P-256 (OpenSSL), checks the signature against the
+//  bootloader's public key and writes the zip (and optionally the .dat and .bin).
+//  Accepts the options of 'nrfutil pkg generate' for applications; a batch file
+//  builds many variants on all cores.
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+//  Copyright © 2018-2019 Classy Code GmbH
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this
+// software and associated documentation files (the "Software"), to deal in the Software
+// without restriction, including without limitation the rights to use, copy, modify,
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies
+// or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+// CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+// OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ecdsa.h>
+#include <openssl/x509.h>
+#include "fwu_initpacket.h"
+#include "ihex.h"
+#include "pubkey.h"
+
+#define MAX_JOBS 64
+#define DAT_MAX_SIZE 512
+// Application flash of 01_Demo_App/main.ld; Intel HEX input must lie within
+#define APP_FLASH_ORIGIN 0x26000
+#define APP_FLASH_LENGTH 0x5a000
+// Init packet values
+#define HASH_TYPE_SHA256 3
+#define SIGNATURE_TYPE_ECDSA_P256_SHA256 0
+
+typedef struct {
+    uint32_t hwVersion;
+    uint32_t sdReq[FWU_INIT_MAX_SD_REQ];
+    uint8_t nofSdReq;
+    uint8_t isDebug;
+    int writeObjects;
+    uint32_t flashOrigin;
+    uint32_t flashLength;
+    // Signing key (NULL: unsigned packages) and the public key the signatures must verify
+    // with, in the byte order of pk[] in dfu_public_key.c
+    EVP_PKEY *key;
+    uint8_t publicKey[64];
+} TBuild;
+
+typedef struct {
+    const char *appPath;
+    const char *zipPath;
+    uint32_t fwVersion;
+    int result;
+    uint32_t binLen;
+    uint64_t micros;
+} TJob;
+
+typedef struct {
+    const TBuild *build;
+    TJob *jobs;
+    int nofJobs;
+    int nextJob;
+    pthread_mutex_t lock;
+} TQueue;
+
+typedef struct {
+    const char *name;
+    const uint8_t *data;
+    uint32_t len;
+} TZipEntry;
+
+static int buildPackage(const TBuild *build, TJob *job);
+static void *worker(void *arg);
+static uint8_t *readFile(const char *path, long *len);
+static int writeFile(const char *path, const uint8_t *data, uint32_t len);
+static int writeZip(const char *path, const TZipEntry *entries, int nofEntries);
+static int signCommand(EVP_PKEY *key, const uint8_t *command, uint32_t len, uint8_t signature[64]);
+static EVP_PKEY *loadPrivateKey(const char *path);
+static int publicKeyOf(EVP_PKEY *key, uint8_t publicKey[64]);
+static int parseSdReq(const char *s, TBuild *build);
+static int readBatch(const char *path, TJob *jobs, int maxJobs, uint32_t fwVersion);
+static char *stem(const char *path, const char *suffix);
+static uint64_t monotonicMicros(void);
+static void usage(const char *prog);
+
+
+int main(int argc, char *argv[])
+{
+    TBuild build;
+    TJob jobs[MAX_JOBS];
+    TQueue queue;
+    pthread_t threads[MAX_JOBS];
+    const char *appPath = NULL;
+    const char *batchPath = NULL;
+    const char *keyPath = NULL;
+    const char *publicKeyPath = NULL;
+    uint32_t fwVersion = 0xffffffff;
+    int haveHwVersion = 0;
+    int nofThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int nofJobs = 0;
+    int nofFailed = 0;
+    uint64_t tStart;
+    int i;
+
+    memset(&build, 0, sizeof(build));
+    build.flashOrigin = APP_FLASH_ORIGIN;
+    build.flashLength = APP_FLASH_LENGTH;
+
+    // Same options as 'nrfutil pkg generate' for an application, plus the batch options.
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!strcmp(a, "--hw-version") && v) {
+            build.hwVersion = strtoul(v, NULL, 0);
+            haveHwVersion = 1;
+            i++;
+        } else if (!strcmp(a, "--application-version") && v) {
+            fwVersion = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--sd-req") && v) {
+            if (parseSdReq(v, &build) != 0) {
+                return -1;
+            }
+            i++;
+        } else if (!strcmp(a, "--application") && v) {
+            appPath = v;
+            i++;
+        } else if (!strcmp(a, "--key-file") && v) {
+            keyPath = v;
+            i++;
+        } else if (!strcmp(a, "--public-key") && v) {
+            publicKeyPath = v;
+            i++;
+        } else if (!strcmp(a, "--debug-mode")) {
+            build.isDebug = 1;
+        } else if (!strcmp(a, "--objects")) {
+            build.writeObjects = 1;
+        } else if (!strcmp(a, "--batch") && v) {
+            batchPath = v;
+            i++;
+        } else if (!strcmp(a, "-j") && v) {
+            nofThreads = atoi(v);
+            i++;
+        } else if (!strcmp(a, "--flash-origin") && v) {
+            build.flashOrigin = strtoul(v, NULL, 0);
+            i++;
+        } else if (!strcmp(a, "--flash-length") && v) {
+            build.flashLength = strtoul(v, NULL, 0);
+            i++;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!haveHwVersion || build.nofSdReq == 0 || (!appPath == !batchPath)
+        || (appPath && argc - i != 1) || (batchPath && argc - i != 0)) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (publicKeyPath && !keyPath) {
+        fprintf(stderr, "--public-key needs the signing key (--key-file)\n");
+        return -1;
+    }
+    if (build.flashLength == 0 || build.flashOrigin + build.flashLength - 1 < build.flashOrigin) {
+        fprintf(stderr, "flash region must lie within 32 bit addresses\n");
+        return -1;
+    }
+
+    if (keyPath) {
+        build.key = loadPrivateKey(keyPath);
+        if (!build.key) {
+            return -1;
+        }
+        // Without the bootloader's key, check that the signature verifies at all.
+        if (publicKeyPath ? pubkeyLoad(publicKeyPath, build.publicKey) != 0
+                          : publicKeyOf(build.key, build.publicKey) != 0) {
+            return -1;
+        }
+    } else {
+        fprintf(stderr, "warning: no --key-file, the packages are unsigned\n");
+    }
+
+    if (batchPath) {
+        nofJobs = readBatch(batchPath, jobs, MAX_JOBS, fwVersion);
+        if (nofJobs < 0) {
+            return -1;
+        }
+    } else {
+        jobs[0].appPath = appPath;
+        jobs[0].zipPath = argv[i];
+        jobs[0].fwVersion = fwVersion;
+        nofJobs = 1;
+    }
+
+    // Every package is built on its own; the threads take the next job until none is left.
+    queue.build = &build;
+    queue.jobs = jobs;
+    queue.nofJobs = nofJobs;
+    queue.nextJob = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    if (nofThreads < 1) {
+        nofThreads = 1;
+    }
+    if (nofThreads > nofJobs) {
+        nofThreads = nofJobs;
+    }
+    tStart = monotonicMicros();
+    for (i = 0; i < nofThreads; i++) {
+        if (pthread_create(&threads[i], NULL, worker, &queue) != 0) {
+            fprintf(stderr, "warning: could only start %d of %d threads\n", i, nofThreads);
+            break;
+        }
+    }
+    nofThreads = i;
+    if (!nofThreads) {
+        // The queue still holds every job, so build them on this thread instead
+        worker(&queue);
+    }
+    for (i = 0; i < nofThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+
+    for (i = 0; i < nofJobs; i++) {
+        if (jobs[i].result != 0) {
+            nofFailed++;
+            continue;
+        }
+        printf("%s: %s, %u bytes, version %u, %s (%.1f ms)\n", jobs[i].zipPath, jobs[i].appPath,
+               jobs[i].binLen, jobs[i].fwVersion,
+               !build.key ? "unsigned" : publicKeyPath ? "signature verified with the bootloader key" : "signed",
+               jobs[i].micros / 1000.0);
+    }
+    printf("%d of %d packages built in %.1f ms (%d threads)\n", nofJobs - nofFailed, nofJobs,
+           (monotonicMicros() - tStart) / 1000.0, nofThreads ? nofThreads : 1);
+
+    EVP_PKEY_free(build.key);
+    return nofFailed ? -1 : 0;
+}
+
+static void *worker(void *arg)
+{
+    TQueue *queue = arg;
+
+    for (;;) {
+        TJob *job;
+        pthread_mutex_lock(&queue->lock);
+        job = queue->nextJob < queue->nofJobs ? &queue->jobs[queue->nextJob++] : NULL;
+        pthread_mutex_unlock(&queue->lock);
+        if (!job) {
+            return NULL;
+        }
+        uint64_t t0 = monotonicMicros();
+        job->result = buildPackage(queue->build, job);
+        job->micros = monotonicMicros() - t0;
+    }
+}
+
+// The image (Intel HEX or bin), its init packet and the zip with both and the manifest
+static int buildPackage(const TBuild *build, TJob *job)
+{
+    TFwuInitPacket packet;
+    uint8_t digest[32];
+    uint8_t hash[32];
+    uint8_t command[DAT_MAX_SIZE];
+    uint8_t signature[64];
+    uint8_t dat[DAT_MAX_SIZE];
+    char manifest[512];
+    TZipEntry entries[3];
+    char *appStem = stem(job->appPath, NULL);
+    const char *appName = strrchr(appStem, '/') ? strrchr(appStem, '/') + 1 : appStem;
+    const char *ext = strrchr(job->appPath, '.');
+    char *binName = malloc(strlen(appName) + 5);
+    char *datName = malloc(strlen(appName) + 5);
+    uint8_t *bin = NULL;
+    long binLen;
+    int commandLen, datLen;
+    int result = -1;
+    int i;
+
+    if (!binName || !datName) {
+        fprintf(stderr, "out of memory\n");
+        goto done;
+    }
+    sprintf(binName, "%s.bin", appName);
+    sprintf(datName, "%s.dat", appName);
+
+    if (ext && (!strcmp(ext, ".hex") || !strcmp(ext, ".ihex"))) {
+        long textLen;
+        uint8_t *text = readFile(job->appPath, &textLen);
+        TIhexInfo info;
+        if (!text) {
+            goto done;
+        }
+        bin = ihexParse(job->appPath, text, textLen, build->flashOrigin, build->flashLength, &info);
+        free(text);
+        if (bin) {
+            binLen = info.len;
+        }
+    } else {
+        bin = readFile(job->appPath, &binLen);
+    }
+    if (!bin) {
+        goto done;
+    }
+    job->binLen = binLen;
+
+    // The bootloader compares the SHA-256 in little endian byte order, as nrfutil writes it.
+    EVP_Digest(bin, binLen, digest, NULL, EVP_sha256(), NULL);
+    for (i = 0; i < 32; i++) {
+        hash[i] = digest[31 - i];
+    }
+    memset(&packet, 0, sizeof(packet));
+    packet.fwVersion = job->fwVersion;
+    packet.hwVersion = build->hwVersion;
+    memcpy(packet.sdReq, build->sdReq, sizeof(packet.sdReq));
+    packet.nofSdReq = build->nofSdReq;
+    packet.type = FWU_INIT_FW_TYPE_APPLICATION;
+    packet.appSize = binLen;
+    packet.hashType = HASH_TYPE_SHA256;
+    packet.hash = hash;
+    packet.hashLen = sizeof(hash);
+    packet.isDebug = build->isDebug;
+
+    if (build->key) {
+        commandLen = fwuInitPacketEncodeCommand(&packet, command, sizeof(command));
+        if (commandLen < 0 || signCommand(build->key, command, commandLen, signature) != 0) {
+            fprintf(stderr, "%s: failed to sign the init command\n", job->appPath);
+            goto done;
+        }
+        EVP_Digest(command, commandLen, digest, NULL, EVP_sha256(), NULL);
+        if (pubkeyVerify(build->publicKey, digest, signature) != 0) {
+            fprintf(stderr, "%s: the signature doesn't verify with the public key; wrong key file?\n", job->appPath);
+            goto done;
+        }
+        packet.signatureType = SIGNATURE_TYPE_ECDSA_P256_SHA256;
+        packet.signature = signature;
+        packet.signatureLen = sizeof(signature);
+    }
+    datLen = fwuInitPacketEncode(&packet, dat, sizeof(dat));
+    if (datLen < 0) {
+        fprintf(stderr, "%s: init packet too large\n", job->appPath);
+        goto done;
+    }
+
+    snprintf(manifest, sizeof(manifest),
+             "{\n"
+             "    \"manifest\": {\n"
+             "        \"application\": {\n"
+             "            \"bin_file\": \"%s\",\n"
+             "            \"dat_file\": \"%s\"\n"
+             "        }\n"
+             "    }\n"
+             "}", binName, datName);
+    entries[0].name = binName;
+    entries[0].data = bin;
+    entries[0].len = binLen;
+    entries[1].name = datName;
+    entries[1].data = dat;
+    entries[1].len = datLen;
+    entries[2].name = "manifest.json";
+    entries[2].data = (const uint8_t *)manifest;
+    entries[2].len = strlen(manifest);
+    if (writeZip(job->zipPath, entries, 3) != 0) {
+        goto done;
+    }
+    if (build->writeObjects) {
+        char *zipStem = stem(job->zipPath, ".zip");
+        char *path = malloc(strlen(zipStem) + 5);
+        int written = path
+            && (sprintf(path, "%s.dat", zipStem), writeFile(path, dat, datLen) == 0)
+            && (sprintf(path, "%s.bin", zipStem), writeFile(path, bin, binLen) == 0);
+        free(path);
+        free(zipStem);
+        if (!written) {
+            goto done;
+        }
+    }
+    result = 0;
+
+done:
+    free(bin);
+    free(binName);
+    free(datName);
+    free(appStem);
+    return result;
+}
+
+// Sign with ECDSA P-256 over SHA-256; the signature is r and s, each in little endian byte
+// order as the bootloader expects them.
+static int signCommand(EVP_PKEY *key, const uint8_t *command, uint32_t len, uint8_t signature[64])
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    uint8_t der[80];
+    size_t derLen = sizeof(der);
+    const uint8_t *p = der;
+    ECDSA_SIG *sig = NULL;
+    const BIGNUM *r, *s;
+    uint8_t be[64];
+    int result = -1;
+    int i;
+
+    if (ctx && EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, key) == 1
+        && EVP_DigestSign(ctx, der, &derLen, command, len) == 1
+        && (sig = d2i_ECDSA_SIG(NULL, &p, derLen)) != NULL) {
+        ECDSA_SIG_get0(sig, &r, &s);
+        if (BN_bn2binpad(r, be, 32) == 32 && BN_bn2binpad(s, &be[32], 32) == 32) {
+            for (i = 0; i < 32; i++) {
+                signature[i] = be[31 - i];
+                signature[32 + i] = be[63 - i];
+            }
+            result = 0;
+        }
+    }
+    ECDSA_SIG_free(sig);
+    EVP_MD_CTX_free(ctx);
+    return result;
+}
+
+static EVP_PKEY *loadPrivateKey(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    EVP_PKEY *key;
+
+    if (!f) {
+        fprintf(stderr, "failed to open key file %s\n", path);
+        return NULL;
+    }
+    key = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    fclose(f);
+    if (!key || EVP_PKEY_base_id(key) != EVP_PKEY_EC || EVP_PKEY_bits(key) != 256) {
+        fprintf(stderr, "%s is not an ECDSA P-256 private key (PEM)\n", path);
+        EVP_PKEY_free(key);
+        return NULL;
+    }
+    return key;
+}
+
+// The public half of the signing key in the byte order of pk[] in dfu_public_key.c: x and y,
+// each in little endian.
+static int publicKeyOf(EVP_PKEY *key, uint8_t publicKey[64])
+{
+    uint8_t *spki = NULL;
+    int len = i2d_PUBKEY(key, &spki);
+    int i;
+
+    // The encoded key ends with the uncompressed point, x and y big endian.
+    if (len < 65) {
+        fprintf(stderr, "failed to encode the public key\n");
+        OPENSSL_free(spki);
+        return -1;
+    }
+    for (i = 0; i < 32; i++) {
+        publicKey[i] = spki[len - 33 - i];
+        publicKey[32 + i] = spki[len - 1 - i];
+    }
+    OPENSSL_free(spki);
+    return 0;
+}
+
+// Stored entries would do for the .dat; everything is deflated for simplicity. The entries
+// carry a fixed time stamp so only the signature differs between builds of the same image.
+static int writeZip(const char *path, const TZipEntry *entries, int nofEntries)
+{
+    FILE *f = fopen(path, "wb");
+    uint8_t central[3 * (46 + 64)];
+    uint32_t centralLen = 0;
+    uint32_t offset = 0;
+    uint8_t eocd[22];
+    int result = 0;
+    int i;
+
+    if (!f) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return -1;
+    }
+    for (i = 0; i < nofEntries && result == 0; i++) {
+        const TZipEntry *e = &entries[i];
+        uLong bound = compressBound(e->len);
+        uint8_t *deflated = malloc(bound);
+        uint32_t nameLen = strlen(e->name);
+        uint32_t crc = crc32(0, e->data, e->len);
+        uint8_t local[30];
+        z_stream zs;
+        uint32_t deflatedLen = 0;
+
+        memset(&zs, 0, sizeof(zs));
+        if (!deflated || nameLen > 64 || deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                                                      Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(deflated);
+            result = -1;
+            break;
+        }
+        zs.next_in = (Bytef *)e->data;
+        zs.avail_in = e->len;
+        zs.next_out = deflated;
+        zs.avail_out = bound;
+        if (deflate(&zs, Z_FINISH) == Z_STREAM_END) {
+            deflatedLen = zs.total_out;
+        } else {
+            result = -1;
+        }
+        deflateEnd(&zs);
+
+        // local file header and central directory header share most fields
+        memset(local, 0, sizeof(local));
+        local[0] = 0x50; local[1] = 0x4b; local[2] = 0x03; local[3] = 0x04;
+        local[4] = 20;                      // version needed
+        local[8] = 8;                       // deflated
+        local[12] = 0x21;                   // 1980-01-01
+        local[14] = crc; local[15] = crc >> 8; local[16] = crc >> 16; local[17] = crc >> 24;
+        local[18] = deflatedLen; local[19] = deflatedLen >> 8; local[20] = deflatedLen >> 16; local[21] = deflatedLen >> 24;
+        local[22] = e->len; local[23] = e->len >> 8; local[24] = e->len >> 16; local[25] = e->len >> 24;
+        local[26] = nameLen;
+
+        uint8_t *c = &central[centralLen];
+        memset(c, 0, 46);
+        c[0] = 0x50; c[1] = 0x4b; c[2] = 0x01; c[3] = 0x02;
+        c[4] = 20;                          // version made by
+        memcpy(&c[6], &local[4], 26);       // version needed .. name length
+        c[42] = offset; c[43] = offset >> 8; c[44] = offset >> 16; c[45] = offset >> 24;
+        memcpy(&c[46], e->name, nameLen);
+        centralLen += 46 + nameLen;
+
+        if (result == 0 && (fwrite(local, 1, 30, f) != 30 || fwrite(e->name, 1, nameLen, f) != nameLen
+                            || fwrite(deflated, 1, deflatedLen, f) != deflatedLen)) {
+            result = -1;
+        }
+        offset += 30 + nameLen + deflatedLen;
+        free(deflated);
+    }
+
+    memset(eocd, 0, sizeof(eocd));
+    eocd[0] = 0x50; eocd[1] = 0x4b; eocd[2] = 0x05; eocd[3] = 0x06;
+    eocd[8] = eocd[10] = nofEntries;
+    eocd[12] = centralLen; eocd[13] = centralLen >> 8;
+    eocd[16] = offset; eocd[17] = offset >> 8; eocd[18] = offset >> 16; eocd[19] = offset >> 24;
+    if (result == 0 && (fwrite(central, 1, centralLen, f) != centralLen || fwrite(eocd, 1, 22, f) != 22)) {
+        result = -1;
+    }
+    if (fclose(f) != 0 || result != 0) {
+        fprintf(stderr, "failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int parseSdReq(const char *s, TBuild *build)
+{
+    char *end;
+
+    build->nofSdReq = 0;
+    for (;;) {
+        if (build->nofSdReq == FWU_INIT_MAX_SD_REQ) {
+            fprintf(stderr, "at most %d --sd-req values\n", FWU_INIT_MAX_SD_REQ);
+            return -1;
+        }
+        build->sdReq[build->nofSdReq++] = strtoul(s, &end, 0);
+        if (end == s || (*end != ',' && *end != 0)) {
+            fprintf(stderr, "--sd-req takes a comma separated list, e.g. 0xAF,0xB7\n");
+            return -1;
+        }
+        if (*end == 0) {
+            return 0;
+        }
+        s = end + 1;
+    }
+}
+
+// One package per line: <application> <package.zip> [<application-version>]; # starts a comment
+static int readBatch(const char *path, TJob *jobs, int maxJobs, uint32_t fwVersion)
+{
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    int lineNo = 0;
+    int n = 0;
+
+    if (!f) {
+        fprintf(stderr, "failed to open batch file %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *save;
+        char *app = strtok_r(line, " \t\r\n", &save);
+        char *zip = app ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+        char *version = zip ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+        lineNo++;
+        if (!app || app[0] == '#') {
+            continue;
+        }
+        if (!zip || (version && strtok_r(NULL, " \t\r\n", &save))) {
+            fprintf(stderr, "%s:%d: expected <application> <package.zip> [<application-version>]\n", path, lineNo);
+            fclose(f);
+            return -1;
+        }
+        if (n == maxJobs) {
+            fprintf(stderr, "%s: at most %d packages\n", path, maxJobs);
+            fclose(f);
+            return -1;
+        }
+        jobs[n].appPath = strdup(app);
+        jobs[n].zipPath = strdup(zip);
+        jobs[n].fwVersion = version ? strtoul(version, NULL, 0) : fwVersion;
+        n++;
+    }
+    fclose(f);
+    if (n == 0) {
+        fprintf(stderr, "%s: no packages\n", path);
+        return -1;
+    }
+    return n;
+}
+
+static uint8_t *readFile(const char *path, long *len)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *data;
+
+    if (!f) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(*len > 0 ? *len : 1);
+    if (*len < 0 || !data || fread(data, 1, *len, f) != (size_t)*len) {
+        fprintf(stderr, "failed to read %s\n", path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static int writeFile(const char *path, const uint8_t *data, uint32_t len)
+{
+    FILE *f = fopen(path, "wb");
+
+    if (!f || fwrite(data, 1, len, f) != len || fclose(f) != 0) {
+        fprintf(stderr, "failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// The path without its extension (only without suffix if one is given)
+static char *stem(const char *path, const char *suffix)
+{
+    char *s = strdup(path);
+    char *dot = strrchr(s, '.');
+
+    if (dot && !strchr(dot, '/') && (!suffix || !strcmp(dot, suffix))) {
+        *dot = 0;
+    }
+    return s;
+}
+
+static uint64_t monotonicMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s --hw-version <n> --sd-req <id>[,<id>...] [--application-version <n>]\n", prog);
+    fprintf(stderr, "          [--key-file <private.key>] [--public-key <dfu_public_key.c>] [--debug-mode] [--objects]\n");
+    fprintf(stderr, "          [--flash-origin <addr>] [--flash-length <bytes>] [-j <threads>]\n");
+    fprintf(stderr, "          --application <app.hex|app.bin> <package.zip> | --batch <file>\n");
+    fprintf(stderr, "Build a signed DFU package for an application, like 'nrfutil pkg generate'.\n");
+    fprintf(stderr, "  --key-file     ECDSA P-256 private key (PEM); without it the package is unsigned\n");
+    fprintf(stderr, "  --public-key   the bootloader's dfu_public_key.c; every signature must verify with it\n");
+    fprintf(stderr, "  --objects      also write <package>.dat and <package>.bin next to the zip\n");
+    fprintf(stderr, "  --flash-origin, --flash-length\n");
+    fprintf(stderr, "                 flash region Intel HEX data must lie in (0x%x, 0x%x: 01_Demo_App/main.ld)\n",
+            APP_FLASH_ORIGIN, APP_FLASH_LENGTH);
+    fprintf(stderr, "  --batch        one package per line: <application> <package.zip> [<application-version>]\n");
+    fprintf(stderr, "  -j             packages built in parallel (default: number of CPUs)\n");
+}